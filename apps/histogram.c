@@ -0,0 +1,141 @@
+/*
+ * Copyright 2013-16 Board of Trustees of Stanford University
+ * Copyright 2013-16 Ecole Polytechnique Federale Lausanne (EPFL)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * histogram.c - log-linear latency histogram for the load generators
+ */
+
+#include <errno.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "histogram.h"
+
+/* the largest value that falls into bucket idx */
+static unsigned long histogram_bucket_high(const struct histogram *h, unsigned int idx)
+{
+	unsigned int shift;
+	unsigned long m;
+
+	if (idx < (1U << h->precision))
+		return idx;
+
+	shift = (idx >> (h->precision - 1)) - 1;
+	m = idx - (shift << (h->precision - 1));
+	return ((m + 1) << shift) - 1;
+}
+
+/**
+ * histogram_init - allocates an empty histogram
+ * @h: the histogram
+ * @precision: the number of significant bits kept per value
+ *
+ * Returns 0 if successful, otherwise -EINVAL or -ENOMEM.
+ */
+int histogram_init(struct histogram *h, unsigned int precision)
+{
+	if (precision < HISTOGRAM_MIN_PRECISION || precision > HISTOGRAM_MAX_PRECISION)
+		return -EINVAL;
+
+	h->precision = precision;
+	h->nr_buckets = histogram_index(h, ULONG_MAX) + 1;
+	h->buckets = calloc(h->nr_buckets, sizeof(unsigned long));
+	if (!h->buckets)
+		return -ENOMEM;
+
+	histogram_reset(h);
+	return 0;
+}
+
+/**
+ * histogram_reset - clears all recorded values
+ * @h: the histogram
+ */
+void histogram_reset(struct histogram *h)
+{
+	memset(h->buckets, 0, h->nr_buckets * sizeof(unsigned long));
+	h->count = 0;
+	h->total = 0;
+	h->min = ULONG_MAX;
+	h->max = 0;
+}
+
+/**
+ * histogram_merge - adds the values recorded in one histogram to another
+ * @dst: the histogram to add to
+ * @src: the histogram to add
+ *
+ * Returns 0 if successful, or -EINVAL if the precisions differ.
+ */
+int histogram_merge(struct histogram *dst, const struct histogram *src)
+{
+	unsigned int i;
+
+	if (dst->precision != src->precision)
+		return -EINVAL;
+
+	for (i = 0; i < dst->nr_buckets; i++)
+		dst->buckets[i] += src->buckets[i];
+
+	dst->count += src->count;
+	dst->total += src->total;
+	if (src->min < dst->min)
+		dst->min = src->min;
+	if (src->max > dst->max)
+		dst->max = src->max;
+	return 0;
+}
+
+/**
+ * histogram_percentile - finds the value at a percentile
+ * @h: the histogram
+ * @percentile: the percentile (0 to 100)
+ *
+ * Returns the highest value equivalent to the recorded value at
+ * @percentile, capped at the recorded maximum, or 0 if @h is empty.
+ */
+unsigned long histogram_percentile(const struct histogram *h, double percentile)
+{
+	unsigned long target, seen = 0;
+	unsigned long high;
+	unsigned int i;
+
+	if (!h->count)
+		return 0;
+
+	target = (unsigned long) (h->count * percentile / 100.0 + 0.5);
+	if (target < 1)
+		target = 1;
+	if (target > h->count)
+		target = h->count;
+
+	for (i = 0; i < h->nr_buckets; i++) {
+		seen += h->buckets[i];
+		if (seen >= target) {
+			high = histogram_bucket_high(h, i);
+			return high < h->max ? high : h->max;
+		}
+	}
+	return h->max;
+}
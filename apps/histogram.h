@@ -0,0 +1,76 @@
+/*
+ * Copyright 2013-16 Board of Trustees of Stanford University
+ * Copyright 2013-16 Ecole Polytechnique Federale Lausanne (EPFL)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * histogram.h - log-linear latency histogram for the load generators
+ *
+ * Values below 2^precision get one bucket each; above that, every power of
+ * two is split into 2^(precision - 1) equal sub-buckets, so the relative
+ * error of a reported value is below 2^-(precision - 1) over the full
+ * 64-bit range. Recording is a bit scan, a shift and an increment.
+ * Histograms with the same precision can be merged by adding buckets.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#define HISTOGRAM_MIN_PRECISION 2
+#define HISTOGRAM_MAX_PRECISION 16
+
+struct histogram {
+	unsigned int precision;
+	unsigned int nr_buckets;
+	unsigned long count;
+	unsigned long total;
+	unsigned long min;
+	unsigned long max;
+	unsigned long *buckets;
+};
+
+static inline unsigned int histogram_index(const struct histogram *h, unsigned long v)
+{
+	unsigned int shift;
+
+	if (v < (1UL << h->precision))
+		return v;
+
+	shift = 64 - __builtin_clzl(v) - h->precision;
+	return (shift << (h->precision - 1)) + (v >> shift);
+}
+
+static inline void histogram_record(struct histogram *h, unsigned long v)
+{
+	h->buckets[histogram_index(h, v)]++;
+	h->count++;
+	h->total += v;
+	if (v < h->min)
+		h->min = v;
+	if (v > h->max)
+		h->max = v;
+}
+
+extern int histogram_init(struct histogram *h, unsigned int precision);
+extern void histogram_reset(struct histogram *h);
+extern int histogram_merge(struct histogram *dst, const struct histogram *src);
+extern unsigned long histogram_percentile(const struct histogram *h, double percentile);
@@ -0,0 +1,94 @@
+/*
+ * Copyright 2013-16 Board of Trustees of Stanford University
+ * Copyright 2013-16 Ecole Polytechnique Federale Lausanne (EPFL)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * prng.h - per-thread xoshiro256** pseudo-random number generator
+ *
+ * Cheaper than rand(), which takes a lock in glibc, and gives 64 bits per
+ * call. Not suitable for anything security related.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+struct prng {
+	uint64_t s[4];
+};
+
+static inline uint64_t prng_rotl(uint64_t x, int k)
+{
+	return (x << k) | (x >> (64 - k));
+}
+
+/* splitmix64, expands a seed into the generator state */
+static inline uint64_t prng_splitmix(uint64_t *x)
+{
+	uint64_t z = (*x += 0x9e3779b97f4a7c15ULL);
+
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+	return z ^ (z >> 31);
+}
+
+/**
+ * prng_seed - initializes a generator
+ * @p: the generator
+ * @seed: any value, distinct seeds give independent streams
+ */
+static inline void prng_seed(struct prng *p, uint64_t seed)
+{
+	int i;
+
+	for (i = 0; i < 4; i++)
+		p->s[i] = prng_splitmix(&seed);
+}
+
+/**
+ * prng_next - returns 64 uniformly random bits
+ * @p: the generator
+ */
+static inline uint64_t prng_next(struct prng *p)
+{
+	uint64_t *s = p->s;
+	uint64_t result = prng_rotl(s[1] * 5, 7) * 9;
+	uint64_t t = s[1] << 17;
+
+	s[2] ^= s[0];
+	s[3] ^= s[1];
+	s[1] ^= s[2];
+	s[0] ^= s[3];
+	s[2] ^= t;
+	s[3] = prng_rotl(s[3], 45);
+	return result;
+}
+
+/**
+ * prng_bounded - returns a uniformly random value in [0, n)
+ * @p: the generator
+ * @n: the bound
+ */
+static inline uint64_t prng_bounded(struct prng *p, uint64_t n)
+{
+	return ((unsigned __int128) prng_next(p) * n) >> 64;
+}
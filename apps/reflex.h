@@ -20,9 +20,44 @@ struct msg_header {
 #define CMD_GET  0x00
 #define CMD_SET  0x01
 #define CMD_SET_NO_ACK  0x02
- 
+
+/*
+ * Commands without a payload in either direction. The response echoes the
+ * opcode with lba_count 0 once the command has completed on flash. TRIM
+ * deallocates lba_count sectors at lba (reads of them return undefined
+ * data afterwards), WRITE_ZEROES zeroes them and FLUSH, which ignores lba
+ * and lba_count, makes all completed writes durable.
+ */
+#define CMD_TRIM  0x03
+#define CMD_FLUSH  0x04
+#define CMD_WRITE_ZEROES  0x05
+
+/*
+ * Response opcode for reads from a compressed tenant. lba_count then holds
+ * the payload length in bytes. The payload is a uint16_t length table with
+ * one entry per 4KB block of the request, followed by the LZ4 blocks back to
+ * back. A length of 0 means the block was never written (reads as zeroes),
+ * REFLEX_LZ4_RAW means the block is stored uncompressed.
+ */
+#define CMD_GET_LZ4  0x10
+#define REFLEX_LZ4_BLOCK 4096
+#define REFLEX_LZ4_RAW REFLEX_LZ4_BLOCK
+
+/*
+ * Response opcode for a request a compressed tenant could not serve, with
+ * no payload. lba_count then holds a RESP_* code: RESP_EINVAL for a
+ * request that is not 4KB aligned or out of range, RESP_ENOMEM when the
+ * server is out of request state (the request may be retried) and
+ * RESP_ENOSPC once the tenant's log region is full.
+ */
+#define CMD_ERR  0x11
+
 #define RESP_OK 0x00
+#define RESP_ENOENT 0x01
+#define RESP_E2BIG 0x03
 #define RESP_EINVAL 0x04
+#define RESP_ENOSPC 0x05
+#define RESP_ENOMEM 0x82
 
 #define REQ_PKT 0x80
 #define RESP_PKT 0x81
@@ -37,4 +72,20 @@ typedef struct __attribute__ ((__packed__)) {
   unsigned int lba_count;
 } binary_header_blk_t;
 
+/*
+ * ReFlex key-value protocol, spoken on the ports listed in kv_tenants in
+ * reflex_server.c. Requests use opcode PUT or GET (enum msg_type), the
+ * server answers with PUT_ACK or GET_RESP. A PUT carries val_len bytes of
+ * value after the header; a GET_RESP carries the value if status is RESP_OK.
+ * A PUT_ACK is sent once the value is durable on flash.
+ */
+typedef struct __attribute__ ((__packed__)) {
+  uint16_t magic;
+  uint16_t opcode;
+  void *req_handle;
+  uint64_t key;
+  unsigned int val_len;
+  uint16_t status;
+} binary_header_kv_t;
+
 
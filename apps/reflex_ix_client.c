@@ -27,6 +27,7 @@
 #include <assert.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <string.h>
 
 #include <fcntl.h>
 #include <sys/time.h>
@@ -37,7 +38,13 @@
 #include <ix/list.h>
 
 #include "reflex.h" 
+#include "reflex_lz4.h"
+#include "histogram.h"
+#include "prng.h"
+#include "timeseries.h"
 #include "timer.h"
+#include "trace.h"
+#include "workload.h"
 
 #include <netinet/in.h>
 
@@ -51,16 +58,24 @@
 
 
 #define MAX_SECTORS_PER_ACCESS 64
-#define MAX_LATENCY 5000 //2000
+#define DEFAULT_HIST_PRECISION 7
 #define MAX_IOPS 950000
 #define NUM_TESTS 16
 #define DURATION 1
 #define MAX_NUM_MEASURE MAX_IOPS * DURATION
+#define MAX_TRACES 64
+#define TRACE_LATE_US 10
+#define MAX_BUF_BYTES (1UL << 30)
+#define NUM_QD_TESTS 9
+#define MAX_QD 256
+#define CL_WARMUP_US 100000
+#define DEFAULT_TS_INTERVAL_MS 100
 
 static const unsigned long sweep[NUM_TESTS] = {1000, 10000, 50000, 100000,
 					       150000, 200000, 250000, 300000,
 					       400000, 600000, 700000, 750000,
 					       800000, 850000, 900000, MAX_IOPS};
+static const unsigned int qd_sweep[NUM_QD_TESTS] = {1, 2, 4, 8, 16, 32, 64, 128, MAX_QD};
 
 //fixme: hard-coding sector size for now
 static int ns_sector_size = 512;
@@ -82,17 +97,41 @@ static int read_percentage;
 static int SWEEP;
 static bool preconditioning;
 static unsigned long global_target_IOPS = 0;
+static unsigned int hist_precision = DEFAULT_HIST_PRECISION;
+static bool co_correction = true;
+
+/* trace replay: thread i replays traces[i] on its own connection */
+static struct trace traces[MAX_TRACES];
+static int trace_ports[MAX_TRACES];
+static int nr_traces;
+static double trace_speedup = 1.0;
+
+/* workload file: thread i generates requests as described by workload[i] */
+static struct workload_conn workload[MAX_TRACES];
+static int nr_workload_conns;
+
+/* closed loop: each connection keeps queue_depth requests outstanding */
+static unsigned int global_queue_depth;
+
+/* per-interval statistics, written by a background thread */
+static const char *ts_path;
+static unsigned int ts_interval_ms = DEFAULT_TS_INTERVAL_MS;
+
+/* per-phase results, merged from all threads and printed by the last one */
+static pthread_mutex_t report_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct histogram report_hist;
+static unsigned long report_iops;
+static unsigned long report_missed;
+static int report_threads;
 
 static __thread struct mempool req_pool;
 static __thread int conn_opened;
 static __thread unsigned long last_send = 0;
 static __thread unsigned long bench_start = 0;
-static __thread unsigned long avg = 0;
-static __thread unsigned long max = 0;
 static __thread unsigned long measure = 0;
 static __thread unsigned long num_measured_reads = 0;
 static __thread long sent = 0;
-static __thread unsigned long measurements[MAX_LATENCY];
+static __thread struct histogram latency_hist;	//read latency in cycles
 static __thread unsigned long missed_sends = 0;
 static __thread bool running = false;
 static __thread bool terminate = false;
@@ -104,6 +143,20 @@ static __thread long NUM_MEASURE;
 
 static struct mempool_datastore nvme_req_buf_datastore;
 static __thread struct mempool nvme_req_buf_pool;
+static __thread char lz_block[REFLEX_LZ4_BLOCK];
+static __thread unsigned long lz_errors = 0;
+static __thread unsigned long req_errors = 0;
+static __thread struct trace *trace;
+static __thread struct trace_rec trace_cur;	//remainder of the record being sent
+static __thread bool trace_have_cur;
+static __thread bool trace_done;
+static __thread struct workload_conn *wl;
+static __thread struct prng rng;
+static __thread unsigned int queue_depth;
+static __thread unsigned int in_flight;
+static __thread bool cl_measuring;
+static __thread bool cl_draining;
+static __thread struct ts_thread *ts;
 
 static inline uint32_t intlog2(const uint32_t x) {
 	uint32_t y;
@@ -123,15 +176,43 @@ compare_ul (const void *a, const void *b)
 	return (*da > *db) - (*da < *db);
 }
 
-long get_percentile(unsigned long m[], unsigned long num_measure, unsigned long percentile) {
- 	unsigned int i = 0;
- 	unsigned long tmp = 0;
- 
- 	while(tmp < (num_measure * percentile) / 100 && i < MAX_LATENCY) {
- 		tmp += m[i];
- 		i++;
- 	}
- 	return i;
+static inline unsigned long hist_us(double percentile)
+{
+	return histogram_percentile(&report_hist, percentile) / cycles_per_us;
+}
+
+/*
+ * merges this thread's measurements of the phase that just ended (@ios
+ * requests completed since phase_start); the last thread to finish prints
+ * the row for all threads
+ */
+static void report_phase(unsigned long target_IOPS, unsigned long ios)
+{
+	unsigned long usecs = 1000UL * 1000UL;
+	unsigned long elapsed = (rdtsc() - phase_start) / cycles_per_us;
+
+	pthread_mutex_lock(&report_lock);
+	histogram_merge(&report_hist, &latency_hist);
+	report_iops += ios * usecs / (elapsed ? elapsed : 1);
+	report_missed += missed_sends;
+
+	if (++report_threads == nr_threads) {
+		if (report_hist.count) {
+			printf("%lu\t %lu\t %lu\t %lu\t %lu\t %lu\t %lu\t %lu\t %lu\t %lu\t %lu\t %lu\t %lu\t %lu\t %lu\t %lu\t %lu\t %lu\n",
+			       target_IOPS, report_iops,
+			       report_hist.total / report_hist.count / cycles_per_us,
+			       hist_us(10), hist_us(20), hist_us(30), hist_us(40),
+			       hist_us(50), hist_us(60), hist_us(70), hist_us(80),
+			       hist_us(90), hist_us(95), hist_us(99), hist_us(99.9),
+			       hist_us(99.99), report_hist.max / cycles_per_us,
+			       report_missed);
+		}
+		histogram_reset(&report_hist);
+		report_iops = 0;
+		report_missed = 0;
+		report_threads = 0;
+	}
+	pthread_mutex_unlock(&report_lock);
 }
 
 struct nvme_req {
@@ -144,6 +225,7 @@ struct nvme_req {
 	struct ixev_ref ref; 		//for zero-copy
 	struct list_node link;
 	unsigned long sent_time;
+	unsigned long intended_time;	//when the open-loop schedule wanted it sent
 	void *remote_req_handle;
 	char *buf;					//nvme buffer to read/write data into
 };
@@ -183,6 +265,92 @@ static int parse_ip_addr(const char *str, uint32_t *addr)
 }
 
 
+/*
+ * decompresses a CMD_GET_LZ4 payload received into req->buf block by block;
+ * returns 0 if every block decodes to exactly REFLEX_LZ4_BLOCK bytes
+ */
+static int lz_decompress_payload(struct nvme_req *req, unsigned int payload_len)
+{
+	int i, nr_blocks = (req->lba_count * ns_sector_size) / REFLEX_LZ4_BLOCK;
+	uint16_t *len = (uint16_t *) req->buf;
+	char *data = req->buf + nr_blocks * sizeof(uint16_t);
+	char *end = req->buf + payload_len;
+
+	for (i = 0; i < nr_blocks; i++) {
+		if (data + len[i] > end)
+			return -EINVAL;
+		if (len[i] == 0)
+			memset(lz_block, 0, REFLEX_LZ4_BLOCK);
+		else if (len[i] == REFLEX_LZ4_RAW)
+			memcpy(lz_block, data, REFLEX_LZ4_BLOCK);
+		else if (reflex_lz4_decompress(data, len[i], lz_block,
+					       REFLEX_LZ4_BLOCK) != REFLEX_LZ4_BLOCK)
+			return -EINVAL;
+		data += len[i];
+	}
+	return 0;
+}
+
+/*
+ * a trace is replayed as a single measurement phase covering every request;
+ * the row is printed once the trace is exhausted and all requests completed
+ */
+static void trace_check_done(void)
+{
+	if (!trace_done || measure != sent || terminate)
+		return;
+
+	report_phase(0, measure);
+	terminate = true;
+}
+
+static void trace_complete(struct nvme_req *req)
+{
+	if (req->cmd == CMD_GET) {
+		histogram_record(&latency_hist, rdtsc() -
+				 (co_correction ? req->intended_time : req->sent_time));
+		num_measured_reads++;
+	}
+	measure++;
+	mempool_free(&nvme_req_buf_pool, req->buf);
+	mempool_free(&req_pool, req);
+	trace_check_done();
+}
+
+/*
+ * closed loop: reads completing during the DURATION seconds that follow
+ * CL_WARMUP_US of warm-up are measured, from their actual send time; then
+ * no new requests are sent and the step ends once all outstanding
+ * requests completed
+ */
+static void closed_loop_end_step(void)
+{
+	terminate = true;
+	cl_draining = false;
+	measure = 0;
+	num_measured_reads = 0;
+	sent = 0;
+	missed_sends = 0;
+	histogram_reset(&latency_hist);
+}
+
+static void closed_loop_complete(struct nvme_req *req)
+{
+	in_flight--;
+	if (cl_measuring) {
+		if (req->cmd == CMD_GET) {
+			histogram_record(&latency_hist, rdtsc() - req->sent_time);
+			num_measured_reads++;
+		}
+		measure++;
+	}
+	mempool_free(&nvme_req_buf_pool, req->buf);
+	mempool_free(&req_pool, req);
+
+	if (cl_draining && !in_flight)
+		closed_loop_end_step();
+}
+
 static void receive_req(struct pp_conn *conn)
 {
 	ssize_t ret;
@@ -215,11 +383,13 @@ static void receive_req(struct pp_conn *conn)
 		assert(header->magic == sizeof(BINARY_HEADER)); 
 				
 		if (header->opcode == CMD_GET) {
-			ret = ixev_recv(&conn->ctx,
-					&conn->data[conn->rx_received],
-					sizeof(BINARY_HEADER) +
+			size_t payload_received = conn->rx_received - sizeof(BINARY_HEADER);
+
+			/* the payload may be larger than conn->data, land it in the request buffer */
+			req = header->req_handle;
+			ret = ixev_recv(&conn->ctx, &req->buf[payload_received],
 					header->lba_count * ns_sector_size
-					- conn->rx_received);
+					- payload_received);
 			if (ret <= 0) {
 				if (ret != -EAGAIN) {
 					assert(0);
@@ -237,7 +407,35 @@ static void receive_req(struct pp_conn *conn)
 						ns_sector_size))
 				return;
 		}
+		else if (header->opcode == CMD_GET_LZ4) {
+			size_t payload_received = conn->rx_received - sizeof(BINARY_HEADER);
+
+			req = header->req_handle;
+			ret = ixev_recv(&conn->ctx, &req->buf[payload_received],
+					header->lba_count - payload_received);
+			if (ret <= 0) {
+				if (ret != -EAGAIN) {
+					if(!conn->nvme_pending) {
+						printf("Connection close 8\n");
+						ixev_close(&conn->ctx);
+					}
+				}
+				break;
+			}
+			conn->rx_received += ret;
+
+			if(conn->rx_received < sizeof(BINARY_HEADER) + header->lba_count)
+				return;
+
+			if (lz_decompress_payload(req, header->lba_count) && !lz_errors++)
+				printf("WARNING: received corrupt compressed payload\n");
+		}
 		else if (header->opcode == CMD_SET) {}
+		else if (header->opcode == CMD_ERR) {
+			if (!req_errors++)
+				printf("WARNING: server failed a request with status %#x\n",
+				       header->lba_count);
+		}
 		else {
 			printf("Received unsupported command, closing connection\n");
 			ixev_close(&conn->ctx);
@@ -245,18 +443,28 @@ static void receive_req(struct pp_conn *conn)
 		}
 
 		req = header->req_handle;
+		if (ts)
+			timeseries_record(ts, req->cmd == CMD_GET, req->lba_count * ns_sector_size,
+					  rdtsc() - (co_correction ? req->intended_time : req->sent_time));
+		if (trace || queue_depth) {
+			if (trace)
+				trace_complete(req);
+			else
+				closed_loop_complete(req);
+			conn->rx_pending = false;
+			conn->rx_received = 0;
+			continue;
+		}
 		if (req->cmd == CMD_GET) { //only report read latency (not write)
 			if (measure >= NUM_MEASURE && measure < NUM_MEASURE * 2) {
-				unsigned long now = rdtsc();
-				if(((now - req->sent_time) / cycles_per_us) >= MAX_LATENCY)
-					measurements[MAX_LATENCY - 1]++;
-				else
-					measurements[(now - req->sent_time) / cycles_per_us]++;
-
-				avg += (now - req->sent_time) / cycles_per_us;
-				if (((now - req->sent_time) / cycles_per_us) > max)
-					max = (now - req->sent_time) / cycles_per_us;
-			
+				/*
+				 * Measuring from the intended send time charges
+				 * requests that were sent late (because the client
+				 * fell behind) with the time they waited, which is
+				 * what a real open-loop arrival would have seen.
+				 */
+				histogram_record(&latency_hist, rdtsc() -
+						 (co_correction ? req->intended_time : req->sent_time));
 				num_measured_reads++;
 			}
 		}
@@ -269,36 +477,11 @@ static void receive_req(struct pp_conn *conn)
 		conn->rx_pending = false;
 		conn->rx_received = 0;
 		
-		if (measure == NUM_MEASURE * 2 && tid == 0 && num_measured_reads != 0) {
-			unsigned long usecs = 1000UL * 1000UL;
-			unsigned long target_IOPS;
-
+		if (measure == NUM_MEASURE * 2) {
 			assert(measure <= MAX_NUM_MEASURE + NUM_MEASURE);
 			assert(num_measured_reads <= NUM_MEASURE);
-		      
-			if (SWEEP){
-				target_IOPS = sweep[run];
-			}
-			else{
-				target_IOPS = global_target_IOPS; 
-			}
 
-			printf("%lu\t %lu\t %lu\t %lu\t %lu\t %lu\t %lu\t %lu\t %lu\t %lu\t %lu\t %lu\t %lu\t %lu\t %lu\t %lu\n",
-			       target_IOPS,
-			       nr_threads * (NUM_MEASURE * usecs) / ((rdtsc() - phase_start) / cycles_per_us),
-			       avg/num_measured_reads, 
-			       get_percentile(measurements, num_measured_reads, 10),
-			       get_percentile(measurements, num_measured_reads, 20),
-			       get_percentile(measurements, num_measured_reads, 30),
-			       get_percentile(measurements, num_measured_reads, 40),
-			       get_percentile(measurements, num_measured_reads, 50),
-			       get_percentile(measurements, num_measured_reads, 60),
-			       get_percentile(measurements, num_measured_reads, 70),
-			       get_percentile(measurements, num_measured_reads, 80),
-			       get_percentile(measurements, num_measured_reads, 90),
-			       get_percentile(measurements, num_measured_reads, 95),
-			       get_percentile(measurements, num_measured_reads, 99),
-			       max, missed_sends);
+			report_phase(SWEEP ? sweep[run] : global_target_IOPS, NUM_MEASURE);
 			run++;
 		}
 
@@ -307,13 +490,9 @@ static void receive_req(struct pp_conn *conn)
 			terminate = true;
 			measure = 0;
 			num_measured_reads = 0;
-			avg = 0;
-			max = 0;
 			sent = 0;
 			missed_sends = 0;
-			for(int i = 0; i< MAX_LATENCY; i++){
-				measurements[i] = 0;
-			}
+			histogram_reset(&latency_hist);
 		}
 	}
 }
@@ -403,6 +582,173 @@ int send_pending_reqs(struct pp_conn *conn)
 	return sent_reqs;
 }
 
+/* returns the cycle at which the trace wants @rec sent */
+static unsigned long trace_due(struct trace_rec *rec)
+{
+	if (rec->ts_ns == TRACE_NO_TS)
+		return bench_start + trace->nr_records * cycles_between_req;
+
+	return bench_start + (unsigned long) (rec->ts_ns / 1000.0 * cycles_per_us / trace_speedup);
+}
+
+/*
+ * open-loop replay: sends every request whose (scaled) trace timestamp has
+ * passed; records larger than REQ_SIZE are split into REQ_SIZE requests
+ */
+static void trace_send_handler(struct pp_conn *conn)
+{
+	unsigned long ns_sectors = ns_size / ns_sector_size;
+	unsigned long now = rdtsc(), due;
+	struct nvme_req *req;
+	unsigned int count;
+	int ssents = 0;
+
+	if (sent == 0)
+		bench_start = phase_start = now;
+
+	while (!trace_done && ssents < 32) {
+		if (!trace_have_cur) {
+			if (trace_next(trace, &trace_cur)) {
+				trace_done = true;
+				trace_check_done();
+				break;
+			}
+			trace_have_cur = true;
+		}
+		due = trace_due(&trace_cur);
+		if (due > now)
+			break;
+
+		req = mempool_alloc(&req_pool);
+		if (!req) {
+			receive_req(conn);
+			break;
+		}
+		req->buf = mempool_alloc(&nvme_req_buf_pool);
+		if (!req->buf) {
+			mempool_free(&req_pool, req);
+			receive_req(conn);
+			break;
+		}
+
+		ixev_nvme_req_ctx_init(&req->ctx);
+		req->conn = conn;
+		req->cmd = trace_cur.write ? CMD_SET : CMD_GET;
+		count = trace_cur.lba_count < req_size ? trace_cur.lba_count : req_size;
+		req->lba_count = count;
+		req->lba = trace_cur.lba;
+		if (req->lba + count > ns_sectors)
+			req->lba %= ns_sectors - count;
+
+		trace_cur.lba += count;
+		trace_cur.lba_count -= count;
+		if (!trace_cur.lba_count)
+			trace_have_cur = false;
+
+		if (now - due > TRACE_LATE_US * cycles_per_us)
+			missed_sends++;
+		req->intended_time = due;
+		req->sent_time = now;
+		conn->list_len++;
+		list_add_tail(&conn->pending_requests, &req->link);
+		sent++;
+		ssents++;
+	}
+	send_pending_reqs(conn);
+}
+
+/* uniform random or sequential LBAs of REQ_SIZE, READ_PERCENTAGE reads */
+static void default_setup_req(struct pp_conn *conn, struct nvme_req *req)
+{
+	if (prng_bounded(&rng, 100) < read_percentage)
+		req->cmd = CMD_GET; 
+	else
+		req->cmd = CMD_SET;
+
+	if (preconditioning)
+		req->cmd = CMD_SET;
+	//only do aligned accesses
+	if (!sequential) {
+		req->lba = prng_bounded(&rng, ns_size >> intlog2(ns_sector_size));
+		//align
+		req->lba = req->lba & ~7;
+	}
+	else {
+		conn->seq_count += req_size;
+		req->lba = conn->seq_count;
+		assert (req->lba < ns_size / ns_sector_size);
+		if ((req->lba % (((ns_size / ns_sector_size) / req_size)/ 100)) == 0)
+			printf("lba %lu %lu %lu\n", req->lba, NUM_MEASURE, ns_size / ns_sector_size);
+	}
+}
+
+/* draws the op, size and LBA of a request from this connection's workload */
+static void workload_setup_req(struct nvme_req *req)
+{
+	unsigned long nr_sectors = ns_size / ns_sector_size;
+
+	if (prng_bounded(&rng, 100) < wl->read_percentage) {
+		req->cmd = CMD_GET;
+		req->lba_count = size_dist_sample(&wl->read_sizes, prng_next(&rng));
+	} else {
+		req->cmd = CMD_SET;
+		req->lba_count = size_dist_sample(&wl->write_sizes, prng_next(&rng));
+	}
+
+	req->lba = lba_dist_sample(&wl->lba, prng_next(&rng), prng_next(&rng)) * WL_BLOCK_SECTORS;
+	if (req->lba + req->lba_count > nr_sectors)
+		req->lba = nr_sectors - req->lba_count;
+}
+
+static void closed_loop_send_handler(struct pp_conn *conn)
+{
+	unsigned long now = rdtsc();
+	struct nvme_req *req;
+
+	if (cl_draining)
+		return;
+	if (sent == 0)
+		bench_start = now;
+
+	if (!cl_measuring && now - bench_start > CL_WARMUP_US * cycles_per_us) {
+		cl_measuring = true;
+		phase_start = now;
+	} else if (cl_measuring && now - phase_start > DURATION * 1000000UL * cycles_per_us) {
+		report_phase(queue_depth, measure);
+		cl_measuring = false;
+		cl_draining = true;
+		if (!in_flight)
+			closed_loop_end_step();
+		return;
+	}
+
+	while (in_flight < queue_depth) {
+		req = mempool_alloc(&req_pool);
+		if (!req)
+			break;
+		req->buf = mempool_alloc(&nvme_req_buf_pool);
+		if (!req->buf) {
+			mempool_free(&req_pool, req);
+			break;
+		}
+
+		ixev_nvme_req_ctx_init(&req->ctx);
+		req->lba_count = req_size;
+		req->conn = conn;
+		if (wl)
+			workload_setup_req(req);
+		else
+			default_setup_req(conn, req);
+
+		req->intended_time = req->sent_time = now;
+		conn->list_len++;
+		list_add_tail(&conn->pending_requests, &req->link);
+		in_flight++;
+		sent++;
+	}
+	send_pending_reqs(conn);
+}
+
 static void send_handler(void * arg)
 {
 	struct nvme_req *req;
@@ -411,6 +757,15 @@ static void send_handler(void * arg)
 	unsigned long now;
 	int ssents = 0;
 	
+	if (trace) {
+		trace_send_handler(conn);
+		return;
+	}
+	if (queue_depth) {
+		closed_loop_send_handler(conn);
+		return;
+	}
+
 	if (sent == NUM_MEASURE * 3)
 		return;
 	
@@ -440,27 +795,16 @@ static void send_handler(void * arg)
 		req->conn = conn;
 
 		req->buf = mempool_alloc(&nvme_req_buf_pool);
+		if (!req->buf) {
+			mempool_free(&req_pool, req);
+			receive_req(conn);
+			break;
+		}
 		
-		if ((rand() % 99) < read_percentage)
-			req->cmd = CMD_GET; 
+		if (wl)
+			workload_setup_req(req);
 		else
-			req->cmd = CMD_SET;
-
-		if (preconditioning)
-			req->cmd = CMD_SET;
-		//only do aligned accesses
-		if (!sequential) {
-			req->lba = rand() % (ns_size >> intlog2(ns_sector_size));
-			//align
-			req->lba = req->lba & ~7;
-		}
-		else {
-			conn->seq_count += req_size;
-			req->lba = conn->seq_count;
-			assert (req->lba < ns_size / ns_sector_size);
-			if ((req->lba % (((ns_size / ns_sector_size) / req_size)/ 100)) == 0)
-				printf("lba %lu %lu %lu\n", req->lba, NUM_MEASURE, ns_size / ns_sector_size);
-		}
+			default_setup_req(conn, req);
 		conn->list_len++;
 		list_add_tail(&conn->pending_requests, &req->link);
 
@@ -475,6 +819,7 @@ static void send_handler(void * arg)
 			}
 		}
 		req->sent_time = rdtsc();
+		req->intended_time = bench_start + sent * cycles_between_req;
 		last_send = now;
 		sent++;
 	}
@@ -504,7 +849,8 @@ static void pp_dialed(struct ixev_ctx *ctx, long ret)
 	ixev_set_handler(&conn->ctx, IXEVIN | IXEVOUT | IXEVHUP, &main_handler);
 	running = true;
 	if (tid == 0){
-		printf("RqIOPS:\t IOPS:\t Avg:\t 10th:\t 20th:\t 30th:\t 40th:\t 50th:\t 60th:\t 70th:\t 80th:\t 90th:\t 95th:\t 99th:\t max:\t missed:\n");
+		printf("%s\t IOPS:\t Avg:\t 10th:\t 20th:\t 30th:\t 40th:\t 50th:\t 60th:\t 70th:\t 80th:\t 90th:\t 95th:\t 99th:\t 99.9th:\t 99.99th:\t max:\t missed:\n",
+		       global_queue_depth ? "QD:" : "RqIOPS:");
 	}
 	
 	conn_opened++;
@@ -575,8 +921,10 @@ static void *receive_loop(void *arg)
 		return NULL;
 	}
 	
-	for(int i = 0; i < MAX_LATENCY; i++){
-		measurements[i] = 0;
+	ret = histogram_init(&latency_hist, hist_precision);
+	if (ret) {
+		fprintf(stderr, "unable to create histogram\n");
+		return NULL;
 	}
 	
 	list_head_init(&conn->pending_requests);
@@ -597,12 +945,28 @@ static void *receive_loop(void *arg)
 	flags = fcntl(STDIN_FILENO, F_GETFL, 0);
 	fcntl(STDIN_FILENO, F_SETFL, flags | O_NONBLOCK);
 
+	if (nr_traces)
+		trace = &traces[tid];
+	if (nr_workload_conns)
+		wl = &workload[tid];
+
+	if (ts_path) {
+		ts = timeseries_thread_init(tid, ip_tuple[tid]->dst_port);
+		if (!ts) {
+			fprintf(stderr, "unable to create timeseries state\n");
+			return NULL;
+		}
+	}
+
 	ixev_dial(&conn->ctx, ip_tuple[tid]);
-	if (preconditioning)
+	prng_seed(&rng, tid);
+	if (preconditioning || trace || (wl && !global_queue_depth))
 		SWEEP = 0;
 	
 	if (!SWEEP)
 		num_tests = 1;
+	else if (global_queue_depth)
+		num_tests = NUM_QD_TESTS;
 	else
 		num_tests = NUM_TESTS;
 	while (!running)
@@ -611,15 +975,22 @@ static void *receive_loop(void *arg)
 		terminate = false;
 		assert(sent == 0);
 		assert(measure == 0);
-		if (SWEEP) {
+		if (global_queue_depth) {
+			queue_depth = SWEEP ? qd_sweep[i] : global_queue_depth;
+		}
+		else if (SWEEP) {
 			cycles_between_req = (((unsigned long)cycles_per_us * 1000UL * 1000UL) / (sweep[i] / nr_threads));	
 			NUM_MEASURE = sweep[i] * DURATION / nr_threads;
 		}
+		else if (wl) {
+			cycles_between_req = ((unsigned long)cycles_per_us * 1000UL * 1000UL) / wl->rate;
+			NUM_MEASURE = wl->rate * DURATION;
+		}
 		else { 
 			cycles_between_req = ((unsigned long)cycles_per_us * 1000UL * 1000UL * nr_threads) / global_target_IOPS;	
 			NUM_MEASURE = global_target_IOPS * DURATION / nr_threads;
 		}
-		assert(NUM_MEASURE <= MAX_NUM_MEASURE);
+		assert(trace || NUM_MEASURE <= MAX_NUM_MEASURE);
 		if (preconditioning) //write each lba once
 			NUM_MEASURE = (ns_size / ns_sector_size) / req_size;
 		pthread_barrier_wait(&barrier);
@@ -627,10 +998,14 @@ static void *receive_loop(void *arg)
 			if (running)
 				send_handler(&conn->ctx);
 			ixev_wait();
+			if (ts)
+				timeseries_tick(ts, rdtsc());
 			if (terminate)
 				break;
 		}
 	}
+	if (ts)
+		timeseries_thread_done(ts);
 	running = true;
 	ixev_close(&conn->ctx);
 	
@@ -647,12 +1022,95 @@ int main(int argc, char *argv[])
 	int nr_cpu, req_size_bytes;
 	pthread_t thread[64];
 	int tid[64];
+	int opt;
+	char *port;
+	const char *workload_path = NULL;
+	unsigned long buf_size, nr_bufs;
 	
+	while ((opt = getopt(argc, argv, "p:ut:s:w:q:o:i:")) != -1) {
+		switch (opt) {
+		case 'p':
+			hist_precision = atoi(optarg);
+			break;
+		case 'u':
+			co_correction = false;
+			break;
+		case 't':
+			if (nr_traces == MAX_TRACES) {
+				fprintf(stderr, "at most %d traces\n", MAX_TRACES);
+				return -1;
+			}
+			port = strrchr(optarg, ':');
+			if (port) {
+				*port = '\0';
+				trace_ports[nr_traces] = atoi(port + 1);
+			}
+			ret = trace_open(&traces[nr_traces], optarg);
+			if (ret) {
+				fprintf(stderr, "unable to open trace '%s': %s\n", optarg, strerror(-ret));
+				return ret;
+			}
+			nr_traces++;
+			break;
+		case 'w':
+			workload_path = optarg;
+			break;
+		case 'o':
+			ts_path = optarg;
+			break;
+		case 'i':
+			ts_interval_ms = atoi(optarg);
+			if (ts_interval_ms < 1) {
+				fprintf(stderr, "invalid interval '%s'\n", optarg);
+				return -1;
+			}
+			break;
+		case 'q':
+			global_queue_depth = atoi(optarg);
+			if (global_queue_depth < 1 || global_queue_depth > MAX_QD) {
+				fprintf(stderr, "queue depth must be 1..%d\n", MAX_QD);
+				return -1;
+			}
+			break;
+		case 's':
+			trace_speedup = atof(optarg);
+			if (trace_speedup <= 0) {
+				fprintf(stderr, "invalid trace speedup '%s'\n", optarg);
+				return -1;
+			}
+			break;
+		default:
+			argc = 0;
+			break;
+		}
+	}
+	/* the remaining arguments are positional */
+	argv[optind - 1] = argv[0];
+	argv += optind - 1;
+	argc -= optind - 1;
+
 	if (argc != 10) {
-		fprintf(stderr, "Usage: %s IP PORT SEQUENTIAL? NUM_THREADS REQ/s READ_PERCENTAGE SWEEP REQ_SIZE PRECONDITION?\n",
-			argv[0]);
+		fprintf(stderr, "Usage: %s [-p HIST_PRECISION] [-u] [-t TRACE[:PORT]]... [-s SPEEDUP] [-w WORKLOAD] [-q QD] [-o FILE [-i MS]] IP PORT SEQUENTIAL? NUM_THREADS REQ/s READ_PERCENTAGE SWEEP REQ_SIZE PRECONDITION?\n"
+			"  -p  significant bits kept per latency sample (%d..%d, default %d)\n"
+			"  -u  report latency from the actual send time (no coordinated omission correction)\n"
+			"  -t  replay a blkparse, fio iolog or CSV trace instead of generating requests;\n"
+			"      repeat once per thread, thread i replays the i-th trace (to PORT if given)\n"
+			"  -s  divide trace inter-arrival times by SPEEDUP (default 1.0)\n"
+			"  -w  generate requests per connection from a workload file (see workload.conf.sample)\n"
+			"  -q  closed loop with QD outstanding requests per thread instead of REQ/s;\n"
+			"      with SWEEP, report QD 1, 2, 4 .. %d\n"
+			"  -o  write per-interval IOPS, bandwidth and latency per thread and per port to FILE\n"
+			"      (CSV if FILE ends in .csv, JSON lines otherwise)\n"
+			"  -i  interval length for -o in milliseconds (default %d)\n",
+			argv[0], HISTOGRAM_MIN_PRECISION, HISTOGRAM_MAX_PRECISION, DEFAULT_HIST_PRECISION, MAX_QD,
+			DEFAULT_TS_INTERVAL_MS);
 		return -1;
 	}
+	ret = histogram_init(&report_hist, hist_precision);
+	if (ret) {
+		fprintf(stderr, "invalid histogram precision %u\n", hist_precision);
+		return ret;
+	}
 	sleep(10);
 
 	nr_cpu = sys_nrcpus();
@@ -672,6 +1130,24 @@ int main(int argc, char *argv[])
 	preconditioning = atoi(argv[9]);
 	
 	assert(nr_threads <= nr_cpu);
+	if (global_queue_depth && (nr_traces || preconditioning)) {
+		fprintf(stderr, "closed loop cannot be combined with trace replay or preconditioning\n");
+		return -1;
+	}
+	if (nr_traces && (nr_traces != nr_threads || preconditioning)) {
+		fprintf(stderr, "trace replay needs one trace per thread and no preconditioning\n");
+		return -1;
+	}
+	if (workload_path) {
+		nr_workload_conns = workload_load(workload_path, ns_size / ns_sector_size / WL_BLOCK_SECTORS,
+						  req_size, workload, MAX_TRACES);
+		if (nr_workload_conns < 0)
+			return nr_workload_conns;
+		if (nr_workload_conns != nr_threads || nr_traces || preconditioning) {
+			fprintf(stderr, "a workload file needs one connection per thread, no traces and no preconditioning\n");
+			return -1;
+		}
+	}
 	pthread_barrier_init(&barrier, NULL, nr_threads);
 	
 	for (int i = 0; i < nr_threads; i++) {
@@ -690,13 +1166,28 @@ int main(int argc, char *argv[])
 
 		timer_calibrate_tsc();
 		
-		ip_tuple[i]->dst_port = atoi(argv[2]) + i;
+		ip_tuple[i]->dst_port = trace_ports[i] ? trace_ports[i] : atoi(argv[2]) + i;
+		if (nr_workload_conns)
+			ip_tuple[i]->dst_port = workload[i].port;
 		ip_tuple[i]->src_port = atoi(argv[2]);
-		printf("Connecting to port: %i\n", atoi(argv[2]) + i);
+		printf("Connecting to port: %i\n", ip_tuple[i]->dst_port);
 	}
 	global_target_IOPS = atoi(argv[5]);
+	if (nr_workload_conns) {
+		global_target_IOPS = 0;
+		for (int i = 0; i < nr_workload_conns; i++)
+			global_target_IOPS += workload[i].rate;
+	}
 	cycles_between_req = ((unsigned long)cycles_per_us * 1000UL * 1000UL * nr_threads) / atoi(argv[5]);
 	NUM_MEASURE = atoi(argv[5]) * DURATION / nr_threads;
+	if (ts_path) {
+		ret = timeseries_init(ts_path, ts_interval_ms, cycles_per_us, rdtsc(),
+				      nr_threads, hist_precision);
+		if (ret) {
+			fprintf(stderr, "unable to open '%s': %s\n", ts_path, strerror(-ret));
+			return ret;
+		}
+	}
 	pp_conn_pool_entries = 16 * 4096;
 	pp_conn_pool_entries = ROUND_UP(pp_conn_pool_entries, MEMPOOL_DEFAULT_CHUNKSIZE);
 	ixev_init(&pp_conn_ops);
@@ -716,10 +1207,17 @@ int main(int argc, char *argv[])
 		return ret;
 	}
 
+	if (nr_workload_conns && workload_max_sectors(workload, nr_workload_conns) > req_size)
+		req_size_bytes = workload_max_sectors(workload, nr_workload_conns) * ns_sector_size;
+	// room for the length table of compressed reads
+	buf_size = req_size_bytes + (req_size_bytes / REFLEX_LZ4_BLOCK + 1) * sizeof(uint16_t);
+	// *2 avoids out-of-mem error, large requests are limited by MAX_BUF_BYTES instead
+	nr_bufs = outstanding_reqs * 2;
+	if (nr_bufs * buf_size > MAX_BUF_BYTES)
+		nr_bufs = ROUND_UP(MAX_BUF_BYTES / buf_size, MEMPOOL_DEFAULT_CHUNKSIZE);
 	ret = mempool_create_datastore(&nvme_req_buf_datastore,
-				       // *2 avoids out-of-mem error
-				       outstanding_reqs * 2,
-				       req_size_bytes, false, 
+				       nr_bufs, buf_size,
+				       false, 
 				       MEMPOOL_DEFAULT_CHUNKSIZE, "nvme_req");
 	if (ret) {
 		fprintf(stderr, "unable to create datastore\n");
@@ -741,6 +1239,8 @@ int main(int argc, char *argv[])
 	for (int i = 1; i < nr_threads; i++) {
 		pthread_join(thread[i], NULL);
 	}
+	if (ts_path)
+		timeseries_finish();
 	printf("joined. Total IOPS: %lu\n", iops);
 	
 	return 0;
@@ -0,0 +1,191 @@
+/*
+ * Copyright 2013-16 Board of Trustees of Stanford University
+ * Copyright 2013-16 Ecole Polytechnique Federale Lausanne (EPFL)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * reflex_kv.c - DRAM hash index for the ReFlex key-value front end
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "reflex_kv.h"
+
+static inline uint64_t kv_hash(uint64_t key)
+{
+	key ^= key >> 33;
+	key *= 0xff51afd7ed558ccdULL;
+	key ^= key >> 33;
+	key *= 0xc4ceb9fe1a85ec53ULL;
+	key ^= key >> 33;
+	return key;
+}
+
+static inline struct kv_bucket *kv_next(struct kv_index *idx, struct kv_bucket *b)
+{
+	return b->next ? &idx->overflow[b->next - 1] : NULL;
+}
+
+static struct kv_bucket *kv_alloc_buckets(unsigned long nr)
+{
+	struct kv_bucket *b;
+
+	b = aligned_alloc(sizeof(struct kv_bucket), nr * sizeof(struct kv_bucket));
+	if (b)
+		memset(b, 0, nr * sizeof(struct kv_bucket));
+	return b;
+}
+
+/**
+ * kv_index_init - allocates an empty index
+ * @idx: the index
+ * @nr_keys: the number of keys the index should hold
+ *
+ * The home table is sized for about 75% slot occupancy, with an
+ * additional 1/8 of its size reserved for overflow buckets.
+ *
+ * Returns 0 if successful, otherwise -ENOMEM.
+ */
+int kv_index_init(struct kv_index *idx, unsigned long nr_keys)
+{
+	unsigned long nr_buckets = 1;
+
+	while (nr_buckets * KV_BUCKET_SLOTS * 3 < nr_keys * 4)
+		nr_buckets <<= 1;
+
+	idx->buckets = kv_alloc_buckets(nr_buckets);
+	if (!idx->buckets)
+		return -ENOMEM;
+
+	idx->nr_overflow = nr_buckets / 8 + 1;
+	idx->overflow = kv_alloc_buckets(idx->nr_overflow);
+	if (!idx->overflow) {
+		free(idx->buckets);
+		idx->buckets = NULL;
+		return -ENOMEM;
+	}
+
+	idx->mask = nr_buckets - 1;
+	idx->overflow_used = 0;
+	idx->nr_keys = 0;
+	return 0;
+}
+
+/**
+ * kv_index_get - looks up a key
+ * @idx: the index
+ * @key: the key
+ *
+ * Returns the location of the key's value, or 0 if the key is not present.
+ */
+uint64_t kv_index_get(struct kv_index *idx, uint64_t key)
+{
+	struct kv_bucket *b = &idx->buckets[kv_hash(key) & idx->mask];
+	int i;
+
+	do {
+		for (i = 0; i < KV_BUCKET_SLOTS; i++) {
+			if (b->loc[i] && b->key[i] == key)
+				return b->loc[i];
+		}
+		b = kv_next(idx, b);
+	} while (b);
+
+	return 0;
+}
+
+/**
+ * kv_index_put - inserts or updates a key
+ * @idx: the index
+ * @key: the key
+ * @loc: the new location of the key's value (must not be 0)
+ *
+ * Returns 0 if successful, or -ENOMEM if no overflow bucket is left.
+ */
+int kv_index_put(struct kv_index *idx, uint64_t key, uint64_t loc)
+{
+	struct kv_bucket *b = &idx->buckets[kv_hash(key) & idx->mask];
+	struct kv_bucket *last, *free_b = NULL;
+	int i, free_i = 0;
+
+	do {
+		for (i = 0; i < KV_BUCKET_SLOTS; i++) {
+			if (b->loc[i] && b->key[i] == key) {
+				b->loc[i] = loc;
+				return 0;
+			}
+			if (!b->loc[i] && !free_b) {
+				free_b = b;
+				free_i = i;
+			}
+		}
+		last = b;
+		b = kv_next(idx, b);
+	} while (b);
+
+	if (!free_b) {
+		if (idx->overflow_used == idx->nr_overflow)
+			return -ENOMEM;
+		free_b = &idx->overflow[idx->overflow_used++];
+		last->next = idx->overflow_used;
+	}
+
+	free_b->key[free_i] = key;
+	free_b->loc[free_i] = loc;
+	idx->nr_keys++;
+	return 0;
+}
+
+/**
+ * kv_index_del - removes a key
+ * @idx: the index
+ * @key: the key
+ */
+void kv_index_del(struct kv_index *idx, uint64_t key)
+{
+	struct kv_bucket *b = &idx->buckets[kv_hash(key) & idx->mask];
+	int i;
+
+	do {
+		for (i = 0; i < KV_BUCKET_SLOTS; i++) {
+			if (b->loc[i] && b->key[i] == key) {
+				b->loc[i] = 0;
+				idx->nr_keys--;
+				return;
+			}
+		}
+		b = kv_next(idx, b);
+	} while (b);
+}
+
+/**
+ * kv_key_owner - picks the thread that owns a key
+ * @key: the key
+ * @nr_threads: the number of threads sharing the key space
+ *
+ * Uses the high half of the hash, the low bits pick the index bucket.
+ */
+unsigned int kv_key_owner(uint64_t key, unsigned int nr_threads)
+{
+	return (kv_hash(key) >> 32) % nr_threads;
+}
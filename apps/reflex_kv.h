@@ -0,0 +1,80 @@
+/*
+ * Copyright 2013-16 Board of Trustees of Stanford University
+ * Copyright 2013-16 Ecole Polytechnique Federale Lausanne (EPFL)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * reflex_kv.h - DRAM hash index for the ReFlex key-value front end
+ *
+ * Keys are partitioned across dataplane threads by kv_key_owner(), and
+ * each thread keeps a private index of its keys, so no synchronization is
+ * needed. Buckets are one cache line: a lookup that hits the home bucket
+ * costs a single cache miss. Full buckets chain to overflow buckets.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#define KV_BUCKET_SLOTS 3
+
+struct kv_bucket {
+	uint64_t key[KV_BUCKET_SLOTS];
+	uint64_t loc[KV_BUCKET_SLOTS];	/* 0 marks an empty slot */
+	uint32_t next;			/* overflow bucket index + 1, 0 if none */
+	uint32_t pad0;
+	uint64_t pad1;
+} __attribute__((aligned(64)));
+
+struct kv_index {
+	struct kv_bucket *buckets;
+	unsigned long mask;
+	struct kv_bucket *overflow;
+	unsigned int nr_overflow;
+	unsigned int overflow_used;
+	unsigned long nr_keys;
+};
+
+/*
+ * A location packs the byte address of a value's log record and the
+ * record length. Records of the open (not yet flushed) segment are
+ * addressed relative to the segment and flagged with KV_LOC_PENDING.
+ */
+#define KV_LOC_LEN_BITS		20
+#define KV_LOC_PENDING		(1UL << 63)
+#define KV_LOC(byte, len)	(((uint64_t) (byte) << KV_LOC_LEN_BITS) | (len))
+#define KV_LOC_BYTE(loc)	(((loc) & ~KV_LOC_PENDING) >> KV_LOC_LEN_BITS)
+#define KV_LOC_LEN(loc)		((loc) & ((1UL << KV_LOC_LEN_BITS) - 1))
+
+/* on-flash record header, followed by the value */
+struct kv_record {
+	uint64_t key;
+	uint32_t len;
+	uint32_t magic;
+} __attribute__((packed));
+
+#define KV_RECORD_MAGIC 0x52464b56
+
+extern int kv_index_init(struct kv_index *idx, unsigned long nr_keys);
+extern uint64_t kv_index_get(struct kv_index *idx, uint64_t key);
+extern int kv_index_put(struct kv_index *idx, uint64_t key, uint64_t loc);
+extern void kv_index_del(struct kv_index *idx, uint64_t key);
+extern unsigned int kv_key_owner(uint64_t key, unsigned int nr_threads);
@@ -0,0 +1,230 @@
+/*
+ * Copyright 2013-16 Board of Trustees of Stanford University
+ * Copyright 2013-16 Ecole Polytechnique Federale Lausanne (EPFL)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * reflex_lz4.c - a small greedy LZ4 block compressor and a bounds-checked
+ * decompressor, sized for 4KB..64KB blocks handled in the dataplane thread.
+ */
+
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "reflex_lz4.h"
+
+#define LZ4_MINMATCH		4
+#define LZ4_LASTLITERALS	5
+#define LZ4_MFLIMIT		12
+#define LZ4_HASH_LOG		12
+#define LZ4_MAX_OFFSET		65535
+
+static inline uint32_t lz4_read32(const uint8_t *p)
+{
+	uint32_t v;
+
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+static inline uint32_t lz4_hash(uint32_t seq)
+{
+	return (seq * 2654435761U) >> (32 - LZ4_HASH_LOG);
+}
+
+static inline uint8_t *lz4_put_len(uint8_t *op, size_t len)
+{
+	while (len >= 255) {
+		*op++ = 255;
+		len -= 255;
+	}
+	*op++ = (uint8_t) len;
+	return op;
+}
+
+/* worst-case encoded size of a sequence, used to bound-check dst up front */
+static inline size_t lz4_seq_bound(size_t lit, size_t mlen)
+{
+	return 1 + lit / 255 + 1 + lit + 2 + mlen / 255 + 1;
+}
+
+/**
+ * reflex_lz4_compress - compresses a block into LZ4 block format
+ * @src: the input data
+ * @src_len: the input length (at most REFLEX_LZ4_MAX_INPUT)
+ * @dst: the output buffer
+ * @dst_cap: the output buffer capacity
+ *
+ * Returns the compressed length, or -ENOSPC if the result does not fit
+ * in @dst_cap. Passing @dst_cap < @src_len turns the call into a "only
+ * if it saves space" compression attempt.
+ */
+int reflex_lz4_compress(const void *src, int src_len, void *dst, int dst_cap)
+{
+	uint16_t table[1 << LZ4_HASH_LOG];
+	const uint8_t *base = src;
+	const uint8_t *ip = base, *anchor = base;
+	const uint8_t *iend = base + src_len;
+	const uint8_t *mflimit = iend - LZ4_MFLIMIT;
+	const uint8_t *matchlimit = iend - LZ4_LASTLITERALS;
+	uint8_t *op = dst, *oend = op + dst_cap;
+	uint8_t *token;
+	size_t lit, mlen;
+
+	if (src_len < 0 || src_len > REFLEX_LZ4_MAX_INPUT)
+		return -EINVAL;
+
+	memset(table, 0, sizeof(table));
+
+	if (src_len > LZ4_MFLIMIT) {
+		ip++;
+		while (ip < mflimit) {
+			uint32_t seq = lz4_read32(ip);
+			uint32_t h = lz4_hash(seq);
+			const uint8_t *ref = base + table[h];
+			const uint8_t *mp, *rp;
+
+			table[h] = (uint16_t) (ip - base);
+			if (ref >= ip || ip - ref > LZ4_MAX_OFFSET ||
+			    lz4_read32(ref) != seq) {
+				ip++;
+				continue;
+			}
+
+			while (ip > anchor && ref > base && ip[-1] == ref[-1]) {
+				ip--;
+				ref--;
+			}
+
+			mp = ip + LZ4_MINMATCH;
+			rp = ref + LZ4_MINMATCH;
+			while (mp < matchlimit && *mp == *rp) {
+				mp++;
+				rp++;
+			}
+
+			lit = ip - anchor;
+			mlen = mp - ip - LZ4_MINMATCH;
+			if (op + lz4_seq_bound(lit, mlen) > oend)
+				return -ENOSPC;
+
+			token = op++;
+			*token = (lit >= 15 ? 15 : lit) << 4;
+			if (lit >= 15)
+				op = lz4_put_len(op, lit - 15);
+			memcpy(op, anchor, lit);
+			op += lit;
+
+			*op++ = (uint8_t) (ip - ref);
+			*op++ = (uint8_t) ((ip - ref) >> 8);
+
+			*token |= mlen >= 15 ? 15 : mlen;
+			if (mlen >= 15)
+				op = lz4_put_len(op, mlen - 15);
+
+			ip = mp;
+			anchor = ip;
+		}
+	}
+
+	/* the last sequence carries only literals */
+	lit = iend - anchor;
+	if (op + lz4_seq_bound(lit, 0) - 3 > oend)
+		return -ENOSPC;
+
+	token = op++;
+	*token = (lit >= 15 ? 15 : lit) << 4;
+	if (lit >= 15)
+		op = lz4_put_len(op, lit - 15);
+	memcpy(op, anchor, lit);
+	op += lit;
+
+	return op - (uint8_t *) dst;
+}
+
+/**
+ * reflex_lz4_decompress - decompresses an LZ4 block
+ * @src: the compressed data
+ * @src_len: the compressed length
+ * @dst: the output buffer
+ * @dst_cap: the output buffer capacity
+ *
+ * Returns the decompressed length, or -EINVAL if the input is malformed
+ * or would overflow @dst_cap.
+ */
+int reflex_lz4_decompress(const void *src, int src_len, void *dst, int dst_cap)
+{
+	const uint8_t *ip = src, *iend = ip + src_len;
+	uint8_t *op = dst, *oend = op + dst_cap;
+	const uint8_t *ref;
+	size_t lit, mlen, off;
+	uint8_t token, b;
+
+	while (ip < iend) {
+		token = *ip++;
+
+		lit = token >> 4;
+		if (lit == 15) {
+			do {
+				if (ip >= iend)
+					return -EINVAL;
+				b = *ip++;
+				lit += b;
+			} while (b == 255);
+		}
+		if (lit > (size_t) (iend - ip) || lit > (size_t) (oend - op))
+			return -EINVAL;
+		memcpy(op, ip, lit);
+		op += lit;
+		ip += lit;
+
+		if (ip == iend)
+			break;
+
+		if (iend - ip < 2)
+			return -EINVAL;
+		off = ip[0] | (ip[1] << 8);
+		ip += 2;
+		if (off == 0 || off > (size_t) (op - (uint8_t *) dst))
+			return -EINVAL;
+
+		mlen = token & 15;
+		if (mlen == 15) {
+			do {
+				if (ip >= iend)
+					return -EINVAL;
+				b = *ip++;
+				mlen += b;
+			} while (b == 255);
+		}
+		mlen += LZ4_MINMATCH;
+		if (mlen > (size_t) (oend - op))
+			return -EINVAL;
+
+		/* byte-wise copy: matches may overlap their own output */
+		ref = op - off;
+		while (mlen--)
+			*op++ = *ref++;
+	}
+
+	return op - (uint8_t *) dst;
+}
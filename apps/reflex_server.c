@@ -24,6 +24,9 @@
 #include <errno.h>
 #include <pthread.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 #include <assert.h>
 #include <netinet/in.h>
 
@@ -31,8 +34,12 @@
 #include <ixev_timer.h>
 #include <mempool.h>
 #include <ix/list.h>
+#include <ix/reqtrace.h>
 
 #include "reflex.h" 
+#include "reflex_lz4.h"
+#include "reflex_kv.h"
+#include "reflex_tenants.h"
 
 #define ROUND_UP(num, multiple) ((((num) + (multiple) - 1) / (multiple)) * (multiple))
 #define BATCH_DEPTH  512
@@ -52,22 +59,229 @@ static unsigned long ns_sector_size;
 static struct mempool_datastore nvme_req_buf_datastore;
 static __thread struct mempool nvme_req_buf_pool;
 
+/*
+ * Block requests larger than 4KB take their payload from the smallest size
+ * class that fits, as one run that never straddles a 2MB page and is thus
+ * physically contiguous. The NVMe command is then a single PRP list rather
+ * than an SGL built by one callback per 4KB, and GET payloads are sent as a
+ * single zero-copy segment. When a class runs dry, or its pool could not be
+ * created, the request falls back to 4KB buffers. The classes split
+ * buf_run_mb of 2MB pages evenly (-b, 0 disables them).
+ */
+#define NR_BUF_RUN_CLASSES 3
+#define BUF_RUN_MB_DEFAULT 48
+
+static const struct {
+	size_t size;
+	int chunk_size;
+} buf_run_classes[NR_BUF_RUN_CLASSES] = {
+	{ 16 * 1024,	64 },
+	{ 64 * 1024,	16 },
+	{ 256 * 1024,	8 },	//MAX_PAGES_PER_ACCESS pages
+};
+
+static unsigned int buf_run_mb = BUF_RUN_MB_DEFAULT;
+static bool buf_run_enabled[NR_BUF_RUN_CLASSES];
+static struct mempool_datastore buf_run_datastore[NR_BUF_RUN_CLASSES];
+static __thread struct mempool buf_run_pool[NR_BUF_RUN_CLASSES];
+
 static struct mempool_datastore nvme_req_datastore;
 static __thread struct mempool nvme_req_pool;
 static __thread int conn_opened;
 static __thread long reqs_allocated = 0;
 
+/*
+ * Compressed tenants
+ *
+ * Writes from a compressed tenant are LZ4-compressed per 4KB block and
+ * appended back to back to a log region on flash reserved for the tenant.
+ * A DRAM extent map with one entry per logical 4KB block records the byte
+ * address and compressed length of the latest copy of each block. Reads
+ * look up the map, fetch only the physically contiguous runs that hold the
+ * compressed blocks and return them still compressed (see CMD_GET_LZ4).
+ *
+ * The scheduler charges tokens for the NVMe commands actually issued, so a
+ * compressed tenant is billed for the physical bytes it touches.
+ *
+ * TRIM and WRITE_ZEROES only drop blocks from the extent map, after which
+ * they read as zeroes, and FLUSH is passed through to the device.
+ *
+ * The log is not garbage collected: once a tenant's region is full, further
+ * writes from that tenant are refused. Requests that cannot be served are
+ * answered with CMD_ERR rather than closing the connection.
+ */
+#define LZ_SECTOR_SIZE 512
+#define LZ_SECTORS_PER_BLOCK (REFLEX_LZ4_BLOCK / LZ_SECTOR_SIZE)
+/* a fragmented read needs at most two 4KB buffers per block */
+#define LZ_MAX_BLOCKS (MAX_PAGES_PER_ACCESS / 2)
+#define LZ_OUTSTANDING 4096
+
+#define LZ_LEN_BITS 13
+#define LZ_ENTRY(byte, len) (((byte) << LZ_LEN_BITS) | (len))
+#define LZ_ENTRY_BYTE(e) ((e) >> LZ_LEN_BITS)
+#define LZ_ENTRY_LEN(e) ((e) & ((1UL << LZ_LEN_BITS) - 1))
+
+struct lz_tenant {
+	unsigned short port;
+	unsigned long logical_blocks;	//size of the logical address space in 4KB blocks
+	unsigned long log_start;	//first LBA of the log region
+	unsigned long log_sectors;	//size of the log region in sectors
+	unsigned long log_head;		//next free sector, relative to log_start
+	unsigned long *map;		//extent map, one entry per logical block
+	bool enabled;			//set once the log region is known to fit
+	bool log_full;			//a write was refused for lack of space
+};
+
+/*
+ * FIXME: like the SLOs in pp_accept(), compression is bound to a port and
+ * the log region is carved out statically. Keep it clear of the LBA range
+ * used by uncompressed tenants.
+ */
+static struct lz_tenant lz_tenants[] = {
+	{
+		.port = 1238,
+		.logical_blocks = 4UL << 20,		//16GB
+		.log_start = 0x40000000UL,		//512GB into the namespace
+		.log_sectors = 0x2000000UL,		//16GB
+	},
+};
+
+struct nvme_req;
+
+struct lz_run {
+	struct ixev_nvme_req_ctx ctx;
+	struct nvme_req *req;
+	unsigned long byte;		//device byte address of the first compressed block
+	unsigned int len;		//compressed bytes in the run
+	unsigned int skip;		//offset of the run in its first sector
+	int first_buf;
+};
+
+struct lz_state {
+	int nr_blocks;
+	int nr_runs;
+	int runs_pending;
+	int cur_run;
+	unsigned int run_sent;
+	unsigned int payload_len;
+	unsigned long phys_lba;
+	uint16_t len[LZ_MAX_BLOCKS];	//sent as-is as the CMD_GET_LZ4 length table
+	struct lz_run run[LZ_MAX_BLOCKS];
+};
+
+static struct mempool_datastore lz_state_datastore;
+static __thread struct mempool lz_state_pool;
+static __thread char lz_scratch[REFLEX_LZ4_BLOCK];
+
+/*
+ * Key-value tenants
+ *
+ * PUTs append a record (struct kv_record followed by the value) to an open
+ * segment in DRAM. The segment is written to the tenant's log region with a
+ * single NVMe command once it is full, or KV_FLUSH_US after it was opened,
+ * and the PUT_ACKs of all its records are sent when that write completes.
+ * A GET costs at most one flash read: the index gives the byte address and
+ * length of the record, and values still in DRAM are copied from their
+ * segment.
+ *
+ * Keys are partitioned across threads by hash (kv_key_owner()). Each thread
+ * owns the index and segments of its keys; a request received by another
+ * thread is handed to the owner through the owner's inbox, and handed back
+ * the same way for the response, so every connection of a tenant sees the
+ * same store. Each thread registers the tenant's flow once the namespace is
+ * open and never drops that registration, so segments can still be written
+ * after the tenant's connections to the thread are gone. Flash I/O is
+ * charged to the tenant's token budget. The log is not garbage collected.
+ */
+#define KV_HEADER binary_header_kv_t
+#define KV_SECTOR_SIZE 512
+#define KV_SEG_PAGES 16
+#define KV_SEG_SIZE (KV_SEG_PAGES * PAGE_SIZE)
+#define KV_MAX_VALUE (KV_SEG_SIZE - sizeof(struct kv_record))
+#define KV_FLUSH_US 50
+#define KV_OUTSTANDING_SEGS 1024
+
+struct kv_tenant {
+	unsigned short port;
+	unsigned long nr_keys;		//index capacity of each thread, for the keys it owns
+	unsigned long log_start;	//first LBA of the log region
+	unsigned long log_sectors;	//size of the log region in sectors
+	unsigned long log_head;		//next free sector, relative to log_start
+	bool enabled;			//set once the log region is known to fit
+};
+
+/* FIXME: bound to a port and carved out statically, like lz_tenants */
+static struct kv_tenant kv_tenants[] = {
+	{
+		.port = 1239,
+		.nr_keys = 1UL << 20,
+		.log_start = 0x50000000UL,		//640GB into the namespace
+		.log_sectors = 0x2000000UL,		//16GB
+	},
+};
+
+#define NR_KV_TENANTS (sizeof(kv_tenants) / sizeof(kv_tenants[0]))
+
+struct kv_core;
+
+struct kv_segment {
+	struct ixev_nvme_req_ctx ctx;
+	struct kv_core *core;
+	unsigned long byte;		//device byte address, set when flushed
+	unsigned int fill;
+	char *buf[KV_SEG_PAGES];
+	struct list_head waiters;	//PUTs to ack once the segment is durable
+	struct list_node link;
+};
+
+struct kv_core {
+	struct kv_tenant *tenant;	//set once the index is allocated
+	struct kv_index index;
+	long fg_handle;			//this thread's registration of the tenant, 0 until registered
+	struct kv_segment *open;
+	struct list_head flushing;	//segments with a write in flight
+	struct ixev_timer flush_timer;
+	bool timer_armed;
+};
+
+static struct mempool_datastore kv_seg_datastore;
+static __thread struct mempool kv_seg_pool;
+static __thread struct kv_core kv_cores[NR_KV_TENANTS];
+
+/* requests handed to a thread, and responses handed back to it */
+struct kv_inbox {
+	spinlock_t lock;
+	struct list_head reqs;
+	volatile bool pending;		//read without the lock
+} __attribute__((aligned(64)));
+
+static int kv_nr_threads;
+static int kv_next_thread;
+static struct kv_inbox *kv_inboxes;
+static __thread int kv_thread;
+
 struct nvme_req {
 	struct ixev_nvme_req_ctx ctx;
+	unsigned long lba;
 	unsigned int lba_count;
 	uint16_t opcode;
 	struct pp_conn *conn;
 	struct list_node link;
 	struct ixev_ref ref;				//for zero-copy
-	unsigned long timestamp;
+	unsigned long timestamp;			//TSC the header was parsed at if traced, else 0
 	void *remote_req_handle;
 	char *buf[MAX_PAGES_PER_ACCESS]; 	//nvme buffer to read/write data into
+	int nr_bufs;
+	int run_class;				//buf[] is one run from buf_run_pool, or -1
 	int current_sgl_buf;
+	struct lz_state *lz;			//only set for compressed tenants
+	uint64_t key;				//key-value tenants only
+	unsigned int val_len;
+	unsigned int val_off;			//offset of the value in buf
+	int kv_tenant;				//index in kv_tenants
+	int kv_origin;				//thread that received the request
+	bool kv_done;				//handed back to kv_origin for the response
+	uint16_t status;
 };
 
 struct pp_conn {
@@ -76,6 +290,7 @@ struct pp_conn {
 	size_t tx_sent;
 	bool rx_pending; 	//is there a ReFlex req currently being received/sent
 	bool tx_pending;
+	bool hup;		//closed by the peer, close once nothing is in flight
 	int nvme_pending;
 	long in_flight_pkts;
 	long sent_pkts;
@@ -83,9 +298,13 @@ struct pp_conn {
 	unsigned long req_received;
 	struct list_head pending_requests;
 	long nvme_fg_handle; //nvme flow group handle
+	struct lz_tenant *lz; //compression state if the tenant is compressed
+	struct kv_core *kv; //key-value state if the tenant is a key-value tenant
 	struct nvme_req *current_req;
 	char data_send[sizeof(BINARY_HEADER)]; //use zero-copy for payload
 	char data_recv[sizeof(BINARY_HEADER)]; //use zero-copy for payload
+	char kv_send[sizeof(KV_HEADER)];
+	char kv_recv[sizeof(KV_HEADER)];
 };
 
 
@@ -96,24 +315,160 @@ static __thread hqu_t handle;
 
 
 static void pp_main_handler(struct ixev_ctx *ctx, unsigned int reason);
+static int kv_send_req(struct nvme_req *req);
 
-static void send_completed_cb(struct ixev_ref *ref)
+#ifdef ENABLE_REQTRACE
+/*
+ * One block request in REQTRACE_SAMPLE has its lifecycle recorded by the
+ * dataplane, which must also be built with ENABLE_REQTRACE (see
+ * ix/reqtrace.h and tools/ix_reqtrace).
+ */
+#define REQTRACE_SAMPLE 64
+
+static __thread unsigned int reqtrace_count;
+
+static void reqtrace_sample(struct nvme_req *req)
 {
-	struct nvme_req *req = container_of(ref, struct nvme_req, ref);
-	struct pp_conn *conn = req->conn;
-	int i, num4k;
-	
-	num4k = (req->lba_count * ns_sector_size) / 4096;
-	if (((req->lba_count * ns_sector_size) % 4096) != 0)
-		num4k++;
-	for (i = 0; i < num4k; i++) 
+	req->timestamp = (++reqtrace_count % REQTRACE_SAMPLE) ? 0 : rdtsc();
+}
+
+static void reqtrace(struct nvme_req *req, int type, unsigned long tsc)
+{
+	if (req->timestamp)
+		ixev_reqtrace((unsigned long) &req->ctx, type, tsc,
+			      req->conn->nvme_fg_handle);
+}
+#else
+static inline void reqtrace_sample(struct nvme_req *req) {}
+static inline void reqtrace(struct nvme_req *req, int type, unsigned long tsc) {}
+#endif
+
+/* copies len bytes to offset pos of an array of 4KB buffers, or zeroes them if src is NULL */
+static void bufs_write(char **bufs, size_t pos, const void *src, size_t len)
+{
+	const char *p = src;
+	size_t n;
+
+	while (len) {
+		n = min(PAGE_SIZE - (pos % PAGE_SIZE), len);
+		if (p) {
+			memcpy(&bufs[pos / PAGE_SIZE][pos % PAGE_SIZE], p, n);
+			p += n;
+		} else {
+			memset(&bufs[pos / PAGE_SIZE][pos % PAGE_SIZE], 0, n);
+		}
+		pos += n;
+		len -= n;
+	}
+}
+
+/* copies len bytes from offset pos of an array of 4KB buffers */
+static void bufs_read(char **bufs, size_t pos, void *dst, size_t len)
+{
+	char *p = dst;
+	size_t n;
+
+	while (len) {
+		n = min(PAGE_SIZE - (pos % PAGE_SIZE), len);
+		memcpy(p, &bufs[pos / PAGE_SIZE][pos % PAGE_SIZE], n);
+		p += n;
+		pos += n;
+		len -= n;
+	}
+}
+
+/*
+ * points req->buf[] into one contiguous run of at least num4k pages;
+ * returns false if the size class is exhausted or no enabled class fits
+ */
+static bool nvme_req_alloc_run(struct nvme_req *req, int num4k)
+{
+	char *run;
+	int c, i;
+
+	for (c = 0; c < NR_BUF_RUN_CLASSES; c++)
+		if (buf_run_enabled[c] && num4k * PAGE_SIZE <= buf_run_classes[c].size)
+			break;
+	if (c == NR_BUF_RUN_CLASSES)
+		return false;
+
+	run = mempool_alloc(&buf_run_pool[c]);
+	if (!run)
+		return false;
+
+	for (i = 0; i < num4k; i++)
+		req->buf[i] = run + i * PAGE_SIZE;
+	req->run_class = c;
+	return true;
+}
+
+static void nvme_req_free(struct nvme_req *req)
+{
+	int i;
+
+	if (req->run_class >= 0)
+		mempool_free(&buf_run_pool[req->run_class], req->buf[0]);
+	for (i = 0; i < req->nr_bufs; i++)
 		mempool_free(&nvme_req_buf_pool, req->buf[i]);
+	if (req->lz)
+		mempool_free(&lz_state_pool, req->lz);
 
 	mempool_free(&nvme_req_pool, req);
 	reqs_allocated--;
+}
+
+static void send_completed_cb(struct ixev_ref *ref)
+{
+	struct nvme_req *req = container_of(ref, struct nvme_req, ref);
+	struct pp_conn *conn = req->conn;
+
+	reqtrace(req, REQTRACE_ACK, rdtsc());
+	nvme_req_free(req);
 	conn->sent_pkts--;
 }
 
+/*
+ * sends the length table, then the compressed runs in logical block order;
+ * returns 0 when the whole payload has been queued or the ixev_send_zc error
+ */
+static int lz_send_payload(struct pp_conn *conn, struct nvme_req *req)
+{
+	struct lz_state *lzs = req->lz;
+	size_t table_len = lzs->nr_blocks * sizeof(uint16_t);
+	struct lz_run *run;
+	size_t pos, to_send;
+	ssize_t ret;
+
+	while (conn->tx_sent < table_len) {
+		ret = ixev_send_zc(&conn->ctx, (char *) lzs->len + conn->tx_sent,
+				   table_len - conn->tx_sent);
+		if (ret < 0)
+			return ret;
+		conn->tx_sent += ret;
+	}
+
+	while (lzs->cur_run < lzs->nr_runs) {
+		run = &lzs->run[lzs->cur_run];
+		pos = run->skip + lzs->run_sent;
+		to_send = min(PAGE_SIZE - (pos % PAGE_SIZE),
+			      (size_t) (run->len - lzs->run_sent));
+
+		ret = ixev_send_zc(&conn->ctx,
+				   &req->buf[run->first_buf + pos / PAGE_SIZE][pos % PAGE_SIZE],
+				   to_send);
+		if (ret < 0)
+			return ret;
+
+		conn->tx_sent += ret;
+		lzs->run_sent += ret;
+		if (lzs->run_sent == run->len) {
+			lzs->cur_run++;
+			lzs->run_sent = 0;
+		}
+	}
+	return 0;
+}
+
 /*
  * returns 0 if send was successfull and -1 if tx path is busy
  */
@@ -123,14 +478,25 @@ int send_req(struct nvme_req *req)
 	int ret = 0;
 	BINARY_HEADER *header;
 
+	if (conn->kv)
+		return kv_send_req(req);
+
 	if(!conn->tx_pending){
 		//setup header
 		header = (BINARY_HEADER *)&conn->data_send[0];
 		header->magic = sizeof(BINARY_HEADER); //RESP_PKT;
 		header->opcode = req->opcode;
 		
-		if (req->opcode == CMD_SET)
+		if (req->status != RESP_OK) {
+			header->opcode = CMD_ERR;
+			header->lba_count = req->status;
+		}
+		else if (req->opcode != CMD_GET)
 			header->lba_count = 0;
+		else if (req->lz) {
+			header->opcode = CMD_GET_LZ4;
+			header->lba_count = req->lz->payload_len;
+		}
 		else
 			header->lba_count = req->lba_count;
 		header->req_handle = req->remote_req_handle;
@@ -149,15 +515,37 @@ int send_req(struct nvme_req *req)
 			}
 			conn->tx_sent += ret;
 		}
+		reqtrace(req, REQTRACE_TX, rdtsc());
 	
 		conn->tx_pending = true;
 		conn->tx_sent = 0;
 	}
 	ret = 0;
-	if (req->opcode == CMD_GET) {
+	if (req->status != RESP_OK) {
+		nvme_req_free(req);
+		conn->sent_pkts--;
+	}
+	else if (req->opcode == CMD_GET && req->lz) {
+		ret = lz_send_payload(conn, req);
+		if (ret < 0) {
+			if (ret == -EAGAIN)
+				return -1;
+
+			if(!conn->nvme_pending) {
+				printf("Connection close 4\n");
+				ixev_close(&conn->ctx);
+			}
+			return -2;
+		}
+		req->ref.cb = &send_completed_cb;
+		ixev_add_sent_cb(&conn->ctx, &req->ref);
+	}
+	else if (req->opcode == CMD_GET) {
 		while (conn->tx_sent < req->lba_count * ns_sector_size) {		
-			int to_send = min(PAGE_SIZE - (conn->tx_sent % PAGE_SIZE),
-					  (req->lba_count * ns_sector_size) - conn->tx_sent);
+			int to_send = (req->lba_count * ns_sector_size) - conn->tx_sent;
+
+			if (req->run_class < 0)
+				to_send = min(PAGE_SIZE - (conn->tx_sent % PAGE_SIZE), to_send);
 		
 			ret = ixev_send_zc(&conn->ctx,
 					   &req->buf[req->current_sgl_buf][conn->tx_sent % PAGE_SIZE],
@@ -176,8 +564,7 @@ int send_req(struct nvme_req *req)
 				printf("fhmm ret is zero\n");
 
 			conn->tx_sent += ret;
-			if ((conn->tx_sent % PAGE_SIZE) == 0)
-				req->current_sgl_buf++;
+			req->current_sgl_buf = conn->tx_sent / PAGE_SIZE;
 		}
 		assert(req->current_sgl_buf <= req->lba_count);
 		req->ref.cb = &send_completed_cb;
@@ -185,15 +572,7 @@ int send_req(struct nvme_req *req)
 		ixev_add_sent_cb(&conn->ctx, &req->ref);
 	}
 	else { //PUT
-		int i, num4k;
-
-		num4k = (req->lba_count * ns_sector_size) / 4096;
-		if (((req->lba_count * ns_sector_size) % 4096) != 0)
-			num4k++;
-		for (i = 0; i < num4k; i++) 
-			mempool_free(&nvme_req_buf_pool, req->buf[i]);
-		mempool_free(&nvme_req_pool, req);
-		reqs_allocated--;
+		nvme_req_free(req);
 		conn->sent_pkts--;
 	}
 	conn->list_len--;
@@ -219,16 +598,36 @@ int send_pending_reqs(struct pp_conn *conn)
 	return sent_reqs;
 }
 
+/*
+ * Completions reference the connection, so a connection the peer closed is
+ * only unregistered and closed once its last request has completed.
+ */
+static void pp_close_idle(struct pp_conn *conn)
+{
+	if (!conn->hup || conn->in_flight_pkts)
+		return;
+
+	conn->hup = false;
+	ixev_nvme_unregister_flow(conn->nvme_fg_handle);
+	ixev_close(&conn->ctx);
+}
+
+static void lz_commit_write(struct lz_tenant *lz, struct nvme_req *req);
+
 static void nvme_written_cb(struct ixev_nvme_req_ctx *ctx, unsigned int reason) 
 {
 	struct nvme_req *req = container_of(ctx, struct nvme_req, ctx);
 	struct pp_conn *conn = req->conn;
 	
+	if (req->lz)
+		lz_commit_write(conn->lz, req);
+
 	conn->list_len++;
 	conn->in_flight_pkts--;
 	conn->sent_pkts++;
 	list_add_tail(&conn->pending_requests, &req->link);
 	send_pending_reqs(conn);
+	pp_close_idle(conn);
 	return;
 }
 
@@ -242,26 +641,299 @@ static void nvme_response_cb(struct ixev_nvme_req_ctx *ctx, unsigned int reason)
 	conn->sent_pkts++;
 	list_add_tail(&conn->pending_requests, &req->link);
 	send_pending_reqs(conn);
+	pp_close_idle(conn);
 	return;
 }
 
+static pthread_once_t tenant_regions_once = PTHREAD_ONCE_INIT;
+
+/*
+ * Enables the compressed and key-value tenants whose log region fits in the
+ * namespace. The others are disabled, and connections to their ports are
+ * refused, so the server still starts on smaller devices.
+ */
+static void tenant_regions_init(void)
+{
+	int i;
+
+	for (i = 0; i < sizeof(lz_tenants) / sizeof(lz_tenants[0]); i++) {
+		if ((lz_tenants[i].log_start + lz_tenants[i].log_sectors) * LZ_SECTOR_SIZE > ns_size) {
+			printf("WARNING: log region of compressed tenant on port %d exceeds namespace, tenant disabled\n",
+			       lz_tenants[i].port);
+			continue;
+		}
+		lz_tenants[i].map = calloc(lz_tenants[i].logical_blocks, sizeof(unsigned long));
+		if (!lz_tenants[i].map) {
+			printf("WARNING: unable to allocate extent map of compressed tenant on port %d, tenant disabled\n",
+			       lz_tenants[i].port);
+			continue;
+		}
+		lz_tenants[i].enabled = true;
+	}
+	for (i = 0; i < NR_KV_TENANTS; i++) {
+		if ((kv_tenants[i].log_start + kv_tenants[i].log_sectors) * KV_SECTOR_SIZE > ns_size) {
+			printf("WARNING: log region of key-value tenant on port %d exceeds namespace, tenant disabled\n",
+			       kv_tenants[i].port);
+			continue;
+		}
+		kv_tenants[i].enabled = true;
+	}
+}
+
+/*
+ * Whether @port belongs to a compressed or key-value tenant that is not
+ * enabled, either because its log region does not fit or because the
+ * namespace is not open yet, or a key-value tenant this thread has not
+ * registered yet
+ */
+static bool tenant_port_disabled(unsigned short port)
+{
+	int i;
+
+	for (i = 0; i < sizeof(lz_tenants) / sizeof(lz_tenants[0]); i++) {
+		if (lz_tenants[i].port == port)
+			return !lz_tenants[i].enabled;
+	}
+	for (i = 0; i < NR_KV_TENANTS; i++) {
+		if (kv_tenants[i].port == port)
+			return !kv_tenants[i].enabled || !kv_cores[i].fg_handle;
+	}
+	return false;
+}
+
+static void kv_cores_init(void);
+
 static void nvme_opened_cb(hqu_t _handle, unsigned long _ns_size, unsigned long _ns_sector_size)
 {
 	ns_size = _ns_size;
 	ns_sector_size = _ns_sector_size;
 	if(ns_size){
 		handle = _handle;
+		pthread_once(&tenant_regions_once, tenant_regions_init);
+		kv_cores_init();
 	}
 }
 
+/*
+ * Compressed tenant I/O
+ */
+
+static struct lz_tenant *lz_tenant_lookup(unsigned short port)
+{
+	int i;
+
+	for (i = 0; i < sizeof(lz_tenants) / sizeof(lz_tenants[0]); i++) {
+		if (lz_tenants[i].port == port)
+			return &lz_tenants[i];
+	}
+	return NULL;
+}
+
+static void lz_commit_write(struct lz_tenant *lz, struct nvme_req *req)
+{
+	struct lz_state *lzs = req->lz;
+	unsigned long first = req->lba / LZ_SECTORS_PER_BLOCK;
+	unsigned long byte = lzs->phys_lba * LZ_SECTOR_SIZE;
+	int i;
+
+	for (i = 0; i < lzs->nr_blocks; i++) {
+		lz->map[first + i] = LZ_ENTRY(byte, (unsigned long) lzs->len[i]);
+		byte += lzs->len[i];
+	}
+
+	mempool_free(&lz_state_pool, lzs);
+	req->lz = NULL;
+}
+
+/*
+ * Compresses the received blocks in place: block i is compressed into the
+ * scratch buffer before it is copied out, and the output never runs ahead
+ * of the input because each block shrinks to at most REFLEX_LZ4_RAW bytes.
+ */
+static int lz_write(struct pp_conn *conn, struct nvme_req *req)
+{
+	struct lz_tenant *lz = conn->lz;
+	struct lz_state *lzs = req->lz;
+	unsigned long out = 0, sectors, head;
+	int i, clen, nbufs;
+
+	for (i = 0; i < lzs->nr_blocks; i++) {
+		clen = reflex_lz4_compress(req->buf[i], REFLEX_LZ4_BLOCK,
+					   lz_scratch, REFLEX_LZ4_BLOCK - 1);
+		if (clen < 0) {
+			memcpy(lz_scratch, req->buf[i], REFLEX_LZ4_BLOCK);
+			clen = REFLEX_LZ4_RAW;
+		}
+		bufs_write(req->buf, out, lz_scratch, clen);
+		lzs->len[i] = clen;
+		out += clen;
+	}
+
+	sectors = (out + LZ_SECTOR_SIZE - 1) / LZ_SECTOR_SIZE;
+	bufs_write(req->buf, out, NULL, sectors * LZ_SECTOR_SIZE - out);
+
+	//threads share the log, reserve its space without overrunning the region
+	do {
+		head = *(volatile unsigned long *) &lz->log_head;
+		if (head + sectors > lz->log_sectors) {
+			if (!lz->log_full) {
+				lz->log_full = true;
+				printf("WARNING: log region of compressed tenant on port %d is full\n",
+				       lz->port);
+			}
+			return -ENOSPC;
+		}
+	} while (!__sync_bool_compare_and_swap(&lz->log_head, head, head + sectors));
+	lzs->phys_lba = lz->log_start + head;
+
+	nbufs = (sectors * LZ_SECTOR_SIZE + PAGE_SIZE - 1) / PAGE_SIZE;
+	ixev_set_nvme_handler(&req->ctx, IXEV_NVME_WR, &nvme_written_cb);
+	ixev_nvme_writev(conn->nvme_fg_handle, (void **)&req->buf[0], nbufs,
+			 lzs->phys_lba, sectors, (unsigned long)&req->ctx);
+	return 0;
+}
+
+static void lz_read_cb(struct ixev_nvme_req_ctx *ctx, unsigned int reason)
+{
+	struct lz_run *run = container_of(ctx, struct lz_run, ctx);
+	struct nvme_req *req = run->req;
+
+	if (--req->lz->runs_pending == 0)
+		nvme_response_cb(&req->ctx, reason);
+}
+
+/*
+ * Issues one NVMe read per physically contiguous run of compressed blocks.
+ * Blocks written by the same request are adjacent in the log, so reads that
+ * mirror the write pattern need a single command.
+ */
+static int lz_read(struct pp_conn *conn, struct nvme_req *req)
+{
+	struct lz_state *lzs = req->lz;
+	unsigned long first = req->lba / LZ_SECTORS_PER_BLOCK;
+	struct lz_run *run = NULL;
+	unsigned long e, byte;
+	unsigned int len, sectors;
+	int i, j, nbufs;
+
+	lzs->payload_len = lzs->nr_blocks * sizeof(uint16_t);
+	for (i = 0; i < lzs->nr_blocks; i++) {
+		e = ((volatile unsigned long *) conn->lz->map)[first + i];
+		len = LZ_ENTRY_LEN(e);
+		lzs->len[i] = len;
+		lzs->payload_len += len;
+		if (!len)
+			continue;
+
+		byte = LZ_ENTRY_BYTE(e);
+		if (run && run->byte + run->len == byte) {
+			run->len += len;
+			continue;
+		}
+		run = &lzs->run[lzs->nr_runs++];
+		run->req = req;
+		run->byte = byte;
+		run->len = len;
+		run->skip = byte % LZ_SECTOR_SIZE;
+	}
+
+	for (j = 0; j < lzs->nr_runs; j++) {
+		run = &lzs->run[j];
+		sectors = (run->skip + run->len + LZ_SECTOR_SIZE - 1) / LZ_SECTOR_SIZE;
+		nbufs = (sectors * LZ_SECTOR_SIZE + PAGE_SIZE - 1) / PAGE_SIZE;
+		run->first_buf = req->nr_bufs;
+		for (i = 0; i < nbufs; i++) {
+			req->buf[req->nr_bufs] = mempool_alloc(&nvme_req_buf_pool);
+			if (!req->buf[req->nr_bufs])
+				return -ENOMEM;
+			req->nr_bufs++;
+		}
+	}
+
+	lzs->runs_pending = lzs->nr_runs;
+	if (!lzs->nr_runs) {
+		//nothing on flash, reply with the length table only
+		nvme_response_cb(&req->ctx, IXEV_NVME_RD);
+		return 0;
+	}
+
+	for (j = 0; j < lzs->nr_runs; j++) {
+		run = &lzs->run[j];
+		sectors = (run->skip + run->len + LZ_SECTOR_SIZE - 1) / LZ_SECTOR_SIZE;
+		nbufs = (sectors * LZ_SECTOR_SIZE + PAGE_SIZE - 1) / PAGE_SIZE;
+
+		ixev_nvme_req_ctx_init(&run->ctx);
+		run->ctx.handle = handle;
+		ixev_set_nvme_handler(&run->ctx, IXEV_NVME_RD, &lz_read_cb);
+		ixev_nvme_readv(conn->nvme_fg_handle, (void **)&req->buf[run->first_buf], nbufs,
+				run->byte / LZ_SECTOR_SIZE, sectors, (unsigned long)&run->ctx);
+	}
+	return 0;
+}
+
+/* TRIM and WRITE_ZEROES: nothing is issued, the log is not garbage collected */
+static int lz_trim(struct pp_conn *conn, struct nvme_req *req)
+{
+	unsigned long first = req->lba / LZ_SECTORS_PER_BLOCK;
+	unsigned long i;
+
+	for (i = 0; i < req->lba_count / LZ_SECTORS_PER_BLOCK; i++)
+		((volatile unsigned long *) conn->lz->map)[first + i] = 0;
+
+	nvme_response_cb(&req->ctx, IXEV_NVME_WR);
+	return 0;
+}
+
+static int lz_submit(struct pp_conn *conn, struct nvme_req *req)
+{
+	struct lz_tenant *lz = conn->lz;
+	struct lz_state *lzs;
+	int nr_blocks = req->lba_count / LZ_SECTORS_PER_BLOCK;
+
+	if (req->opcode == CMD_FLUSH) {
+		ixev_set_nvme_handler(&req->ctx, IXEV_NVME_WR, &nvme_written_cb);
+		ixev_nvme_flush(conn->nvme_fg_handle, (unsigned long)&req->ctx);
+		return 0;
+	}
+
+	if ((req->lba % LZ_SECTORS_PER_BLOCK) || (req->lba_count % LZ_SECTORS_PER_BLOCK) ||
+	    nr_blocks == 0 || req->lba / LZ_SECTORS_PER_BLOCK + nr_blocks > lz->logical_blocks)
+		return -EINVAL;
+	if (req->opcode == CMD_TRIM || req->opcode == CMD_WRITE_ZEROES)
+		return lz_trim(conn, req);
+	if (nr_blocks > LZ_MAX_BLOCKS)
+		return -EINVAL;
+
+	lzs = mempool_alloc(&lz_state_pool);
+	if (!lzs)
+		return -ENOMEM;
+	req->lz = lzs;
+	lzs->nr_blocks = nr_blocks;
+	lzs->nr_runs = 0;
+	lzs->cur_run = 0;
+	lzs->run_sent = 0;
+
+	if (req->opcode == CMD_SET)
+		return lz_write(conn, req);
+	return lz_read(conn, req);
+}
+
 
 static void nvme_registered_flow_cb(long fg_handle, struct ixev_ctx* ctx, long ret)
 {
+	struct kv_core *core = (struct kv_core *) ctx;
+
 	if(ret < 0){
 		printf("ERROR: couldn't register flow\n");
 		//probably signifies you need a less strict SLO
 	}
 	
+	//a thread's own registration of a key-value tenant, see kv_cores_init()
+	if (core >= &kv_cores[0] && core < &kv_cores[NR_KV_TENANTS]) {
+		core->fg_handle = fg_handle;
+		return;
+	}
+
 	struct pp_conn *conn = container_of(ctx, struct pp_conn, ctx);
 	conn->nvme_fg_handle = fg_handle;
 }
@@ -316,6 +988,13 @@ static void receive_req(struct pp_conn *conn)
 				return;
 			}
 			conn->current_req->current_sgl_buf = 0;
+			conn->current_req->nr_bufs = 0;
+			conn->current_req->run_class = -1;
+			conn->current_req->lz = NULL;
+			conn->current_req->status = RESP_OK;
+			conn->current_req->timestamp = 0;
+			if (!conn->lz)
+				reqtrace_sample(conn->current_req);
 			//allocate lba_count sector sized nvme bufs
 			header = (BINARY_HEADER *)&conn->data_recv[0];
 			
@@ -323,6 +1002,14 @@ static void receive_req(struct pp_conn *conn)
 			num4k = (header->lba_count * ns_sector_size) / 4096;
 			if (((header->lba_count * ns_sector_size) % 4096) != 0)
 				num4k++;
+			//compressed reads size their buffers from the extent map
+			if (conn->lz && header->opcode == CMD_GET)
+				num4k = 0;
+			//TRIM, FLUSH and WRITE_ZEROES carry no data
+			if (header->opcode != CMD_GET && header->opcode != CMD_SET)
+				num4k = 0;
+			if (num4k > 1 && !conn->lz && nvme_req_alloc_run(conn->current_req, num4k))
+				num4k = 0;	//payload is one contiguous run
 			for (i = 0; i < num4k; i++) {
 				conn->current_req->buf[i] = mempool_alloc(&nvme_req_buf_pool);
 				if (!conn->current_req->buf[i]) {
@@ -330,6 +1017,7 @@ static void receive_req(struct pp_conn *conn)
 					       reqs_allocated, conn->in_flight_pkts, conn->sent_pkts, conn->list_len);
 					return;
 				}
+				conn->current_req->nr_bufs++;
 			}
  
 			ixev_nvme_req_ctx_init(&conn->current_req->ctx);
@@ -346,8 +1034,10 @@ static void receive_req(struct pp_conn *conn)
 		
 		if (header->opcode == CMD_SET) {
 			while (conn->rx_received < header->lba_count * ns_sector_size) {		
-				int to_receive = min(PAGE_SIZE - (conn->rx_received % PAGE_SIZE),
-						  (header->lba_count * ns_sector_size) - conn->rx_received);
+				int to_receive = (header->lba_count * ns_sector_size) - conn->rx_received;
+
+				if (req->run_class < 0)
+					to_receive = min(PAGE_SIZE - (conn->rx_received % PAGE_SIZE), to_receive);
 				
 				ret = ixev_recv(&conn->ctx,
 						&req->buf[req->current_sgl_buf][conn->rx_received % PAGE_SIZE],
@@ -365,14 +1055,15 @@ static void receive_req(struct pp_conn *conn)
 				}
 
 				conn->rx_received += ret;
-				if ((conn->rx_received % PAGE_SIZE) == 0)
-					req->current_sgl_buf++;
+				req->current_sgl_buf = conn->rx_received / PAGE_SIZE;
 			}
 			//4KB sgl bufs should match number of 512B sectors
 			assert(req->current_sgl_buf <= header->lba_count * 8);
 
 		}
 		else if (header->opcode == CMD_GET) {}
+		else if (header->opcode == CMD_TRIM || header->opcode == CMD_FLUSH ||
+			 header->opcode == CMD_WRITE_ZEROES) {}
 		else {
 			printf("Received unsupported command, closing connection\n");
 			ixev_close(&conn->ctx);
@@ -380,12 +1071,29 @@ static void receive_req(struct pp_conn *conn)
 		}
 
 		req->opcode = header->opcode;
+		req->lba = header->lba;
 		req->lba_count = header->lba_count;
 		req->remote_req_handle = header->req_handle;
 				
 		req->ctx.handle = handle;
 		req->conn = conn;
 
+		if (conn->lz) {
+			conn->in_flight_pkts++;
+			ret = lz_submit(conn, req);
+			conn->rx_received = 0;
+			conn->rx_pending = false;
+			if (ret) {
+				//nothing was issued, answer with an error right away
+				req->status = ret == -ENOSPC ? RESP_ENOSPC :
+					      ret == -ENOMEM ? RESP_ENOMEM : RESP_EINVAL;
+				nvme_response_cb(&req->ctx, 0);
+				continue;
+			}
+			conn->nvme_pending++;
+			continue;
+		}
+
 		nvme_addr = (void*)(header->lba << 9); 
 		assert((unsigned long)nvme_addr < ns_size); 
 		
@@ -394,32 +1102,573 @@ static void receive_req(struct pp_conn *conn)
 		if (((header->lba_count * ns_sector_size) % PAGE_SIZE) != 0)
 			num4k++;
 		
+		reqtrace(req, REQTRACE_RX, req->timestamp);
 		switch (header->opcode) {
 		case CMD_SET:
 			ixev_set_nvme_handler(&req->ctx, IXEV_NVME_WR, &nvme_written_cb);
-			//ixev_nvme_write(conn->nvme_fg_handle, req->buf[0], header->lba, header->lba_count, (unsigned long)&req->ctx);
-			ixev_nvme_writev(conn->nvme_fg_handle, (void**)&req->buf[0], num4k,
-					header->lba, header->lba_count, (unsigned long)&req->ctx);
+			if (req->run_class >= 0)
+				ixev_nvme_write(conn->nvme_fg_handle, req->buf[0], header->lba,
+						header->lba_count, (unsigned long)&req->ctx);
+			else
+				ixev_nvme_writev(conn->nvme_fg_handle, (void**)&req->buf[0], num4k,
+						header->lba, header->lba_count, (unsigned long)&req->ctx);
 			conn->nvme_pending++;	
 			break;
 		case CMD_GET:
 			ixev_set_nvme_handler(&req->ctx, IXEV_NVME_RD, &nvme_response_cb);
-			//ixev_nvme_read(conn->nvme_fg_handle, req->buf[0], header->lba, header->lba_count, (unsigned long)&req->ctx);
-			ixev_nvme_readv(conn->nvme_fg_handle, (void**)&req->buf[0], num4k,
-					header->lba, header->lba_count, (unsigned long)&req->ctx);
+			if (req->run_class >= 0)
+				ixev_nvme_read(conn->nvme_fg_handle, req->buf[0], header->lba,
+					       header->lba_count, (unsigned long)&req->ctx);
+			else
+				ixev_nvme_readv(conn->nvme_fg_handle, (void**)&req->buf[0], num4k,
+						header->lba, header->lba_count, (unsigned long)&req->ctx);
 			conn->nvme_pending++;	
 			break;
+		case CMD_TRIM:
+			ixev_set_nvme_handler(&req->ctx, IXEV_NVME_WR, &nvme_written_cb);
+			ixev_nvme_trim(conn->nvme_fg_handle, header->lba, header->lba_count,
+				       (unsigned long)&req->ctx);
+			conn->nvme_pending++;
+			break;
+		case CMD_FLUSH:
+			ixev_set_nvme_handler(&req->ctx, IXEV_NVME_WR, &nvme_written_cb);
+			ixev_nvme_flush(conn->nvme_fg_handle, (unsigned long)&req->ctx);
+			conn->nvme_pending++;
+			break;
+		case CMD_WRITE_ZEROES:
+			ixev_set_nvme_handler(&req->ctx, IXEV_NVME_WR, &nvme_written_cb);
+			ixev_nvme_write_zeroes(conn->nvme_fg_handle, header->lba, header->lba_count,
+					       (unsigned long)&req->ctx);
+			conn->nvme_pending++;
+			break;
 		default:
 			printf("Received illegal msg - dropping msg\n");
-			mempool_free(&nvme_req_buf_pool, req->buf);
-			mempool_free(&nvme_req_pool, req);
-			reqs_allocated--;
+			nvme_req_free(req);
 		}
 		conn->rx_received = 0;
 		conn->rx_pending = false;
 	}
 }
 
+/*
+ * Key-value tenant I/O
+ */
+
+static void kv_flush_timer_cb(void *arg);
+static void pp_register_flow(unsigned short port, unsigned long cookie, unsigned int flags);
+
+/*
+ * Sets up this thread's index and segments for each enabled key-value
+ * tenant and registers the tenant's flow for them. The registration cookie
+ * is the kv_core rather than a connection, see nvme_registered_flow_cb().
+ */
+static void kv_cores_init(void)
+{
+	struct kv_core *core;
+	int i;
+
+	for (i = 0; i < NR_KV_TENANTS; i++) {
+		if (!kv_tenants[i].enabled)
+			continue;
+
+		core = &kv_cores[i];
+		if (kv_index_init(&core->index, kv_tenants[i].nr_keys)) {
+			printf("ERROR: cannot allocate key-value index\n");
+			continue;
+		}
+		core->tenant = &kv_tenants[i];
+		core->fg_handle = 0;
+		core->open = NULL;
+		core->timer_armed = false;
+		list_head_init(&core->flushing);
+		ixev_timer_init(&core->flush_timer, &kv_flush_timer_cb, core);
+		//the segments of this thread are written on this registration
+		pp_register_flow(kv_tenants[i].port, (unsigned long) core, NVME_FLOW_PINNED);
+	}
+}
+
+static struct kv_core *kv_core_lookup(unsigned short port)
+{
+	int i;
+
+	for (i = 0; i < NR_KV_TENANTS; i++) {
+		if (kv_tenants[i].port == port)
+			return &kv_cores[i];
+	}
+	return NULL;
+}
+
+static void kv_inbox_push(int thread, struct nvme_req *req)
+{
+	struct kv_inbox *inbox = &kv_inboxes[thread];
+
+	spin_lock(&inbox->lock);
+	list_add_tail(&inbox->reqs, &req->link);
+	inbox->pending = true;
+	spin_unlock(&inbox->lock);
+}
+
+static void kv_complete(struct nvme_req *req, uint16_t status)
+{
+	req->status = status;
+	if (req->kv_origin != kv_thread) {
+		//the connection belongs to another thread, it sends the response
+		req->kv_done = true;
+		kv_inbox_push(req->kv_origin, req);
+		return;
+	}
+	nvme_response_cb(&req->ctx, IXEV_NVME_RD);
+}
+
+static struct kv_segment *kv_seg_alloc(struct kv_core *core)
+{
+	struct kv_segment *seg;
+	int i;
+
+	seg = mempool_alloc(&kv_seg_pool);
+	if (!seg)
+		return NULL;
+
+	for (i = 0; i < KV_SEG_PAGES; i++) {
+		seg->buf[i] = mempool_alloc(&nvme_req_buf_pool);
+		if (!seg->buf[i]) {
+			while (i--)
+				mempool_free(&nvme_req_buf_pool, seg->buf[i]);
+			mempool_free(&kv_seg_pool, seg);
+			return NULL;
+		}
+	}
+
+	seg->core = core;
+	seg->fill = 0;
+	list_head_init(&seg->waiters);
+	return seg;
+}
+
+static void kv_seg_free(struct kv_segment *seg)
+{
+	int i;
+
+	for (i = 0; i < KV_SEG_PAGES; i++)
+		mempool_free(&nvme_req_buf_pool, seg->buf[i]);
+	mempool_free(&kv_seg_pool, seg);
+}
+
+static void kv_seg_written_cb(struct ixev_nvme_req_ctx *ctx, unsigned int reason)
+{
+	struct kv_segment *seg = container_of(ctx, struct kv_segment, ctx);
+	struct nvme_req *req;
+
+	list_del(&seg->link);
+	while ((req = list_pop(&seg->waiters, struct nvme_req, link)))
+		kv_complete(req, RESP_OK);
+	kv_seg_free(seg);
+}
+
+/*
+ * Assigns the open segment its place in the log, repoints the index entries
+ * of its live records from the segment to the log and writes it out.
+ */
+static void kv_flush(struct kv_core *core)
+{
+	struct kv_segment *seg = core->open;
+	struct kv_tenant *t = core->tenant;
+	struct kv_record rec;
+	struct nvme_req *req;
+	unsigned long sectors, head;
+	uint64_t loc;
+	size_t pos, len;
+	int nbufs;
+
+	if (!seg)
+		return;
+	core->open = NULL;
+
+	sectors = (seg->fill + KV_SECTOR_SIZE - 1) / KV_SECTOR_SIZE;
+	head = __sync_fetch_and_add(&t->log_head, sectors);
+	if (head + sectors > t->log_sectors) {
+		printf("ERROR: log region of key-value tenant on port %d is full\n", t->port);
+		for (pos = 0; pos < seg->fill; pos += len) {
+			bufs_read(seg->buf, pos, &rec, sizeof(rec));
+			len = sizeof(rec) + rec.len;
+			loc = KV_LOC_PENDING | KV_LOC(pos, len);
+			if (kv_index_get(&core->index, rec.key) == loc)
+				kv_index_del(&core->index, rec.key);
+		}
+		while ((req = list_pop(&seg->waiters, struct nvme_req, link)))
+			kv_complete(req, RESP_ENOMEM);
+		kv_seg_free(seg);
+		return;
+	}
+	seg->byte = (t->log_start + head) * KV_SECTOR_SIZE;
+
+	for (pos = 0; pos < seg->fill; pos += len) {
+		bufs_read(seg->buf, pos, &rec, sizeof(rec));
+		len = sizeof(rec) + rec.len;
+		loc = KV_LOC_PENDING | KV_LOC(pos, len);
+		if (kv_index_get(&core->index, rec.key) == loc)
+			kv_index_put(&core->index, rec.key, KV_LOC(seg->byte + pos, len));
+	}
+	bufs_write(seg->buf, seg->fill, NULL, sectors * KV_SECTOR_SIZE - seg->fill);
+
+	list_add_tail(&core->flushing, &seg->link);
+	nbufs = (sectors * KV_SECTOR_SIZE + PAGE_SIZE - 1) / PAGE_SIZE;
+	ixev_nvme_req_ctx_init(&seg->ctx);
+	seg->ctx.handle = handle;
+	ixev_set_nvme_handler(&seg->ctx, IXEV_NVME_WR, &kv_seg_written_cb);
+	ixev_nvme_writev(core->fg_handle, (void **)&seg->buf[0], nbufs,
+			 seg->byte / KV_SECTOR_SIZE, sectors, (unsigned long)&seg->ctx);
+}
+
+static void kv_flush_timer_cb(void *arg)
+{
+	struct kv_core *core = arg;
+
+	core->timer_armed = false;
+	kv_flush(core);
+}
+
+static int kv_put(struct kv_core *core, struct nvme_req *req)
+{
+	struct kv_segment *seg;
+	struct kv_record rec;
+	size_t rec_len = sizeof(rec) + req->val_len;
+	size_t pos;
+	struct timeval tv = {
+		.tv_sec = 0,
+		.tv_usec = KV_FLUSH_US,
+	};
+
+	if (core->open && core->open->fill + rec_len > KV_SEG_SIZE)
+		kv_flush(core);
+	if (!core->open) {
+		core->open = kv_seg_alloc(core);
+		if (!core->open)
+			return -ENOMEM;
+	}
+	seg = core->open;
+
+	if (kv_index_put(&core->index, req->key, KV_LOC_PENDING | KV_LOC(seg->fill, rec_len)))
+		return -ENOMEM;
+
+	rec.key = req->key;
+	rec.len = req->val_len;
+	rec.magic = KV_RECORD_MAGIC;
+	bufs_write(seg->buf, seg->fill, &rec, sizeof(rec));
+	for (pos = 0; pos < req->val_len; pos += PAGE_SIZE)
+		bufs_write(seg->buf, seg->fill + sizeof(rec) + pos, req->buf[pos / PAGE_SIZE],
+			   min((size_t) PAGE_SIZE, req->val_len - pos));
+	seg->fill += rec_len;
+	list_add_tail(&seg->waiters, &req->link);
+
+	if (seg->fill + sizeof(rec) >= KV_SEG_SIZE) {
+		kv_flush(core);
+	} else if (!core->timer_armed) {
+		core->timer_armed = true;
+		ixev_timer_add(&core->flush_timer, tv);
+	}
+	return 0;
+}
+
+static void kv_read_cb(struct ixev_nvme_req_ctx *ctx, unsigned int reason)
+{
+	struct nvme_req *req = container_of(ctx, struct nvme_req, ctx);
+	struct kv_record rec;
+
+	bufs_read(req->buf, req->val_off - sizeof(rec), &rec, sizeof(rec));
+	if (rec.magic != KV_RECORD_MAGIC || rec.key != req->key || rec.len != req->val_len) {
+		printf("ERROR: corrupt key-value record for key %lx\n", req->key);
+		kv_complete(req, RESP_EINVAL);
+		return;
+	}
+	kv_complete(req, RESP_OK);
+}
+
+static int kv_get(struct kv_core *core, struct nvme_req *req)
+{
+	struct kv_segment *seg = NULL, *s;
+	unsigned long byte, sectors, skip;
+	unsigned int len;
+	uint64_t loc;
+	int nbufs;
+
+	loc = kv_index_get(&core->index, req->key);
+	if (!loc) {
+		req->val_len = 0;
+		kv_complete(req, RESP_ENOENT);
+		return 0;
+	}
+	byte = KV_LOC_BYTE(loc);
+	len = KV_LOC_LEN(loc);
+	req->val_len = len - sizeof(struct kv_record);
+
+	if (loc & KV_LOC_PENDING) {
+		seg = core->open;
+	} else {
+		list_for_each(&core->flushing, s, link) {
+			if (byte >= s->byte && byte < s->byte + s->fill) {
+				seg = s;
+				byte -= s->byte;
+				break;
+			}
+		}
+	}
+
+	if (seg) {
+		skip = 0;
+		sectors = 0;
+		nbufs = (req->val_len + PAGE_SIZE - 1) / PAGE_SIZE;
+	} else {
+		skip = byte % KV_SECTOR_SIZE;
+		sectors = (skip + len + KV_SECTOR_SIZE - 1) / KV_SECTOR_SIZE;
+		nbufs = (sectors * KV_SECTOR_SIZE + PAGE_SIZE - 1) / PAGE_SIZE;
+	}
+	while (req->nr_bufs < nbufs) {
+		req->buf[req->nr_bufs] = mempool_alloc(&nvme_req_buf_pool);
+		if (!req->buf[req->nr_bufs])
+			return -ENOMEM;
+		req->nr_bufs++;
+	}
+
+	if (seg) {
+		req->val_off = 0;
+		for (skip = 0; skip < req->val_len; skip += PAGE_SIZE)
+			bufs_read(seg->buf, byte + sizeof(struct kv_record) + skip,
+				  req->buf[skip / PAGE_SIZE],
+				  min((size_t) PAGE_SIZE, req->val_len - skip));
+		kv_complete(req, RESP_OK);
+		return 0;
+	}
+
+	req->val_off = skip + sizeof(struct kv_record);
+	ixev_set_nvme_handler(&req->ctx, IXEV_NVME_RD, &kv_read_cb);
+	ixev_nvme_readv(core->fg_handle, (void **)&req->buf[0], nbufs,
+			byte / KV_SECTOR_SIZE, sectors, (unsigned long)&req->ctx);
+	return 0;
+}
+
+/*
+ * Serves a request for a key this thread owns. Buffers a GET allocates here
+ * are freed by the thread that received it, into a pool of the same
+ * datastore.
+ */
+static void kv_serve(struct nvme_req *req)
+{
+	struct kv_core *core = &kv_cores[req->kv_tenant];
+	int ret;
+
+	if (!core->tenant) {
+		kv_complete(req, RESP_ENOMEM);
+		return;
+	}
+	if (!core->fg_handle) {
+		//not registered yet, retry on the next pass
+		kv_inbox_push(kv_thread, req);
+		return;
+	}
+
+	req->ctx.handle = handle;
+	if (req->opcode == PUT)
+		ret = kv_put(core, req);
+	else
+		ret = kv_get(core, req);
+	if (ret)
+		kv_complete(req, RESP_ENOMEM);
+}
+
+static void kv_dispatch(struct nvme_req *req)
+{
+	int owner = kv_key_owner(req->key, kv_nr_threads);
+
+	if (owner == kv_thread)
+		kv_serve(req);
+	else
+		kv_inbox_push(owner, req);
+}
+
+/* serves the requests handed to this thread and sends the responses handed back */
+static void kv_inbox_poll(void)
+{
+	struct kv_inbox *inbox = &kv_inboxes[kv_thread];
+	struct list_head reqs;
+	struct nvme_req *req;
+
+	if (!inbox->pending)
+		return;
+
+	list_head_init(&reqs);
+	spin_lock(&inbox->lock);
+	list_append_list(&reqs, &inbox->reqs);
+	inbox->pending = false;
+	spin_unlock(&inbox->lock);
+
+	while ((req = list_pop(&reqs, struct nvme_req, link))) {
+		if (req->kv_done)
+			nvme_response_cb(&req->ctx, IXEV_NVME_RD);
+		else
+			kv_serve(req);
+	}
+}
+
+/*
+ * returns 0 if send was successfull and -1 if tx path is busy
+ */
+static int kv_send_req(struct nvme_req *req)
+{
+	struct pp_conn *conn = req->conn;
+	bool has_value = req->opcode == GET && req->status == RESP_OK;
+	KV_HEADER *header;
+	size_t pos, to_send;
+	ssize_t ret;
+
+	if (!conn->tx_pending) {
+		header = (KV_HEADER *)&conn->kv_send[0];
+		header->magic = sizeof(KV_HEADER);
+		header->opcode = req->opcode == PUT ? PUT_ACK : GET_RESP;
+		header->req_handle = req->remote_req_handle;
+		header->key = req->key;
+		header->val_len = has_value ? req->val_len : 0;
+		header->status = req->status;
+
+		while (conn->tx_sent < sizeof(KV_HEADER)) {
+			ret = ixev_send(&conn->ctx, &conn->kv_send[conn->tx_sent],
+					sizeof(KV_HEADER) - conn->tx_sent);
+			if (ret == -EAGAIN)
+				return -1;
+			if (ret < 0) {
+				if(!conn->nvme_pending)
+					ixev_close(&conn->ctx);
+				return -2;
+			}
+			conn->tx_sent += ret;
+		}
+		conn->tx_pending = true;
+		conn->tx_sent = 0;
+	}
+
+	if (has_value) {
+		while (conn->tx_sent < req->val_len) {
+			pos = req->val_off + conn->tx_sent;
+			to_send = min((size_t) PAGE_SIZE - (pos % PAGE_SIZE),
+				      req->val_len - conn->tx_sent);
+			ret = ixev_send_zc(&conn->ctx, &req->buf[pos / PAGE_SIZE][pos % PAGE_SIZE],
+					   to_send);
+			if (ret < 0) {
+				if (ret == -EAGAIN)
+					return -1;
+				if(!conn->nvme_pending)
+					ixev_close(&conn->ctx);
+				return -2;
+			}
+			conn->tx_sent += ret;
+		}
+		req->ref.cb = &send_completed_cb;
+		ixev_add_sent_cb(&conn->ctx, &req->ref);
+	} else {
+		nvme_req_free(req);
+		conn->sent_pkts--;
+	}
+	conn->list_len--;
+	conn->tx_sent = 0;
+	conn->tx_pending = false;
+	return 0;
+}
+
+static void kv_receive_req(struct pp_conn *conn)
+{
+	KV_HEADER *header = (KV_HEADER *)&conn->kv_recv[0];
+	struct nvme_req *req;
+	size_t to_receive;
+	ssize_t ret;
+	int nbufs;
+
+	while (1) {
+		if (!conn->rx_pending) {
+			ret = ixev_recv(&conn->ctx, &conn->kv_recv[conn->rx_received],
+					sizeof(KV_HEADER) - conn->rx_received);
+			if (ret <= 0) {
+				if (ret != -EAGAIN && !conn->nvme_pending)
+					ixev_close(&conn->ctx);
+				return;
+			}
+			conn->rx_received += ret;
+			if (conn->rx_received < sizeof(KV_HEADER))
+				return;
+
+			if (header->magic != sizeof(KV_HEADER) ||
+			    (header->opcode != PUT && header->opcode != GET) ||
+			    (header->opcode == PUT && header->val_len > KV_MAX_VALUE)) {
+				printf("Received invalid key-value request, closing connection\n");
+				ixev_close(&conn->ctx);
+				return;
+			}
+
+			req = mempool_alloc(&nvme_req_pool);
+			if (!req) {
+				printf("Cannot allocate nvme_usr req. In flight requests: %lu sent req %lu . list len %lu \n", conn->in_flight_pkts, conn->sent_pkts, conn->list_len);
+				return;
+			}
+			req->nr_bufs = 0;
+			req->run_class = -1;
+			req->current_sgl_buf = 0;
+			req->lz = NULL;
+			req->timestamp = 0;
+			conn->current_req = req;
+
+			nbufs = 0;
+			if (header->opcode == PUT)
+				nbufs = (header->val_len + PAGE_SIZE - 1) / PAGE_SIZE;
+			while (req->nr_bufs < nbufs) {
+				req->buf[req->nr_bufs] = mempool_alloc(&nvme_req_buf_pool);
+				if (!req->buf[req->nr_bufs]) {
+					printf("Cannot allocate nvme_usr req buf. Req allocated: %lx. In flight requests: %lu sent req %lu . list len %lu \n",
+					       reqs_allocated, conn->in_flight_pkts, conn->sent_pkts, conn->list_len);
+					return;
+				}
+				req->nr_bufs++;
+			}
+
+			ixev_nvme_req_ctx_init(&req->ctx);
+			reqs_allocated++;
+			conn->rx_pending = true;
+			conn->rx_received = 0;
+		}
+
+		req = conn->current_req;
+		if (header->opcode == PUT) {
+			while (conn->rx_received < header->val_len) {
+				to_receive = min((size_t) PAGE_SIZE - (conn->rx_received % PAGE_SIZE),
+						 header->val_len - conn->rx_received);
+				ret = ixev_recv(&conn->ctx,
+						&req->buf[conn->rx_received / PAGE_SIZE][conn->rx_received % PAGE_SIZE],
+						to_receive);
+				if (ret <= 0) {
+					if (ret != -EAGAIN && !conn->nvme_pending)
+						ixev_close(&conn->ctx);
+					return;
+				}
+				conn->rx_received += ret;
+			}
+		}
+
+		req->opcode = header->opcode;
+		req->key = header->key;
+		req->val_len = header->val_len;
+		req->remote_req_handle = header->req_handle;
+		req->ctx.handle = handle;
+		req->conn = conn;
+		conn->rx_received = 0;
+		conn->rx_pending = false;
+
+		conn->in_flight_pkts++;
+		conn->nvme_pending++;
+		req->kv_tenant = conn->kv - kv_cores;
+		req->kv_origin = kv_thread;
+		req->kv_done = false;
+		kv_dispatch(req);
+	}
+}
+
 static void pp_main_handler(struct ixev_ctx *ctx, unsigned int reason)
 {
 	struct pp_conn *conn = container_of(ctx, struct pp_conn, ctx);
@@ -429,21 +1678,49 @@ static void pp_main_handler(struct ixev_ctx *ctx, unsigned int reason)
 		send_pending_reqs(conn);
 	}
 	if(reason==IXEVHUP) {
-		ixev_nvme_unregister_flow(conn->nvme_fg_handle);
-		ixev_close(&conn->ctx);
+		conn->hup = true;
+		pp_close_idle(conn);
 		return;
 	}
-	receive_req(conn);
+	if (conn->kv)
+		kv_receive_req(conn);
+	else
+		receive_req(conn);
 }
 
-static struct ixev_ctx *pp_accept(struct ip_tuple *id)
+/* registers the flow of the tenant on @port, best-effort if it has no SLO policy */
+static void pp_register_flow(unsigned short port, unsigned long cookie, unsigned int flags)
 {
-	unsigned long cookie;
 	unsigned int latency_us_SLO = 0;
 	unsigned long IOPS_SLO = 0;
 	int rd_wr_ratio_SLO = 50;
-	
-	struct pp_conn *conn = mempool_alloc(&pp_conn_pool);
+	unsigned int be_weight = 1;
+	const struct reflex_slo_policy *slo;
+
+	slo = reflex_slo_lookup(port);
+	if (slo) {
+		latency_us_SLO = slo->latency_us_SLO;
+		IOPS_SLO = slo->IOPS_SLO;
+		rd_wr_ratio_SLO = slo->rd_wr_ratio_SLO;
+		be_weight = slo->be_weight;
+	} else {
+		printf("WARNING: unrecognized SLO policy, default is best-effort\n");
+	}
+	ixev_nvme_register_flow(port, cookie, latency_us_SLO, IOPS_SLO, rd_wr_ratio_SLO,
+				be_weight, flags);
+}
+
+static struct ixev_ctx *pp_accept(struct ip_tuple *id)
+{
+	unsigned long cookie;
+	struct pp_conn *conn;
+
+	if (tenant_port_disabled(id->dst_port)) {
+		printf("WARNING: tenant on port %d is disabled, refusing connection\n", id->dst_port);
+		return NULL;
+	}
+
+	conn = mempool_alloc(&pp_conn_pool);
 	if (!conn) {
 		printf("MEMPOOL ALLOC FAILED !\n");
 		return NULL;
@@ -453,6 +1730,7 @@ static struct ixev_ctx *pp_accept(struct ip_tuple *id)
 	conn->rx_pending = false;
 	conn->tx_sent = 0;
 	conn->tx_pending = false;
+	conn->hup = false;
 	conn->in_flight_pkts = 0x0UL;
 	conn->sent_pkts = 0x0UL;
 	conn->list_len = 0x0UL;
@@ -462,53 +1740,12 @@ static struct ixev_ctx *pp_accept(struct ip_tuple *id)
 	conn_opened++;
 
 	conn->nvme_fg_handle = 0; //set to this for now
+	conn->lz = lz_tenant_lookup(id->dst_port);
+	conn->kv = kv_core_lookup(id->dst_port);
 	cookie = (unsigned long) &conn->ctx;
 
-	/****************************************/
-	/* LATENCY SLO POLICIES FOR FLOW GROUPS */
-	switch (id->dst_port) {
-
-	case 1234:
-		latency_us_SLO = 0; //best-effort
-		IOPS_SLO = 0;
-		rd_wr_ratio_SLO = 100;
-		break; 
-	case 1235:
-		latency_us_SLO = 0; //best-effort
-		IOPS_SLO = 0;
-		rd_wr_ratio_SLO = 100;
-		break;
-	case 1236:
-		latency_us_SLO = 0; //best-effort
-		IOPS_SLO = 0;
-		rd_wr_ratio_SLO = 100;
-		break;
-	case 1237:
-		latency_us_SLO = 0; //best-effort
-		IOPS_SLO = 0;
-		rd_wr_ratio_SLO = 100;
-		break;
-	case 5678: 
-		latency_us_SLO = 1000; //latency-critical
-		IOPS_SLO = 120000;
-		rd_wr_ratio_SLO = 100;
-		break;
-	case 5679: 
-		latency_us_SLO = 1000; //latency-critical
-		IOPS_SLO = 70000;
-		rd_wr_ratio_SLO = 80;
-		break;
-
-	default:
-		printf("WARNING: unrecognized SLO policy, default is best-effort\n");
-		break;
-	}
-	/*
-	 * FIXME: add support for dynamic SLO registration by client
-	 * Current hack: associate a port with an SLO (defined in case statement above)
-	 * Client communicates with server using dst_port that corresponds to its SLO
-	 */
-	ixev_nvme_register_flow(id->dst_port, cookie, latency_us_SLO, IOPS_SLO, rd_wr_ratio_SLO);
+	//key-value state is per thread, the tenant must not move to another core
+	pp_register_flow(id->dst_port, cookie, conn->kv ? NVME_FLOW_PINNED : 0);
 	return &conn->ctx;
 }
 
@@ -527,8 +1764,9 @@ static struct ixev_conn_ops pp_conn_ops = {
 
 static void *pp_main(void *arg)
 {
-	int ret;
+	int i, ret;
 	conn_opened = 0;
+	kv_thread = __sync_fetch_and_add(&kv_next_thread, 1);
 	
 	ret = ixev_init_thread();
 	if (ret) {
@@ -548,15 +1786,38 @@ static void *pp_main(void *arg)
 		return NULL;
 	}
 
+	for (i = 0; i < NR_BUF_RUN_CLASSES; i++) {
+		if (!buf_run_enabled[i])
+			continue;
+		ret = mempool_create(&buf_run_pool[i], &buf_run_datastore[i]);
+		if (ret) {
+			fprintf(stderr, "unable to create mempool\n");
+			return NULL;
+		}
+	}
+
 	ret = mempool_create(&pp_conn_pool, &pp_conn_datastore);
 	if (ret) {
 		fprintf(stderr, "unable to create mempool\n");
 		return NULL;
 	}
 
+	ret = mempool_create(&lz_state_pool, &lz_state_datastore);
+	if (ret) {
+		fprintf(stderr, "unable to create mempool\n");
+		return NULL;
+	}
+
+	ret = mempool_create(&kv_seg_pool, &kv_seg_datastore);
+	if (ret) {
+		fprintf(stderr, "unable to create mempool\n");
+		return NULL;
+	}
+
 	ixev_nvme_open(NAMESPACE, 1);
 	while (1) {
 		ixev_wait();
+		kv_inbox_poll();
 	}
 
 	return NULL;
@@ -564,11 +1825,23 @@ static void *pp_main(void *arg)
 
 int main(int argc, char *argv[])
 {
-	int i, nr_cpu;
+	int i, nr_cpu, nr_elems;
 	pthread_t tid;
-	int ret;
+	int ret, opt;
 	unsigned int pp_conn_pool_entries;
 
+	while ((opt = getopt(argc, argv, "b:")) != -1) {
+		switch (opt) {
+		case 'b':
+			buf_run_mb = atoi(optarg);
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-b MB of 2MB pages for multi-page payloads, default %d]\n",
+				argv[0], BUF_RUN_MB_DEFAULT);
+			exit(-1);
+		}
+	}
+
 	nr_cpu = sys_nrcpus();
 	if (nr_cpu < 1) {
 		fprintf(stderr, "got invalid cpu count %d\n", nr_cpu);
@@ -576,6 +1849,18 @@ int main(int argc, char *argv[])
 	}
 
 	nr_cpu--; /* don't count the main thread */
+
+	kv_nr_threads = nr_cpu + 1;
+	kv_inboxes = aligned_alloc(sizeof(struct kv_inbox), kv_nr_threads * sizeof(struct kv_inbox));
+	if (!kv_inboxes) {
+		fprintf(stderr, "unable to allocate key-value inboxes\n");
+		return -ENOMEM;
+	}
+	for (i = 0; i < kv_nr_threads; i++) {
+		spin_lock_init(&kv_inboxes[i].lock);
+		list_head_init(&kv_inboxes[i].reqs);
+		kv_inboxes[i].pending = false;
+	}
 		
 	ret = mempool_create_datastore(&nvme_req_datastore, 
 				       outstanding_reqs,
@@ -593,7 +1878,39 @@ int main(int argc, char *argv[])
 		fprintf(stderr, "unable to create datastore\n");
 		return ret;
 	}
+	for (i = 0; i < NR_BUF_RUN_CLASSES; i++) {
+		nr_elems = ((unsigned long) buf_run_mb << 20) / NR_BUF_RUN_CLASSES /
+			   buf_run_classes[i].size;
+		nr_elems -= nr_elems % buf_run_classes[i].chunk_size;
+		if (!nr_elems)
+			continue;
+		ret = mempool_create_datastore(&buf_run_datastore[i], nr_elems,
+					       buf_run_classes[i].size, true,
+					       buf_run_classes[i].chunk_size, "nvme_buf_run");
+		if (ret) {
+			fprintf(stderr, "WARNING: unable to create %zuKB run datastore, using 4KB buffers\n",
+				buf_run_classes[i].size / 1024);
+			continue;
+		}
+		buf_run_enabled[i] = true;
+	}
 
+	ret = mempool_create_datastore(&lz_state_datastore,
+				       LZ_OUTSTANDING,
+				       sizeof(struct lz_state), false,
+				       MEMPOOL_DEFAULT_CHUNKSIZE, "lz_state");
+	if (ret) {
+		fprintf(stderr, "unable to create datastore\n");
+		return ret;
+	}
+	ret = mempool_create_datastore(&kv_seg_datastore,
+				       KV_OUTSTANDING_SEGS,
+				       sizeof(struct kv_segment), false,
+				       MEMPOOL_DEFAULT_CHUNKSIZE, "kv_seg");
+	if (ret) {
+		fprintf(stderr, "unable to create datastore\n");
+		return ret;
+	}
 	pp_conn_pool_entries = ROUND_UP(16 * 4096, MEMPOOL_DEFAULT_CHUNKSIZE);
 
 	ixev_init_conn_nvme(&pp_conn_ops, &nvme_ops);
@@ -0,0 +1,76 @@
+/*
+ * Copyright 2013-16 Board of Trustees of Stanford University
+ * Copyright 2013-16 Ecole Polytechnique Federale Lausanne (EPFL)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * reflex_tenants.h - per-port tenant SLO policies, shared by the IX server
+ * (reflex_server.c) and the Linux server (reflex_linux/)
+ */
+
+#pragma once
+
+/* the protocol a port speaks, see apps/reflex.h */
+enum reflex_proto {
+	REFLEX_PROTO_BLOCK = 0,
+	REFLEX_PROTO_LZ4,		// compressed block tenant, must be in lz_tenants (reflex_server.c)
+	REFLEX_PROTO_KV,		// key-value tenant, must be in kv_tenants (reflex_server.c)
+};
+
+struct reflex_slo_policy {
+	unsigned short port;
+	enum reflex_proto proto;
+	unsigned int latency_us_SLO;	// 0 for best-effort tenants
+	unsigned long IOPS_SLO;		// in 4KB IOPS
+	int rd_wr_ratio_SLO;		// percentage of reads
+	unsigned int be_weight;		// best-effort share relative to other BE tenants, 0 counts as 1
+};
+
+/****************************************/
+/* LATENCY SLO POLICIES FOR FLOW GROUPS */
+static const struct reflex_slo_policy reflex_slo_policies[] = {
+	{ .port = 1234, .latency_us_SLO = 0, .IOPS_SLO = 0, .rd_wr_ratio_SLO = 100 },		//best-effort
+	{ .port = 1235, .latency_us_SLO = 0, .IOPS_SLO = 0, .rd_wr_ratio_SLO = 100 },		//best-effort
+	{ .port = 1236, .latency_us_SLO = 0, .IOPS_SLO = 0, .rd_wr_ratio_SLO = 100 },		//best-effort
+	{ .port = 1237, .latency_us_SLO = 0, .IOPS_SLO = 0, .rd_wr_ratio_SLO = 100 },		//best-effort
+	{ .port = 5678, .latency_us_SLO = 1000, .IOPS_SLO = 120000, .rd_wr_ratio_SLO = 100 },	//latency-critical
+	{ .port = 5679, .latency_us_SLO = 1000, .IOPS_SLO = 70000, .rd_wr_ratio_SLO = 80 },	//latency-critical
+	{ .port = 1238, .proto = REFLEX_PROTO_LZ4, .latency_us_SLO = 0, .IOPS_SLO = 0, .rd_wr_ratio_SLO = 100 },	//best-effort, compressed
+	{ .port = 1239, .proto = REFLEX_PROTO_KV, .latency_us_SLO = 0, .IOPS_SLO = 0, .rd_wr_ratio_SLO = 50 },	//best-effort, key-value
+};
+
+#define NR_REFLEX_SLO_POLICIES (sizeof(reflex_slo_policies) / sizeof(reflex_slo_policies[0]))
+
+/*
+ * FIXME: add support for dynamic SLO registration by client
+ * Current hack: associate a port with an SLO (defined in the table above)
+ * Client communicates with server using dst_port that corresponds to its SLO
+ */
+static inline const struct reflex_slo_policy *reflex_slo_lookup(unsigned short port)
+{
+	unsigned int i;
+
+	for (i = 0; i < NR_REFLEX_SLO_POLICIES; i++) {
+		if (reflex_slo_policies[i].port == port)
+			return &reflex_slo_policies[i];
+	}
+	return NULL;
+}
@@ -0,0 +1,332 @@
+/*
+ * Copyright 2013-16 Board of Trustees of Stanford University
+ * Copyright 2013-16 Ecole Polytechnique Federale Lausanne (EPFL)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * timeseries.c - per-interval statistics of the IX load generator
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "timeseries.h"
+
+unsigned long ts_interval_cycles;
+unsigned long ts_start;
+
+static FILE *ts_file;
+static bool ts_csv;
+static unsigned int ts_interval_ms;
+static int ts_cycles_per_us;
+static int ts_nr_threads;
+static unsigned int ts_precision;
+static struct ts_thread **ts_threads;
+static struct ts_sample *ts_ports;	/* per-port sums, indexed like ts_threads */
+static struct ts_sample ts_empty;
+static pthread_t ts_flusher;
+
+static int ts_sample_init(struct ts_sample *s)
+{
+	memset(s, 0, sizeof(*s));
+	return histogram_init(&s->hist, ts_precision);
+}
+
+static void ts_sample_add(struct ts_sample *dst, const struct ts_sample *src)
+{
+	dst->reads += src->reads;
+	dst->writes += src->writes;
+	dst->read_bytes += src->read_bytes;
+	dst->write_bytes += src->write_bytes;
+	histogram_merge(&dst->hist, &src->hist);
+}
+
+static void ts_sample_reset(struct ts_sample *s)
+{
+	s->reads = s->writes = 0;
+	s->read_bytes = s->write_bytes = 0;
+	histogram_reset(&s->hist);
+}
+
+static inline double ts_us(const struct histogram *h, double percentile)
+{
+	return (double) histogram_percentile(h, percentile) / ts_cycles_per_us;
+}
+
+static void ts_write_row(unsigned long interval, const char *scope, int id, int port,
+			 const struct ts_sample *s)
+{
+	double secs = ts_interval_ms / 1000.0;
+	double usecs = ts_interval_ms * 1000.0;
+	const struct histogram *h = &s->hist;
+	double avg = 0, p50 = 0, p90 = 0, p99 = 0, p999 = 0, max = 0;
+
+	if (h->count) {
+		avg = (double) h->total / h->count / ts_cycles_per_us;
+		p50 = ts_us(h, 50);
+		p90 = ts_us(h, 90);
+		p99 = ts_us(h, 99);
+		p999 = ts_us(h, 99.9);
+		max = (double) h->max / ts_cycles_per_us;
+	}
+
+	if (ts_csv)
+		fprintf(ts_file, "%lu,%s,%d,%d,%.0f,%.0f,%.2f,%.2f,%.1f,%.1f,%.1f,%.1f,%.1f,%.1f\n",
+			interval * ts_interval_ms, scope, id, port,
+			s->reads / secs, s->writes / secs,
+			s->read_bytes / usecs, s->write_bytes / usecs,
+			avg, p50, p90, p99, p999, max);
+	else
+		fprintf(ts_file, "{\"time_ms\":%lu,\"scope\":\"%s\",\"id\":%d,\"port\":%d,"
+			"\"read_iops\":%.0f,\"write_iops\":%.0f,\"read_mbps\":%.2f,\"write_mbps\":%.2f,"
+			"\"avg_us\":%.1f,\"p50_us\":%.1f,\"p90_us\":%.1f,\"p99_us\":%.1f,"
+			"\"p999_us\":%.1f,\"max_us\":%.1f}\n",
+			interval * ts_interval_ms, scope, id, port,
+			s->reads / secs, s->writes / secs,
+			s->read_bytes / usecs, s->write_bytes / usecs,
+			avg, p50, p90, p99, p999, max);
+}
+
+/* returns the index of the first thread connected to the same port as @i */
+static int ts_port_slot(int i)
+{
+	int j;
+
+	for (j = 0; j < i; j++)
+		if (ts_threads[j]->port == ts_threads[i]->port)
+			return j;
+	return i;
+}
+
+static void ts_write_interval(unsigned long interval)
+{
+	struct ts_thread *t;
+	struct ts_sample *s;
+	bool active[ts_nr_threads];
+	unsigned long tail;
+	int i, slot;
+
+	memset(active, 0, sizeof(active));
+
+	for (i = 0; i < ts_nr_threads; i++) {
+		t = ts_threads[i];
+		tail = t->tail;
+		s = NULL;
+		if (tail != __atomic_load_n(&t->head, __ATOMIC_ACQUIRE) &&
+		    t->ring[tail % TS_RING_SLOTS].interval == interval)
+			s = &t->ring[tail % TS_RING_SLOTS];
+
+		/* threads that finished do not report idle intervals */
+		if (!s && __atomic_load_n(&t->done, __ATOMIC_ACQUIRE))
+			continue;
+
+		ts_write_row(interval, "thread", t->tid, t->port, s ? s : &ts_empty);
+
+		slot = ts_port_slot(i);
+		active[slot] = true;
+		if (s) {
+			ts_sample_add(&ts_ports[slot], s);
+			ts_sample_reset(s);
+			__atomic_store_n(&t->tail, tail + 1, __ATOMIC_RELEASE);
+		}
+	}
+
+	for (i = 0; i < ts_nr_threads; i++) {
+		if (!active[i])
+			continue;
+		ts_write_row(interval, "port", ts_threads[i]->port, ts_threads[i]->port, &ts_ports[i]);
+		ts_sample_reset(&ts_ports[i]);
+	}
+	fflush(ts_file);
+}
+
+/*
+ * writes interval k once every running thread has moved past it, so all of
+ * its samples are in the rings; exits when all threads are done and drained
+ */
+static void *ts_flush_loop(void *arg)
+{
+	unsigned long k = 0;
+	bool ready, done, drained;
+	struct ts_thread *t;
+	int i;
+
+	while (1) {
+		ready = done = drained = true;
+		for (i = 0; i < ts_nr_threads; i++) {
+			t = __atomic_load_n(&ts_threads[i], __ATOMIC_ACQUIRE);
+			if (!t) {
+				ready = done = false;
+				break;
+			}
+			if (!__atomic_load_n(&t->done, __ATOMIC_ACQUIRE)) {
+				done = false;
+				if (__atomic_load_n(&t->cur_interval, __ATOMIC_ACQUIRE) <= k)
+					ready = false;
+			}
+			if (t->tail != __atomic_load_n(&t->head, __ATOMIC_ACQUIRE))
+				drained = false;
+		}
+
+		if (done && drained)
+			break;
+		if (!ready) {
+			usleep(ts_interval_ms * 1000 / 4);
+			continue;
+		}
+		ts_write_interval(k++);
+	}
+
+	for (i = 0; i < ts_nr_threads; i++)
+		if (ts_threads[i]->dropped)
+			fprintf(stderr, "timeseries: thread %d dropped %lu samples\n",
+				i, ts_threads[i]->dropped);
+	fclose(ts_file);
+	return NULL;
+}
+
+/**
+ * timeseries_init - opens the output file and starts the flush thread
+ * @path: the output file, CSV if it ends in .csv, JSON lines otherwise
+ * @interval_ms: the interval length
+ * @cycles_per_us: the TSC frequency
+ * @start: the TSC value at which interval 0 starts
+ * @nr_threads: the number of client threads that will register
+ * @precision: the latency histogram precision
+ *
+ * Returns 0 if successful, otherwise fail.
+ */
+int timeseries_init(const char *path, unsigned int interval_ms, int cycles_per_us,
+		    unsigned long start, int nr_threads, unsigned int precision)
+{
+	size_t len = strlen(path);
+	int i, ret;
+
+	if (!interval_ms)
+		return -EINVAL;
+
+	ts_interval_ms = interval_ms;
+	ts_cycles_per_us = cycles_per_us;
+	ts_interval_cycles = (unsigned long) interval_ms * 1000 * cycles_per_us;
+	ts_start = start;
+	ts_nr_threads = nr_threads;
+	ts_precision = precision;
+	ts_csv = len > 4 && !strcmp(path + len - 4, ".csv");
+
+	ts_threads = calloc(nr_threads, sizeof(*ts_threads));
+	ts_ports = calloc(nr_threads, sizeof(*ts_ports));
+	if (!ts_threads || !ts_ports)
+		return -ENOMEM;
+	ret = ts_sample_init(&ts_empty);
+	for (i = 0; !ret && i < nr_threads; i++)
+		ret = ts_sample_init(&ts_ports[i]);
+	if (ret)
+		return ret;
+
+	ts_file = fopen(path, "w");
+	if (!ts_file)
+		return -errno;
+	if (ts_csv)
+		fprintf(ts_file, "time_ms,scope,id,port,read_iops,write_iops,read_mbps,write_mbps,"
+			"avg_us,p50_us,p90_us,p99_us,p999_us,max_us\n");
+
+	return -pthread_create(&ts_flusher, NULL, ts_flush_loop, NULL);
+}
+
+/**
+ * timeseries_thread_init - registers a client thread
+ * @tid: the thread index, below nr_threads
+ * @port: the server port the thread is connected to
+ *
+ * Returns the thread's state, or NULL on failure.
+ */
+struct ts_thread *timeseries_thread_init(int tid, int port)
+{
+	struct ts_thread *ts;
+	int i;
+
+	ts = calloc(1, sizeof(*ts));
+	if (!ts)
+		return NULL;
+
+	ts->tid = tid;
+	ts->port = port;
+	if (ts_sample_init(&ts->cur))
+		return NULL;
+	for (i = 0; i < TS_RING_SLOTS; i++)
+		if (ts_sample_init(&ts->ring[i]))
+			return NULL;
+
+	__atomic_store_n(&ts_threads[tid], ts, __ATOMIC_RELEASE);
+	return ts;
+}
+
+/**
+ * timeseries_publish - hands the current interval to the flush thread
+ * @ts: the thread's state
+ * @interval: the interval that starts now
+ *
+ * Only swaps histogram buffers, the flush thread resets them.
+ */
+void timeseries_publish(struct ts_thread *ts, unsigned long interval)
+{
+	struct ts_sample *slot;
+	struct histogram clean;
+
+	if (ts->cur.reads || ts->cur.writes) {
+		if (ts->head - __atomic_load_n(&ts->tail, __ATOMIC_ACQUIRE) == TS_RING_SLOTS) {
+			ts->dropped++;
+			ts_sample_reset(&ts->cur);
+		} else {
+			slot = &ts->ring[ts->head % TS_RING_SLOTS];
+			clean = slot->hist;
+			*slot = ts->cur;
+			slot->interval = ts->cur_interval;
+			ts->cur.hist = clean;
+			ts->cur.reads = ts->cur.writes = 0;
+			ts->cur.read_bytes = ts->cur.write_bytes = 0;
+			__atomic_store_n(&ts->head, ts->head + 1, __ATOMIC_RELEASE);
+		}
+	}
+	__atomic_store_n(&ts->cur_interval, interval, __ATOMIC_RELEASE);
+}
+
+/**
+ * timeseries_thread_done - publishes the last interval of a thread
+ * @ts: the thread's state
+ */
+void timeseries_thread_done(struct ts_thread *ts)
+{
+	timeseries_publish(ts, ts->cur_interval + 1);
+	__atomic_store_n(&ts->done, true, __ATOMIC_RELEASE);
+}
+
+/**
+ * timeseries_finish - waits until all samples have been written
+ */
+void timeseries_finish(void)
+{
+	pthread_join(ts_flusher, NULL);
+}
@@ -0,0 +1,106 @@
+/*
+ * Copyright 2013-16 Board of Trustees of Stanford University
+ * Copyright 2013-16 Ecole Polytechnique Federale Lausanne (EPFL)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * timeseries.h - per-interval statistics of the IX load generator
+ *
+ * Each client thread accumulates counters and a read latency histogram for
+ * the current interval and, when the interval ends, copies them into a
+ * single-producer ring. A background thread drains the rings and writes one
+ * row per thread and one per server port for every interval, as JSON lines
+ * or CSV (if the file name ends in .csv). Nothing is formatted or written
+ * by the client threads; if a ring is full the sample is dropped and
+ * counted.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+
+#include "histogram.h"
+
+#define TS_RING_SLOTS	64
+
+struct ts_sample {
+	unsigned long interval;
+	unsigned long reads;
+	unsigned long writes;
+	unsigned long read_bytes;
+	unsigned long write_bytes;
+	struct histogram hist;		/* read latency in cycles */
+};
+
+struct ts_thread {
+	int tid;
+	int port;
+	struct ts_sample cur;
+	struct ts_sample ring[TS_RING_SLOTS];
+	unsigned long head;		/* written by the client thread */
+	unsigned long tail;		/* written by the flush thread */
+	unsigned long cur_interval;	/* intervals before this one are published */
+	unsigned long dropped;
+	bool done;
+};
+
+extern unsigned long ts_interval_cycles;
+extern unsigned long ts_start;
+
+extern int timeseries_init(const char *path, unsigned int interval_ms, int cycles_per_us,
+			   unsigned long start, int nr_threads, unsigned int precision);
+extern struct ts_thread *timeseries_thread_init(int tid, int port);
+extern void timeseries_publish(struct ts_thread *ts, unsigned long interval);
+extern void timeseries_thread_done(struct ts_thread *ts);
+extern void timeseries_finish(void);
+
+/**
+ * timeseries_record - accounts a completed request in the current interval
+ * @ts: the thread's state
+ * @read: true for reads, whose @latency is recorded
+ * @bytes: the request size
+ * @latency: the latency in cycles
+ */
+static inline void timeseries_record(struct ts_thread *ts, bool read,
+				     unsigned long bytes, unsigned long latency)
+{
+	if (read) {
+		ts->cur.reads++;
+		ts->cur.read_bytes += bytes;
+		histogram_record(&ts->cur.hist, latency);
+	} else {
+		ts->cur.writes++;
+		ts->cur.write_bytes += bytes;
+	}
+}
+
+/**
+ * timeseries_tick - closes the current interval if it has ended
+ * @ts: the thread's state
+ * @now: the current TSC
+ */
+static inline void timeseries_tick(struct ts_thread *ts, unsigned long now)
+{
+	unsigned long interval = (now - ts_start) / ts_interval_cycles;
+
+	if (interval != ts->cur_interval)
+		timeseries_publish(ts, interval);
+}
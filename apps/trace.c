@@ -0,0 +1,256 @@
+/*
+ * Copyright 2013-16 Board of Trustees of Stanford University
+ * Copyright 2013-16 Ecole Polytechnique Federale Lausanne (EPFL)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * trace.c - streaming block trace reader for the IX load generator
+ */
+
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "trace.h"
+
+#define TRACE_MAX_LINE		512
+#define TRACE_DROP_CHUNK	(64UL << 20)
+#define TRACE_SECTOR_SIZE	512
+
+/* copies the next line into buf; returns false at the end of the trace */
+static bool trace_getline(struct trace *t, char *buf, size_t len)
+{
+	const char *start, *nl;
+	size_t n;
+
+	if (t->pos >= t->size)
+		return false;
+
+	start = t->base + t->pos;
+	nl = memchr(start, '\n', t->size - t->pos);
+	n = nl ? (size_t) (nl - start) : t->size - t->pos;
+	t->pos += n + (nl ? 1 : 0);
+
+	if (n >= len)
+		n = len - 1;
+	memcpy(buf, start, n);
+	buf[n] = '\0';
+
+	if (t->pos - t->dropped >= TRACE_DROP_CHUNK) {
+		madvise((void *) (t->base + t->dropped), TRACE_DROP_CHUNK, MADV_DONTNEED);
+		t->dropped += TRACE_DROP_CHUNK;
+	}
+	return true;
+}
+
+static bool trace_set_op(struct trace_rec *rec, const char *op)
+{
+	if (strchr(op, 'D'))		/* discard */
+		return false;
+	if (strchr(op, 'R') || !strcasecmp(op, "read") || !strcmp(op, "r")) {
+		rec->write = false;
+		return true;
+	}
+	if (strchr(op, 'W') || !strcasecmp(op, "write") || !strcmp(op, "w")) {
+		rec->write = true;
+		return true;
+	}
+	return false;
+}
+
+static unsigned int trace_sectors(unsigned long bytes)
+{
+	return (bytes + TRACE_SECTOR_SIZE - 1) / TRACE_SECTOR_SIZE;
+}
+
+static bool trace_parse_blkparse(const char *line, struct trace_rec *rec, double *ts_s)
+{
+	char action, rwbs[16];
+	unsigned long sector;
+	unsigned int nr_sectors;
+
+	if (sscanf(line, " %*d,%*d %*d %*u %lf %*d %c %15s %lu + %u",
+		   ts_s, &action, rwbs, &sector, &nr_sectors) != 5)
+		return false;
+	if (action != 'Q' || !nr_sectors || !trace_set_op(rec, rwbs))
+		return false;
+
+	rec->lba = sector;
+	rec->lba_count = nr_sectors;
+	return true;
+}
+
+static bool trace_parse_fio(struct trace *t, const char *line, struct trace_rec *rec,
+			    unsigned long *ts_ms)
+{
+	char action[16];
+	unsigned long offset, len;
+	int ret;
+
+	if (t->fio_version >= 3)
+		ret = sscanf(line, "%lu %*s %15s %lu %lu", ts_ms, action, &offset, &len) == 4;
+	else
+		ret = sscanf(line, "%*s %15s %lu %lu", action, &offset, &len) == 3;
+	if (!ret || !len)
+		return false;
+	if (strcmp(action, "read") && strcmp(action, "write"))
+		return false;
+
+	trace_set_op(rec, action);
+	rec->lba = offset / TRACE_SECTOR_SIZE;
+	rec->lba_count = trace_sectors(len);
+	return true;
+}
+
+static bool trace_parse_csv(const char *line, struct trace_rec *rec, double *ts_us)
+{
+	char op[16];
+	unsigned long lba, len;
+
+	if (!isdigit((unsigned char) line[0]) && line[0] != '.')
+		return false;
+	if (sscanf(line, "%lf , %15[^,] , %lu , %lu", ts_us, op, &lba, &len) != 4)
+		return false;
+	if (!len || !trace_set_op(rec, op))
+		return false;
+
+	rec->lba = lba;
+	rec->lba_count = trace_sectors(len);
+	return true;
+}
+
+/**
+ * trace_open - maps a trace file and detects its format
+ * @t: the trace
+ * @path: the trace file
+ *
+ * Returns 0 if successful, otherwise a negative error code.
+ */
+int trace_open(struct trace *t, const char *path)
+{
+	char line[TRACE_MAX_LINE];
+	struct stat st;
+	size_t first;
+	int fd;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return -errno;
+	if (fstat(fd, &st) || st.st_size == 0) {
+		close(fd);
+		return -EINVAL;
+	}
+
+	t->base = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (t->base == MAP_FAILED)
+		return -errno;
+	madvise((void *) t->base, st.st_size, MADV_SEQUENTIAL);
+
+	t->path = path;
+	t->size = st.st_size;
+	t->pos = 0;
+	t->dropped = 0;
+	t->have_first_ts = false;
+	t->nr_records = 0;
+	t->fio_version = 0;
+
+	do {
+		first = t->pos;
+		if (!trace_getline(t, line, sizeof(line))) {
+			trace_close(t);
+			return -EINVAL;
+		}
+	} while (line[0] == '\0' || line[0] == '#');
+
+	if (sscanf(line, "fio version %d iolog", &t->fio_version) == 1) {
+		t->format = TRACE_FIO;
+	} else {
+		t->format = strchr(line, ',') && !strchr(line, '+') ? TRACE_CSV : TRACE_BLKPARSE;
+		t->pos = first;
+	}
+	return 0;
+}
+
+/**
+ * trace_next - reads the next I/O record
+ * @t: the trace
+ * @rec: the record to fill in
+ *
+ * Lines that do not describe a read or write are skipped.
+ *
+ * Returns 0 if successful, or -ENODATA at the end of the trace.
+ */
+int trace_next(struct trace *t, struct trace_rec *rec)
+{
+	char line[TRACE_MAX_LINE];
+	unsigned long ts_ns, ts_ms;
+	double ts;
+	bool ok;
+
+	while (trace_getline(t, line, sizeof(line))) {
+		switch (t->format) {
+		case TRACE_BLKPARSE:
+			ok = trace_parse_blkparse(line, rec, &ts);
+			ts_ns = (unsigned long) (ts * 1E9);
+			break;
+		case TRACE_FIO:
+			ok = trace_parse_fio(t, line, rec, &ts_ms);
+			ts_ns = t->fio_version >= 3 ? ts_ms * 1000000UL : TRACE_NO_TS;
+			break;
+		default:
+			ok = trace_parse_csv(line, rec, &ts);
+			ts_ns = (unsigned long) (ts * 1E3);
+			break;
+		}
+		if (!ok)
+			continue;
+
+		if (ts_ns != TRACE_NO_TS) {
+			if (!t->have_first_ts) {
+				t->first_ts_ns = ts_ns;
+				t->have_first_ts = true;
+			}
+			/* tolerate slightly out of order records */
+			ts_ns = ts_ns > t->first_ts_ns ? ts_ns - t->first_ts_ns : 0;
+		}
+		rec->ts_ns = ts_ns;
+		t->nr_records++;
+		return 0;
+	}
+	return -ENODATA;
+}
+
+/**
+ * trace_close - unmaps a trace
+ * @t: the trace
+ */
+void trace_close(struct trace *t)
+{
+	munmap((void *) t->base, t->size);
+}
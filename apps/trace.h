@@ -0,0 +1,72 @@
+/*
+ * Copyright 2013-16 Board of Trustees of Stanford University
+ * Copyright 2013-16 Ecole Polytechnique Federale Lausanne (EPFL)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * trace.h - streaming block trace reader for the IX load generator
+ *
+ * Supported formats (detected from the first line):
+ *  - blkparse text output: "Q" (queued) events with R or W in the RWBS field
+ *  - fio iolog version 2 (no timestamps) and version 3 (timestamps in ms)
+ *  - CSV: timestamp_us,op,lba,length with op R or W, lba in 512B sectors
+ *    and length in bytes; lines starting with '#' are ignored
+ *
+ * The file is memory-mapped and parsed one line at a time; pages behind the
+ * read position are dropped, so traces larger than memory can be replayed.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#define TRACE_NO_TS (~0UL)
+
+enum trace_format {
+	TRACE_BLKPARSE,
+	TRACE_FIO,
+	TRACE_CSV,
+};
+
+struct trace_rec {
+	unsigned long ts_ns;		/* relative to the first record, or TRACE_NO_TS */
+	bool write;
+	unsigned long lba;		/* in 512B sectors */
+	unsigned int lba_count;
+};
+
+struct trace {
+	const char *path;
+	enum trace_format format;
+	int fio_version;
+	const char *base;
+	size_t size;
+	size_t pos;
+	size_t dropped;			/* bytes already released with MADV_DONTNEED */
+	bool have_first_ts;
+	unsigned long first_ts_ns;
+	unsigned long nr_records;
+};
+
+extern int trace_open(struct trace *t, const char *path);
+extern int trace_next(struct trace *t, struct trace_rec *rec);
+extern void trace_close(struct trace *t);
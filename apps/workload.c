@@ -0,0 +1,326 @@
+/*
+ * Copyright 2013-16 Board of Trustees of Stanford University
+ * Copyright 2013-16 Ecole Polytechnique Federale Lausanne (EPFL)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * workload.c - request generators for the IX load generator
+ */
+
+#include <errno.h>
+#include <libconfig.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "workload.h"
+
+/* prime larger than WL_ZIPF_BUCKETS, scatters ranks over the namespace */
+#define WL_SCATTER	2654435761UL
+
+static inline unsigned long wl_bounded(uint64_t r, unsigned long n)
+{
+	return ((unsigned __int128) r * n) >> 64;
+}
+
+/**
+ * alias_table_init - builds an alias table (Vose's method)
+ * @t: the table
+ * @weights: non-negative weights, at least one of them positive
+ * @n: the number of weights
+ *
+ * Returns 0 if successful, otherwise fail.
+ */
+int alias_table_init(struct alias_table *t, const double *weights, unsigned int n)
+{
+	unsigned int *small, *large;
+	unsigned int nr_small = 0, nr_large = 0, i, s, l;
+	double *p, sum = 0;
+
+	for (i = 0; i < n; i++) {
+		if (weights[i] < 0)
+			return -EINVAL;
+		sum += weights[i];
+	}
+	if (!n || sum <= 0)
+		return -EINVAL;
+
+	t->n = n;
+	t->prob = malloc(n * sizeof(uint32_t));
+	t->alias = malloc(n * sizeof(uint32_t));
+	p = malloc(n * sizeof(double));
+	small = malloc(n * sizeof(unsigned int));
+	large = malloc(n * sizeof(unsigned int));
+	if (!t->prob || !t->alias || !p || !small || !large) {
+		free(t->prob);
+		free(t->alias);
+		free(p);
+		free(small);
+		free(large);
+		return -ENOMEM;
+	}
+
+	for (i = 0; i < n; i++) {
+		p[i] = weights[i] * n / sum;
+		if (p[i] < 1.0)
+			small[nr_small++] = i;
+		else
+			large[nr_large++] = i;
+	}
+
+	while (nr_small && nr_large) {
+		s = small[--nr_small];
+		l = large[--nr_large];
+		t->prob[s] = (uint32_t) (p[s] * 4294967296.0);
+		t->alias[s] = l;
+		p[l] -= 1.0 - p[s];
+		if (p[l] < 1.0)
+			small[nr_small++] = l;
+		else
+			large[nr_large++] = l;
+	}
+
+	/* what is left has probability 1, up to rounding */
+	while (nr_large) {
+		l = large[--nr_large];
+		t->prob[l] = UINT32_MAX;
+		t->alias[l] = l;
+	}
+	while (nr_small) {
+		s = small[--nr_small];
+		t->prob[s] = UINT32_MAX;
+		t->alias[s] = s;
+	}
+
+	free(p);
+	free(small);
+	free(large);
+	return 0;
+}
+
+static int lba_dist_init_zipf(struct lba_dist *d, double theta)
+{
+	unsigned long i;
+	double *weights;
+	int ret;
+
+	d->nr_buckets = d->nr_blocks < WL_ZIPF_BUCKETS ? d->nr_blocks : WL_ZIPF_BUCKETS;
+	weights = malloc(d->nr_buckets * sizeof(double));
+	if (!weights)
+		return -ENOMEM;
+
+	for (i = 0; i < d->nr_buckets; i++)
+		weights[i] = 1.0 / pow(i + 1, theta);
+
+	ret = alias_table_init(&d->table, weights, d->nr_buckets);
+	free(weights);
+	return ret;
+}
+
+static int lba_dist_init_hotspot(struct lba_dist *d, double hot_fraction, double hot_access)
+{
+	double weights[2] = {hot_access, 1.0 - hot_access};
+
+	if (hot_fraction <= 0 || hot_fraction >= 1 || hot_access < 0 || hot_access > 1)
+		return -EINVAL;
+
+	d->hot_blocks = d->nr_blocks * hot_fraction;
+	if (!d->hot_blocks)
+		d->hot_blocks = 1;
+	return alias_table_init(&d->table, weights, 2);
+}
+
+/**
+ * lba_dist_sample - draws a block number
+ * @d: the distribution
+ * @r1: 64 uniformly random bits
+ * @r2: 64 more uniformly random bits
+ *
+ * Returns a block number in [0, d->nr_blocks).
+ */
+unsigned long lba_dist_sample(const struct lba_dist *d, uint64_t r1, uint64_t r2)
+{
+	unsigned long bucket, start, end;
+
+	switch (d->type) {
+	case LBA_ZIPF:
+		bucket = (alias_table_sample(&d->table, r1) * WL_SCATTER) % d->nr_buckets;
+		start = bucket * d->nr_blocks / d->nr_buckets;
+		end = (bucket + 1) * d->nr_blocks / d->nr_buckets;
+		return start + wl_bounded(r2, end - start);
+	case LBA_HOTSPOT:
+		if (alias_table_sample(&d->table, r1) == 0)
+			return wl_bounded(r2, d->hot_blocks);
+		return d->hot_blocks + wl_bounded(r2, d->nr_blocks - d->hot_blocks);
+	default:
+		return wl_bounded(r1, d->nr_blocks);
+	}
+}
+
+static int parse_lba_dist(const config_setting_t *entry, struct lba_dist *d)
+{
+	const config_setting_t *lba = config_setting_get_member(entry, "lba");
+	const char *dist = "uniform";
+	double theta = 0.99, hot_fraction = 0.2, hot_access = 0.8;
+
+	if (lba) {
+		config_setting_lookup_string(lba, "dist", &dist);
+		config_setting_lookup_float(lba, "theta", &theta);
+		config_setting_lookup_float(lba, "hot_fraction", &hot_fraction);
+		config_setting_lookup_float(lba, "hot_access", &hot_access);
+	}
+
+	if (!strcmp(dist, "uniform")) {
+		d->type = LBA_UNIFORM;
+		return 0;
+	} else if (!strcmp(dist, "zipf")) {
+		d->type = LBA_ZIPF;
+		if (theta <= 0)
+			return -EINVAL;
+		return lba_dist_init_zipf(d, theta);
+	} else if (!strcmp(dist, "hotspot")) {
+		d->type = LBA_HOTSPOT;
+		return lba_dist_init_hotspot(d, hot_fraction, hot_access);
+	}
+	return -EINVAL;
+}
+
+static int parse_size_dist(const config_setting_t *entry, const char *name,
+			   unsigned int default_sectors, struct size_dist *d)
+{
+	const config_setting_t *sizes = config_setting_get_member(entry, name);
+	const config_setting_t *elem;
+	double weights[WL_MAX_SIZES];
+	double weight;
+	int i, size;
+
+	if (!sizes) {
+		d->nr_sizes = 1;
+		d->sectors[0] = default_sectors;
+		weights[0] = 1;
+		return alias_table_init(&d->table, weights, 1);
+	}
+
+	d->nr_sizes = config_setting_length(sizes);
+	if (!d->nr_sizes || d->nr_sizes > WL_MAX_SIZES)
+		return -EINVAL;
+
+	for (i = 0; i < d->nr_sizes; i++) {
+		elem = config_setting_get_elem(sizes, i);
+		weight = 1;
+		if (!config_setting_lookup_int(elem, "size", &size) ||
+		    size <= 0 || size % (WL_BLOCK_SECTORS * 512))
+			return -EINVAL;
+		if (!config_setting_lookup_float(elem, "weight", &weight)) {
+			int iweight;
+
+			if (config_setting_lookup_int(elem, "weight", &iweight))
+				weight = iweight;
+		}
+		d->sectors[i] = size / 512;
+		weights[i] = weight;
+	}
+	return alias_table_init(&d->table, weights, d->nr_sizes);
+}
+
+/**
+ * workload_max_sectors - returns the largest request size of any connection
+ */
+unsigned int workload_max_sectors(const struct workload_conn *conns, int nr_conns)
+{
+	unsigned int max = 0;
+	int i, j;
+
+	for (i = 0; i < nr_conns; i++) {
+		for (j = 0; j < conns[i].read_sizes.nr_sizes; j++)
+			if (conns[i].read_sizes.sectors[j] > max)
+				max = conns[i].read_sizes.sectors[j];
+		for (j = 0; j < conns[i].write_sizes.nr_sizes; j++)
+			if (conns[i].write_sizes.sectors[j] > max)
+				max = conns[i].write_sizes.sectors[j];
+	}
+	return max;
+}
+
+/**
+ * workload_load - parses a workload file
+ * @path: the libconfig file, see workload.conf.sample
+ * @nr_blocks: the number of 4KB blocks in the namespace
+ * @default_sectors: the request size of connections that do not list sizes
+ * @conns: the connections to fill in, one per entry of "connections"
+ * @max_conns: the capacity of @conns
+ *
+ * Returns the number of connections if successful, otherwise fail.
+ */
+int workload_load(const char *path, unsigned long nr_blocks, unsigned int default_sectors,
+		  struct workload_conn *conns, int max_conns)
+{
+	const config_setting_t *list, *entry;
+	struct workload_conn *c;
+	config_t cfg;
+	int i, n, rate, ret = -EINVAL;
+
+	config_init(&cfg);
+	if (!config_read_file(&cfg, path)) {
+		fprintf(stderr, "%s:%d - %s\n", path, config_error_line(&cfg),
+			config_error_text(&cfg));
+		goto out;
+	}
+
+	list = config_lookup(&cfg, "connections");
+	n = list ? config_setting_length(list) : 0;
+	if (!n || n > max_conns) {
+		fprintf(stderr, "%s: expected 1 to %d connections\n", path, max_conns);
+		goto out;
+	}
+
+	for (i = 0; i < n; i++) {
+		entry = config_setting_get_elem(list, i);
+		c = &conns[i];
+		memset(c, 0, sizeof(*c));
+		c->read_percentage = 100;
+		c->lba.nr_blocks = nr_blocks;
+
+		if (!config_setting_lookup_int(entry, "port", &c->port) ||
+		    !config_setting_lookup_int(entry, "rate", &rate) || rate <= 0) {
+			fprintf(stderr, "%s: connection %d needs a port and a rate\n", path, i);
+			goto out;
+		}
+		c->rate = rate;
+		config_setting_lookup_int(entry, "read_percentage", &c->read_percentage);
+
+		ret = parse_lba_dist(entry, &c->lba);
+		if (!ret)
+			ret = parse_size_dist(entry, "read_sizes", default_sectors, &c->read_sizes);
+		if (!ret)
+			ret = parse_size_dist(entry, "write_sizes", default_sectors, &c->write_sizes);
+		if (ret) {
+			fprintf(stderr, "%s: invalid distribution for connection %d\n", path, i);
+			goto out;
+		}
+	}
+	ret = n;
+
+out:
+	config_destroy(&cfg);
+	return ret;
+}
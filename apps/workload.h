@@ -0,0 +1,100 @@
+/*
+ * Copyright 2013-16 Board of Trustees of Stanford University
+ * Copyright 2013-16 Ecole Polytechnique Federale Lausanne (EPFL)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * workload.h - request generators for the IX load generator
+ *
+ * LBA and request size distributions are sampled in O(1) from alias tables
+ * built once at startup. Zipfian popularity is computed over at most
+ * WL_ZIPF_BUCKETS regions of the namespace, scattered across the device
+ * so hot regions are not adjacent; blocks within a region are uniform.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#define WL_BLOCK_SECTORS	8		/* LBAs are 4KB aligned */
+#define WL_ZIPF_BUCKETS		(1UL << 20)
+#define WL_MAX_SIZES		16
+
+struct alias_table {
+	unsigned int n;
+	uint32_t *prob;		/* probability of keeping the slot, scaled to 2^32 */
+	uint32_t *alias;
+};
+
+enum lba_dist_type {
+	LBA_UNIFORM,
+	LBA_ZIPF,
+	LBA_HOTSPOT,
+};
+
+struct lba_dist {
+	enum lba_dist_type type;
+	unsigned long nr_blocks;
+	unsigned long nr_buckets;	/* LBA_ZIPF: regions the table ranks */
+	unsigned long hot_blocks;	/* LBA_HOTSPOT: blocks in the hot region */
+	struct alias_table table;
+};
+
+struct size_dist {
+	unsigned int nr_sizes;
+	unsigned int sectors[WL_MAX_SIZES];
+	struct alias_table table;
+};
+
+/* the generator of one client connection, see workload_load() */
+struct workload_conn {
+	int port;
+	unsigned long rate;		/* requests per second */
+	int read_percentage;
+	struct lba_dist lba;
+	struct size_dist read_sizes;
+	struct size_dist write_sizes;
+};
+
+extern int alias_table_init(struct alias_table *t, const double *weights, unsigned int n);
+
+/**
+ * alias_table_sample - draws an index from an alias table
+ * @t: the table
+ * @r: 64 uniformly random bits
+ */
+static inline unsigned int alias_table_sample(const struct alias_table *t, uint64_t r)
+{
+	unsigned int i = ((r >> 32) * t->n) >> 32;
+
+	return (uint32_t) r < t->prob[i] ? i : t->alias[i];
+}
+
+extern unsigned long lba_dist_sample(const struct lba_dist *d, uint64_t r1, uint64_t r2);
+
+static inline unsigned int size_dist_sample(const struct size_dist *d, uint64_t r)
+{
+	return d->sectors[alias_table_sample(&d->table, r)];
+}
+
+extern unsigned int workload_max_sectors(const struct workload_conn *conns, int nr_conns);
+extern int workload_load(const char *path, unsigned long nr_blocks, unsigned int default_sectors,
+			 struct workload_conn *conns, int max_conns);
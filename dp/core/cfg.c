@@ -57,7 +57,6 @@ extern int net_cfg(void);
 extern int arp_insert(struct ip_addr *addr, struct eth_addr *mac);
 
 static config_t cfg;
-static config_t cfg_devmodel;
 static char config_file[256];
 static char devmodel_file[256];
 
@@ -72,6 +71,9 @@ static int parse_cpu(void);
 static int parse_batch(void);
 static int parse_loader_path(void);
 static int parse_scheduler_mode(void);
+static int parse_tenant_balance(void);
+static int parse_core_park(void);
+static int parse_log_file(void);
 
 extern int ixgbe_fdir_add_rule(uint32_t dst_addr, uint32_t src_addr, uint16_t dst_port, int queue_id);
 
@@ -92,6 +94,9 @@ static struct config_vector_t config_tbl[] = {
 	{ "batch",        parse_batch},
 	{ "loader_path",  parse_loader_path},
 	{ "scheduler", 	  parse_scheduler_mode},
+	{ "tenant_balance_ms", parse_tenant_balance},
+	{ "core_park_ms", parse_core_park},
+	{ "log_file",     parse_log_file},
 	{ NULL,           NULL}
 };
 
@@ -355,27 +360,14 @@ static int parse_nvme_devices(void)
 	return 0;
 }
 
-int compare_lat_tokenrate (const void * a, const void * b)
-{
-   struct lat_tokenrate_pair *a_pair = (struct lat_tokenrate_pair*) a;
-   struct lat_tokenrate_pair *b_pair = (struct lat_tokenrate_pair*) b;
-   return ( a_pair->p95_tail_latency - b_pair->p95_tail_latency );
-}
-
 static int parse_nvme_device_model(void)
 {
 	config_setting_t *devs = NULL;
 	const char *dev_model_ = NULL;
-	config_setting_t *read_cost;
-	config_setting_t *write_cost;
-	config_setting_t *max_token_rate;
-	config_setting_t *token_limits = NULL, *entry = NULL;
-	int i;
 
 	devs = config_lookup(&cfg, "nvme_device_model");
 	if (!devs) {
 		nvme_dev_model = DEFAULT_FLASH;
-		MAX_DEV_TOKEN_RATE = UINT_MAX;
 		return 0;
 	}
 
@@ -383,8 +375,6 @@ static int parse_nvme_device_model(void)
 	if (!strcmp(dev_model_, "fake")){
 		log_info("NVMe device model: FAKE_FLASH (fake I/O completion events)\n");
 		nvme_dev_model = FAKE_FLASH;
-		NVME_READ_COST = 100; // default read cost
-		NVME_WRITE_COST = 2000; // default write cost
 		return 0;
 	}
 	if (!strcmp(dev_model_, "default")){
@@ -397,80 +387,9 @@ static int parse_nvme_device_model(void)
 
 	strncpy(devmodel_file, dev_model_, sizeof(devmodel_file));
 	devmodel_file[sizeof(devmodel_file) - 1] = '\0';
-	dev_model_size = 1;
-	
-	config_init(&cfg_devmodel);
-	if (!config_read_file(&cfg_devmodel, devmodel_file)) {
-		fprintf(stderr, "%s:%d - %s\n",
-			config_error_file(&cfg_devmodel),
-			config_error_line(&cfg_devmodel),
-			config_error_text(&cfg_devmodel));
-		config_destroy(&cfg_devmodel);
-		return -EINVAL;
-	}
-
-	log_info("NVMe device model: %s\n", devmodel_file);
-	// parse device request costs
-	read_cost = config_lookup(&cfg_devmodel, "read_cost_4KB");
-	write_cost = config_lookup(&cfg_devmodel, "write_cost_4KB");
-	max_token_rate = config_lookup(&cfg_devmodel, "max_token_rate");
-	if (config_setting_get_int(read_cost)) {
-		NVME_READ_COST = config_setting_get_int(read_cost);
-	}
-	else{ 
-		NVME_READ_COST = 100; // default read cost
-		log_info("WARNING: no read cost specified. Default is 100 tokens.");
-	}
-	if (config_setting_get_int(write_cost)) {
-		NVME_WRITE_COST = config_setting_get_int(write_cost);
-	}
-	else{ 
-		log_info("WARNING: no write cost specified. Default is 2000 tokens.");
-		NVME_WRITE_COST = 2000; // default write cost
-	}
-
-	// parse token limits and store in memory for lookup during runtime	
-	if (config_setting_get_int(max_token_rate)) {
-		MAX_DEV_TOKEN_RATE = config_setting_get_int(max_token_rate);
-	}
-	else{ 
-		MAX_DEV_TOKEN_RATE = UINT_MAX; // default max token rate
-	}
-
-	token_limits = config_lookup(&cfg_devmodel, "token_limits");
-	if (!token_limits) {
-		log_info("WARNING: return no token limits specified.\n");
-		return 0;
-	}
-
-	dev_model_size = config_setting_length(token_limits);
-	assert(dev_model_size < 128); // if this fails, increase size of dev_model array in cfg.h
-
-	for (i = 0; i < config_setting_length(token_limits); ++i) {
-		int lat =0;
-	   	long long token_rate_limit, token_rdonly_rate_limit = 0;
-		entry = config_setting_get_elem(token_limits, i);
-		config_setting_lookup_int(entry, "p95_latency_limit", &lat);
-		config_setting_lookup_int64(entry, "max_token_rate", &token_rate_limit);
-		config_setting_lookup_int64(entry, "max_rdonly_token_rate", &token_rdonly_rate_limit);
-		if ( !lat || !token_rate_limit )
-			return -EINVAL;
-		
-		dev_model[i].p95_tail_latency = lat;
-		dev_model[i].token_rate_limit = (unsigned long) token_rate_limit;
-		
-		if ( !token_rdonly_rate_limit ){
-			dev_model[i].token_rdonly_rate_limit = (unsigned long) token_rate_limit;
-		}
-		else{
-			dev_model[i].token_rdonly_rate_limit = (unsigned long) token_rdonly_rate_limit;
-		}
-	}
-	// sort dev_model array for easy lookup during runtime
-	qsort (dev_model, dev_model_size, sizeof(struct lat_tokenrate_pair), &compare_lat_tokenrate);
 
-	//log_info("WARNING: only support 1 device type for now\n");
-	return 0;
+	// request costs and token limits, see nvme_sched.c
+	return nvme_sched_parse_devmodel(devmodel_file);
 }
 
 static int parse_scheduler_mode(void)
@@ -505,6 +424,49 @@ static int parse_scheduler_mode(void)
 	return 0;
 }
 
+static int parse_tenant_balance(void)
+{
+	int interval = 0;
+
+	config_lookup_int(&cfg, "tenant_balance_ms", &interval);
+	if (interval < 0)
+		return -EINVAL;
+	nvme_balance_interval_ms = interval;
+	if (interval)
+		log_info("Tenant balancer: every %d ms\n", interval);
+	return 0;
+}
+
+static int parse_core_park(void)
+{
+	int interval = 0, iops = 300000, delay = 50;
+
+	config_lookup_int(&cfg, "core_park_ms", &interval);
+	config_lookup_int(&cfg, "core_park_iops", &iops);
+	config_lookup_int(&cfg, "core_park_delay_us", &delay);
+	if (interval < 0 || iops <= 0 || delay <= 0)
+		return -EINVAL;
+	nvme_park_interval_ms = interval;
+	nvme_park_core_iops = iops;
+	nvme_park_delay_us = delay;
+	if (interval)
+		log_info("Core parking: every %d ms, %d IOPS per core, wake at %d us RX delay\n",
+			 interval, iops, delay);
+	return 0;
+}
+
+static int parse_log_file(void)
+{
+	const char *parsed = NULL;
+
+	config_lookup_string(&cfg, "log_file", &parsed);
+	if (!parsed)
+		return 0;
+	strncpy(CFG.log_file, parsed, sizeof(CFG.log_file));
+	CFG.log_file[sizeof(CFG.log_file) - 1] = '\0';
+	return 0;
+}
+
 static int add_cpu(int cpu)
 {
 	int i;
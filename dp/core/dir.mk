@@ -21,11 +21,15 @@
 
 # Makefile for the core system
 
-SRC = ethdev.c ethfg.c ethqueue.c cfg.c control_plane.c cpu.c init.c log.c mbuf.c mem.c mempool.c page.c pci.c utimer.c syscall.c timer.c vm.c dpdk.c nvme_sw_queue.c
+SRC = ethdev.c ethfg.c ethqueue.c cfg.c control_plane.c cpu.c init.c log.c mbuf.c mem.c mempool.c page.c pci.c utimer.c syscall.c timer.c vm.c dpdk.c nvme_sw_queue.c nvme_sched.c
 
 ifneq ($(ENABLE_KSTATS),)
 SRC += kstats.c tailqueue.c
 endif
 
+ifneq ($(ENABLE_REQTRACE),)
+SRC += reqtrace.c
+endif
+
 $(eval $(call register_dir, core, $(SRC)))
 
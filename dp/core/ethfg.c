@@ -209,6 +209,31 @@ static void migrate_fdir(struct ix_rte_eth_dev *dev, struct eth_fg *cur_fg,
 	cur_fg->cur_cpu = CFG.cpu[cpu];
 }
 
+/**
+ * eth_fg_has_local_port - checks for an active connection on a local port
+ * @fg: the flow group
+ * @port: the local TCP port (host byte order)
+ *
+ * Returns true if any active connection of @fg is bound to @port.
+ */
+bool eth_fg_has_local_port(struct eth_fg *fg, uint16_t port)
+{
+	struct tcp_hash_entry *he;
+	struct hlist_node *cur, *n;
+	struct tcp_pcb *pcb;
+
+	hlist_for_each(&fg->active_buckets, cur) {
+		he = hlist_entry(cur, struct tcp_hash_entry, hash_link);
+		hlist_for_each(&he->pcbs, n) {
+			pcb = hlist_entry(n, struct tcp_pcb, link);
+			if (pcb->local_port == port)
+				return true;
+		}
+	}
+
+	return false;
+}
+
 /**
  * eth_fg_assign_to_cpu - assigns the flow group to the given cpu
  * @fg_id: the flow group (global name; across devices)
@@ -39,6 +39,7 @@
 #include <ix/mbuf.h>
 #include <ix/syscall.h>
 #include <ix/kstats.h>
+#include <ix/reqtrace.h>
 #include <ix/profiler.h>
 #include <ix/lock.h>
 #include <ix/cfg.h>
@@ -93,8 +94,10 @@ static struct init_vector_t init_tbl[] = {
 	{ "CPU",     cpu_init,     NULL, NULL},
 	{ "Dune",    init_dune,    NULL, NULL},
 	{ "timer",   timer_init,   timer_init_cpu, NULL},
+	{ "hrtimer", NULL,         hrtimer_init_cpu, NULL},
 	{ "net",     net_init,     NULL, NULL},
 	{ "cfg",     init_cfg,     NULL, NULL},              // after net
+	{ "log",     log_init,     log_init_cpu, NULL},      // after cfg and timer
 	{ "cp",      cp_init,      NULL, NULL},
 	{ "dpdk",    dpdk_init,    NULL, NULL},
 	{ "firstcpu", init_firstcpu, NULL, NULL},             // after cfg
@@ -110,6 +113,9 @@ static struct init_vector_t init_tbl[] = {
 	{ "syscall", NULL,         syscall_init_cpu, NULL},
 #ifdef ENABLE_KSTATS
 	{ "kstats",  NULL,         kstats_init_cpu, NULL},    // after timer
+#endif
+#ifdef ENABLE_REQTRACE
+	{ "reqtrace", reqtrace_init, reqtrace_init_cpu, NULL}, // after cfg
 #endif
 	{ "init-net", NULL,         init_network_cpu, NULL},  // FIXME should be split
 	{ NULL, NULL, NULL, NULL}
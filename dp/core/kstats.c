@@ -24,7 +24,8 @@
 
 /*
  * kstats.c -- "kstats" (tree-based) statistics
- *    reports min/avg/max latency and occupancy for the various IX services
+ *    reports min/avg/max latency and occupancy for the various IX services,
+ *    and latency percentiles from a sampled log2 histogram
  *    printfs at regular intervals, which reset the counters.
  */
 
@@ -47,6 +48,7 @@ DEFINE_PERCPU(kstats_accumulate, _kstats_accumulate);
 DEFINE_PERCPU(int, _kstats_packets);
 DEFINE_PERCPU(int, _kstats_batch_histogram[KSTATS_BATCH_HISTOGRAM_SIZE]);
 DEFINE_PERCPU(int, _kstats_backlog_histogram[KSTATS_BACKLOG_HISTOGRAM_SIZE]);
+DEFINE_PERCPU(kstats_nvme_poll, _kstats_nvme_poll);
 DEFINE_PERCPU(int, llc_load_misses_fd);
 DEFINE_PERCPU(int, hw_instructions_fd);
 
@@ -77,6 +79,7 @@ void kstats_leave(kstats_accumulate *saved_accu)
 	kstats_distr *cur = acc->cur;
 
 	if (cur)  {
+		kstats_hist_add(cur, diff_lat);
 		cur->tot_lat += diff_lat;
 		cur->tot_occ += diff_occ;
 		if (cur->count == 0) {
@@ -102,11 +105,37 @@ void kstats_leave(kstats_accumulate *saved_accu)
 	}
 }
 
+/*
+ * returns the upper bound of the histogram bucket holding the
+ * @permille-th sample, or 0 if there are no samples
+ */
+static uint64_t kstats_hist_percentile(kstats_distr *d, int permille)
+{
+	uint64_t samples = 0, seen = 0;
+	int i;
+
+	for (i = 0; i < KSTATS_HIST_BUCKETS; i++)
+		samples += d->lat_hist[i];
+	if (!samples)
+		return 0;
+
+	for (i = 0; i < KSTATS_HIST_BUCKETS - 1; i++) {
+		seen += d->lat_hist[i];
+		if (seen * 1000 >= samples * permille)
+			break;
+	}
+	return 1UL << (i + 1);
+}
+
 static void kstats_printone(kstats_distr *d, const char *name, long total_cycles)
 {
+	char hist[KSTATS_HIST_BUCKETS * 16], *pos = hist;
+	int i;
+
 	if (d->count) {
 		log_info("kstat: %2d %-30s %9lu %2d%% latency %7lu | %7lu | %7lu "
-			 "occupancy %6lu | %6lu | %6lu\n",
+			 "occupancy %6lu | %6lu | %6lu "
+			 "p50/p99/p99.9 < %lu/%lu/%lu\n",
 			 percpu_get(cpu_id),
 			 name,
 			 d->count,
@@ -116,7 +145,17 @@ static void kstats_printone(kstats_distr *d, const char *name, long total_cycles
 			 d->max_lat,
 			 d->min_occ,
 			 d->tot_occ / d->count,
-			 d->max_occ);
+			 d->max_occ,
+			 kstats_hist_percentile(d, 500),
+			 kstats_hist_percentile(d, 990),
+			 kstats_hist_percentile(d, 999));
+
+		hist[0] = 0;
+		for (i = 0; i < KSTATS_HIST_BUCKETS; i++)
+			if (d->lat_hist[i])
+				pos += sprintf(pos, "%d:%u ", i, d->lat_hist[i]);
+		log_info("kstat: %2d %-30s log2 cycles histogram [%s]\n",
+			 percpu_get(cpu_id), name, hist);
 	}
 }
 
@@ -167,6 +206,7 @@ static void kstats_print(struct timer *t, struct eth_fg *none)
 	histogram_to_str(percpu_get(_kstats_backlog_histogram), KSTATS_BACKLOG_HISTOGRAM_SIZE, backlog_histogram, &avg_backlog);
 
 	kstats *ks = &(percpu_get(_kstats));
+	kstats_nvme_poll *np = &percpu_get(_kstats_nvme_poll);
 	log_info("--- BEGIN KSTATS --- %ld%% idle, %ld%% user, %ld%% sys, non idle cycles=%lld, HW instructions=%lld, LLC load misses=%lld (%d pkts, avg batch=%d [%s], avg backlog=%d [%s])\n",
 		 ks->idle.tot_lat * 100 / total_cycles,
 		 ks->user.tot_lat * 100 / total_cycles,
@@ -179,6 +219,10 @@ static void kstats_print(struct timer *t, struct eth_fg *none)
 		 batch_histogram,
 		 avg_backlog,
 		 backlog_histogram);
+	if (np->polls)
+		log_info("kstat: %2d nvme polls %lu, %lu completions, avg batch=%lu, avg budget=%lu\n",
+			 percpu_get(cpu_id), np->polls, np->completions,
+			 np->completions / np->polls, np->budget / np->polls);
 #undef DEF_KSTATS
 #define DEF_KSTATS(_c)  kstats_printone(&ks->_c, # _c, total_cycles);
 #include <ix/kstatvectors.h>
@@ -189,6 +233,7 @@ static void kstats_print(struct timer *t, struct eth_fg *none)
 	bzero(percpu_get(_kstats_batch_histogram), sizeof(*percpu_get(_kstats_batch_histogram))*KSTATS_BATCH_HISTOGRAM_SIZE);
 	bzero(percpu_get(_kstats_backlog_histogram), sizeof(*percpu_get(_kstats_backlog_histogram))*KSTATS_BACKLOG_HISTOGRAM_SIZE);
 	percpu_get(_kstats_packets) = 0;
+	bzero(np, sizeof(*np));
 
 	timer_add(&percpu_get(_kstats_timer), NULL, KSTATS_INTERVAL);
 }
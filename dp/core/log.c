@@ -24,20 +24,53 @@
 /*
  * log.c - the logging system
  *
+ * logk() formats and prints synchronously. logk_fast() instead appends a
+ * binary record to a single-producer ring owned by the calling core, and
+ * a log thread outside the dataplane drains the rings of all cores.
+ *
  * FIXME: Should we direct logs to a file?
  */
 
 #include <ix/stddef.h>
 #include <ix/log.h>
+#include <ix/binlog.h>
+#include <ix/cfg.h>
 #include <ix/cpu.h>
+#include <ix/errno.h>
+#include <ix/timer.h>
 
+#include <pthread.h>
 #include <stdio.h>
 #include <stdarg.h>
+#include <stdlib.h>
 #include <time.h>
 #include <string.h>
+#include <unistd.h>
 
 #define MAX_LOG_LEN	1024
 
+#define LOG_RING_SIZE		4096	/* records, a power of 2 */
+#define LOG_MAX_SITES		4096
+#define LOG_DRAIN_US		1000
+
+struct log_ring {
+	volatile uint32_t head;		/* written by the core */
+	uint64_t dropped;		/* calls lost because the ring was full */
+	uint32_t cpu;
+	volatile uint32_t tail __aligned(CACHE_LINE_SIZE);	/* written by the log thread */
+	uint64_t dropped_seen;
+	struct binlog_record rec[LOG_RING_SIZE] __aligned(CACHE_LINE_SIZE);
+};
+
+static DEFINE_PERCPU(struct log_ring *, log_ring);
+
+static struct log_ring *log_rings[NCPU];
+static int log_nr_rings;
+static struct log_site *log_sites[LOG_MAX_SITES];
+static int log_nr_sites;
+static FILE *log_file;
+static pthread_mutex_t log_drain_lock = PTHREAD_MUTEX_INITIALIZER;
+
 __thread bool log_is_early_boot = true;
 
 int max_loglevel = LOG_DEBUG;
@@ -70,3 +103,244 @@ void logk(int level, const char *fmt, ...)
 	printf("%s", buf);
 }
 
+
+static int log_site_id(struct log_site *site)
+{
+	int id = __sync_add_and_fetch(&log_nr_sites, 1);
+
+	if (id >= LOG_MAX_SITES)
+		return -1;
+
+	log_sites[id] = site;
+	/* if another core got here first, our slot stays a duplicate */
+	return __sync_val_compare_and_swap(&site->id, 0, id) ? site->id : id;
+}
+
+void __logk_fast(struct log_site *site, int nargs, ...)
+{
+	struct log_ring *ring;
+	struct binlog_record *rec;
+	uint64_t now;
+	uint32_t head;
+	va_list ap;
+	int i;
+
+	if (log_is_early_boot || !(ring = percpu_get(log_ring))) {
+		char buf[MAX_LOG_LEN];
+
+		va_start(ap, nargs);
+		vsnprintf(buf, sizeof(buf), site->fmt, ap);
+		va_end(ap);
+		logk(site->level, "%s", buf);
+		return;
+	}
+
+	/*
+	 * The rate limit state is shared by all cores and updated without
+	 * locks, so it is only approximate when several cores log from the
+	 * same site at once.
+	 */
+	now = rdtsc();
+	if (now - site->window > (uint64_t) cycles_per_us * ONE_SECOND) {
+		site->window = now;
+		site->count = 0;
+	}
+	if (site->count >= LOG_FAST_RATE) {
+		site->suppressed++;
+		return;
+	}
+	site->count++;
+
+	if (unlikely(!site->id) && log_site_id(site) < 0)
+		return;
+
+	head = ring->head;
+	if (head - ring->tail >= LOG_RING_SIZE) {
+		ring->dropped++;
+		return;
+	}
+
+	rec = &ring->rec[head & (LOG_RING_SIZE - 1)];
+	rec->tsc = now;
+	rec->site = site->id;
+	rec->cpu = ring->cpu;
+	rec->nargs = min(nargs, BINLOG_MAX_ARGS);
+	rec->suppressed = site->suppressed;
+	site->suppressed = 0;
+
+	/* arguments are widened to 64 bits by the calling convention */
+	va_start(ap, nargs);
+	for (i = 0; i < rec->nargs; i++)
+		rec->args[i] = va_arg(ap, uint64_t);
+	va_end(ap);
+
+	/* publish the record after its contents */
+	asm volatile("" ::: "memory");
+	ring->head = head + 1;
+}
+
+static void log_write_site(struct log_site *site)
+{
+	struct binlog_site_ent ent = {
+		.type = BINLOG_ENT_SITE,
+		.id = site->id,
+		.level = site->level,
+		.line = site->line,
+		.fmt_len = strlen(site->fmt),
+		.file_len = strlen(site->file),
+	};
+
+	fwrite(&ent, sizeof(ent), 1, log_file);
+	fwrite(site->fmt, ent.fmt_len, 1, log_file);
+	fwrite(site->file, ent.file_len, 1, log_file);
+}
+
+static void log_print_record(struct binlog_record *rec, struct log_site *site)
+{
+	char msg[MAX_LOG_LEN];
+	time_t ts;
+	uint64_t age_us = (rdtsc() - rec->tsc) / cycles_per_us;
+	char stamp[32];
+
+	binlog_format(msg, sizeof(msg), site->fmt, rec->args, rec->nargs);
+
+	ts = time(NULL) - age_us / ONE_SECOND;
+	strftime(stamp, sizeof(stamp), "%H:%M:%S", localtime(&ts));
+	if (rec->suppressed)
+		printf("CPU %02d| %s <%d>: (%u similar messages suppressed)\n",
+		       rec->cpu, stamp, site->level, rec->suppressed);
+	printf("CPU %02d| %s <%d>: %s", rec->cpu, stamp, site->level, msg);
+}
+
+/* drains every core's ring; returns the number of records consumed */
+static int log_drain(void)
+{
+	static bool site_written[LOG_MAX_SITES];
+	int i, nr = 0;
+
+	pthread_mutex_lock(&log_drain_lock);
+	for (i = 0; i < log_nr_rings; i++) {
+		struct log_ring *ring = log_rings[i];
+		uint32_t tail = ring->tail, head = ring->head;
+		uint64_t dropped = ring->dropped;
+
+		/* read the records only after seeing head */
+		asm volatile("" ::: "memory");
+		for (; tail != head; tail++, nr++) {
+			struct binlog_record *rec = &ring->rec[tail & (LOG_RING_SIZE - 1)];
+			struct log_site *site = log_sites[rec->site];
+
+			if (!log_file) {
+				log_print_record(rec, site);
+				continue;
+			}
+
+			if (!site_written[rec->site]) {
+				log_write_site(site);
+				site_written[rec->site] = true;
+			}
+
+			struct binlog_record_ent ent = {
+				.type = BINLOG_ENT_RECORD,
+				.rec = *rec,
+			};
+			fwrite(&ent, sizeof(ent), 1, log_file);
+		}
+		asm volatile("" ::: "memory");
+		ring->tail = tail;
+
+		if (dropped != ring->dropped_seen) {
+			if (log_file) {
+				struct binlog_dropped_ent ent = {
+					.type = BINLOG_ENT_DROPPED,
+					.cpu = ring->cpu,
+					.count = dropped - ring->dropped_seen,
+				};
+				fwrite(&ent, sizeof(ent), 1, log_file);
+			} else {
+				printf("CPU %02d| log: %lu messages dropped, ring full\n",
+				       ring->cpu, dropped - ring->dropped_seen);
+			}
+			ring->dropped_seen = dropped;
+		}
+	}
+	if (nr) {
+		if (log_file)
+			fflush(log_file);
+		else
+			fflush(stdout);
+	}
+	pthread_mutex_unlock(&log_drain_lock);
+
+	return nr;
+}
+
+static void *log_thread(void *arg)
+{
+	while (true) {
+		if (!log_drain())
+			usleep(LOG_DRAIN_US);
+	}
+	return NULL;
+}
+
+static void log_exit(void)
+{
+	log_drain();
+}
+
+/**
+ * log_init - starts the thread that drains logk_fast() records
+ *
+ * Must run after the config is parsed.
+ */
+int log_init(void)
+{
+	pthread_t tid;
+
+	if (CFG.log_file[0]) {
+		struct binlog_file_hdr hdr = {
+			.magic = BINLOG_MAGIC,
+			.cycles_per_us = cycles_per_us,
+			.start_tsc = rdtsc(),
+			.start_time = time(NULL),
+		};
+
+		log_file = fopen(CFG.log_file, "w");
+		if (!log_file) {
+			log_err("log: cannot open %s\n", CFG.log_file);
+			return -EINVAL;
+		}
+		fwrite(&hdr, sizeof(hdr), 1, log_file);
+		log_info("log: writing binary log to %s\n", CFG.log_file);
+	}
+
+	if (pthread_create(&tid, NULL, log_thread, NULL))
+		return -EAGAIN;
+	atexit(log_exit);
+
+	return 0;
+}
+
+/**
+ * log_init_cpu - allocates the logk_fast() ring of the current core
+ */
+int log_init_cpu(void)
+{
+	struct log_ring *ring;
+	int idx;
+
+	if (posix_memalign((void **) &ring, CACHE_LINE_SIZE, sizeof(*ring)))
+		return -ENOMEM;
+	memset(ring, 0, sizeof(*ring));
+	ring->cpu = percpu_get(cpu_id);
+
+	pthread_mutex_lock(&log_drain_lock);
+	idx = log_nr_rings;
+	log_rings[idx] = ring;
+	log_nr_rings = idx + 1;
+	pthread_mutex_unlock(&log_drain_lock);
+
+	percpu_get(log_ring) = ring;
+	return 0;
+}
@@ -0,0 +1,1023 @@
+/*
+ * Copyright 2013-16 Board of Trustees of Stanford University
+ * Copyright 2013-16 Ecole Polytechnique Federale Lausanne (EPFL)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * nvme_sched.c - the flash token scheduler
+ *
+ * Subround 1 serves latency-critical (LC) tenants from their reserved token
+ * rate, subround 2 serves best-effort (BE) tenants by weighted deficit round
+ * robin from their fair share plus tokens donated to a global bucket.
+ *
+ * This file is also built into reflex_linux, so it must not use percpu
+ * variables, locks or anything else from the dataplane: per-thread state is
+ * passed in as struct nvme_tenant_mgmt, time comes from nvme_sched_now()
+ * and requests that got their tokens go to nvme_sched_issue(). Callers
+ * serialize flow group registration with their own lock.
+ */
+
+#include <assert.h>
+#include <libconfig.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <ix/errno.h>
+#include <ix/bitmap.h>
+#include <ix/nvme_sched.h>
+
+int nvme_dev_model = DEFAULT_FLASH;
+bool nvme_sched_flag = true;
+
+int NVME_READ_COST = 100;
+int NVME_WRITE_COST = 2000;
+int NVME_TRIM_COST = 100;
+int NVME_FLUSH_COST = 2000;
+int NVME_WRITE_ZEROES_COST = 2000;
+
+int NVME_MAX_INFLIGHT_TENANT;
+int NVME_MAX_INFLIGHT_BYTES_TENANT;
+int NVME_MAX_INFLIGHT_LC;
+int NVME_MAX_INFLIGHT_BYTES_LC;
+int NVME_MAX_INFLIGHT_BE;
+int NVME_MAX_INFLIGHT_BYTES_BE;
+unsigned long MAX_DEV_TOKEN_RATE = UINT_MAX;
+
+struct lat_tokenrate_pair dev_model[128];
+int dev_model_size;
+
+struct nvme_flow_group nvme_fgs[MAX_NVME_FLOW_GROUPS];
+DEFINE_BITMAP(nvme_fgs_bitmap, MAX_NVME_FLOW_GROUPS);
+
+static unsigned long global_token_rate = UINT_MAX; 				 	// max token rate device can handle for current strictest latency SLO
+static atomic_u64_t global_leftover_tokens = ATOMIC_INIT(0); 	 	// shared token bucket
+static unsigned long global_LC_sum_token_rate = 0; 	 				// LC tenant token reservation summed across all LC tenants globally
+static unsigned long global_num_best_effort_tenants = 0; 			// total num of best effort tenants
+static unsigned long global_num_lc_tenants = 0; 					// total num of latency critical tenants
+static unsigned long global_be_weight = 0; 							// sum of the weights of best effort tenants
+static atomic_t global_be_token_rate_per_weight = ATOMIC_INIT(0); 	// token rate per unit of best effort weight
+static atomic_u64_t global_be_token_rate = ATOMIC_INIT(0); 			// the same as a fixed-point rate
+static atomic_u64_t global_be_active_weight = ATOMIC_INIT(0); 		// weight of BE tenants with queued requests, all threads
+static unsigned long global_lc_boost_no_BE = 0; 			 		// fair share of leftover tokens that LC tenant can use when no BE registered
+static unsigned int global_strictest_latency_SLO = UINT_MAX;		// strictest latency SLO of registered LC tenants
+static bool global_readonly_flag = true;
+
+/*
+ * Caps on device commands and bytes in flight, 0 means no cap. The class
+ * caps apply per thread, since each thread has its own queue pair.
+ */
+struct nvme_inflight_cap {
+	unsigned int cmds;
+	unsigned long bytes;
+};
+static struct nvme_inflight_cap tenant_inflight_cap;
+static struct nvme_inflight_cap class_inflight_cap[2];			// indexed by NVME_CLASS_*
+
+static unsigned long sched_ticks_per_us = 1;
+static int sched_nr_threads = 1;
+static int scheduled_bit_vector[NVME_SCHED_MAX_THREADS];
+
+// LC tenants give away 9/10 of the tokens they don't use
+#define TOKEN_GIVEAWAY_NUM 9
+#define TOKEN_GIVEAWAY_DEN 10
+static long TOKEN_DEFICIT_LIMIT = 10000;
+static long DRR_QUANTUM = 100;
+
+#define SLO_REQ_SIZE 4096
+
+uint64_t token_rate_fixed(unsigned long tokens_per_s)
+{
+	return ((unsigned __int128) tokens_per_s << TOKEN_RATE_SHIFT) /
+			((uint64_t) sched_ticks_per_us * 1000000);
+}
+
+/*
+ * tokens_accrued: tokens earned at @rate over @delta_ticks, carrying the
+ * fraction of a token left over in @rem to the next round
+ */
+static inline unsigned long tokens_accrued(uint64_t rate, unsigned long delta_ticks, uint64_t *rem)
+{
+	unsigned __int128 acc = (unsigned __int128) rate * delta_ticks + *rem;
+
+	*rem = (uint64_t) acc & ((1UL << TOKEN_RATE_SHIFT) - 1);
+	return (unsigned long) (acc >> TOKEN_RATE_SHIFT);
+}
+
+static int compare_lat_tokenrate(const void *a, const void *b)
+{
+	const struct lat_tokenrate_pair *a_pair = a;
+	const struct lat_tokenrate_pair *b_pair = b;
+
+	return a_pair->p95_tail_latency - b_pair->p95_tail_latency;
+}
+
+/*
+ * Costs of commands without data. TRIM and FLUSH cost the same for any
+ * range, WRITE_ZEROES is charged per 4KB like a write. Defaults are derived
+ * from the read and write costs unless the device model sets them.
+ */
+static void parse_nvme_nodata_costs(config_t *model)
+{
+	int cost;
+
+	NVME_TRIM_COST = NVME_READ_COST;
+	NVME_FLUSH_COST = NVME_WRITE_COST;
+	NVME_WRITE_ZEROES_COST = NVME_WRITE_COST;
+
+	if (config_lookup_int(model, "trim_cost", &cost) && cost)
+		NVME_TRIM_COST = cost;
+	if (config_lookup_int(model, "flush_cost", &cost) && cost)
+		NVME_FLUSH_COST = cost;
+	if (config_lookup_int(model, "write_zeroes_cost_4KB", &cost) && cost)
+		NVME_WRITE_ZEROES_COST = cost;
+}
+
+/*
+ * Caps on commands and bytes in flight on the device, per tenant and per
+ * thread for each class (LC, BE). Without them, a tenant holding saved
+ * tokens can burst deep into the device queue.
+ */
+static void parse_nvme_inflight_limits(config_t *model)
+{
+	config_lookup_int(model, "max_inflight_tenant", &NVME_MAX_INFLIGHT_TENANT);
+	config_lookup_int(model, "max_inflight_bytes_tenant", &NVME_MAX_INFLIGHT_BYTES_TENANT);
+	config_lookup_int(model, "max_inflight_lc", &NVME_MAX_INFLIGHT_LC);
+	config_lookup_int(model, "max_inflight_bytes_lc", &NVME_MAX_INFLIGHT_BYTES_LC);
+	config_lookup_int(model, "max_inflight_be", &NVME_MAX_INFLIGHT_BE);
+	config_lookup_int(model, "max_inflight_bytes_be", &NVME_MAX_INFLIGHT_BYTES_BE);
+	if (NVME_MAX_INFLIGHT_TENANT < 0 || NVME_MAX_INFLIGHT_BYTES_TENANT < 0) {
+		nvme_sched_log("WARNING: per-tenant in-flight caps can't be derived, not capping tenants\n");
+		NVME_MAX_INFLIGHT_TENANT = 0;
+		NVME_MAX_INFLIGHT_BYTES_TENANT = 0;
+	}
+}
+
+/**
+ * nvme_sched_parse_devmodel - reads request costs and token limits
+ * @devmodel_file: the device model, see the sample in ix.conf.sample
+ *
+ * Returns 0 if successful, otherwise fail.
+ */
+int nvme_sched_parse_devmodel(const char *devmodel_file)
+{
+	config_t cfg_devmodel;
+	config_setting_t *token_limits, *entry;
+	int read_cost = 0, write_cost = 0;
+	long long max_token_rate = 0;
+	int i;
+
+	config_init(&cfg_devmodel);
+	if (!config_read_file(&cfg_devmodel, devmodel_file)) {
+		fprintf(stderr, "%s:%d - %s\n",
+			config_error_file(&cfg_devmodel),
+			config_error_line(&cfg_devmodel),
+			config_error_text(&cfg_devmodel));
+		config_destroy(&cfg_devmodel);
+		return -EINVAL;
+	}
+
+	nvme_sched_log("NVMe device model: %s\n", devmodel_file);
+	// parse device request costs
+	config_lookup_int(&cfg_devmodel, "read_cost_4KB", &read_cost);
+	config_lookup_int(&cfg_devmodel, "write_cost_4KB", &write_cost);
+	if (read_cost)
+		NVME_READ_COST = read_cost;
+	else
+		nvme_sched_log("WARNING: no read cost specified. Default is 100 tokens.\n");
+	if (write_cost)
+		NVME_WRITE_COST = write_cost;
+	else
+		nvme_sched_log("WARNING: no write cost specified. Default is 2000 tokens.\n");
+	parse_nvme_nodata_costs(&cfg_devmodel);
+	parse_nvme_inflight_limits(&cfg_devmodel);
+
+	// parse token limits and store in memory for lookup during runtime
+	config_lookup_int64(&cfg_devmodel, "max_token_rate", &max_token_rate);
+	MAX_DEV_TOKEN_RATE = max_token_rate ? (unsigned long) max_token_rate : UINT_MAX;
+
+	token_limits = config_lookup(&cfg_devmodel, "token_limits");
+	if (!token_limits) {
+		nvme_sched_log("WARNING: no token limits specified.\n");
+		config_destroy(&cfg_devmodel);
+		return 0;
+	}
+
+	dev_model_size = config_setting_length(token_limits);
+	if (dev_model_size > ARRAY_SIZE(dev_model)) {
+		nvme_sched_log("WARNING: only the first %d token limits are used\n",
+			       (int) ARRAY_SIZE(dev_model));
+		dev_model_size = ARRAY_SIZE(dev_model);
+	}
+
+	for (i = 0; i < dev_model_size; i++) {
+		int lat = 0;
+		long long token_rate_limit = 0, token_rdonly_rate_limit = 0;
+
+		entry = config_setting_get_elem(token_limits, i);
+		config_setting_lookup_int(entry, "p95_latency_limit", &lat);
+		config_setting_lookup_int64(entry, "max_token_rate", &token_rate_limit);
+		config_setting_lookup_int64(entry, "max_rdonly_token_rate", &token_rdonly_rate_limit);
+		if (!lat || !token_rate_limit) {
+			dev_model_size = 0;
+			config_destroy(&cfg_devmodel);
+			return -EINVAL;
+		}
+
+		dev_model[i].p95_tail_latency = lat;
+		dev_model[i].token_rate_limit = (unsigned long) token_rate_limit;
+		dev_model[i].token_rdonly_rate_limit = token_rdonly_rate_limit ?
+			(unsigned long) token_rdonly_rate_limit : (unsigned long) token_rate_limit;
+	}
+	// sort dev_model array for easy lookup during runtime
+	qsort(dev_model, dev_model_size, sizeof(struct lat_tokenrate_pair), &compare_lat_tokenrate);
+
+	config_destroy(&cfg_devmodel);
+	return 0;
+}
+
+static void update_inflight_caps(void);
+
+/**
+ * nvme_sched_init - sets up the scheduler once the device model is known
+ * @ticks_per_us: the rate of the nvme_sched_now() clock
+ * @nr_threads: the number of threads calling nvme_sched_round()
+ */
+void nvme_sched_init(unsigned long ticks_per_us, int nr_threads)
+{
+	assert(nr_threads > 0 && nr_threads <= NVME_SCHED_MAX_THREADS);
+	sched_ticks_per_us = ticks_per_us;
+	sched_nr_threads = nr_threads;
+
+	// adjust token deficit limit to allow LC tenants to burst, but not too much
+	nvme_sched_log("DEVICE PARAMS: read cost %d, write cost %d\n", NVME_READ_COST, NVME_WRITE_COST);
+	TOKEN_DEFICIT_LIMIT = 100*NVME_WRITE_COST;
+	// any 4KB request fits in the DRR quantum of a tenant with weight 1
+	DRR_QUANTUM = max(NVME_READ_COST, NVME_WRITE_COST);
+
+	update_inflight_caps();
+}
+
+/**
+ * nvme_sched_thread_init - initializes a thread's tenant manager
+ * @m: the thread's state
+ * @tid: the thread index, below the count passed to nvme_sched_init()
+ */
+void nvme_sched_thread_init(struct nvme_tenant_mgmt *m, int tid)
+{
+	memset(m, 0, sizeof(*m));
+	list_head_init(&m->tenant_swq);
+	list_head_init(&m->be_active);
+	m->tid = tid;
+	m->last_sched_time = nvme_sched_now();
+}
+
+// publish this thread's active BE weight, which splits the global leftover tokens
+static void publish_be_active_weight(struct nvme_tenant_mgmt *m)
+{
+	if (m->be_active_weight == m->be_active_weight_published)
+		return;
+	atomic_u64_fetch_and_add(&global_be_active_weight,
+				 m->be_active_weight - m->be_active_weight_published);
+	m->be_active_weight_published = m->be_active_weight;
+}
+
+/**
+ * nvme_sched_thread_idle - a thread stops or resumes calling nvme_sched_round()
+ * @m: the thread's state
+ * @idle: true before the thread sleeps, false once it runs again
+ *
+ * nvme_sched_running() must return false for the thread while it sleeps,
+ * so the global bucket keeps being reset without it. A thread that wakes
+ * up starts a fresh interval rather than collecting tokens for the time
+ * it slept.
+ */
+void nvme_sched_thread_idle(struct nvme_tenant_mgmt *m, bool idle)
+{
+	if (idle)
+		publish_be_active_weight(m);
+	else
+		m->last_sched_time = nvme_sched_now();
+}
+
+/*
+ * Best-effort tenants share this thread's BE tokens by deficit round robin
+ * (DRR): each turn adds the tenant's weight times DRR_QUANTUM to its
+ * deficit, and the tenant issues requests while their cost fits in it.
+ * Only tenants with queued requests are linked in be_active, so picking
+ * the next tenant is O(1).
+ */
+void drr_activate(struct nvme_tenant_mgmt *m, struct nvme_sw_queue *swq)
+{
+	if (swq->drr_active)
+		return;
+	swq->drr_active = true;
+	list_add_tail(&m->be_active, &swq->drr_list);
+	m->be_active_weight += nvme_fgs[swq->fg_handle].be_weight;
+}
+
+void drr_deactivate(struct nvme_tenant_mgmt *m, struct nvme_sw_queue *swq)
+{
+	if (!swq->drr_active)
+		return;
+	swq->drr_active = false;
+	list_del(&swq->drr_list);
+	m->be_active_weight -= nvme_fgs[swq->fg_handle].be_weight;
+}
+
+// request cost scales linearly with size above 4KB
+// note: may need to adjust this if does not match your Flash device behavior
+int nvme_compute_req_cost(int req_type, size_t req_len)
+{
+	int len_scale_factor = 1;
+
+	// TRIM and FLUSH cost the same regardless of range
+	if (req_type == NVME_CMD_TRIM)
+		return NVME_TRIM_COST;
+	if (req_type == NVME_CMD_FLUSH)
+		return NVME_FLUSH_COST;
+
+	if (req_len == 0)
+		return 0;
+
+	if (req_len > 4096){
+		// divide req_len by 4096 and round up
+		len_scale_factor = (req_len  + 4096 -1 )/ 4096;
+	}
+
+	if (req_type == NVME_CMD_READ)
+		return NVME_READ_COST * len_scale_factor;
+	else if (req_type == NVME_CMD_WRITE)
+		return NVME_WRITE_COST * len_scale_factor;
+	else if (req_type == NVME_CMD_WRITE_ZEROES)
+		return NVME_WRITE_ZEROES_COST * len_scale_factor;
+	return 1;
+}
+
+static unsigned long find_token_limit_from_devmodel(unsigned int lat_SLO)
+{
+	unsigned long y0, y1, x0, x1;
+	int i;
+
+	if (!dev_model_size)
+		return MAX_DEV_TOKEN_RATE;
+
+	for (i = 0; i < dev_model_size; i++) {
+		if (lat_SLO < dev_model[i].p95_tail_latency)
+			break;
+	}
+	if (i == 0) {
+		nvme_sched_log("WARNING: provide dev model info for latency SLO %u\n", lat_SLO);
+		return global_readonly_flag ? dev_model[0].token_rdonly_rate_limit :
+		       dev_model[0].token_rate_limit;
+	}
+
+	if (global_readonly_flag) {
+		if (i == dev_model_size)
+			return dev_model[i-1].token_rdonly_rate_limit;
+		y0 = dev_model[i-1].token_rdonly_rate_limit;
+		y1 = dev_model[i].token_rdonly_rate_limit;
+	} else {
+		if (i == dev_model_size)
+			return dev_model[i-1].token_rate_limit;
+		y0 = dev_model[i-1].token_rate_limit;
+		y1 = dev_model[i].token_rate_limit;
+	}
+	// linear interpolation of token limits provided in devmodel config file
+	x0 = dev_model[i-1].p95_tail_latency;
+	x1 = dev_model[i].p95_tail_latency;
+	assert(x1-x0 != 0);
+	return (unsigned long) (y0 + (((double) y1 - y0) * (lat_SLO - x0) / (double) (x1 - x0)));
+}
+
+static unsigned long lookup_device_token_rate(unsigned int lat_SLO)
+{
+	switch (nvme_dev_model) {
+	case FLASH_DEV_MODEL:
+		return find_token_limit_from_devmodel(lat_SLO);
+	default:
+		return UINT_MAX;
+	}
+}
+
+unsigned long scaled_IOPS(unsigned long IOPS, int rw_ratio_100)
+{
+	double scaledIOPS;
+	double rw_ratio = (double) rw_ratio_100 / (double) 100;
+
+	/*
+	 * NOTE: when calculating token reservation for latency-critical tenants,
+	 * 		 assume SLO specificed for 4kB requests
+	 * 		 e.g. if your application's IOPS SLO is 100K IOPS for 8K IOs,
+	 * 		      register your app's SLO with ReFlex as 200K IOPS
+	 */
+	scaledIOPS = (IOPS * rw_ratio * nvme_compute_req_cost(NVME_CMD_READ, SLO_REQ_SIZE))
+					+ (IOPS * (1-rw_ratio) * nvme_compute_req_cost(NVME_CMD_WRITE, SLO_REQ_SIZE));
+	return (unsigned long) (scaledIOPS + 0.5);
+}
+
+static void readjust_lc_tenant_token_limits(void)
+{
+	int i,j = 0;
+	for (i = 0; i < MAX_NVME_FLOW_GROUPS; i++){
+		if (bitmap_test(nvme_fgs_bitmap, i)) {
+			if (nvme_fgs[i].latency_critical_flag) {
+				nvme_fgs[i].token_rate = token_rate_fixed(nvme_fgs[i].scaled_IOPS_limit + global_lc_boost_no_BE);
+				j++;
+				if (j == global_num_lc_tenants){
+					return;
+				}
+			}
+		}
+	}
+
+}
+
+/*
+ * derive_class_inflight_cap: Little's law, the tokens a class may spend
+ * per thread over one strictest-SLO interval, expressed in 4KB reads
+ */
+static void derive_class_inflight_cap(struct nvme_inflight_cap *cap, unsigned long class_token_rate)
+{
+	unsigned long tokens;
+
+	if (nvme_dev_model != FLASH_DEV_MODEL || global_strictest_latency_SLO == UINT_MAX) {
+		cap->cmds = 0;
+		cap->bytes = 0;
+		return;
+	}
+
+	tokens = (unsigned long) ((double) class_token_rate * global_strictest_latency_SLO / 1E6);
+	tokens /= sched_nr_threads;
+	cap->cmds = max(tokens / NVME_READ_COST, 1UL);
+	cap->bytes = (unsigned long) cap->cmds * SLO_REQ_SIZE;
+}
+
+static void set_class_inflight_cap(int sched_class, int cmds, int bytes, unsigned long class_token_rate)
+{
+	struct nvme_inflight_cap *cap = &class_inflight_cap[sched_class];
+
+	if (cmds < 0 || bytes < 0)
+		derive_class_inflight_cap(cap, class_token_rate);
+	if (cmds >= 0)
+		cap->cmds = cmds;
+	if (bytes >= 0)
+		cap->bytes = bytes;
+}
+
+/*
+ * update_inflight_caps: recomputes the in-flight caps after the token rates
+ * changed
+ */
+static void update_inflight_caps(void)
+{
+	struct nvme_inflight_cap old_lc = class_inflight_cap[NVME_CLASS_LC];
+	struct nvme_inflight_cap old_be = class_inflight_cap[NVME_CLASS_BE];
+
+	tenant_inflight_cap.cmds = NVME_MAX_INFLIGHT_TENANT;
+	tenant_inflight_cap.bytes = NVME_MAX_INFLIGHT_BYTES_TENANT;
+	set_class_inflight_cap(NVME_CLASS_LC, NVME_MAX_INFLIGHT_LC, NVME_MAX_INFLIGHT_BYTES_LC,
+			       global_LC_sum_token_rate);
+	set_class_inflight_cap(NVME_CLASS_BE, NVME_MAX_INFLIGHT_BE, NVME_MAX_INFLIGHT_BYTES_BE,
+			       global_token_rate - global_LC_sum_token_rate);
+
+	if (memcmp(&old_lc, &class_inflight_cap[NVME_CLASS_LC], sizeof(old_lc)) ||
+	    memcmp(&old_be, &class_inflight_cap[NVME_CLASS_BE], sizeof(old_be)))
+		nvme_sched_log("In-flight caps per thread: LC %u cmds %lu bytes, BE %u cmds %lu bytes\n",
+			       class_inflight_cap[NVME_CLASS_LC].cmds, class_inflight_cap[NVME_CLASS_LC].bytes,
+			       class_inflight_cap[NVME_CLASS_BE].cmds, class_inflight_cap[NVME_CLASS_BE].bytes);
+}
+
+/* derives the BE fair share and the LC boost from the global token rates */
+static void update_be_token_rate(void)
+{
+	unsigned long lc_token_rate_boost_when_no_BE = 0;
+	unsigned int be_token_rate_per_weight = 0;
+
+	if (global_num_best_effort_tenants) {
+		be_token_rate_per_weight = (global_token_rate - global_LC_sum_token_rate) / global_be_weight;
+	} else if (global_num_lc_tenants) {
+		lc_token_rate_boost_when_no_BE = (global_token_rate - global_LC_sum_token_rate) /
+						 global_num_lc_tenants;
+	}
+	atomic_write(&global_be_token_rate_per_weight, be_token_rate_per_weight);
+	atomic_u64_write(&global_be_token_rate, token_rate_fixed(be_token_rate_per_weight));
+
+	// if number of BE tenants has changes from 0 to 1 or more (or vice versa)
+	// adjust LC tenant boost (only want to boost if no BE tenants registered)
+	if (lc_token_rate_boost_when_no_BE != global_lc_boost_no_BE){
+		global_lc_boost_no_BE = lc_token_rate_boost_when_no_BE;
+		readjust_lc_tenant_token_limits();
+	}
+	update_inflight_caps();
+}
+
+/**
+ * recalculate_weights_add - accounts for a new tenant in the global token rates
+ * @new_flow_group_idx: the tenant's flow group, with its SLO filled in
+ *
+ * Call with the caller's flow group lock held.
+ *
+ * Returns false if the device can't meet the tenant's SLO next to the
+ * tenants already registered, and the tenant must not be registered.
+ */
+bool recalculate_weights_add(long new_flow_group_idx)
+{
+	struct nvme_flow_group *fg = &nvme_fgs[new_flow_group_idx];
+	unsigned long new_global_token_rate = 0;
+	unsigned long new_global_LC_sum_token_rate = 0;
+
+	if (fg->latency_critical_flag) {
+		new_global_LC_sum_token_rate = global_LC_sum_token_rate + fg->scaled_IOPS_limit;
+		if (fg->rw_ratio_SLO < 100){
+			global_readonly_flag = false;
+		}
+
+		new_global_token_rate = lookup_device_token_rate(fg->latency_us_SLO);
+		if (new_global_token_rate > global_token_rate){
+			new_global_token_rate = global_token_rate; // keep limit based on strictest latency SLO
+		}
+
+		if (new_global_LC_sum_token_rate > new_global_token_rate){
+			// control plane notifies tenant can't meet its SLO
+			// don't update the global token rate since won't regsiter this tenant
+			nvme_sched_log("CANNOT SATISFY TENANT's SLO: %lu > %lu\n",
+				       new_global_LC_sum_token_rate, new_global_token_rate);
+			return false;
+		}
+
+		global_token_rate = new_global_token_rate;
+		global_LC_sum_token_rate = new_global_LC_sum_token_rate;
+		if (fg->latency_us_SLO < global_strictest_latency_SLO)
+			global_strictest_latency_SLO = fg->latency_us_SLO;
+		nvme_sched_log("Global token rate: %lu tokens/s.\n", global_token_rate);
+		global_num_lc_tenants++;
+	}
+	else{
+		global_num_best_effort_tenants++;
+		global_be_weight += fg->be_weight;
+		global_readonly_flag = false; // assume BE tenant has rd/wr mixed workload
+	}
+
+	update_be_token_rate();
+	return true;
+}
+
+/**
+ * recalculate_weights_remove - drops a tenant from the global token rates
+ * @flow_group_idx: the tenant's flow group
+ *
+ * Call with the caller's flow group lock held.
+ */
+void recalculate_weights_remove(long flow_group_idx)
+{
+	long i;
+	unsigned int strictest_latency_SLO = UINT_MAX;
+
+	if (nvme_fgs[flow_group_idx].latency_critical_flag) {
+		//find new strictest latency SLO
+		global_readonly_flag = true;
+		for (i = 0; i < MAX_NVME_FLOW_GROUPS; i++){
+			if (bitmap_test(nvme_fgs_bitmap, i) && i != flow_group_idx) {
+				if (nvme_fgs[i].latency_critical_flag) {
+					if(nvme_fgs[i].latency_us_SLO < strictest_latency_SLO){
+						strictest_latency_SLO = nvme_fgs[i].latency_us_SLO;
+					}
+					if(nvme_fgs[i].rw_ratio_SLO < 100){
+						global_readonly_flag = false;
+					}
+				}
+			}
+		}
+		global_LC_sum_token_rate -= nvme_fgs[flow_group_idx].scaled_IOPS_limit;
+		global_token_rate = lookup_device_token_rate(strictest_latency_SLO);
+		global_strictest_latency_SLO = strictest_latency_SLO;
+
+		nvme_sched_log("Global token rate: %lu tokens/s\n", global_token_rate);
+
+		global_num_lc_tenants--;
+	}
+	else{
+		global_num_best_effort_tenants--;
+		global_be_weight -= nvme_fgs[flow_group_idx].be_weight;
+	}
+
+	if (global_num_best_effort_tenants)
+		global_readonly_flag = false;
+	update_be_token_rate();
+}
+
+/**
+ * nvme_sched_add_tenant - makes a thread serve a tenant
+ * @m: the thread's state
+ * @swq: the tenant's software queue, initialized here
+ * @fg_handle: the tenant's flow group
+ */
+void nvme_sched_add_tenant(struct nvme_tenant_mgmt *m, struct nvme_sw_queue *swq,
+			   long fg_handle)
+{
+	struct nvme_flow_group *fg = &nvme_fgs[fg_handle];
+
+	nvme_sw_queue_init(swq, fg_handle);
+	fg->nvme_swq = swq;
+	list_add(&m->tenant_swq, &swq->list);
+	m->num_tenants++;
+	if (!fg->latency_critical_flag) {
+		m->num_best_effort_tenants++;
+		m->be_weight += fg->be_weight;
+	}
+}
+
+/**
+ * nvme_sched_remove_tenant - stops serving a tenant
+ * @m: the thread's state
+ * @swq: the tenant's software queue, which the caller frees
+ */
+void nvme_sched_remove_tenant(struct nvme_tenant_mgmt *m, struct nvme_sw_queue *swq)
+{
+	if (!nvme_fgs[swq->fg_handle].latency_critical_flag) {
+		m->num_best_effort_tenants--;
+		m->be_weight -= nvme_fgs[swq->fg_handle].be_weight;
+		drr_deactivate(m, swq);
+	}
+	list_del(&swq->list);
+	m->num_tenants--;
+}
+
+/**
+ * nvme_sched_enqueue - queues a request until its tenant has the tokens
+ * @m: the thread's state
+ * @fg_handle: the tenant's flow group, served by this thread
+ * @req: the request
+ * @cmd: the NVME_CMD_* command
+ * @len: the request length in bytes
+ *
+ * Returns 0 if successful, or -EAGAIN if the tenant's queue is full.
+ */
+int nvme_sched_enqueue(struct nvme_tenant_mgmt *m, long fg_handle,
+		       struct nvme_sched_req *req, int cmd, size_t len)
+{
+	struct nvme_sw_queue *swq = nvme_fgs[fg_handle].nvme_swq;
+	int ret;
+
+	req->req_cost = nvme_compute_req_cost(cmd, len);
+	req->bytes = (cmd == NVME_CMD_TRIM || cmd == NVME_CMD_FLUSH) ? 0 : len;
+	req->swq = NULL;
+
+	ret = nvme_sw_queue_push_back(swq, req);
+	if (ret == 0 && !nvme_fgs[fg_handle].latency_critical_flag)
+		drr_activate(m, swq);
+	return ret;
+}
+
+static inline bool nvme_inflight_fits(const struct nvme_inflight_cap *cap, unsigned int cmds,
+				      unsigned long bytes, unsigned long req_bytes)
+{
+	// an idle tenant or class may always issue one command, however large
+	if (cmds == 0)
+		return true;
+	if (cap->cmds && cmds >= cap->cmds)
+		return false;
+	if (cap->bytes && bytes + req_bytes > cap->bytes)
+		return false;
+	return true;
+}
+
+/*
+ * nvme_inflight_allowed: whether the command at the head of the tenant's
+ * software queue fits under the tenant's and its class's in-flight caps
+ */
+static bool nvme_inflight_allowed(struct nvme_tenant_mgmt *m, struct nvme_sw_queue *swq,
+				  int sched_class)
+{
+	unsigned long bytes;
+
+	// a tenant being migrated waits for its in-flight commands to drain
+	if (swq->draining)
+		return false;
+
+	bytes = nvme_sw_queue_peek_head(swq)->bytes;
+	return nvme_inflight_fits(&tenant_inflight_cap, swq->inflight_cmds,
+				  swq->inflight_bytes, bytes) &&
+	       nvme_inflight_fits(&class_inflight_cap[sched_class],
+				  m->class_inflight_cmds[sched_class],
+				  m->class_inflight_bytes[sched_class], bytes);
+}
+
+static void nvme_inflight_get(struct nvme_tenant_mgmt *m, struct nvme_sw_queue *swq,
+			      struct nvme_sched_req *req)
+{
+	req->swq = swq;
+	req->sched_class = nvme_fgs[swq->fg_handle].latency_critical_flag ?
+			   NVME_CLASS_LC : NVME_CLASS_BE;
+	swq->inflight_cmds++;
+	swq->inflight_bytes += req->bytes;
+	m->class_inflight_cmds[req->sched_class]++;
+	m->class_inflight_bytes[req->sched_class] += req->bytes;
+}
+
+/**
+ * nvme_inflight_put - releases a completed command from the in-flight caps
+ * @m: the state of the thread that issued the command
+ * @req: the request, which may have bypassed the scheduler
+ *
+ * Completions are handled on the thread that issued the command, which
+ * also owns the tenant's software queue. The servers only unregister a
+ * tenant once its commands have completed, so the queue is still around.
+ */
+void nvme_inflight_put(struct nvme_tenant_mgmt *m, struct nvme_sched_req *req)
+{
+	struct nvme_sw_queue *swq = req->swq;
+
+	if (!swq)
+		return;
+
+	swq->inflight_cmds--;
+	swq->inflight_bytes -= req->bytes;
+	m->class_inflight_cmds[req->sched_class]--;
+	m->class_inflight_bytes[req->sched_class] -= req->bytes;
+	req->swq = NULL;
+}
+
+/*
+ * try_acquire_global_tokens: takes up to @token_demand tokens from the
+ * global leftover pool, but no more than this thread's share of it by
+ * @weight, the weight of its BE tenants with queued requests
+ */
+static unsigned long try_acquire_global_tokens(unsigned long token_demand, unsigned long weight)
+{
+	unsigned long new_token_level = 0;
+	unsigned long avail_tokens = 0;
+	unsigned long active_weight, share;
+
+	while (1) {
+		avail_tokens = atomic_u64_read(&global_leftover_tokens);
+		active_weight = atomic_u64_read(&global_be_active_weight);
+		if (active_weight > weight) {
+			share = avail_tokens * weight / active_weight;
+			if (token_demand > share)
+				token_demand = share;
+		}
+
+		if (token_demand > avail_tokens) {
+			if (atomic_u64_cmpxchg(&global_leftover_tokens, avail_tokens, 0)){
+				return avail_tokens;
+			}
+
+		}
+		else {
+			new_token_level = avail_tokens - token_demand;
+			if (atomic_u64_cmpxchg(&global_leftover_tokens, avail_tokens, new_token_level)){
+				return token_demand;
+			}
+		}
+	}
+}
+
+/*
+ * issue_nvme_req: hands the request at the head of @swq to the server,
+ * returns its cost. The request may be freed once issued.
+ */
+static inline int issue_nvme_req(struct nvme_tenant_mgmt *m, struct nvme_sw_queue *swq)
+{
+	struct nvme_sched_req *req;
+	int cost;
+
+	nvme_sw_queue_pop_front(swq, &req);
+	cost = req->req_cost;
+	swq->issued_tokens += cost;
+	nvme_inflight_get(m, swq, req);
+	nvme_sched_issue(m, req);
+	return cost;
+}
+
+/*
+ * nvme_sched_subround1: schedule latency critical tenant traffic
+ */
+static inline void nvme_sched_subround1(struct nvme_tenant_mgmt *m, unsigned long time_delta)
+{
+	struct nvme_sw_queue* nvme_swq;
+	long POS_LIMIT = 0;
+	long giveaway;
+	unsigned long local_leftover = 0;
+	unsigned long local_demand = 0;
+	unsigned long token_increment;
+
+	list_for_each(&m->tenant_swq, nvme_swq, list) {
+		// serve latency-critical (LC) tenants
+		if (nvme_fgs[nvme_swq->fg_handle].latency_critical_flag) {
+			token_increment = tokens_accrued(nvme_fgs[nvme_swq->fg_handle].token_rate,
+							 time_delta, &nvme_swq->token_rem);
+			nvme_swq->token_credit += token_increment;
+			if (nvme_swq->token_credit < -TOKEN_DEFICIT_LIMIT){
+				/*
+				 * Notify control plane, may need to re-negotiate tenant SLO
+				 * FUTURE WORK: implement control plane
+				 */
+
+				//TODO: try to grab from global token bucket
+				//NOTE: may also need to schedule LC tenants in round robin for fairness
+			}
+			while (nvme_sw_queue_isempty(nvme_swq) == 0 &&
+				   nvme_swq->token_credit > -TOKEN_DEFICIT_LIMIT &&
+				   nvme_inflight_allowed(m, nvme_swq, NVME_CLASS_LC))
+				nvme_swq->token_credit -= issue_nvme_req(m, nvme_swq);
+
+			/*
+			 * POS_LIMIT can be tuned to balance work-conservation and favoring of LC traffic
+			 *	  * default POS_LIMIT    = 3 * token_increment
+			 *	  						if LC tenant doesn't use tokens accumulated
+			 *	  						from ~3 sched rounds, donate them
+			 *
+			 *   * lower POS_LIMIT 		is good for work-conservation
+			 *   						(give tokens to BE tenants more easily)
+			 *
+			 *   * higher POS_LIMIT 	allows latency-critical tenants to accumulate
+			 *     						more tokens & burst
+			 */
+			POS_LIMIT = 3 * token_increment;
+			if (nvme_swq->token_credit > POS_LIMIT) {
+				giveaway = nvme_swq->token_credit * TOKEN_GIVEAWAY_NUM / TOKEN_GIVEAWAY_DEN;
+				local_leftover += giveaway;
+				nvme_swq->token_credit -= giveaway;
+			}
+		}
+		else { // track demand of best-effort (will need for subround2)
+			local_demand += nvme_swq->total_token_demand - nvme_swq->saved_tokens;
+		}
+	}
+
+	m->local_extra_demand = local_demand;
+	m->local_leftover_tokens = local_leftover;
+}
+
+/*
+ * nvme_sched_subround2: schedule best-effort tenant traffic
+ */
+static inline void nvme_sched_subround2(struct nvme_tenant_mgmt *m, unsigned long time_delta)
+{
+	struct nvme_sw_queue* nvme_swq;
+	int cost;
+	unsigned long local_leftover = m->local_leftover_tokens;
+	unsigned long local_demand = m->local_extra_demand;
+	unsigned long be_tokens = 0;
+	unsigned long token_demand = 0;
+	unsigned long global_tokens_acquired = 0;
+	uint64_t be_token_rate = atomic_u64_read(&global_be_token_rate);
+	bool issued, capped, out_of_tokens = false;
+	int stalled = 0;
+
+	// compare local leftover with local demand
+	// synchronize access to global token bucket
+	if (local_leftover > 0 && local_demand == 0) { //give away leftoever tokens to global pool
+		atomic_u64_fetch_and_add(&global_leftover_tokens, local_leftover);
+		return;
+	}
+	else if (local_leftover < local_demand) { //try to get how much you need from global pool
+		token_demand = local_demand - local_leftover;
+		global_tokens_acquired = try_acquire_global_tokens(token_demand,
+								   m->be_active_weight); // atomic
+		be_tokens = local_leftover + global_tokens_acquired;
+	}
+	else if (local_leftover >= local_demand) {
+		be_tokens = local_leftover;
+	}
+
+	// this thread's share of the BE token rate, by the weight of its BE tenants
+	be_tokens += tokens_accrued(be_token_rate * m->be_weight, time_delta, &m->be_token_rem);
+
+	/*
+	 * serve best effort tenants by deficit round robin; a tenant that
+	 * issues nothing moves to the tail, so stop once every tenant had a
+	 * turn without issuing
+	 */
+	while ((nvme_swq = list_top(&m->be_active, struct nvme_sw_queue, drr_list)) &&
+	       stalled < m->num_best_effort_tenants) {
+		if (!nvme_swq->drr_turn) {
+			nvme_swq->drr_deficit += DRR_QUANTUM * nvme_fgs[nvme_swq->fg_handle].be_weight;
+			nvme_swq->drr_turn = true;
+		}
+		be_tokens += nvme_sw_queue_take_saved_tokens(nvme_swq);
+
+		issued = false;
+		capped = false;
+		while (nvme_sw_queue_isempty(nvme_swq) == 0 &&
+		       nvme_sw_queue_peak_head_cost(nvme_swq) <= nvme_swq->drr_deficit) {
+			if (nvme_sw_queue_peak_head_cost(nvme_swq) > be_tokens) {
+				out_of_tokens = true;
+				break;
+			}
+			if (!nvme_inflight_allowed(m, nvme_swq, NVME_CLASS_BE)) {
+				capped = true;
+				break;
+			}
+			cost = issue_nvme_req(m, nvme_swq);
+			nvme_swq->drr_deficit -= cost;
+			be_tokens -= cost;
+			issued = true;
+		}
+
+		if (out_of_tokens) {
+			// keep the turn and save tokens toward the head request
+			be_tokens -= nvme_sw_queue_save_tokens(nvme_swq, be_tokens);
+			break;
+		}
+
+		if (nvme_sw_queue_isempty(nvme_swq)) {
+			nvme_swq->drr_deficit = 0;
+			nvme_swq->drr_turn = false;
+			drr_deactivate(m, nvme_swq);
+		}
+		else {
+			// a tenant held back by in-flight caps keeps its turn, so its deficit doesn't grow
+			if (!capped)
+				nvme_swq->drr_turn = false;
+			list_del(&nvme_swq->drr_list);
+			list_add_tail(&m->be_active, &nvme_swq->drr_list);
+		}
+		stalled = issued ? 0 : stalled + 1;
+	}
+
+	if (be_tokens > 0){
+		atomic_u64_fetch_and_add(&global_leftover_tokens, be_tokens);
+	}
+
+}
+
+/*
+ * update_scheduler_bitvector:
+ * 		- synchronizes clearing of the global token bucket to limit global BE token accumulation
+ * 		- mark global bitvector to indicate this thread has completed a scheduling round
+ * 		- if last thread to complete a round, clear the global vector
+ * 		- updates to global vector are not atomic operations because want to limit perf overhead
+ * 		  and the exact timing of token bucket reset is not critical, as long as we reset approximately
+ * 		  after each thread has had a chance to get tokens
+ * 		- threads that don't run the scheduler (parked or asleep) are not waited for
+ */
+static void update_scheduled_bitvector(struct nvme_tenant_mgmt *m)
+{
+	int i;
+
+	scheduled_bit_vector[m->tid]++;
+
+	for (i = 0; i < sched_nr_threads; i++){
+		if (scheduled_bit_vector[i] == 0 && nvme_sched_running(i))
+			break;
+	}
+	if (i == sched_nr_threads){ // all other threads scheduled at least once
+		atomic_u64_write(&global_leftover_tokens, 0);
+
+		//clear scheduled bit vector
+		for (i = 0; i < sched_nr_threads; i++) {
+			scheduled_bit_vector[i] =  0;
+		}
+	}
+}
+
+/**
+ * nvme_sched_round - runs one scheduling round for the calling thread
+ * @m: the thread's state
+ *
+ * Issues the queued requests whose tenants have the tokens for them.
+ */
+void nvme_sched_round(struct nvme_tenant_mgmt *m)
+{
+	unsigned long now, time_delta;
+
+	now = nvme_sched_now();
+	time_delta = now - m->last_sched_time;
+	m->last_sched_time = now;
+	publish_be_active_weight(m);
+
+	if (m->num_tenants == 0) {
+		update_scheduled_bitvector(m);
+		return;
+	}
+
+	nvme_sched_subround1(m, time_delta); // serve latency-critical tenants
+	nvme_sched_subround2(m, time_delta); // serve best-effort tenants
+
+	m->local_leftover_tokens = 0;
+	m->local_extra_demand = 0;
+
+	update_scheduled_bitvector(m);
+}
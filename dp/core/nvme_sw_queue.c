@@ -1,11 +1,5 @@
-#include <stdio.h>
-#include <stdlib.h>
-#include <string.h>
-
 #include <ix/nvme_sw_queue.h>
 #include <ix/errno.h>
-#include <ix/log.h>
-#include <ix/timer.h>
 
 
 void nvme_sw_queue_init(struct nvme_sw_queue *q, long fg_handle)
@@ -16,29 +10,35 @@ void nvme_sw_queue_init(struct nvme_sw_queue *q, long fg_handle)
 	q->total_token_demand = 0;
 	q->saved_tokens = 0;
 	q->token_credit = 0;
+	q->token_rem = 0;
+	q->inflight_cmds = 0;
+	q->inflight_bytes = 0;
+	q->issued_tokens = 0;
+	q->draining = false;
+	q->drr_deficit = 0;
+	q->drr_turn = false;
+	q->drr_active = false;
 	q->fg_handle = fg_handle;
 }
 
-int nvme_sw_queue_push_back(struct nvme_sw_queue *q, struct nvme_ctx *ctx)
+int nvme_sw_queue_push_back(struct nvme_sw_queue *q, struct nvme_sched_req *req)
 {
-    if(q->count == NVME_SW_QUEUE_SIZE){ 
-		log_info("nvme_sw_queue full!\n");
+    if(q->count == NVME_SW_QUEUE_SIZE)
 		return -EAGAIN;
-	}
-	q->buf[q->head] = ctx;
+	q->buf[q->head] = req;
    	q->head = (q->head + 1) % NVME_SW_QUEUE_SIZE; 
     q->count++;
-	q->total_token_demand += ctx->req_cost;
+	q->total_token_demand += req->req_cost;
 	return 0;
 }
 
-int nvme_sw_queue_pop_front(struct nvme_sw_queue *q, struct nvme_ctx **ctx)
+int nvme_sw_queue_pop_front(struct nvme_sw_queue *q, struct nvme_sched_req **req)
 {
     if(q->count == 0){
 		//log_info("ringbuf empty!\n");
         return -EAGAIN;
 	}
-	*ctx = q->buf[q->tail];
+	*req = q->buf[q->tail];
 	q->total_token_demand -= q->buf[q->tail]->req_cost;
     q->tail = (q->tail + 1) % NVME_SW_QUEUE_SIZE; 
     q->count--;
@@ -64,6 +64,14 @@ int nvme_sw_queue_peak_head_cost(struct nvme_sw_queue *q)
 
 }
 
+struct nvme_sched_req *nvme_sw_queue_peek_head(struct nvme_sw_queue *q)
+{
+	if (q->count == 0)
+		return NULL;
+
+	return q->buf[q->tail];
+}
+
 unsigned long nvme_sw_queue_save_tokens(struct nvme_sw_queue *q, unsigned long tokens)
 {
 
@@ -0,0 +1,124 @@
+/*
+ * Copyright 2013-16 Board of Trustees of Stanford University
+ * Copyright 2013-16 Ecole Polytechnique Federale Lausanne (EPFL)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * reqtrace.c - request lifecycle tracing
+ *
+ * The trace rings live in a POSIX shared memory segment, one per core, so
+ * tools/ix_reqtrace can take a snapshot while the dataplane runs. Only
+ * built with ENABLE_REQTRACE.
+ */
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <ix/stddef.h>
+#include <ix/cfg.h>
+#include <ix/cpu.h>
+#include <ix/errno.h>
+#include <ix/log.h>
+#include <ix/syscall.h>
+#include <ix/timer.h>
+#include <ix/reqtrace.h>
+
+DEFINE_PERCPU(struct reqtrace_ring *, reqtrace_ring);
+DEFINE_PERCPU(unsigned long, reqtrace_pending);
+
+static struct reqtrace_shmem *reqtrace_shmem;
+
+/**
+ * bsys_reqtrace - records an event seen by the application
+ * @id: the cookie of the request
+ * @type: REQTRACE_RX, REQTRACE_TX or REQTRACE_ACK
+ * @tsc: the application's TSC reading when the event happened
+ * @arg: the NVMe flow group handle of the tenant
+ *
+ * Returns 0 if successful, otherwise fail.
+ */
+long bsys_reqtrace(unsigned long id, int type, uint64_t tsc, uint32_t arg)
+{
+	switch (type) {
+	case REQTRACE_RX:
+		percpu_get(reqtrace_pending) = id;
+		break;
+	case REQTRACE_TX:
+	case REQTRACE_ACK:
+		break;
+	default:
+		return -RET_INVAL;
+	}
+
+	reqtrace_record(id, type, tsc, arg);
+	return 0;
+}
+
+/**
+ * reqtrace_init - creates the shared memory segment holding the rings
+ *
+ * Must run after the config is parsed.
+ */
+int reqtrace_init(void)
+{
+	size_t len;
+	void *vaddr;
+	int fd;
+
+	len = sizeof(struct reqtrace_shmem) +
+	      CFG.num_cpus * sizeof(struct reqtrace_ring);
+
+	fd = shm_open(REQTRACE_SHM, O_RDWR | O_CREAT | O_TRUNC, 0660);
+	if (fd == -1)
+		return -EIO;
+	if (ftruncate(fd, len)) {
+		close(fd);
+		return -EIO;
+	}
+
+	vaddr = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (vaddr == MAP_FAILED)
+		return -ENOMEM;
+
+	reqtrace_shmem = vaddr;
+	memset(reqtrace_shmem, 0, len);
+	reqtrace_shmem->nr_cpus = CFG.num_cpus;
+	reqtrace_shmem->ring_size = REQTRACE_RING_SIZE;
+	reqtrace_shmem->cycles_per_us = cycles_per_us;
+	asm volatile("" ::: "memory");
+	reqtrace_shmem->magic = REQTRACE_MAGIC;
+
+	log_info("reqtrace: recording request events in /dev/shm%s\n", REQTRACE_SHM);
+	return 0;
+}
+
+/**
+ * reqtrace_init_cpu - attaches the current core to its ring
+ */
+int reqtrace_init_cpu(void)
+{
+	percpu_get(reqtrace_ring) = &reqtrace_shmem->ring[percpu_get(cpu_nr)];
+	return 0;
+}
@@ -45,6 +45,7 @@
 #include <ix/ethfg.h>
 #include <ix/nvmedev.h>
 #include <ix/utimer.h>
+#include <ix/reqtrace.h>
 
 #include <dune.h>
 
@@ -77,12 +78,16 @@ static bsysfn_t bsys_tbl[] = {
 	(bsysfn_t) bsys_nvme_open,
 	(bsysfn_t) bsys_nvme_close,
 	(bsysfn_t) bsys_nvme_register_flow,
-	(bsysfn_t) bsys_nvme_unregister_flow
+	(bsysfn_t) bsys_nvme_unregister_flow,
+	(bsysfn_t) bsys_nvme_trim,
+	(bsysfn_t) bsys_nvme_flush,
+	(bsysfn_t) bsys_nvme_write_zeroes,
+	(bsysfn_t) bsys_reqtrace
 };
 
 static int bsys_dispatch_one(struct bsys_desc __user *d)
 {
-	uint64_t sysnr, arga, argb, argc, argd, arge, argf, ret;
+	uint64_t sysnr, arga, argb, argc, argd, arge, argf, argg, ret;
 
 	sysnr = uaccess_peekq(&d->sysnr);
 	arga = uaccess_peekq(&d->arga);
@@ -91,6 +96,7 @@ static int bsys_dispatch_one(struct bsys_desc __user *d)
 	argd = uaccess_peekq(&d->argd);
 	arge = uaccess_peekq(&d->arge);
 	argf = uaccess_peekq(&d->argf);
+	argg = uaccess_peekq(&d->argg);
 
 	if (unlikely(uaccess_check_fault()))
 		return -EFAULT;
@@ -99,7 +105,7 @@ static int bsys_dispatch_one(struct bsys_desc __user *d)
 		goto out;
 	}
 
-	ret = bsys_tbl[sysnr](arga, argb, argc, argd, arge, argf);
+	ret = bsys_tbl[sysnr](arga, argb, argc, argd, arge, argf, argg);
 
 out:
 	arga = percpu_get(syscall_cookie);
@@ -145,6 +151,7 @@ static int bsys_dispatch(struct bsys_desc __user *d, unsigned int nr)
 static int sys_bpoll(struct bsys_desc __user *d, unsigned int nr)
 {
 	int ret;
+	bool rx_drained;
 
 	usys_reset();
 
@@ -174,6 +181,14 @@ static int sys_bpoll(struct bsys_desc __user *d, unsigned int nr)
 		eth_fg_assign_to_cpu((bitmap_ptr) percpu_get(cp_cmd)->migrate.fg_bitmap, percpu_get(cp_cmd)->migrate.cpu);
 		percpu_get(cp_cmd)->cmd_id = CP_CMD_NOP;
 		break;
+	case CP_CMD_MIGRATE_TENANT:
+		if (percpu_get(usys_arr)->len)
+			return 0;
+		/* keep the command until the tenants' in-flight I/O drains */
+		if (nvme_migrate_tenant(percpu_get(cp_cmd)->migrate_tenant.nvme_fg,
+					percpu_get(cp_cmd)->migrate_tenant.cpu) != -EAGAIN)
+			percpu_get(cp_cmd)->cmd_id = CP_CMD_NOP;
+		break;
 	case CP_CMD_IDLE:
 		if (percpu_get(usys_arr)->len)
 			return 0;
@@ -182,9 +197,14 @@ static int sys_bpoll(struct bsys_desc __user *d, unsigned int nr)
 		break;
 	}
 
+	/* fire short timers first, they may pace this round */
+	hrtimer_run();
+
 	//schedule
 	if (nvme_sched_flag) {
+		KSTATS_PUSH(nvme_sched, NULL);
 		nvme_sched();
+		KSTATS_POP(NULL);
 	}
 
 	KSTATS_PUSH(percpu_bookkeeping, NULL);
@@ -201,10 +221,12 @@ static int sys_bpoll(struct bsys_desc __user *d, unsigned int nr)
 	KSTATS_POP(NULL);
 
 	KSTATS_PUSH(rx_recv, NULL);
-	eth_process_recv();
+	rx_drained = eth_process_recv();
 	KSTATS_POP(NULL);
 
-	nvme_process_completions();
+	KSTATS_PUSH(nvme_completions, NULL);
+	nvme_process_completions(!rx_drained);
+	KSTATS_POP(NULL);
 
 	KSTATS_PUSH(tx_send, NULL);
 	eth_process_send();
@@ -86,6 +86,20 @@ struct timerwheel {
 
 static DEFINE_PERCPU(struct timerwheel, timer_wheel_cpu);
 
+/*
+ * High-resolution timers live in a per-core binary min-heap ordered by
+ * TSC deadline. Only short delays are accepted, so few are ever pending
+ * and the heap can be a fixed array.
+ */
+#define HRTIMER_HEAP_SIZE	256
+
+struct hrtimer_heap {
+	int count;
+	struct hrtimer *heap[HRTIMER_HEAP_SIZE];
+};
+
+static DEFINE_PERCPU(struct hrtimer_heap, hrtimer_heap_cpu);
+
 
 int cycles_per_us __aligned(64);
 
@@ -309,6 +323,139 @@ void timer_run(void)
 }
 
 
+static inline void hrtimer_heap_set(struct hrtimer_heap *h, int idx, struct hrtimer *t)
+{
+	h->heap[idx] = t;
+	t->heap_idx = idx;
+}
+
+static void hrtimer_sift_up(struct hrtimer_heap *h, int idx)
+{
+	struct hrtimer *t = h->heap[idx];
+
+	while (idx > 0) {
+		int parent = (idx - 1) / 2;
+
+		if (h->heap[parent]->deadline <= t->deadline)
+			break;
+		hrtimer_heap_set(h, idx, h->heap[parent]);
+		idx = parent;
+	}
+	hrtimer_heap_set(h, idx, t);
+}
+
+static void hrtimer_sift_down(struct hrtimer_heap *h, int idx)
+{
+	struct hrtimer *t = h->heap[idx];
+
+	for (;;) {
+		int child = 2 * idx + 1;
+
+		if (child >= h->count)
+			break;
+		if (child + 1 < h->count &&
+		    h->heap[child + 1]->deadline < h->heap[child]->deadline)
+			child++;
+		if (t->deadline <= h->heap[child]->deadline)
+			break;
+		hrtimer_heap_set(h, idx, h->heap[child]);
+		idx = child;
+	}
+	hrtimer_heap_set(h, idx, t);
+}
+
+/**
+ * hrtimer_add_abs - adds a high-resolution timer with an absolute deadline
+ * @t: the timer, which must not be pending
+ * @deadline: the TSC value at which to fire the timer
+ *
+ * Returns 0 if successful, or -ENOSPC if too many timers are pending.
+ */
+int hrtimer_add_abs(struct hrtimer *t, uint64_t deadline)
+{
+	struct hrtimer_heap *h = &percpu_get(hrtimer_heap_cpu);
+
+	assert(!hrtimer_pending(t));
+	if (unlikely(h->count >= HRTIMER_HEAP_SIZE))
+		return -ENOSPC;
+
+	t->deadline = deadline;
+	h->heap[h->count] = t;
+	hrtimer_sift_up(h, h->count++);
+
+	return 0;
+}
+
+/**
+ * hrtimer_add - adds a high-resolution timer
+ * @t: the timer, which must not be pending
+ * @nsecs: the time interval from present to fire the timer
+ *
+ * Returns 0 if successful, -EINVAL if @nsecs is not below
+ * HRTIMER_MAX_DELAY_US (use timer_add() instead), or -ENOSPC
+ * if too many timers are pending.
+ */
+int hrtimer_add(struct hrtimer *t, uint64_t nsecs)
+{
+	if (nsecs >= HRTIMER_MAX_DELAY_US * 1000)
+		return -EINVAL;
+
+	return hrtimer_add_abs(t, rdtsc() + nsecs * cycles_per_us / 1000);
+}
+
+/**
+ * hrtimer_del - disarms a high-resolution timer
+ * @t: the timer
+ *
+ * Does nothing if the timer is not pending.
+ */
+void hrtimer_del(struct hrtimer *t)
+{
+	struct hrtimer_heap *h = &percpu_get(hrtimer_heap_cpu);
+	struct hrtimer *last;
+	int idx = t->heap_idx;
+
+	if (!hrtimer_pending(t))
+		return;
+
+	t->heap_idx = -1;
+	last = h->heap[--h->count];
+	if (last == t)
+		return;
+
+	h->heap[idx] = last;
+	if (idx > 0 && h->heap[(idx - 1) / 2]->deadline > last->deadline)
+		hrtimer_sift_up(h, idx);
+	else
+		hrtimer_sift_down(h, idx);
+}
+
+/**
+ * hrtimer_run - fires expired high-resolution timers
+ *
+ * Call this once per polling pass; it does not read the TSC unless a timer
+ * is pending. How late each timer fired relative to its deadline, in
+ * cycles, is recorded in the hrtimer_late kstats.
+ */
+void hrtimer_run(void)
+{
+	struct hrtimer_heap *h = &percpu_get(hrtimer_heap_cpu);
+	uint64_t now;
+
+	if (!h->count)
+		return;
+
+	/* timers re-armed by their handler wait for the next pass */
+	now = rdtsc();
+	while (h->count && h->heap[0]->deadline <= now) {
+		struct hrtimer *t = h->heap[0];
+
+		hrtimer_del(t);
+		KSTATS_SAMPLE(hrtimer_late, now - t->deadline);
+		t->handler(t);
+	}
+}
+
 /**
  * timer_deadline - determine the time remaining until the next deadline
  * @max_deadline_us: the maximum amount of time to look into the future
@@ -329,10 +476,21 @@ uint64_t
 timer_deadline(uint64_t max_deadline_us)
 {
 	struct timerwheel *tw = &percpu_get(timer_wheel_cpu);
+	struct hrtimer_heap *h = &percpu_get(hrtimer_heap_cpu);
 	uint64_t now_us = tw->now_us;
-	uint64_t future_us = now_us + max_deadline_us;
+	uint64_t future_us;
 	int idx;
 
+	if (h->count) {
+		uint64_t now = rdtsc();
+
+		if (h->heap[0]->deadline <= now)
+			return 0;
+		max_deadline_us = min(max_deadline_us,
+				      (h->heap[0]->deadline - now) / cycles_per_us);
+	}
+	future_us = now_us + max_deadline_us;
+
 	for (idx = 0; idx < WHEEL_COUNT; idx++) {
 		uint64_t start = (now_us >> WHEEL_IDX_TO_SHIFT(idx));
 		uint64_t end = (future_us >> WHEEL_IDX_TO_SHIFT(idx));
@@ -467,6 +625,19 @@ int timer_init_cpu(void)
 	tw->timer_pos = tw->now_us;
 	return 0;
 }
+
+/**
+ * hrtimer_init_cpu - initializes the high-resolution timers for a core
+ *
+ * Only called at boot: unlike timer_init_cpu(), which also runs on every
+ * wake from cp_idle(), it must not drop pending timers. Those fire late,
+ * as overdue, on the first hrtimer_run() after the wake.
+ */
+int hrtimer_init_cpu(void)
+{
+	percpu_get(hrtimer_heap_cpu).count = 0;
+	return 0;
+}
 /**
  * timer_init - global timer initialization
  *
@@ -6,6 +6,7 @@
 
 struct utimer {
 	struct timer t;
+	struct hrtimer ht;	/* used instead of t for short delays */
 	void *cookie;
 };
 
@@ -22,6 +23,13 @@ void generic_handler(struct timer *t, struct eth_fg *unused)
 	usys_timer((unsigned long) ut->cookie);
 }
 
+static void generic_hr_handler(struct hrtimer *t)
+{
+	struct utimer *ut;
+	ut = container_of(t, struct utimer, ht);
+	usys_timer((unsigned long) ut->cookie);
+}
+
 static int find_available(struct utimer_list *tl)
 {
 	static int next;
@@ -44,13 +52,20 @@ int utimer_init(struct utimer_list *tl, void *udata)
 	ut = &tl->arr[index];
 	ut->cookie = udata;
 	timer_init_entry(&ut->t, generic_handler);
+	hrtimer_init_entry(&ut->ht, generic_hr_handler);
 
 	return index;
 }
 
 int utimer_arm(struct utimer_list *tl, int timer_id, uint64_t delay)
 {
-	struct timer *t;
-	t = &tl->arr[timer_id].t;
-	return timer_add(t, NULL, delay);
+	struct utimer *ut;
+	ut = &tl->arr[timer_id];
+
+	timer_del(&ut->t);
+	hrtimer_del(&ut->ht);
+	if (delay < HRTIMER_MAX_DELAY_US && !hrtimer_add(&ut->ht, delay * 1000))
+		return 0;
+
+	return timer_add(&ut->t, NULL, delay);
 }
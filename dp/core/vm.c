@@ -33,6 +33,7 @@
 #include <dune.h>
 
 DEFINE_SPINLOCK(vm_lock);
+atomic_t vm_unmap_gen = ATOMIC_INIT(0);
 static uintptr_t vm_iomapk_pos = MEM_USER_IOMAPK_BASE_ADDR;
 
 extern int __dune_vm_page_walk(ptent_t *dir, void *start_va, void *end_va,
@@ -60,6 +61,7 @@ void vm_unmap(void *addr, int nr, int size)
 {
 	spin_lock(&vm_lock);
 	__vm_unmap(addr, nr, size);
+	atomic_inc(&vm_unmap_gen);
 	spin_unlock(&vm_lock);
 }
 
@@ -358,14 +358,14 @@ static int ixgbe_rx_poll(struct eth_rx_queue *rx)
 		/* Check IP checksum calculated by hardware (if applicable) */
 		if (unlikely((rxdp->wb.upper.status_error & IXGBE_RXD_STAT_IPCS) &&
 			     (rxdp->wb.upper.status_error & IXGBE_RXDADV_ERR_IPE))) {
-			log_err("ixgbe: IP RX checksum error, dropping pkt\n");
+			log_err_fast("ixgbe: IP RX checksum error, dropping pkt\n");
 			valid_checksum = false;
 		}
 
 		/* Check TCP checksum calculated by hardware (if applicable) */
 		if (unlikely((rxdp->wb.upper.status_error & IXGBE_RXD_STAT_L4CS) &&
 			     (rxdp->wb.upper.status_error & IXGBE_RXDADV_ERR_TCPE))) {
-			log_err("ixgbe: TCP RX checksum error, dropping pkt\n");
+			log_err_fast("ixgbe: TCP RX checksum error, dropping pkt\n");
 			valid_checksum = false;
 		}
 
@@ -383,7 +383,7 @@ static int ixgbe_rx_poll(struct eth_rx_queue *rx)
 
 		new_b = mbuf_alloc_local();
 		if (unlikely(!new_b)) {
-			log_err("ixgbe: unable to allocate RX mbuf\n");
+			log_err_fast("ixgbe: unable to allocate RX mbuf\n");
 			goto out;
 		}
 
@@ -393,7 +393,7 @@ static int ixgbe_rx_poll(struct eth_rx_queue *rx)
 		rxdp->read.pkt_addr = cpu_to_le32(maddr);
 
 		if (unlikely(!valid_checksum || eth_recv(rx, b))) {
-			log_info("ixgbe: dropping packet\n");
+			log_info_fast("ixgbe: dropping packet\n");
 			mbuf_free(b);
 		}
 
@@ -9,12 +9,27 @@
 #include <ix/nvme_sw_queue.h>
 #include <ix/spdk.h>
 #include <ix/atomic.h>
+#include <ix/control_plane.h>
+#include <ix/ethfg.h>
+#include <ix/ethqueue.h>
+#include <ix/timer.h>
+#include <ix/kstats.h>
+#include <ix/reqtrace.h>
 
 #include <spdk/nvme.h>
+#include <fcntl.h>
 #include <limits.h>
+#include <math.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 
 static struct spdk_nvme_ctrlr *nvme_ctrlr = NULL;
+static void *nvme_zero_page;	// source of emulated WRITE_ZEROES
 static long global_ns_id = 1;
 static long global_ns_size = 1;
 static long global_ns_sector_size = 1;
@@ -33,46 +48,84 @@ static struct mempool_datastore request_datastore;
 static struct mempool_datastore ctx_datastore;
 static struct mempool_datastore nvme_swq_datastore;
 
-static struct nvme_flow_group nvme_fgs[MAX_NVME_FLOW_GROUPS];
-static unsigned long global_token_rate = UINT_MAX; 				 	// max token rate device can handle for current strictest latency SLO
-static atomic_u64_t global_leftover_tokens = ATOMIC_INIT(0); 	 	// shared token bucket
-static unsigned long global_LC_sum_token_rate = 0; 	 				// LC tenant token reservation summed across all LC tenants globally
-static unsigned long global_num_best_effort_tenants = 0; 			// total num of best effort tenants
-static unsigned long global_num_lc_tenants = 0; 					// total num of latency critical tenants
-static atomic_t global_be_token_rate_per_tenant = ATOMIC_INIT(0); 	// token rate per best effort tenant
-static unsigned long global_lc_boost_no_BE = 0; 			 		// fair share of leftover tokens that LC tenant can use when no BE registered
+#define NVME_LOAD_PERIOD_US 10000
+#define NVME_LOAD_EMA 0.2
+// move a tenant only if the busiest core has this much more load than the idlest
+#define NVME_BALANCE_RATIO 1.5
+#define NVME_BALANCE_MIN_GAP 0.5	// tokens/us
 
-#define MAX_NUM_THREADS 24
-static int scheduled_bit_vector[MAX_NUM_THREADS];
+static struct timer nvme_balance_timer;
 
-#define TOKEN_FRAC_GIVEAWAY 0.9 
-static long TOKEN_DEFICIT_LIMIT = 10000;
-static bool global_readonly_flag = true;
+// park a core only if the others can take its load with this much headroom
+#define NVME_PARK_HEADROOM 0.75
+#define NVME_PARK_STEP_MS 1		// controller period while parking or waking a core
+#define NVME_PARK_DRAIN_MAX_MS 1000	// give up parking a core that takes longer to drain
+#define NVME_PARK_COOLDOWN_MS 1000	// no core is parked this long after a transition
+#define NVME_PARK_FIFO "/tmp/ix-park-%d"
 
-#define SLO_REQ_SIZE 4096
+static struct timer nvme_park_timer;
+
+#define NVME_POLL_BUDGET_MAX 4096	// completions reaped per polling pass, see nvme_poll_adapt()
 
 DEFINE_PERCPU(struct mempool, request_mempool __attribute__ ((aligned (64))));
 DEFINE_PERCPU(struct mempool, ctx_mempool __attribute__ ((aligned (64))));
 DEFINE_PERCPU(struct mempool, nvme_swq_mempool __attribute__ ((aligned (64))));
 DEFINE_PERCPU(int, received_nvme_completions);
+DEFINE_PERCPU(unsigned long, nvme_completions_acc);	// since the last load update
+DEFINE_PERCPU(unsigned int, nvme_outstanding);		// commands submitted to the qpair
+DEFINE_PERCPU(int, nvme_poll_budget);
 
 DEFINE_PERCPU(struct nvme_tenant_mgmt, nvme_tenant_manager);
 
-DEFINE_PERCPU(unsigned long, last_sched_time);
-DEFINE_PERCPU(unsigned long, last_sched_time_be);
-DEFINE_PERCPU(unsigned long, local_extra_demand);
-DEFINE_PERCPU(unsigned long, local_leftover_tokens);
-DEFINE_PERCPU(int, roundrobin_start);
+DEFINE_PERCPU(unsigned long, last_load_update);
+DEFINE_PERCPU(unsigned long, nvme_flow_gen);		// flows (un)registered on this core
 
-static int nvme_compute_req_cost(int req_type, size_t req_len);
+/*
+ * Hooks of the token scheduler in nvme_sched.c: each core is a scheduler
+ * thread and its clock is the cycle counter.
+ */
+unsigned long nvme_sched_now(void)
+{
+	return rdtsc();
+}
 
-static void set_token_deficit_limit(void);
+// parked cores do not run the scheduler
+bool nvme_sched_running(int tid)
+{
+	return cp_shmem->command[tid].cpu_state == CP_CPU_STATE_RUNNING;
+}
+
+void nvme_sched_log(const char *fmt, ...)
+{
+	char buf[256];
+	va_list ptr;
+
+	va_start(ptr, fmt);
+	vsnprintf(buf, sizeof(buf), fmt, ptr);
+	va_end(ptr);
+	log_info("%s", buf);
+}
+
+static int nvme_ctx_enqueue(struct nvme_ctx *ctx)
+{
+	int ret;
+
+#ifdef ENABLE_REQTRACE
+	ctx->traced = reqtrace_claim(ctx->cookie);
+#endif
+	REQTRACE_CTX(ctx, REQTRACE_NVME_ENQUEUE);
+	ret = nvme_sched_enqueue(&percpu_get(nvme_tenant_manager), ctx->fg_handle, &ctx->sched,
+				 ctx->cmd, (unsigned long) ctx->lba_count * global_ns_sector_size);
+	if (ret != 0)
+		log_info_fast("nvme_sw_queue full!\n");
+	return ret;
+}
 
 struct nvme_request * alloc_local_nvme_request(struct nvme_request **req)
 {
 	*req =  mempool_alloc(&percpu_get(request_mempool));
 	if(*req == NULL)
-		log_info("Ran out of nvme requests\n");
+		log_info_fast("Ran out of nvme requests\n");
 	assert(*req);
 	return *req;
 }
@@ -84,7 +137,16 @@ void free_local_nvme_request(struct nvme_request *req)
 
 struct nvme_ctx * alloc_local_nvme_ctx(void)
 {
-	return mempool_alloc(&percpu_get(ctx_mempool));
+	struct nvme_ctx *ctx = mempool_alloc(&percpu_get(ctx_mempool));
+
+	if (ctx) {
+		ctx->sched.swq = NULL;
+		ctx->paddr = NULL;
+#ifdef ENABLE_REQTRACE
+		ctx->traced = false;
+#endif
+	}
+	return ctx;
 }
 
 extern void free_local_nvme_ctx(struct nvme_ctx *req)
@@ -108,7 +170,6 @@ void free_local_nvme_swq(struct nvme_sw_queue *q)
  */
 int init_nvme_request_cpu(void)
 {
-	struct nvme_tenant_mgmt* thread_tenant_manager;
 	struct mempool *m = &percpu_get(request_mempool);
 	int ret;
 
@@ -143,15 +204,7 @@ int init_nvme_request_cpu(void)
 		return ret;
 	}
 	
-	thread_tenant_manager = &percpu_get(nvme_tenant_manager);
-	list_head_init(&thread_tenant_manager->tenant_swq);
-	thread_tenant_manager->num_tenants = 0;
-	thread_tenant_manager->num_best_effort_tenants = 0;
-
-	percpu_get(last_sched_time) = timer_now();
-	percpu_get(last_sched_time_be) = rdtsc(); //timer_now();
-	percpu_get(local_leftover_tokens) = 0;
-	percpu_get(local_extra_demand) = 0;
+	nvme_sched_thread_init(&percpu_get(nvme_tenant_manager), percpu_get(cpu_nr));
 	percpu_get(mempool_initialized) = true;
 	
 	return ret;
@@ -201,10 +254,18 @@ int init_nvme_request(void)
 		return ret;
 	}
 
+	nvme_zero_page = page_alloc();
+	if (!nvme_zero_page) {
+		mempool_pagemem_destroy(m);
+		mempool_pagemem_destroy(m2);
+		return -ENOMEM;
+	}
+	memset(nvme_zero_page, 0, PGSIZE_4KB);
+
 	//need to alloc req mempool for admin queue
 	init_nvme_request_cpu();
 
-	set_token_deficit_limit();
+	nvme_sched_init(cycles_per_us, cpus_active);
 	
 	return 0;
 }
@@ -293,6 +354,10 @@ int init_nvmedev(void)
 	return 0;
 }
 
+static void nvme_balance_tenants(struct timer *t, struct eth_fg *unused);
+static void nvme_park_cores(struct timer *t, struct eth_fg *unused);
+static int nvme_park_init(void);
+
 int init_nvmeqp_cpu(void)
 {
 	if (CFG.num_nvmedev == 0)
@@ -302,6 +367,24 @@ int init_nvmeqp_cpu(void)
 	
 	percpu_get(qpair) = spdk_nvme_ctrlr_alloc_io_qpair(nvme_ctrlr, 0);
 	assert(percpu_get(qpair));
+	percpu_get(nvme_poll_budget) = NVME_POLL_BUDGET_MAX;
+
+	if (percpu_get(cpu_nr) == 0 && nvme_balance_interval_ms) {
+		if (!nvme_sched_flag) {
+			log_info("WARNING: tenant balancer needs the scheduler, not balancing\n");
+			return 0;
+		}
+		timer_init_entry(&nvme_balance_timer, nvme_balance_tenants);
+		timer_add(&nvme_balance_timer, NULL, nvme_balance_interval_ms * ONE_MS);
+	}
+
+	if (percpu_get(cpu_nr) == 0 && nvme_park_interval_ms) {
+		if (!nvme_sched_flag) {
+			log_info("WARNING: core parking needs the scheduler, not parking\n");
+			return 0;
+		}
+		return nvme_park_init();
+	}
 	
 	return 0;
 }
@@ -336,18 +419,34 @@ int allocate_nvme_ioq(void)
 
 
 
+/*
+ * nvme_submitted: counts a command handed to the qpair if @ret, the
+ * return value of the spdk_nvme_ns_cmd_*() call, is success. Completion
+ * polling is skipped while none are outstanding.
+ */
+static inline int nvme_submitted(int ret)
+{
+	if (ret == 0)
+		percpu_get(nvme_outstanding)++;
+	return ret;
+}
+
 void
 nvme_write_cb(void *ctx, const struct spdk_nvme_cpl *completion)
 {
 	struct nvme_ctx *n_ctx = (struct nvme_ctx *) ctx;
 
+	REQTRACE_CTX(n_ctx, REQTRACE_NVME_COMPLETE);
+	percpu_get(nvme_outstanding)--;
+	nvme_inflight_put(&percpu_get(nvme_tenant_manager), &n_ctx->sched);
+
 	if (spdk_nvme_cpl_is_error(completion))
-		log_info("SPDK Write Failed!\n");
+		log_info_fast("SPDK Write Failed!\n");
 	
 	usys_nvme_written(n_ctx->cookie, RET_OK);
 	/*
 	if (spdk_nvme_cpl_is_error(completion)) {
-		log_info("ERROR: nvme_write completion status error: %x\n", completion->status.sc);
+		log_info_fast("ERROR: nvme_write completion status error: %x\n", completion->status.sc);
 		usys_nvme_written(n_ctx->cookie, -RET_FAULT);
 		percpu_get(received_nvme_completions)++;
 	}
@@ -363,14 +462,18 @@ nvme_read_cb(void *ctx, const struct spdk_nvme_cpl *completion)
 {
 	struct nvme_ctx *n_ctx = (struct nvme_ctx *) ctx;
 
+	REQTRACE_CTX(n_ctx, REQTRACE_NVME_COMPLETE);
+	percpu_get(nvme_outstanding)--;
+	nvme_inflight_put(&percpu_get(nvme_tenant_manager), &n_ctx->sched);
+
 	if (spdk_nvme_cpl_is_error(completion))
-		log_info("SPDK Read Failed!\n");
+		log_info_fast("SPDK Read Failed!\n");
 
 	
 	usys_nvme_response(n_ctx->cookie, n_ctx->user_buf.buf, RET_OK);
 	/*
 	if (nvme_completion_is_error(completion)) {
-		log_info("ERROR: nvme_write completion status error\n");
+		log_info_fast("ERROR: nvme_write completion status error\n");
 		usys_nvme_response(n_ctx->cookie, n_ctx->buf, -RET_FAULT);
 		percpu_get(received_nvme_completions)++;
 	}
@@ -457,243 +560,16 @@ int set_nvme_flow_group_id(long flow_group_id, long* fg_handle_to_set)
 	return 0;
 }
 
-// adjust token deficit limit to allow LC tenants to burst, but not too much
-static void set_token_deficit_limit(void){
-	log_info("DEVICE PARAMS: read cost %d, write cost %d\n", NVME_READ_COST, NVME_WRITE_COST);
-	TOKEN_DEFICIT_LIMIT = 100*NVME_WRITE_COST; 
-}
-
-
-
-static unsigned long find_token_limit_from_devmodel(unsigned int lat_SLO){
-	int i=0;
-	unsigned long y0, y1, x0, x1;
-	double y;
-
-	for (i=0; i < dev_model_size; i++){
-		if (lat_SLO < dev_model[i].p95_tail_latency){
-			break;
-		}	
-	}	
-	if (i > 0){
-		if (global_readonly_flag){
-			if (i == dev_model_size){
-				return dev_model[i-1].token_rdonly_rate_limit;
-			}
-			// linear interpolation of token limits provided in devmodel config file
-			y0 = dev_model[i-1].token_rdonly_rate_limit;
-			y1 = dev_model[i].token_rdonly_rate_limit; 
-			x0 = dev_model[i-1].p95_tail_latency;
-			x1 = dev_model[i].p95_tail_latency;
-			assert(x1-x0 != 0);
-			y = y0 + ((y1 - y0) * (lat_SLO - x0) / (double) (x1 - x0));
-			return  (unsigned long) y;
-
-		}
-		else {
-			if (i == dev_model_size){
-				return dev_model[i-1].token_rate_limit;
-			}
-			// linear interpolation of token limits provided in devmodel config file
-			y0 = dev_model[i-1].token_rate_limit;
-			y1 = dev_model[i].token_rate_limit; 
-			x0 = dev_model[i-1].p95_tail_latency;
-			x1 = dev_model[i].p95_tail_latency;
-			y = y0 + ((y1 - y0) * (lat_SLO - x0) / (double) (x1 - x0));
-			assert(x1-x0 != 0);
-			return  (unsigned long) y;
-		}
-	}
-	log_info("WARNING: provide dev model info for latency SLO %d\n", lat_SLO);	
-	if (global_readonly_flag){
-		return dev_model[0].token_rdonly_rate_limit;
-	}
-	return dev_model[0].token_rate_limit; 
-
-}
-
-
-unsigned long lookup_device_token_rate(unsigned int lat_SLO){
-
-	switch (nvme_dev_model) {
-		case DEFAULT_FLASH:
-			return UINT_MAX;
-		case FAKE_FLASH:
-			return UINT_MAX;
-		case FLASH_DEV_MODEL:
-			return find_token_limit_from_devmodel(lat_SLO);
-		default:
-			log_info("WARNING: undefined flash device model\n");
-			return UINT_MAX;
-
-	}
-
-	log_err("Set device lookup for lat SLO %ld!\n", lat_SLO);	
-	return 500000;
-}
-
-unsigned long scaled_IOPS(unsigned long IOPS, int rw_ratio_100){
-	double scaledIOPS;
-	double rw_ratio = (double) rw_ratio_100 / (double) 100;
-
-	/*
-	 * NOTE: when calculating token reservation for latency-critical tenants,
-	 * 		 assume SLO specificed for 4kB requests
-	 * 		 e.g. if your application's IOPS SLO is 100K IOPS for 8K IOs, 
-	 * 		      register your app's SLO with ReFlex as 200K IOPS 
-	 */
-	scaledIOPS = (IOPS * rw_ratio * nvme_compute_req_cost(NVME_CMD_READ, SLO_REQ_SIZE)) 
-					+ (IOPS * (1-rw_ratio) * nvme_compute_req_cost(NVME_CMD_WRITE, SLO_REQ_SIZE));
-	return (unsigned long) (scaledIOPS + 0.5);
-}
-
-static void readjust_lc_tenant_token_limits(void){
-	int i,j = 0;
-	for (i = 0; i < MAX_NVME_FLOW_GROUPS; i++){
-		if (bitmap_test(nvme_fgs_bitmap, i)) {
-			if (nvme_fgs[i].latency_critical_flag) {
-				nvme_fgs[i].scaled_IOPuS_limit = (nvme_fgs[i].scaled_IOPS_limit + global_lc_boost_no_BE) / (double) 1E6;
-				j++;
-				if (j == global_num_lc_tenants){
-					return;
-				}
-			}
-		}
-	}
-
-}
-
-
-int recalculate_weights_add(long new_flow_group_idx){
-	unsigned long new_global_token_rate = 0;
-	unsigned long new_global_LC_sum_token_rate = 0;
-	unsigned long lc_token_rate_boost_when_no_BE = 0;
-	unsigned int be_token_rate_per_tenant;
-
-
-	spin_lock(&nvme_bitmap_lock);	
-	
-	if (nvme_fgs[new_flow_group_idx].latency_critical_flag) {
-		new_global_LC_sum_token_rate = global_LC_sum_token_rate + nvme_fgs[new_flow_group_idx].scaled_IOPS_limit;
-		if (nvme_fgs[new_flow_group_idx].rw_ratio_SLO < 100){
-			global_readonly_flag = false;
-		}
-		
-		new_global_token_rate = lookup_device_token_rate(nvme_fgs[new_flow_group_idx].latency_us_SLO);
-		if (new_global_token_rate > global_token_rate){
-			new_global_token_rate = global_token_rate; // keep limit based on strictest latency SLO
-		}
-		
-		if (new_global_LC_sum_token_rate > new_global_token_rate){
-			// control plane notifies tenant can't meet its SLO
-			// don't update the global token rate since won't regsiter this tenant
-			log_err("CANNOT SATISFY TENANT's SLO: %lu > %lu\n", new_global_LC_sum_token_rate, new_global_token_rate);
-			spin_unlock(&nvme_bitmap_lock);	
-			return -RET_CANTMEETSLO;
-		}
-	
-		global_token_rate = new_global_token_rate;
-		global_LC_sum_token_rate = new_global_LC_sum_token_rate;
-		log_info("Global token rate: %lu tokens/s.\n", global_token_rate);
-		global_num_lc_tenants++;
-	}
-	else{
-		global_num_best_effort_tenants++;
-		global_readonly_flag = false; // assume BE tenant has rd/wr mixed workload
-	}	
-	
-	if (global_num_best_effort_tenants){
-	   	be_token_rate_per_tenant = (global_token_rate - global_LC_sum_token_rate) / global_num_best_effort_tenants;
-		lc_token_rate_boost_when_no_BE = 0;
-	}
-	else{
-		be_token_rate_per_tenant = 0;
-		if (global_num_lc_tenants)
-			lc_token_rate_boost_when_no_BE = (global_token_rate - global_LC_sum_token_rate) / global_num_lc_tenants;
-	}
-	atomic_write(&global_be_token_rate_per_tenant, be_token_rate_per_tenant);
-	
-	// if number of BE tenants has changes from 0 to 1 or more (or vice versa)
-	// adjust LC tenant boost (only want to boost if no BE tenants registered)
-	if (lc_token_rate_boost_when_no_BE != global_lc_boost_no_BE){
-		global_lc_boost_no_BE = lc_token_rate_boost_when_no_BE;
-		readjust_lc_tenant_token_limits();
-	}
-	spin_unlock(&nvme_bitmap_lock);	
-	
-	return 1;
-}
-
-int recalculate_weights_remove(long flow_group_idx){
-	long i;
-	unsigned int strictest_latency_SLO = UINT_MAX;
-	unsigned int be_token_rate_per_tenant;
-	unsigned long lc_token_rate_boost_when_no_BE = 0;
-
-
-	spin_lock(&nvme_bitmap_lock);	
-
-	if (nvme_fgs[flow_group_idx].latency_critical_flag) {
-		//find new strictest latency SLO
-		global_readonly_flag = true;
-		for (i = 0; i < MAX_NVME_FLOW_GROUPS; i++){
-			if (bitmap_test(nvme_fgs_bitmap, i) && i != flow_group_idx) {
-				if (nvme_fgs[i].latency_critical_flag) {
-					if(nvme_fgs[i].latency_us_SLO < strictest_latency_SLO){
-						strictest_latency_SLO = nvme_fgs[i].latency_us_SLO;
-					}
-					if(nvme_fgs[i].rw_ratio_SLO < 100){
-						global_readonly_flag = false;
-					}
-				}
-			}
-		}
-		global_LC_sum_token_rate -= nvme_fgs[flow_group_idx].scaled_IOPS_limit;
-		global_token_rate = lookup_device_token_rate(strictest_latency_SLO);
-		
-		log_info("Global token rate: %lu tokens/s\n", global_token_rate);
-
-		global_num_lc_tenants--;
-	}
-	else{
-		global_num_best_effort_tenants--;
-	}	
-	
-	if (global_num_best_effort_tenants){
-		global_readonly_flag = false;
-	   	be_token_rate_per_tenant = (global_token_rate - global_LC_sum_token_rate) / global_num_best_effort_tenants;
-		lc_token_rate_boost_when_no_BE = 0;
-	}
-	else{
-		be_token_rate_per_tenant = 0;
-		if (global_num_lc_tenants)
-			lc_token_rate_boost_when_no_BE = (global_token_rate - global_LC_sum_token_rate) / global_num_lc_tenants;
-	}
-	atomic_write(&global_be_token_rate_per_tenant, be_token_rate_per_tenant);
-
-	// if number of BE tenants has changes from 0 to 1 or more (or vice versa)
-	// adjust LC tenant boost (only want to boost if no BE tenants registered)
-	if (lc_token_rate_boost_when_no_BE != global_lc_boost_no_BE){
-		global_lc_boost_no_BE = lc_token_rate_boost_when_no_BE;
-		readjust_lc_tenant_token_limits();
-	}
-
-	spin_unlock(&nvme_bitmap_lock);	
-
-	return 1;
-}
-
-
 //TODO: consider implementing separate per-thread lists for BE and LC tenants (will simplify some code for scheduler)
 long bsys_nvme_register_flow(long flow_group_id, unsigned long cookie, 
 							 unsigned int latency_us_SLO, unsigned long IOPS_SLO, 
-							 int rw_ratio_SLO  )
+							 int rw_ratio_SLO, unsigned int be_weight,
+							 unsigned int flags)
 {
 	long fg_handle = 0;
 	struct nvme_flow_group* nvme_fg;
-	int ret = 0;
+	bool ret;
 	int already_registered_flow = 0;
-	struct nvme_tenant_mgmt* thread_tenant_manager;
 	struct nvme_sw_queue* swq;
 
 	already_registered_flow = set_nvme_flow_group_id(flow_group_id, &fg_handle);
@@ -722,7 +598,7 @@ long bsys_nvme_register_flow(long flow_group_id, unsigned long cookie,
 		 *
 		 */
 		log_info("warning: tenant connection registered different SLO, will overwrite previous SLO for all of this tenant's connections. 1 SLO per tenant.\n");
-		nvme_fg->scaled_IOPuS_limit = nvme_fg->scaled_IOPS_limit / (double) 1E6; 
+		nvme_fg->token_rate = token_rate_fixed(nvme_fg->scaled_IOPS_limit);
 	}
 	
 	if (latency_us_SLO == 0){
@@ -733,9 +609,15 @@ long bsys_nvme_register_flow(long flow_group_id, unsigned long cookie,
 	}
 
 	if (already_registered_flow == 0){
-		nvme_fg->scaled_IOPuS_limit = nvme_fg->scaled_IOPS_limit / (double) 1E6; 
-		ret = recalculate_weights_add(fg_handle); 
-		if (ret < 0) {
+		nvme_fg->token_rate = token_rate_fixed(nvme_fg->scaled_IOPS_limit);
+		if (latency_us_SLO == 0)
+			nvme_fg->be_weight = be_weight ? be_weight : 1;
+		else
+			nvme_fg->be_weight = 0;
+		spin_lock(&nvme_bitmap_lock);
+		ret = recalculate_weights_add(fg_handle);
+		spin_unlock(&nvme_bitmap_lock);
+		if (!ret) {
 			log_info("warning: cannot satisfy SLO\n"); 
 			return -RET_CANTMEETSLO;
 		}
@@ -745,20 +627,14 @@ long bsys_nvme_register_flow(long flow_group_id, unsigned long cookie,
 			log_err("error: can't allocate nvme_swq for flow group\n");
 			return -RET_NOMEM;
 		}	
-		nvme_fg->nvme_swq = swq;
-		nvme_sw_queue_init(swq, fg_handle);
-		thread_tenant_manager = &percpu_get(nvme_tenant_manager);
-		list_add(&thread_tenant_manager->tenant_swq, &swq->list);
-		thread_tenant_manager->num_tenants++;
-		percpu_get(roundrobin_start) = 0; 
+		nvme_sched_add_tenant(&percpu_get(nvme_tenant_manager), swq, fg_handle);
 		nvme_fg->conn_ref_count = 0;
-		if (latency_us_SLO == 0){
-			thread_tenant_manager->num_best_effort_tenants++;
-		}
+		nvme_fg->load = 0;
+		nvme_fg->pinned = false;
 		
 		if (latency_us_SLO == 0){
-			log_info("Register tenant %ld (port id: %ld). Managed by thread %ld. Best-effort tenant. \n", 
-					 fg_handle, flow_group_id, percpu_get(cpu_nr));
+			log_info("Register tenant %ld (port id: %ld). Managed by thread %ld. Best-effort tenant, weight %u. \n", 
+					 fg_handle, flow_group_id, percpu_get(cpu_nr), nvme_fg->be_weight);
 
 		}
 		else{
@@ -766,7 +642,10 @@ long bsys_nvme_register_flow(long flow_group_id, unsigned long cookie,
 					 fg_handle, flow_group_id, percpu_get(cpu_nr),  IOPS_SLO, rw_ratio_SLO, nvme_fg->scaled_IOPS_limit, latency_us_SLO);
 		}
 	}
+	if (flags & NVME_FLOW_PINNED)
+		nvme_fg->pinned = true;
 	nvme_fg->conn_ref_count++;
+	percpu_get(nvme_flow_gen)++;
 	
 	usys_nvme_registered_flow(fg_handle, cookie, RET_OK);
 
@@ -775,20 +654,14 @@ long bsys_nvme_register_flow(long flow_group_id, unsigned long cookie,
 
 long bsys_nvme_unregister_flow(long fg_handle) 
 {
-	struct nvme_tenant_mgmt* thread_tenant_manager;
-	
+	percpu_get(nvme_flow_gen)++;
 	nvme_fgs[fg_handle].conn_ref_count--;
 	if (nvme_fgs[fg_handle].conn_ref_count == 0){
-		thread_tenant_manager = &percpu_get(nvme_tenant_manager);
-		if (!nvme_fgs[fg_handle].latency_critical_flag){
-			thread_tenant_manager->num_best_effort_tenants--;
-		}
-		list_del(&nvme_fgs[fg_handle].nvme_swq->list);
+		nvme_sched_remove_tenant(&percpu_get(nvme_tenant_manager), nvme_fgs[fg_handle].nvme_swq);
 		free_local_nvme_swq(nvme_fgs[fg_handle].nvme_swq);	
-		thread_tenant_manager->num_tenants--;
-		recalculate_weights_remove(fg_handle);
 
 		spin_lock(&nvme_bitmap_lock);	
+		recalculate_weights_remove(fg_handle);
 		bitmap_clear(nvme_fgs_bitmap, fg_handle);
 		spin_unlock(&nvme_bitmap_lock);
 	}
@@ -798,29 +671,65 @@ long bsys_nvme_unregister_flow(long fg_handle)
 	return RET_OK;
 }
 
-// request cost scales linearly with size above 4KB
-// note: may need to adjust this if does not match your Flash device behavior
-static int nvme_compute_req_cost(int req_type, size_t req_len) 
+/*
+ * Per-core cache of user buffer translations, keyed by 2MB virtual page.
+ * Server buffers come from a few 2MB-page mempools, so once a page has been
+ * seen, translating a buffer is a table lookup plus add instead of a page
+ * table walk and a page_tbl lookup. A vm_unmap() on any core flushes the
+ * cache at its next lookup.
+ */
+#define NVME_XLATE_CACHE_SIZE	256	/* direct mapped, covers 512MB */
+
+struct nvme_xlate_ent {
+	uintptr_t vpn;		/* 0 if invalid */
+	physaddr_t paddr;
+	machaddr_t maddr;
+};
+
+struct nvme_xlate_cache {
+	int gen;
+	struct nvme_xlate_ent ent[NVME_XLATE_CACHE_SIZE];
+};
+
+static DEFINE_PERCPU(struct nvme_xlate_cache, nvme_xlate_cache);
+
+static struct nvme_xlate_ent *
+nvme_xlate_fill(struct nvme_xlate_cache *c, struct nvme_xlate_ent *e, void *vaddr)
 {
-	if (req_len <= 0){
-		log_info("ERROR: request size <= 0!\n");
-		return 0;
+	int gen = atomic_read(&vm_unmap_gen);
+	physaddr_t paddr;
+
+	if (c->gen != gen) {
+		memset(c->ent, 0, sizeof(c->ent));
+		c->gen = gen;
 	}
 
-	int len_scale_factor = 1;
+	paddr = vm_lookup_phys(vaddr, PGSIZE_2MB);
+	if (unlikely(!paddr))
+		return NULL;
 
-	if (req_len > 4096){
-		// divide req_len by 4096 and round up
-		len_scale_factor = (req_len  + 4096 -1 )/ 4096;
-	}
+	e->vpn = PGN_2MB(vaddr);
+	e->paddr = paddr;
+	e->maddr = nvme_vtophys((void *) paddr);
+	return e;
+}
 
-	if (req_type == NVME_CMD_READ){
-		return NVME_READ_COST * len_scale_factor;
-	}
-	else if (req_type == NVME_CMD_WRITE) {
-		return NVME_WRITE_COST * len_scale_factor;
-	}
-	return 1;
+/**
+ * nvme_xlate - translates a user buffer address
+ * @vaddr: the address, in a 2MB page
+ *
+ * Returns the cache entry for the page holding @vaddr, or NULL if it is
+ * not mapped.
+ */
+static inline struct nvme_xlate_ent *nvme_xlate(void __user *vaddr)
+{
+	struct nvme_xlate_cache *c = &percpu_get(nvme_xlate_cache);
+	uintptr_t vpn = PGN_2MB(vaddr);
+	struct nvme_xlate_ent *e = &c->ent[vpn & (NVME_XLATE_CACHE_SIZE - 1)];
+
+	if (likely(e->vpn == vpn && c->gen == atomic_read(&vm_unmap_gen)))
+		return e;
+	return nvme_xlate_fill(c, e, vaddr);
 }
 
 long bsys_nvme_write(hqu_t fg_handle, void __user *__restrict vaddr, unsigned long lba,
@@ -828,47 +737,47 @@ long bsys_nvme_write(hqu_t fg_handle, void __user *__restrict vaddr, unsigned lo
 {
 	struct spdk_nvme_ns *ns;
 	struct nvme_ctx *ctx;
+	struct nvme_xlate_ent *xlate;
 	void* paddr;
 	int ret;
 
+	KSTATS_VECTOR(bsys_nvme_write);
+
 	ns = spdk_nvme_ctrlr_get_ns(nvme_ctrlr, global_ns_id);
 	ctx = alloc_local_nvme_ctx();
 	if (ctx == NULL) {
-		log_info("ERROR: Cannot allocate memory for nvme_ctx in bsys_nvme_write\n");
+		log_info_fast("ERROR: Cannot allocate memory for nvme_ctx in bsys_nvme_write\n");
 		return -RET_NOMEM;
 	}
 	ctx->cookie = cookie;
 
-	paddr = (void *) vm_lookup_phys(vaddr, PGSIZE_2MB);
-	if (unlikely(!paddr)) {
-		log_info("bsys_nvme_write: no paddr for requested vaddr!");
+	xlate = nvme_xlate(vaddr);
+	if (unlikely(!xlate)) {
+		log_info_fast("bsys_nvme_write: no paddr for requested vaddr!");
 		return -RET_FAULT;
 	}
  
-	paddr = (void *) ((uintptr_t) paddr + PGOFF_2MB(vaddr));
+	paddr = (void *) (xlate->paddr + PGOFF_2MB(vaddr));
 	
 	if (nvme_sched_flag){
 		// Store all info in ctx before add to software queue
 		ctx->tid = percpu_get(cpu_nr);
 		ctx->fg_handle = fg_handle; 
 		ctx->cmd = NVME_CMD_WRITE;
-		ctx->req_cost = nvme_compute_req_cost(NVME_CMD_WRITE, lba_count * global_ns_sector_size);
 		ctx->ns = ns;
 		ctx->paddr = paddr;
 		ctx->lba = lba;
 		ctx->lba_count = lba_count;
 
-		// add to SW queue
-		//struct nvme_sw_queue swq = percpu_get(nvme_swq[ctx->priority]);
-		struct nvme_sw_queue* swq = nvme_fgs[fg_handle].nvme_swq;
-		ret = nvme_sw_queue_push_back(swq, ctx);
+		ret = nvme_ctx_enqueue(ctx);
 		if (ret != 0) {
 			free_local_nvme_ctx(ctx);
 			return -RET_NOMEM;
 		}
 	}
 	else {
-		ret = spdk_nvme_ns_cmd_write(ns, percpu_get(qpair), paddr, lba, lba_count, nvme_write_cb, ctx, 0);
+		ret = nvme_submitted(spdk_nvme_ns_cmd_write(ns, percpu_get(qpair), paddr, lba, lba_count,
+							    nvme_write_cb, ctx, 0));
 		if(ret != 0)
 			log_info("NVME Write ret: %lx\n", ret);
 		assert(ret == 0);
@@ -882,24 +791,27 @@ long bsys_nvme_read(hqu_t fg_handle, void __user *__restrict vaddr, unsigned lon
 {
 	struct spdk_nvme_ns *ns;
 	struct nvme_ctx *ctx;
+	struct nvme_xlate_ent *xlate;
 	void* paddr;
 	int ret;
 	
+	KSTATS_VECTOR(bsys_nvme_read);
+
 	ns = spdk_nvme_ctrlr_get_ns(nvme_ctrlr, global_ns_id);
 	
 	ctx = alloc_local_nvme_ctx();
 	if (ctx == NULL) {
-		log_info("ERROR: Cannot allocate memory for nvme_ctx in bsys_nvme_read\n");
+		log_info_fast("ERROR: Cannot allocate memory for nvme_ctx in bsys_nvme_read\n");
 		return -RET_NOMEM;
 	}
 	ctx->cookie = cookie;
 	
-	paddr = (void *) vm_lookup_phys(vaddr, PGSIZE_2MB);
-	if (unlikely(!paddr)) {
-		log_info("bsys_nvme_read: no paddr for requested vaddr!");
+	xlate = nvme_xlate(vaddr);
+	if (unlikely(!xlate)) {
+		log_info_fast("bsys_nvme_read: no paddr for requested vaddr!");
 		return -RET_FAULT;
 	}
-	paddr = (void *) ((uintptr_t) paddr + PGOFF_2MB(vaddr));
+	paddr = (void *) (xlate->paddr + PGOFF_2MB(vaddr));
 
 	ctx->user_buf.buf = vaddr;
 	
@@ -908,15 +820,12 @@ long bsys_nvme_read(hqu_t fg_handle, void __user *__restrict vaddr, unsigned lon
 		ctx->tid = percpu_get(cpu_nr);
 		ctx->fg_handle = fg_handle; 
 		ctx->cmd = NVME_CMD_READ;
-		ctx->req_cost = nvme_compute_req_cost(NVME_CMD_READ, lba_count * global_ns_sector_size);
 		ctx->ns = ns;
 		ctx->paddr = paddr;
 		ctx->lba = lba;
 		ctx->lba_count = lba_count;
 
-		// add to SW queue
-		struct nvme_sw_queue* swq = nvme_fgs[fg_handle].nvme_swq;
-		ret = nvme_sw_queue_push_back(swq, ctx);
+		ret = nvme_ctx_enqueue(ctx);
 		if (ret != 0) {
 			free_local_nvme_ctx(ctx);
 			return -RET_NOMEM;
@@ -924,7 +833,8 @@ long bsys_nvme_read(hqu_t fg_handle, void __user *__restrict vaddr, unsigned lon
 	}
 	else {
 		assert(((lba / lba_count) * lba_count) == lba);
-		ret = spdk_nvme_ns_cmd_read(ns, percpu_get(qpair), paddr, lba, lba_count, nvme_read_cb, ctx, 0);
+		ret = nvme_submitted(spdk_nvme_ns_cmd_read(ns, percpu_get(qpair), paddr, lba, lba_count,
+							   nvme_read_cb, ctx, 0));
 		if(ret != 0)
 			log_info("NVME Read ret: %lx\n", ret);
 		assert(ret == 0);
@@ -942,7 +852,7 @@ static void sgl_reset_cb(void *cb_arg, uint32_t sgl_offset)
 
 static int sgl_next_cb(void *cb_arg, uint64_t *address, uint32_t *length)
 {
-	void *paddr;
+	struct nvme_xlate_ent *xlate;
 	void __user *__restrict temp;
 	struct nvme_ctx *ctx = (struct nvme_ctx *)cb_arg;
 	
@@ -954,15 +864,13 @@ static int sgl_next_cb(void *cb_arg, uint64_t *address, uint32_t *length)
 	}
 	else {
 		temp = ctx->user_buf.sgl_buf.sgl[ctx->user_buf.sgl_buf.current_sgl++];
-		paddr = (void *) vm_lookup_phys(temp, PGSIZE_2MB);
-		if (unlikely(!paddr)) {
-			log_info("bsys_nvme_read: no paddr for requested buf!");
+		xlate = nvme_xlate(temp);
+		if (unlikely(!xlate)) {
+			log_info_fast("bsys_nvme_read: no paddr for requested buf!");
 			return -RET_FAULT;
 		}
-		//virt to phys
-		*address = (uint64_t) ((uintptr_t) paddr + PGOFF_2MB(temp));
-		//phys to hw
-		*address = nvme_vtophys((void *)*address);
+		//virt to hw
+		*address = xlate->maddr + PGOFF_2MB(temp);
 		*length = PGSIZE_4KB;
 	}
 	return 0;
@@ -975,11 +883,13 @@ long bsys_nvme_writev(hqu_t fg_handle, void __user **__restrict buf, int num_sgl
 	struct nvme_ctx *ctx;
 	int ret;
 	
+	KSTATS_VECTOR(bsys_nvme_writev);
+
 	ns = spdk_nvme_ctrlr_get_ns(nvme_ctrlr, global_ns_id);
 	
 	ctx = alloc_local_nvme_ctx();
 	if (ctx == NULL) {
-		log_info("ERROR: Cannot allocate memory for nvme_ctx in bsys_nvme_read\n");
+		log_info_fast("ERROR: Cannot allocate memory for nvme_ctx in bsys_nvme_read\n");
 		return -RET_NOMEM;
 	}
 	ctx->cookie = cookie;
@@ -991,22 +901,19 @@ long bsys_nvme_writev(hqu_t fg_handle, void __user **__restrict buf, int num_sgl
 		ctx->tid = percpu_get(cpu_nr);
 		ctx->fg_handle = fg_handle; 
 		ctx->cmd = NVME_CMD_WRITE;
-		ctx->req_cost = nvme_compute_req_cost(NVME_CMD_WRITE, lba_count * global_ns_sector_size);
 		ctx->ns = ns;
 		ctx->lba = lba;
 		ctx->lba_count = lba_count;
 
-		// add to SW queue
-		struct nvme_sw_queue* swq = nvme_fgs[fg_handle].nvme_swq;
-		ret = nvme_sw_queue_push_back(swq, ctx);
+		ret = nvme_ctx_enqueue(ctx);
 		if (ret != 0) {
 			free_local_nvme_ctx(ctx);
 			return -RET_NOMEM;
 		}
 	}
 	else {
-		ret = spdk_nvme_ns_cmd_writev(ns, percpu_get(qpair), lba, lba_count,
-									  nvme_write_cb, ctx, 0, sgl_reset_cb, sgl_next_cb);
+		ret = nvme_submitted(spdk_nvme_ns_cmd_writev(ns, percpu_get(qpair), lba, lba_count,
+							     nvme_write_cb, ctx, 0, sgl_reset_cb, sgl_next_cb));
 		if(ret != 0)
 			log_info("Writev failed: %lx %lx %lx\n", ret, num_sgls, lba_count);
 		assert(ret == 0);
@@ -1022,11 +929,13 @@ long bsys_nvme_readv(hqu_t fg_handle, void __user **__restrict buf, int num_sgls
 	struct nvme_ctx *ctx;
 	int ret;
 
+	KSTATS_VECTOR(bsys_nvme_readv);
+
 	ns = spdk_nvme_ctrlr_get_ns(nvme_ctrlr, global_ns_id);
 	
 	ctx = alloc_local_nvme_ctx();
 	if (ctx == NULL) {
-		log_info("ERROR: Cannot allocate memory for nvme_ctx in bsys_nvme_read\n");
+		log_info_fast("ERROR: Cannot allocate memory for nvme_ctx in bsys_nvme_read\n");
 		return -RET_NOMEM;
 	}
 	ctx->cookie = cookie;
@@ -1038,23 +947,20 @@ long bsys_nvme_readv(hqu_t fg_handle, void __user **__restrict buf, int num_sgls
 		ctx->tid = percpu_get(cpu_nr);
 		ctx->fg_handle = fg_handle; 
 		ctx->cmd = NVME_CMD_READ;
-		ctx->req_cost = nvme_compute_req_cost(NVME_CMD_READ, lba_count * global_ns_sector_size);
 		ctx->ns = ns;
 		ctx->lba = lba;
 		ctx->lba_count = lba_count;
 
-		// add to SW queue
-		struct nvme_sw_queue* swq = nvme_fgs[fg_handle].nvme_swq;
-		ret = nvme_sw_queue_push_back(swq, ctx);
+		ret = nvme_ctx_enqueue(ctx);
 		if (ret != 0) {
 			free_local_nvme_ctx(ctx);
-			log_info("returning NOMEM from readv\n");
+			log_info_fast("returning NOMEM from readv\n");
 			return -RET_NOMEM;
 		}
 	}
 	else {
-		ret = spdk_nvme_ns_cmd_readv(ns, percpu_get(qpair), lba, lba_count,
-									 nvme_read_cb, ctx, 0, sgl_reset_cb, sgl_next_cb);
+		ret = nvme_submitted(spdk_nvme_ns_cmd_readv(ns, percpu_get(qpair), lba, lba_count,
+							    nvme_read_cb, ctx, 0, sgl_reset_cb, sgl_next_cb));
 		if(ret != 0)
 			log_info("Readv failed: %lx %lx %lx\n", ret, num_sgls, lba_count);
 		assert(ret == 0);
@@ -1063,65 +969,175 @@ long bsys_nvme_readv(hqu_t fg_handle, void __user **__restrict buf, int num_sgls
 	return RET_OK;
 }
 
-unsigned long try_acquire_global_tokens(unsigned long token_demand) {
-	unsigned long new_token_level = 0;
-	unsigned long avail_tokens = 0;
+/*
+ * WRITE_ZEROES on namespaces without native support: every SGL entry
+ * points at the same zeroed page
+ */
+static void zero_sgl_reset_cb(void *cb_arg, uint32_t sgl_offset)
+{
+}
 
-	while (1) {
-		avail_tokens = atomic_u64_read(&global_leftover_tokens);
+static int zero_sgl_next_cb(void *cb_arg, uint64_t *address, uint32_t *length)
+{
+	*address = nvme_vtophys(nvme_zero_page);
+	*length = PGSIZE_4KB;
+	return 0;
+}
 
-		if (token_demand > avail_tokens) {
-			if (atomic_u64_cmpxchg(&global_leftover_tokens, avail_tokens, 0)){
-				return avail_tokens;
-			}
+/*
+ * nvme_submit_nodata_cmd: submits TRIM, FLUSH and WRITE_ZEROES to the device.
+ * Completes right away what the namespace doesn't need: TRIM without
+ * deallocate support is only a hint and FLUSH without a volatile write
+ * cache has nothing to do.
+ */
+static int nvme_submit_nodata_cmd(struct nvme_ctx *ctx)
+{
+	uint32_t flags = spdk_nvme_ns_get_flags(ctx->ns);
+	struct spdk_nvme_dsm_range *range;
 
-		}
-		else {
-			new_token_level = avail_tokens - token_demand;
-			if (atomic_u64_cmpxchg(&global_leftover_tokens, avail_tokens, new_token_level)){
-				return token_demand;
-			}
+	switch (ctx->cmd) {
+	case NVME_CMD_TRIM:
+		if (!(flags & SPDK_NVME_NS_DEALLOCATE_SUPPORTED))
+			break;
+		BUILD_ASSERT(sizeof(ctx->dsm_range) == sizeof(*range));
+		range = (struct spdk_nvme_dsm_range *) ctx->dsm_range;
+		memset(range, 0, sizeof(*range));
+		range->starting_lba = ctx->lba;
+		range->length = ctx->lba_count;
+		return nvme_submitted(spdk_nvme_ns_cmd_deallocate(ctx->ns, percpu_get(qpair), range,
+								  1, nvme_write_cb, ctx));
+	case NVME_CMD_FLUSH:
+		if (!(flags & SPDK_NVME_NS_FLUSH_SUPPORTED))
+			break;
+		return nvme_submitted(spdk_nvme_ns_cmd_flush(ctx->ns, percpu_get(qpair),
+							     nvme_write_cb, ctx));
+	case NVME_CMD_WRITE_ZEROES:
+		if (flags & SPDK_NVME_NS_WRITE_ZEROES_SUPPORTED)
+			return nvme_submitted(spdk_nvme_ns_cmd_write_zeroes(ctx->ns, percpu_get(qpair),
+				ctx->lba, ctx->lba_count, nvme_write_cb, ctx, 0));
+		return nvme_submitted(spdk_nvme_ns_cmd_writev(ctx->ns, percpu_get(qpair), ctx->lba,
+				ctx->lba_count, nvme_write_cb, ctx, 0, zero_sgl_reset_cb, zero_sgl_next_cb));
+	default:
+		panic("unrecognized nvme request\n");
+	}
+
+	nvme_inflight_put(&percpu_get(nvme_tenant_manager), &ctx->sched);
+	usys_nvme_written(ctx->cookie, RET_OK);
+	percpu_get(received_nvme_completions)++;
+	free_local_nvme_ctx(ctx);
+	return 0;
+}
+
+static long nvme_nodata_cmd(hqu_t fg_handle, int cmd, unsigned long lba,
+			    unsigned int lba_count, unsigned long cookie)
+{
+	struct nvme_ctx *ctx;
+	int ret;
+
+	ctx = alloc_local_nvme_ctx();
+	if (ctx == NULL) {
+		log_info_fast("ERROR: Cannot allocate memory for nvme_ctx in nvme_nodata_cmd\n");
+		return -RET_NOMEM;
+	}
+	ctx->cookie = cookie;
+	ctx->cmd = cmd;
+	ctx->ns = spdk_nvme_ctrlr_get_ns(nvme_ctrlr, global_ns_id);
+	ctx->lba = lba;
+	ctx->lba_count = lba_count;
+
+	if (nvme_sched_flag) {
+		ctx->tid = percpu_get(cpu_nr);
+		ctx->fg_handle = fg_handle;
+		ret = nvme_ctx_enqueue(ctx);
+		if (ret != 0) {
+			free_local_nvme_ctx(ctx);
+			return -RET_NOMEM;
 		}
 	}
+	else {
+		ret = nvme_submit_nodata_cmd(ctx);
+		if (ret != 0)
+			log_info("NVME cmd %d failed: %lx\n", cmd, ret);
+		assert(ret == 0);
+	}
+
+	return RET_OK;
+}
+
+long bsys_nvme_trim(hqu_t fg_handle, unsigned long lba, unsigned int lba_count,
+		    unsigned long cookie)
+{
+	KSTATS_VECTOR(bsys_nvme_trim);
+	return nvme_nodata_cmd(fg_handle, NVME_CMD_TRIM, lba, lba_count, cookie);
+}
+
+long bsys_nvme_flush(hqu_t fg_handle, unsigned long cookie)
+{
+	KSTATS_VECTOR(bsys_nvme_flush);
+	return nvme_nodata_cmd(fg_handle, NVME_CMD_FLUSH, 0, 0, cookie);
 }
 
-static void issue_nvme_req(struct nvme_ctx* ctx)
+long bsys_nvme_write_zeroes(hqu_t fg_handle, unsigned long lba, unsigned int lba_count,
+			    unsigned long cookie)
 {
+	KSTATS_VECTOR(bsys_nvme_write_zeroes);
+	return nvme_nodata_cmd(fg_handle, NVME_CMD_WRITE_ZEROES, lba, lba_count, cookie);
+}
+
+/*
+ * nvme_sched_issue: submits a request the scheduler took off a software
+ * queue, already charged to its tenant
+ */
+void nvme_sched_issue(struct nvme_tenant_mgmt *m, struct nvme_sched_req *req)
+{
+	struct nvme_ctx *ctx = container_of(req, struct nvme_ctx, sched);
 	int ret;
 
+	REQTRACE_CTX(ctx, REQTRACE_NVME_DISPATCH);
+
 	//don't schedule request on flash if FAKE_FLASH test	
 	if (nvme_dev_model == FAKE_FLASH) {
+		REQTRACE_CTX(ctx, REQTRACE_NVME_COMPLETE);
 		if (ctx->cmd == NVME_CMD_READ) {
 			usys_nvme_response(ctx->cookie, ctx->user_buf.buf, RET_OK);
 			percpu_get(received_nvme_completions)++;
 		}
-		else if (ctx->cmd == NVME_CMD_WRITE) {
+		else {
 			usys_nvme_written(ctx->cookie, RET_OK);
 			percpu_get(received_nvme_completions)++;
 		}
+		nvme_inflight_put(m, req);
 		free_local_nvme_ctx(ctx);
 
 		return; 
 	}
 
+	/*
+	 * Contiguous buffers (bsys_nvme_read/write) have ctx->paddr set and
+	 * go out as a single PRP command; scattered ones use SGL callbacks.
+	 */
 	if (ctx->cmd == NVME_CMD_READ) {
-		// if PRP:
-		//ret = spdk_nvme_ns_cmd_read(ctx->ns, percpu_get(qpair), ctx->paddr, ctx->lba, ctx->lba_count, nvme_read_cb, ctx, 0);
-		// for SGL:
-		ret = spdk_nvme_ns_cmd_readv(ctx->ns, percpu_get(qpair), ctx->lba, ctx->lba_count,
-									 nvme_read_cb, ctx, 0, sgl_reset_cb, sgl_next_cb);
+		if (ctx->paddr)
+			ret = spdk_nvme_ns_cmd_read(ctx->ns, percpu_get(qpair), ctx->paddr, ctx->lba,
+						    ctx->lba_count, nvme_read_cb, ctx, 0);
+		else
+			ret = spdk_nvme_ns_cmd_readv(ctx->ns, percpu_get(qpair), ctx->lba, ctx->lba_count,
+										 nvme_read_cb, ctx, 0, sgl_reset_cb, sgl_next_cb);
+		nvme_submitted(ret);
 		
 	}
 	else if (ctx->cmd == NVME_CMD_WRITE) {
-		// if PRP:
-		//ret = spdk_nvme_ns_cmd_write(ctx->ns, percpu_get(qpair), ctx->paddr, ctx->lba, ctx->lba_count, nvme_write_cb, ctx, 0);
-		// for SGL:
-		ret = spdk_nvme_ns_cmd_writev(ctx->ns, percpu_get(qpair), ctx->lba, ctx->lba_count,
-									  nvme_write_cb, ctx, 0, sgl_reset_cb, sgl_next_cb);
+		if (ctx->paddr)
+			ret = spdk_nvme_ns_cmd_write(ctx->ns, percpu_get(qpair), ctx->paddr, ctx->lba,
+						     ctx->lba_count, nvme_write_cb, ctx, 0);
+		else
+			ret = spdk_nvme_ns_cmd_writev(ctx->ns, percpu_get(qpair), ctx->lba, ctx->lba_count,
+										  nvme_write_cb, ctx, 0, sgl_reset_cb, sgl_next_cb);
+		nvme_submitted(ret);
 		
 	}
 	else {
-		panic("unrecognized nvme request\n");
+		ret = nvme_submit_nodata_cmd(ctx);
 	}
 	if (ret < 0) {
 		log_info("Ran out of NVMe cmd buffer space\n");
@@ -1131,273 +1147,623 @@ static void issue_nvme_req(struct nvme_ctx* ctx)
 
 
 /*
- * nvme_sched_subround1: schedule latency critical tenant traffic 
+ * update_load_metrics: publishes this core's scheduler load in cp_shmem,
+ * the tokens its tenants issue per us and the tokens they have queued
  */
-static inline int nvme_sched_subround1(void)
+static void update_load_metrics(void)
 {
-	struct nvme_tenant_mgmt* thread_tenant_manager;
-	struct nvme_sw_queue* nvme_swq;
-	struct nvme_ctx *ctx;
-	unsigned long now;
-	unsigned long time_delta;
-	long POS_LIMIT = 0;
-	unsigned long local_leftover = 0;
-	unsigned long local_demand = 0;
-	double token_increment;
-
-	now = timer_now();	//in us
-	time_delta = now - percpu_get(last_sched_time);
-	percpu_get(last_sched_time) = now;
-	
-	thread_tenant_manager = &percpu_get(nvme_tenant_manager);
-	
-	list_for_each(&thread_tenant_manager->tenant_swq, nvme_swq, list) {
-		// serve latency-critical (LC) tenants
-		if (nvme_fgs[nvme_swq->fg_handle].latency_critical_flag) {
-			if (nvme_swq->fg_handle == 2){
-				//log_info("%f\n", nvme_fgs[nvme_swq->fg_handle].scaled_IOPuS_limit);
-			}
-			
-			token_increment = (nvme_fgs[nvme_swq->fg_handle].scaled_IOPuS_limit * time_delta) + 0.5; // 0.5 is for rounding
-			nvme_swq->token_credit += (long) token_increment;
-			if (nvme_swq->token_credit < -TOKEN_DEFICIT_LIMIT){
-				/*
-				 * Notify control plane, may need to re-negotiate tenant SLO
-				 * FUTURE WORK: implement control plane
-				 */
-
-				//TODO: try to grab from global token bucket
-				//NOTE: may also need to schedule LC tenants in round robin for fairness
-			}
-			while (nvme_sw_queue_isempty(nvme_swq) == 0 && 
-				   nvme_swq->token_credit > -TOKEN_DEFICIT_LIMIT) {
-				nvme_sw_queue_pop_front(nvme_swq, &ctx); 
-				issue_nvme_req(ctx);
-				nvme_swq->token_credit -= ctx->req_cost;
-			}
-
-			/*
-			 * POS_LIMIT can be tuned to balance work-conservation and favoring of LC traffic
-			 *	  * default POS_LIMIT    = 3 * token_increment
-			 *	  						if LC tenant doesn't use tokens accumulated 
-			 *	  						from ~3 sched rounds, donate them
-			 *	  						
-			 *   * lower POS_LIMIT 		is good for work-conservation 
-			 *   						(give tokens to BE tenants more easily)
-			 *   
-			 *   * higher POS_LIMIT 	allows latency-critical tenants to accumulate 
-			 *     						more tokens & burst
-			 */
-			POS_LIMIT = 3 * token_increment;
-			if (nvme_swq->token_credit > POS_LIMIT) {
-				local_leftover += (nvme_swq->token_credit * TOKEN_FRAC_GIVEAWAY);	
-				nvme_swq->token_credit -= nvme_swq->token_credit * TOKEN_FRAC_GIVEAWAY; 
-			}
-		}
-		else { // track demand of best-effort (will need for subround2)
-			local_demand += nvme_swq->total_token_demand - nvme_swq->saved_tokens;
-		}
-	}
+	struct nvme_tenant_mgmt *thread_tenant_manager = &percpu_get(nvme_tenant_manager);
+	volatile struct cpu_metrics *metrics = &cp_shmem->cpu_metrics[percpu_get(cpu_nr)];
+	struct nvme_sw_queue *nvme_swq;
+	struct nvme_flow_group *nvme_fg;
+	unsigned long now = timer_now();
+	unsigned long delta = now - percpu_get(last_load_update);
+	double load = 0, backlog = 0;
+
+	if (delta < NVME_LOAD_PERIOD_US)
+		return;
+	percpu_get(last_load_update) = now;
 
-	
-	percpu_get(local_extra_demand) = local_demand;
-	percpu_get(local_leftover_tokens) = local_leftover;
+	list_for_each(&thread_tenant_manager->tenant_swq, nvme_swq, list) {
+		nvme_fg = &nvme_fgs[nvme_swq->fg_handle];
+		EMA_UPDATE(nvme_fg->load, (double) nvme_swq->issued_tokens / delta, NVME_LOAD_EMA);
+		nvme_swq->issued_tokens = 0;
+		load += nvme_fg->load;
+		backlog += nvme_swq->total_token_demand;
+	}
+
+	metrics->nvme_load = load;
+	EMA_UPDATE(metrics->nvme_backlog, backlog, NVME_LOAD_EMA);
+	EMA_UPDATE(metrics->nvme_completions,
+		   (double) percpu_get(nvme_completions_acc) * ONE_SECOND / delta, NVME_LOAD_EMA);
+	percpu_get(nvme_completions_acc) = 0;
+	metrics->nvme_tenants = thread_tenant_manager->num_tenants;
+}
 
+int nvme_sched(void)
+{
+#ifdef NO_SCHED
 	return 0;
+#endif
+	nvme_sched_round(&percpu_get(nvme_tenant_manager));
+	update_load_metrics();
 
+	return 0;
 }
 
-
 /*
- * nvme_sched_subround2: schedule best-effort tenant traffic 
+ * nvme_poll_adapt: halves the completion budget, down to one RX batch, if
+ * both the NIC and the completion queue had work left after this pass,
+ * so neither starves the other; doubles it back once RX is drained.
  */
-static inline void nvme_sched_subround2(void)
+static inline void nvme_poll_adapt(int completions, bool rx_backlog)
 {
-	struct nvme_tenant_mgmt* thread_tenant_manager;
-	struct nvme_sw_queue* nvme_swq;
-	struct nvme_ctx *ctx;
-	int i;
-	unsigned long local_leftover = 0;
-	unsigned long local_demand = 0;
-	unsigned long be_tokens = 0;
-	double token_increment = 0;
-	unsigned long token_demand = 0;
-	unsigned long global_tokens_acquired = 0;
-	unsigned long now;
-	unsigned long time_delta_cycles;
+	int budget = percpu_get(nvme_poll_budget);
 
+	if (!rx_backlog)
+		budget = min(budget * 2, NVME_POLL_BUDGET_MAX);
+	else if (completions >= budget)
+		budget = max(budget / 2, (int) eth_rx_max_batch);
+	percpu_get(nvme_poll_budget) = budget;
+}
 
-	local_leftover = percpu_get(local_leftover_tokens); 
-	local_demand = percpu_get(local_extra_demand);
+/**
+ * nvme_process_completions - reaps completed NVMe commands
+ * @rx_backlog: whether received packets are left after this polling pass
+ *
+ * The completion queue is only read while commands are outstanding.
+ */
+void nvme_process_completions(bool rx_backlog)
+{
+	int i, ret, budget;
 
-	thread_tenant_manager = &percpu_get(nvme_tenant_manager);
-	
-	// compare local leftover with local demand 
-	// synchronize access to global token bucket
-	if (local_leftover > 0 && local_demand == 0) { //give away leftoever tokens to global pool
-		atomic_u64_fetch_and_add(&global_leftover_tokens, local_leftover);
+	if (CFG.num_nvmedev == 0)
 		return;
+
+	if (unlikely(percpu_get(open_ev_ptr))) {
+		for (i = 0; i < percpu_get(open_ev_ptr); i++) {
+			usys_nvme_opened(percpu_get(open_ev[i]), global_ns_size, global_ns_sector_size);
+			percpu_get(received_nvme_completions)++;
+		}
+		percpu_get(open_ev_ptr) = 0;
 	}
-	else if (local_leftover < local_demand) { //try to get how much you need from global pool
-		token_demand = local_demand - local_leftover;
-		global_tokens_acquired = try_acquire_global_tokens(token_demand); // atomic 
-		be_tokens = local_leftover + global_tokens_acquired;
+
+	if (!percpu_get(nvme_outstanding)) {
+		KSTATS_VECTOR(nvme_poll_skipped);
+		return;
 	}
-	else if (local_leftover >= local_demand) {
-		be_tokens = local_leftover;
+
+	budget = percpu_get(nvme_poll_budget);
+	ret = spdk_nvme_qpair_process_completions(percpu_get(qpair), budget);
+	if (ret > 0) {
+		percpu_get(received_nvme_completions) += ret;
+		percpu_get(nvme_completions_acc) += ret;
 	}
+	if (ret >= budget)
+		KSTATS_VECTOR(nvme_poll_capped);
+	KSTATS_NVME_POLL_INC(max(ret, 0), budget);
 
-	now = rdtsc();	
-	time_delta_cycles = now - percpu_get(last_sched_time_be);
-	percpu_get(last_sched_time_be) = now; 
+	nvme_poll_adapt(ret, rx_backlog);
+}
 
-	// serve best effort tenants in round-robin order
-	// TODO: simplify by implementing separate per-thread lists of BE and LC tenants
-	i = 0 ; 
-	list_for_each(&thread_tenant_manager->tenant_swq, nvme_swq, list) {
-		if (i < percpu_get(roundrobin_start)){
-			i++;
-			continue;
+/*
+ * Tenant migration: moves NVMe tenants and the Ethernet flow groups
+ * carrying their connections from this core to another. A tenant's
+ * connections may share flow groups with other tenants, so the set moved
+ * is the closure of the requested tenant over shared flow groups.
+ * Commands already issued complete on this core's queue pair, so the
+ * tenants stop issuing and migrate once their in-flight commands drain.
+ * Queued requests and token state travel with the software queues.
+ */
+struct nvme_tenant_handoff {
+	struct list_head swqs;
+	int num_tenants;
+	int num_best_effort_tenants;
+	unsigned long be_weight;
+};
+
+static void nvme_tenant_handoff_target(void *data)
+{
+	struct nvme_tenant_handoff *handoff = data;
+	struct nvme_tenant_mgmt *thread_tenant_manager = &percpu_get(nvme_tenant_manager);
+	struct nvme_sw_queue *nvme_swq, *next;
+
+	list_for_each_safe(&handoff->swqs, nvme_swq, next, list) {
+		list_del(&nvme_swq->list);
+		list_add_tail(&thread_tenant_manager->tenant_swq, &nvme_swq->list);
+		if (!nvme_fgs[nvme_swq->fg_handle].latency_critical_flag &&
+		    !nvme_sw_queue_isempty(nvme_swq))
+			drr_activate(thread_tenant_manager, nvme_swq);
+	}
+	thread_tenant_manager->num_tenants += handoff->num_tenants;
+	thread_tenant_manager->num_best_effort_tenants += handoff->num_best_effort_tenants;
+	thread_tenant_manager->be_weight += handoff->be_weight;
+
+	free(handoff);
+}
+
+/*
+ * The closure of the migration in progress is computed once, when the
+ * command starts, and kept while its tenants drain. It is recomputed only
+ * if a flow was registered or unregistered on this core meanwhile.
+ */
+static DEFINE_PERCPU(long, migrate_fg_handle);
+static DEFINE_PERCPU(unsigned long, migrate_flow_gen);
+static DEFINE_PERCPU(unsigned long, migrate_fg_bitmap[BITMAP_LONG_SIZE(ETH_MAX_TOTAL_FG)]);
+
+static void clear_draining_tenants(void)
+{
+	struct nvme_sw_queue *nvme_swq;
+
+	list_for_each(&percpu_get(nvme_tenant_manager).tenant_swq, nvme_swq, list)
+		nvme_swq->draining = false;
+	percpu_get(migrate_fg_handle) = 0;
+}
+
+static bool nvme_swq_on_fg(struct nvme_sw_queue *nvme_swq, struct eth_fg *fg)
+{
+	return eth_fg_has_local_port(fg, nvme_fgs[nvme_swq->fg_handle].flow_group_id);
+}
+
+/*
+ * mark_migrating_tenants: marks the tenants to move as draining and
+ * returns the flow groups to move in @fg_bitmap
+ */
+static void mark_migrating_tenants(struct nvme_sw_queue *first, bitmap_ptr fg_bitmap)
+{
+	struct nvme_tenant_mgmt *thread_tenant_manager = &percpu_get(nvme_tenant_manager);
+	struct nvme_sw_queue *nvme_swq;
+	bool changed = true;
+	int i;
+
+	bitmap_init(fg_bitmap, ETH_MAX_TOTAL_FG, 0);
+	clear_draining_tenants();
+	first->draining = true;
+
+	while (changed) {
+		changed = false;
+		for (i = 0; i < ETH_MAX_TOTAL_FG; i++) {
+			if (!fgs[i] || fgs[i]->cur_cpu != percpu_get(cpu_id) ||
+			    bitmap_test(fg_bitmap, i))
+				continue;
+			list_for_each(&thread_tenant_manager->tenant_swq, nvme_swq, list) {
+				if (nvme_swq->draining && nvme_swq_on_fg(nvme_swq, fgs[i])) {
+					bitmap_set(fg_bitmap, i);
+					changed = true;
+					break;
+				}
+			}
 		}
-		if (!nvme_fgs[nvme_swq->fg_handle].latency_critical_flag){ 
-			be_tokens += nvme_sw_queue_take_saved_tokens(nvme_swq); 
-			token_increment = (atomic_read(&global_be_token_rate_per_tenant) * time_delta_cycles) / (double) (cycles_per_us * 1E6);
-			be_tokens += (long) (token_increment + 0.5);
-					
-			while ( (nvme_sw_queue_isempty(nvme_swq) == 0) && 
-					nvme_sw_queue_peak_head_cost(nvme_swq) <= be_tokens) {
-				nvme_sw_queue_pop_front(nvme_swq, &ctx); 
-				issue_nvme_req(ctx);
-				be_tokens -= ctx->req_cost;
+		list_for_each(&thread_tenant_manager->tenant_swq, nvme_swq, list) {
+			if (nvme_swq->draining)
+				continue;
+			for (i = 0; i < ETH_MAX_TOTAL_FG; i++) {
+				if (bitmap_test(fg_bitmap, i) && nvme_swq_on_fg(nvme_swq, fgs[i])) {
+					nvme_swq->draining = true;
+					changed = true;
+					break;
+				}
 			}
-			//save extra tokens for this tenant if still has demand
-			be_tokens -= nvme_sw_queue_save_tokens(nvme_swq, be_tokens);
-			assert(be_tokens >= 0);
 		}
-		i++;
 	}
-	
-	int j = 0;
-	list_for_each(&thread_tenant_manager->tenant_swq, nvme_swq, list) {
-		if (j >= percpu_get(roundrobin_start)){
-			break;
-		}
-		log_debug("schedule tenant second %d\n", j);
-		log_debug("subround2: sched tenant handle %ld, tenant_tokens %lu\n", nvme_swq->fg_handle, tenant_tokens);
-		if (!nvme_fgs[nvme_swq->fg_handle].latency_critical_flag){		
-			be_tokens += nvme_sw_queue_take_saved_tokens(nvme_swq); 
-			token_increment = (atomic_read(&global_be_token_rate_per_tenant) * time_delta_cycles) / (double) (cycles_per_us * 1E6);
-			be_tokens += (long) (token_increment + 0.5);
-			
-			while ( (nvme_sw_queue_isempty(nvme_swq) == 0) && 
-					nvme_sw_queue_peak_head_cost(nvme_swq) <= be_tokens) { 
-				nvme_sw_queue_pop_front(nvme_swq, &ctx); 
-				issue_nvme_req(ctx);
-				be_tokens -= ctx->req_cost; 
+}
+
+/**
+ * nvme_migrate_tenant - moves a tenant and its connections to another core
+ * @fg_handle: the NVMe flow group of the tenant, managed by this core
+ * @cpu: the target cpu sequence number
+ *
+ * Must be called in a quiescent state, with no pending user events.
+ * Returns 0 if the migration started, -EAGAIN if the tenants still have
+ * commands in flight (call again later), otherwise fail. Fails with -EPERM
+ * if the tenant, or one sharing a flow group with it, is pinned.
+ */
+int nvme_migrate_tenant(long fg_handle, int cpu)
+{
+	struct nvme_tenant_mgmt *thread_tenant_manager = &percpu_get(nvme_tenant_manager);
+	struct nvme_sw_queue *nvme_swq, *next;
+	struct nvme_tenant_handoff *handoff;
+	unsigned long *fg_bitmap = percpu_get(migrate_fg_bitmap);
+	int i, num_fgs = 0;
+
+	if (!nvme_sched_flag || fg_handle <= 0 || fg_handle >= MAX_NVME_FLOW_GROUPS ||
+	    !bitmap_test(nvme_fgs_bitmap, fg_handle) ||
+	    nvme_fgs[fg_handle].tid != percpu_get(cpu_nr) ||
+	    cpu < 0 || cpu >= cpus_active || cpu == percpu_get(cpu_nr)) {
+		log_info("WARNING: can't migrate tenant %ld to thread %d\n", fg_handle, cpu);
+		clear_draining_tenants();
+		percpu_get(cp_cmd)->status = CP_STATUS_READY;
+		return -EINVAL;
+	}
+
+	if (percpu_get(migrate_fg_handle) != fg_handle ||
+	    percpu_get(migrate_flow_gen) != percpu_get(nvme_flow_gen)) {
+		mark_migrating_tenants(nvme_fgs[fg_handle].nvme_swq, fg_bitmap);
+
+		list_for_each(&thread_tenant_manager->tenant_swq, nvme_swq, list) {
+			if (nvme_swq->draining && nvme_fgs[nvme_swq->fg_handle].pinned) {
+				log_info_fast("WARNING: can't migrate tenant %ld, tenant %ld is pinned to thread %d\n",
+					      fg_handle, nvme_swq->fg_handle, percpu_get(cpu_nr));
+				clear_draining_tenants();
+				percpu_get(cp_cmd)->status = CP_STATUS_READY;
+				return -EPERM;
 			}
-			//save extra tokens for this tenant if still has demand
-			be_tokens -= nvme_sw_queue_save_tokens(nvme_swq, be_tokens);
-			assert(be_tokens >= 0);
 		}
-		j++;
+		percpu_get(migrate_fg_handle) = fg_handle;
+		percpu_get(migrate_flow_gen) = percpu_get(nvme_flow_gen);
 	}
 
-	int done = 0;
-	if (thread_tenant_manager->num_best_effort_tenants > 0){
-		while (1) { //find next round-robin start and check it's a best-effort tenant (otherwise unfair)
-			percpu_get(roundrobin_start) = (percpu_get(roundrobin_start) + 1) % thread_tenant_manager->num_tenants;
-			i = 0;
-			list_for_each(&thread_tenant_manager->tenant_swq, nvme_swq, list) {
-				if (i != percpu_get(roundrobin_start)){
-					i++;
-					continue;
-				}
-				if (!nvme_fgs[nvme_swq->fg_handle].latency_critical_flag){		
-					done = 1; //incremented to next best effort tenant
-				}
-				break;
-			}
-			if (done == 1) { 
-				break;
-			}
+	list_for_each(&thread_tenant_manager->tenant_swq, nvme_swq, list) {
+		if (nvme_swq->draining && nvme_swq->inflight_cmds)
+			return -EAGAIN;
+	}
+
+	handoff = malloc(sizeof(*handoff));
+	if (!handoff) {
+		clear_draining_tenants();
+		percpu_get(cp_cmd)->status = CP_STATUS_READY;
+		return -ENOMEM;
+	}
+	list_head_init(&handoff->swqs);
+	handoff->num_tenants = 0;
+	handoff->num_best_effort_tenants = 0;
+	handoff->be_weight = 0;
+
+	list_for_each_safe(&thread_tenant_manager->tenant_swq, nvme_swq, next, list) {
+		if (!nvme_swq->draining)
+			continue;
+		nvme_swq->draining = false;
+		list_del(&nvme_swq->list);
+		list_add_tail(&handoff->swqs, &nvme_swq->list);
+		nvme_fgs[nvme_swq->fg_handle].tid = cpu;
+		handoff->num_tenants++;
+		if (!nvme_fgs[nvme_swq->fg_handle].latency_critical_flag) {
+			// the DRR deficit and turn travel with the tenant
+			drr_deactivate(thread_tenant_manager, nvme_swq);
+			handoff->num_best_effort_tenants++;
+			handoff->be_weight += nvme_fgs[nvme_swq->fg_handle].be_weight;
 		}
 	}
-	
-	if (be_tokens > 0){
-		atomic_u64_fetch_and_add(&global_leftover_tokens, be_tokens);
+	thread_tenant_manager->num_tenants -= handoff->num_tenants;
+	thread_tenant_manager->num_best_effort_tenants -= handoff->num_best_effort_tenants;
+	thread_tenant_manager->be_weight -= handoff->be_weight;
+	percpu_get(migrate_fg_handle) = 0;
+
+	for (i = 0; i < ETH_MAX_TOTAL_FG; i++)
+		if (bitmap_test(fg_bitmap, i))
+			num_fgs++;
+	log_info("Migrate tenant %ld (port id: %d) with %d tenants and %d flow groups from thread %d to %d\n",
+		 fg_handle, nvme_fgs[fg_handle].flow_group_id, handoff->num_tenants, num_fgs,
+		 percpu_get(cpu_nr), cpu);
+
+	/*
+	 * Queue the handoff before moving the flow groups, so the target owns
+	 * the software queues before it sees any request of their connections.
+	 */
+	cpu_run_on_one(nvme_tenant_handoff_target, handoff, CFG.cpu[cpu]);
+
+	if (num_fgs)
+		eth_fg_assign_to_cpu(fg_bitmap, cpu);
+	else
+		percpu_get(cp_cmd)->status = CP_STATUS_READY;
+
+	return 0;
+}
+
+static int park_cpu = -1;
+
+/*
+ * nvme_balance_once: moves one tenant from the core with the highest
+ * scheduler load to the one with the lowest, choosing the tenant whose
+ * load best evens out the two. Runs on the first core and uses the same
+ * commands as an external control plane, so it only acts when no other
+ * command is in progress.
+ */
+static void nvme_balance_once(void)
+{
+	volatile struct command_struct *cmd;
+	int i, src = -1, dst = -1;
+	double load, gap, best_gap;
+	long best = -1;
+
+	for (i = 0; i < cpus_active; i++) {
+		cmd = &cp_shmem->command[i];
+		if (cmd->cmd_id != CP_CMD_NOP || cmd->status != CP_STATUS_READY)
+			return;
+		if (cmd->cpu_state != CP_CPU_STATE_RUNNING || i == park_cpu)
+			continue;
+		load = cp_shmem->cpu_metrics[i].nvme_load;
+		if (cp_shmem->cpu_metrics[i].nvme_tenants > 1 &&
+		    (src < 0 || load > cp_shmem->cpu_metrics[src].nvme_load))
+			src = i;
+		if (dst < 0 || load < cp_shmem->cpu_metrics[dst].nvme_load)
+			dst = i;
+	}
+	if (src < 0 || dst < 0 || src == dst)
+		return;
+
+	gap = cp_shmem->cpu_metrics[src].nvme_load - cp_shmem->cpu_metrics[dst].nvme_load;
+	if (gap < NVME_BALANCE_MIN_GAP ||
+	    cp_shmem->cpu_metrics[src].nvme_load < NVME_BALANCE_RATIO * cp_shmem->cpu_metrics[dst].nvme_load)
+		return;
+
+	// moving a tenant with load x leaves a gap of |gap - 2x|
+	best_gap = gap;
+	spin_lock(&nvme_bitmap_lock);
+	for (i = 1; i < MAX_NVME_FLOW_GROUPS; i++) {
+		if (!bitmap_test(nvme_fgs_bitmap, i) || nvme_fgs[i].tid != src ||
+		    nvme_fgs[i].pinned)
+			continue;
+		if (fabs(gap - 2 * nvme_fgs[i].load) < best_gap) {
+			best_gap = fabs(gap - 2 * nvme_fgs[i].load);
+			best = i;
+		}
 	}
+	spin_unlock(&nvme_bitmap_lock);
+	if (best < 0)
+		return;
 
+	cmd = &cp_shmem->command[src];
+	cmd->migrate_tenant.nvme_fg = best;
+	cmd->migrate_tenant.cpu = dst;
+	cmd->status = CP_STATUS_RUNNING;
+	cmd->cmd_id = CP_CMD_MIGRATE_TENANT;
 }
 
 /*
- * update_scheduler_bitvector: 
- * 		- synchronizes clearing of the global token bucket to limit global BE token accumulation
- * 		- mark global bitvector to indicate this thread has completed a scheduling round
- * 		- if last thread to complete a round, clear the global vector
- * 		- updates to global vector are not atomic operations because want to limit perf overhead
- * 		  and the exact timing of token bucket reset is not critical, as long as we reset approximately
- * 		  after each thread has had a chance to get tokens  
+ * nvme_balance_tenants: the tenant balancer, runs nvme_balance_once()
+ * every nvme_balance_interval_ms
  */
-static void update_scheduled_bitvector(void){
-	
+static void nvme_balance_tenants(struct timer *t, struct eth_fg *unused)
+{
+	timer_add(&nvme_balance_timer, NULL, nvme_balance_interval_ms * ONE_MS);
+	nvme_balance_once();
+}
+
+/*
+ * Core parking: when the NVMe completion rate of the running cores fits
+ * on one core fewer, the controller moves the tenants and flow groups of
+ * the last running core to the others, one command at a time, and parks
+ * it in cp_idle(). When the rate exceeds the running cores' capacity or
+ * a core's RX queuing delay exceeds nvme_park_delay_us, it wakes a parked
+ * core through its idle FIFO and balances tenants back onto it. Parking
+ * is abandoned if the delay rises while the core drains.
+ *
+ * Runs on the first core, which is never parked, and moves one core at a
+ * time. Cores with pinned tenants are not parked. Each transition logs
+ * how long it took and the highest RX queuing delay of the running cores
+ * meanwhile, the latency it added.
+ */
+enum {
+	PARK_NONE = 0,
+	PARK_DRAINING,		// moving tenants and flow groups off park_cpu
+	PARK_IDLING,		// CP_CMD_IDLE sent, waiting for park_cpu to block
+	PARK_WAKING,		// FIFO written, waiting for park_cpu to run
+};
+
+static int park_state;
+static unsigned long park_start;	// TSC the transition started at
+static unsigned long park_cooldown;	// TSC before which no core is parked
+static double park_max_delay;		// highest RX queuing delay during the transition
+static double park_worst_delay;		// highest over all transitions
+
+static int nvme_park_init(void)
+{
+	char path[IDLE_FIFO_SIZE];
 	int i;
-	scheduled_bit_vector[percpu_get(cpu_nr)]++;
 
-	for (i = 0; i < cpus_active; i++){
-		if (scheduled_bit_vector[i] == 0)
-			break;
-	}
-	if (i == cpus_active){ // all other threads scheduled at least once
-		atomic_u64_write(&global_leftover_tokens, 0);
-		
-		//clear scheduled bit vector
-		for (i = 0; i < cpus_active; i++) {
-			scheduled_bit_vector[i] =  0;
+	for (i = 1; i < cpus_active; i++) {
+		snprintf(path, sizeof(path), NVME_PARK_FIFO, i);
+		if (mkfifo(path, 0600) && access(path, F_OK)) {
+			log_err("core parking: cannot create %s\n", path);
+			return -EIO;
 		}
 	}
-	
+
+	timer_init_entry(&nvme_park_timer, nvme_park_cores);
+	timer_add(&nvme_park_timer, NULL, nvme_park_interval_ms * ONE_MS);
+	return 0;
 }
 
-int nvme_sched(void)
+static void park_start_transition(int state, int cpu)
 {
-#ifdef NO_SCHED
-	return 0;
-#endif
-	struct nvme_tenant_mgmt* thread_tenant_manager;
-	thread_tenant_manager = &percpu_get(nvme_tenant_manager);
-	
-	if (thread_tenant_manager->num_tenants == 0) { 
-		percpu_get(last_sched_time) = timer_now();
-		percpu_get(last_sched_time_be) = rdtsc();
-		update_scheduled_bitvector(); 
-		return 0;
-	}
+	park_state = state;
+	park_cpu = cpu;
+	park_start = rdtsc();
+	park_max_delay = 0;
+}
 
-	nvme_sched_subround1(); // serve latency-critical tenants
-	nvme_sched_subround2(); // serve best-effort tenants
-	
-	percpu_get(local_leftover_tokens) = 0;
-	percpu_get(local_extra_demand) = 0;
+static void park_end_transition(const char *what)
+{
+	if (park_max_delay > park_worst_delay)
+		park_worst_delay = park_max_delay;
+	log_info("core parking: %s core %d in %lu us, RX queuing delay up to %.1f us (worst %.1f us)\n",
+		 what, park_cpu, (rdtsc() - park_start) / cycles_per_us,
+		 park_max_delay, park_worst_delay);
+
+	park_state = PARK_NONE;
+	park_cpu = -1;
+	park_cooldown = rdtsc() + (unsigned long) cycles_per_us * NVME_PARK_COOLDOWN_MS * ONE_MS;
+}
 
-	update_scheduled_bitvector(); 
+// whether a tenant managed by cpu is pinned to it
+static bool park_cpu_pinned(int cpu)
+{
+	bool pinned = false;
+	int i;
 
-	return 0;
+	spin_lock(&nvme_bitmap_lock);
+	for (i = 1; i < MAX_NVME_FLOW_GROUPS; i++) {
+		if (bitmap_test(nvme_fgs_bitmap, i) && nvme_fgs[i].tid == cpu &&
+		    nvme_fgs[i].pinned) {
+			pinned = true;
+			break;
+		}
+	}
+	spin_unlock(&nvme_bitmap_lock);
+	return pinned;
 }
 
-void nvme_process_completions()
+// the last running core without pinned tenants, never the first one
+static int park_candidate(void)
 {
 	int i;
-	int max_completions = 4096;
 
-	if (CFG.num_nvmedev == 0)
+	for (i = cpus_active - 1; i > 0; i--) {
+		if (cp_shmem->command[i].cpu_state == CP_CPU_STATE_RUNNING &&
+		    !park_cpu_pinned(i))
+			return i;
+	}
+	return -1;
+}
+
+// the running core, other than park_cpu, that is idle and least loaded
+static int park_target(void)
+{
+	volatile struct command_struct *cmd;
+	int i, dst = -1;
+
+	for (i = 0; i < cpus_active; i++) {
+		cmd = &cp_shmem->command[i];
+		if (i == park_cpu || cmd->cpu_state != CP_CPU_STATE_RUNNING ||
+		    cmd->cmd_id != CP_CMD_NOP || cmd->status != CP_STATUS_READY)
+			continue;
+		if (dst < 0 || cp_shmem->cpu_metrics[i].nvme_completions <
+			       cp_shmem->cpu_metrics[dst].nvme_completions)
+			dst = i;
+	}
+	return dst;
+}
+
+// issues the next command that empties park_cpu, then parks it
+static void park_drain(void)
+{
+	volatile struct command_struct *cmd = &cp_shmem->command[park_cpu];
+	DEFINE_BITMAP(fg_bitmap, ETH_MAX_TOTAL_FG);
+	int i, dst, num_fgs = 0;
+	long fg_handle = -1;
+
+	if (cmd->cmd_id != CP_CMD_NOP || cmd->status != CP_STATUS_READY)
+		return;
+	// a pinned tenant may have registered since draining started
+	if (park_cpu_pinned(park_cpu)) {
+		park_end_transition("gave up parking");
+		return;
+	}
+	dst = park_target();
+	if (dst < 0)
 		return;
 
-	for(i = 0; i < percpu_get(open_ev_ptr); i++) {
-		usys_nvme_opened(percpu_get(open_ev[i]), global_ns_size, global_ns_sector_size);
-		percpu_get(received_nvme_completions)++;
+	spin_lock(&nvme_bitmap_lock);
+	for (i = 1; i < MAX_NVME_FLOW_GROUPS; i++) {
+		if (bitmap_test(nvme_fgs_bitmap, i) && nvme_fgs[i].tid == park_cpu) {
+			fg_handle = i;
+			break;
+		}
 	}
-	percpu_get(open_ev_ptr) = 0;
-	percpu_get(received_nvme_completions) +=
-		spdk_nvme_qpair_process_completions(percpu_get(qpair),
-						    max_completions);
+	spin_unlock(&nvme_bitmap_lock);
+
+	if (fg_handle > 0) {
+		cmd->migrate_tenant.nvme_fg = fg_handle;
+		cmd->migrate_tenant.cpu = dst;
+		cmd->status = CP_STATUS_RUNNING;
+		cmd->cmd_id = CP_CMD_MIGRATE_TENANT;
+		return;
+	}
+
+	// flow groups without tenants, e.g. of connections not registered yet
+	bitmap_init(fg_bitmap, ETH_MAX_TOTAL_FG, 0);
+	for (i = 0; i < cp_shmem->nr_flow_groups; i++) {
+		if (cp_shmem->flow_group[i].cpu == park_cpu) {
+			bitmap_set(fg_bitmap, i);
+			num_fgs++;
+		}
+	}
+	if (num_fgs) {
+		memcpy((void *) cmd->migrate.fg_bitmap, fg_bitmap, sizeof(fg_bitmap));
+		cmd->migrate.cpu = dst;
+		cmd->status = CP_STATUS_RUNNING;
+		cmd->cmd_id = CP_CMD_MIGRATE;
+		return;
+	}
+
+	snprintf((char *) cmd->idle.fifo, IDLE_FIFO_SIZE, NVME_PARK_FIFO, park_cpu);
+	cmd->cmd_id = CP_CMD_IDLE;
+	park_state = PARK_IDLING;
+}
+
+// writes to the FIFO cpu blocks on in cp_idle(), fails if it is not there yet
+static bool park_wake(int cpu)
+{
+	char c = 0;
+	int fd, ret;
+
+	fd = open((char *) cp_shmem->command[cpu].idle.fifo, O_WRONLY | O_NONBLOCK);
+	if (fd == -1)
+		return false;
+	ret = write(fd, &c, 1);
+	close(fd);
+	return ret == 1;
+}
+
+static void nvme_park_cores(struct timer *t, struct eth_fg *unused)
+{
+	volatile struct command_struct *cmd;
+	volatile struct cpu_metrics *metrics;
+	int i, running = 0, parked = -1, cpu;
+	double rate = 0, delay = 0;
+
+	for (i = 0; i < cpus_active; i++) {
+		cmd = &cp_shmem->command[i];
+		metrics = &cp_shmem->cpu_metrics[i];
+		if (i == park_cpu)
+			continue;
+		if (cmd->cpu_state != CP_CPU_STATE_RUNNING) {
+			parked = i;
+			continue;
+		}
+		running++;
+		rate += metrics->nvme_completions;
+		if (metrics->queuing_delay > delay)
+			delay = metrics->queuing_delay;
+	}
+	if (delay > park_max_delay)
+		park_max_delay = delay;
+
+	switch (park_state) {
+	case PARK_DRAINING:
+		if (delay > nvme_park_delay_us ||
+		    rdtsc() - park_start > (unsigned long) cycles_per_us * NVME_PARK_DRAIN_MAX_MS * ONE_MS) {
+			// the balancer moves its tenants back if needed
+			park_end_transition("gave up parking");
+			break;
+		}
+		park_drain();
+		break;
+	case PARK_IDLING:
+		if (cp_shmem->command[park_cpu].cpu_state != CP_CPU_STATE_RUNNING)
+			park_end_transition("parked");
+		break;
+	case PARK_WAKING:
+		if (cp_shmem->command[park_cpu].cpu_state == CP_CPU_STATE_RUNNING)
+			park_end_transition("woke");
+		break;
+	default:
+		if (parked >= 0 && (delay > nvme_park_delay_us ||
+				    rate > (double) running * nvme_park_core_iops)) {
+			if (park_wake(parked))
+				park_start_transition(PARK_WAKING, parked);
+		} else if (running > 1 && rdtsc() > park_cooldown &&
+			   delay < nvme_park_delay_us / 2 &&
+			   rate < (running - 1) * nvme_park_core_iops * NVME_PARK_HEADROOM &&
+			   (cpu = park_candidate()) > 0) {
+			park_start_transition(PARK_DRAINING, cpu);
+			park_drain();
+		} else {
+			nvme_balance_once();
+		}
+	}
+
+	timer_add(&nvme_park_timer, NULL,
+		  (park_state == PARK_NONE ? nvme_park_interval_ms : NVME_PARK_STEP_MS) * ONE_MS);
 }
@@ -0,0 +1,155 @@
+/*
+ * Copyright 2013-16 Board of Trustees of Stanford University
+ * Copyright 2013-16 Ecole Polytechnique Federale Lausanne (EPFL)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * binlog.h - binary log records and file format
+ *
+ * logk_fast() records a call site id and its raw arguments instead of a
+ * formatted string. This header is shared by the dataplane, which writes
+ * the records, and tools/ix_logdecode, which formats them offline.
+ *
+ * A binary log file starts with a struct binlog_file_hdr, followed by
+ * entries that each begin with a uint32_t type:
+ * - BINLOG_ENT_SITE: a struct binlog_site_ent, then the format string and
+ *   the file name, emitted before the first record of the site
+ * - BINLOG_ENT_RECORD: a struct binlog_record_ent
+ * - BINLOG_ENT_DROPPED: a struct binlog_dropped_ent, for records lost
+ *   because a core's ring was full
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#define BINLOG_MAGIC		"IXBINLOG"
+#define BINLOG_MAX_ARGS		6
+
+enum {
+	BINLOG_ENT_SITE = 1,
+	BINLOG_ENT_RECORD,
+	BINLOG_ENT_DROPPED,
+};
+
+struct binlog_record {
+	uint64_t tsc;
+	uint16_t site;
+	uint8_t cpu;
+	uint8_t nargs;
+	uint32_t suppressed;	/* rate limited calls of the site before this one */
+	uint64_t args[BINLOG_MAX_ARGS];
+};
+
+struct binlog_file_hdr {
+	char magic[8];
+	uint64_t cycles_per_us;
+	uint64_t start_tsc;
+	uint64_t start_time;	/* in seconds since the epoch, at start_tsc */
+};
+
+struct binlog_site_ent {
+	uint32_t type;
+	uint16_t id;
+	uint8_t level;
+	uint8_t pad;
+	uint32_t line;
+	uint16_t fmt_len;
+	uint16_t file_len;
+};
+
+struct binlog_record_ent {
+	uint32_t type;
+	uint32_t pad;
+	struct binlog_record rec;
+};
+
+struct binlog_dropped_ent {
+	uint32_t type;
+	uint32_t cpu;
+	uint64_t count;
+};
+
+/**
+ * binlog_format - formats a record
+ * @buf: the output buffer
+ * @len: the size of @buf
+ * @fmt: the printf format string of the call site
+ * @args: the arguments, each widened to 64 bits
+ * @nargs: the number of arguments
+ *
+ * Only integer and pointer conversions are supported. Strings and floating
+ * point arguments cannot be recorded, so %s prints the pointer value and
+ * floating point conversions print a placeholder.
+ */
+static inline void binlog_format(char *buf, size_t len, const char *fmt,
+				 const uint64_t *args, int nargs)
+{
+	char spec[32];
+	size_t off = 0;
+	int arg = 0;
+
+	buf[0] = 0;
+	while (*fmt && off + 1 < len) {
+		const char *start = fmt;
+		bool is_long = false;
+		int n;
+
+		if (*fmt != '%' || fmt[1] == '%') {
+			buf[off++] = *fmt;
+			fmt += (*fmt == '%') ? 2 : 1;
+			buf[off] = 0;
+			continue;
+		}
+
+		for (fmt++; *fmt && strchr("#0- +'0123456789.hlLqjzt", *fmt); fmt++)
+			if (*fmt == 'l' || *fmt == 'q' || *fmt == 'j' || *fmt == 'z' || *fmt == 't')
+				is_long = true;
+		if (!*fmt || fmt - start + 2 > (int) sizeof(spec))
+			break;
+		memcpy(spec, start, fmt - start + 1);
+		spec[fmt - start + 1] = 0;
+
+		if (arg >= nargs) {
+			n = snprintf(buf + off, len - off, "<?>");
+		} else if (strchr("diouxXc", *fmt)) {
+			if (is_long)
+				n = snprintf(buf + off, len - off, spec, (long) args[arg]);
+			else
+				n = snprintf(buf + off, len - off, spec, (int) args[arg]);
+			arg++;
+		} else if (*fmt == 'p' || *fmt == 's') {
+			n = snprintf(buf + off, len - off, "%#lx", (unsigned long) args[arg++]);
+		} else {
+			n = snprintf(buf + off, len - off, "<%c>", *fmt);
+			arg++;
+		}
+		fmt++;
+		if (n < 0)
+			break;
+		off += n;
+		if (off >= len)
+			off = len - 1;
+	}
+}
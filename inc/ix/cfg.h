@@ -28,6 +28,7 @@
 #pragma once
 
 #include <ix/pci.h>
+#include <ix/nvme_sched.h>
 #include <net/ethernet.h>
 
 
@@ -41,12 +42,6 @@ enum dev_types {
 	NVME_DEV,
 };
 
-enum nvme_dev_models {
-	DEFAULT_FLASH, 		// generic device with no token limit
-	FAKE_FLASH,			// no flash: don't schedule nvme requests on device, directly call nvme completion event
-	FLASH_DEV_MODEL,	// flash with request cost model and token limits specified in config input file
-};
-
 struct cfg_ip_addr {
 	uint32_t addr;
 };
@@ -72,26 +67,15 @@ struct cfg_parameters {
 	uint16_t ports[CFG_MAX_PORTS];
 
 	char loader_path[256];
+	char log_file[256];	/* binary log of logk_fast(), or empty for stdout */
 };
 
 extern struct cfg_parameters CFG;
 
-int nvme_dev_model;
-bool nvme_sched_flag;
-
-
-int NVME_READ_COST;
-int NVME_WRITE_COST;
-unsigned long MAX_DEV_TOKEN_RATE;
-
-struct lat_tokenrate_pair{
-	uint32_t p95_tail_latency;
-	uint64_t token_rate_limit;
-	uint64_t token_rdonly_rate_limit;
-};
-
-struct lat_tokenrate_pair dev_model[128];
-int dev_model_size;
+int nvme_balance_interval_ms;	// period of the tenant balancer, 0 if off
+int nvme_park_interval_ms;	// period of the core parking controller, 0 if off
+int nvme_park_core_iops;	// NVMe completions/s a running core should serve
+int nvme_park_delay_us;		// RX queuing delay that wakes a parked core
 
 extern int cfg_init(int argc, char *argv[], int *args_parsed);
 
@@ -36,6 +36,10 @@ struct cpu_metrics {
 	double queue_size[3];
 	long loop_duration;
 	double idle[3];
+	double nvme_load;	/* NVMe tokens issued per us (EMA) */
+	double nvme_backlog;	/* NVMe tokens queued in software queues (EMA) */
+	double nvme_completions; /* NVMe completions per second (EMA) */
+	int nvme_tenants;
 } __aligned(64);
 
 struct flow_group_metrics {
@@ -51,6 +55,7 @@ enum commands {
 	CP_CMD_NOP = 0,
 	CP_CMD_MIGRATE,
 	CP_CMD_IDLE,
+	CP_CMD_MIGRATE_TENANT,
 };
 
 enum status {
@@ -70,6 +75,10 @@ struct command_struct {
 		struct {
 			char fifo[IDLE_FIFO_SIZE];
 		} idle;
+		struct {
+			long nvme_fg;	/* NVMe flow group handle */
+			int cpu;
+		} migrate_tenant;
 	};
 	char no_idle;
 };
@@ -30,6 +30,14 @@
 #include <ix/cpu.h>
 #include <ix/log.h>
 
+/*
+ * Each vector also keeps a histogram of latencies in cycles, bucket i
+ * counting [2^i, 2^(i+1)) and the last bucket everything above. Only one
+ * event in KSTATS_HIST_SAMPLE (a power of 2) is added to it.
+ */
+#define KSTATS_HIST_BUCKETS	32
+#define KSTATS_HIST_SAMPLE	8
+
 typedef struct kstats_distr {
 	uint64_t count;
 	uint64_t min_occ;
@@ -38,6 +46,7 @@ typedef struct kstats_distr {
 	uint64_t min_lat;
 	uint64_t max_lat;
 	uint64_t tot_lat;
+	uint32_t lat_hist[KSTATS_HIST_BUCKETS];
 
 } kstats_distr;
 
@@ -55,6 +64,13 @@ typedef struct kstats {
 #include "kstatvectors.h"
 } kstats;
 
+/* NVMe completion polling passes that reached the device */
+typedef struct kstats_nvme_poll {
+	uint64_t polls;
+	uint64_t completions;
+	uint64_t budget;
+} kstats_nvme_poll;
+
 #ifdef ENABLE_KSTATS
 
 DECLARE_PERCPU(kstats, _kstats);
@@ -62,6 +78,7 @@ DECLARE_PERCPU(kstats_accumulate, _kstats_accumulate);
 DECLARE_PERCPU(int, _kstats_packets);
 DECLARE_PERCPU(int, _kstats_batch_histogram[]);
 DECLARE_PERCPU(int, _kstats_backlog_histogram[]);
+DECLARE_PERCPU(kstats_nvme_poll, _kstats_nvme_poll);
 
 #define KSTATS_BATCH_HISTOGRAM_SIZE 512
 #define KSTATS_BACKLOG_HISTOGRAM_SIZE 512
@@ -74,6 +91,30 @@ static inline void kstats_vector(kstats_distr *n)
 	percpu_get(_kstats_accumulate).cur = n;
 }
 
+/* called before n->count is incremented for the event */
+static inline void kstats_hist_add(kstats_distr *n, uint64_t cycles)
+{
+	int bucket;
+
+	if (n->count & (KSTATS_HIST_SAMPLE - 1))
+		return;
+
+	bucket = cycles ? 63 - clz64(cycles) : 0;
+	n->lat_hist[min(bucket, KSTATS_HIST_BUCKETS - 1)]++;
+}
+
+/* records a sample, e.g. a delay, as the latency of @n */
+static inline void kstats_sample(kstats_distr *n, uint64_t cycles)
+{
+	kstats_hist_add(n, cycles);
+	if (n->count == 0 || n->min_lat > cycles)
+		n->min_lat = cycles;
+	if (n->max_lat < cycles)
+		n->max_lat = cycles;
+	n->tot_lat += cycles;
+	n->count++;
+}
+
 static inline void kstats_packets_inc(int count)
 {
 	percpu_get(_kstats_packets) += count;
@@ -95,12 +136,23 @@ static inline void kstats_backlog_inc(int count)
 	percpu_get(_kstats_backlog_histogram)[count]++;
 }
 
+static inline void kstats_nvme_poll_inc(int completions, int budget)
+{
+	kstats_nvme_poll *p = &percpu_get(_kstats_nvme_poll);
+
+	p->polls++;
+	p->completions += completions;
+	p->budget += budget;
+}
+
 #define KSTATS_PUSH(TYPE, _save) \
 	kstats_enter(&(percpu_get(_kstats)).TYPE, _save)
 #define KSTATS_VECTOR(TYPE)     \
 	kstats_vector(&(percpu_get(_kstats)).TYPE)
 #define KSTATS_POP(_save)       \
 	kstats_leave(_save)
+#define KSTATS_SAMPLE(TYPE, _cycles) \
+	kstats_sample(&(percpu_get(_kstats)).TYPE, _cycles)
 //#define KSTATS_CURRENT_IS(TYPE)	(percpu_get(_kstats_accumulate).cur==&kstatsCounters.TYPE)
 #define KSTATS_PACKETS_INC(_count) \
 	kstats_packets_inc(_count)
@@ -108,6 +160,8 @@ static inline void kstats_backlog_inc(int count)
 	kstats_batch_inc(_count)
 #define KSTATS_BACKLOG_INC(_count) \
 	kstats_backlog_inc(_count)
+#define KSTATS_NVME_POLL_INC(_completions, _budget) \
+	kstats_nvme_poll_inc(_completions, _budget)
 
 extern int kstats_init_cpu(void);
 
@@ -116,10 +170,12 @@ extern int kstats_init_cpu(void);
 #define KSTATS_PUSH(TYPE, _save)
 #define KSTATS_VECTOR(TYPE)
 #define KSTATS_POP(_save)
+#define KSTATS_SAMPLE(TYPE, _cycles)
 #define KSTATS_CURRENT_IS(TYPE)     0
 #define KSTATS_PACKETS_INC(_count)
 #define KSTATS_BATCH_INC(_count)
 #define KSTATS_BACKLOG_INC(_count)
+#define KSTATS_NVME_POLL_INC(_completions, _budget)
 
 
 #endif /* ENABLE_KSTATS */
@@ -48,6 +48,7 @@ DEF_KSTATS(tcp_output_syn);
 DEF_KSTATS(tcp_unified_handler);
 DEF_KSTATS(timer_tcp_send_delayed_ack);
 DEF_KSTATS(timer_handler);
+DEF_KSTATS(hrtimer_late);
 DEF_KSTATS(timer_tcp_retransmit);
 DEF_KSTATS(timer_tcp_persist);
 DEF_KSTATS(bsys_dispatch_one);
@@ -61,5 +62,16 @@ DEF_KSTATS(bsys_tcp_sendv);
 DEF_KSTATS(bsys_udp_recv_done);
 DEF_KSTATS(bsys_udp_send);
 DEF_KSTATS(bsys_udp_sendv);
+DEF_KSTATS(nvme_sched);
+DEF_KSTATS(nvme_completions);
+DEF_KSTATS(nvme_poll_skipped);
+DEF_KSTATS(nvme_poll_capped);
+DEF_KSTATS(bsys_nvme_read);
+DEF_KSTATS(bsys_nvme_write);
+DEF_KSTATS(bsys_nvme_readv);
+DEF_KSTATS(bsys_nvme_writev);
+DEF_KSTATS(bsys_nvme_trim);
+DEF_KSTATS(bsys_nvme_flush);
+DEF_KSTATS(bsys_nvme_write_zeroes);
 
 DEF_KSTATS(posix_syscall);
@@ -59,3 +59,50 @@ enum {
 #define panic(fmt, ...) \
 do {logk(LOG_EMERG, fmt, ##__VA_ARGS__); exit(-1); } while (0)
 
+/*
+ * logk_fast - logs from the dataplane without blocking
+ *
+ * Records the call site and up to BINLOG_MAX_ARGS integer or pointer
+ * arguments in a per-core ring, which a separate thread drains to stdout
+ * or to the binary log file set by log_file in the config. Each call site
+ * logs at most LOG_FAST_RATE records per second; the next record after a
+ * burst says how many calls were suppressed. A call made when the ring is
+ * full is dropped and counted. Strings and floating point arguments are
+ * not supported.
+ *
+ * Before a core has its ring, logk_fast() falls back to logk().
+ */
+#define LOG_FAST_RATE	100
+
+struct log_site {
+	const char *fmt;
+	const char *file;
+	int line;
+	int level;
+	int id;			/* 0 until first used */
+	unsigned int count;	/* records in the current one second window */
+	unsigned int suppressed;
+	uint64_t window;	/* start of the window, in cycles */
+};
+
+extern void __logk_fast(struct log_site *site, int nargs, ...);
+
+#define __LOG_NARGS(_0, _1, _2, _3, _4, _5, _6, N, ...) N
+#define LOG_NARGS(...) __LOG_NARGS(0, ##__VA_ARGS__, 6, 5, 4, 3, 2, 1, 0)
+
+#define logk_fast(_level, _fmt, ...) \
+do { \
+	static struct log_site __log_site = { \
+		.fmt = _fmt, .file = __FILE__, .line = __LINE__, .level = _level, \
+	}; \
+	if ((_level) <= max_loglevel) \
+		__logk_fast(&__log_site, LOG_NARGS(__VA_ARGS__), ##__VA_ARGS__); \
+} while (0)
+
+#define log_err_fast(fmt, ...) logk_fast(LOG_ERR, fmt, ##__VA_ARGS__)
+#define log_warn_fast(fmt, ...) logk_fast(LOG_WARN, fmt, ##__VA_ARGS__)
+#define log_info_fast(fmt, ...) logk_fast(LOG_INFO, fmt, ##__VA_ARGS__)
+
+extern int log_init(void);
+extern int log_init_cpu(void);
+
@@ -0,0 +1,158 @@
+/*
+ * Copyright 2013-16 Board of Trustees of Stanford University
+ * Copyright 2013-16 Ecole Polytechnique Federale Lausanne (EPFL)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * nvme_sched.h - the flash token scheduler
+ *
+ * Request cost model, device model, tenant weights, in-flight caps and the
+ * two scheduling subrounds. dp/core/nvme_sched.c has no dependency on the
+ * rest of IX, and is compiled into both the dataplane (drivers/nvmedev.c)
+ * and the Linux server (reflex_linux/token_sched.c). Each of them provides
+ * the hooks below and keeps one struct nvme_tenant_mgmt per thread.
+ */
+
+#pragma once
+
+#include <ix/stddef.h>
+#include <ix/atomic.h>
+#include <ix/list.h>
+#include <ix/nvme_sw_queue.h>
+
+#define NVME_CMD_READ 0
+#define NVME_CMD_WRITE 1
+#define NVME_CMD_TRIM 2
+#define NVME_CMD_FLUSH 3
+#define NVME_CMD_WRITE_ZEROES 4
+
+#define NVME_CLASS_BE 0
+#define NVME_CLASS_LC 1
+
+// token rates are fixed point, in tokens per 2^TOKEN_RATE_SHIFT clock ticks
+#define TOKEN_RATE_SHIFT 32
+
+#define MAX_NVME_FLOW_GROUPS 16384 //16
+#define NVME_SCHED_MAX_THREADS 128
+
+enum nvme_dev_models {
+	DEFAULT_FLASH, 		// generic device with no token limit
+	FAKE_FLASH,			// no flash: don't schedule nvme requests on device, directly call nvme completion event
+	FLASH_DEV_MODEL,	// flash with request cost model and token limits specified in config input file
+};
+
+struct lat_tokenrate_pair{
+	uint32_t p95_tail_latency;
+	uint64_t token_rate_limit;
+	uint64_t token_rdonly_rate_limit;
+};
+
+extern int nvme_dev_model;
+extern bool nvme_sched_flag;
+
+extern int NVME_READ_COST;
+extern int NVME_WRITE_COST;
+extern int NVME_TRIM_COST;
+extern int NVME_FLUSH_COST;
+extern int NVME_WRITE_ZEROES_COST;
+
+/* in-flight command and byte caps, 0 for none, -1 to derive from token_limits */
+extern int NVME_MAX_INFLIGHT_TENANT;
+extern int NVME_MAX_INFLIGHT_BYTES_TENANT;
+extern int NVME_MAX_INFLIGHT_LC;
+extern int NVME_MAX_INFLIGHT_BYTES_LC;
+extern int NVME_MAX_INFLIGHT_BE;
+extern int NVME_MAX_INFLIGHT_BYTES_BE;
+extern unsigned long MAX_DEV_TOKEN_RATE;
+
+extern struct lat_tokenrate_pair dev_model[128];
+extern int dev_model_size;
+
+struct nvme_flow_group {
+	int flow_group_id;				// flow group id (index in bitmap)
+	//long ns_id; 					// namespace id
+	unsigned long cookie;			// cookie associated with connection context for user
+	unsigned int latency_us_SLO;	// latency SLO info (0 if best effort)
+	unsigned long IOPS_SLO;
+	int rw_ratio_SLO;
+	unsigned long scaled_IOPS_limit; // calculated based on IOPS, rw_ratio and rw cost
+	uint64_t token_rate;			// scaled_IOPS_limit (plus LC boost) in tokens per 2^TOKEN_RATE_SHIFT ticks
+	unsigned int be_weight;			// share of best-effort tokens relative to other BE tenants
+	bool latency_critical_flag;
+	struct nvme_sw_queue* nvme_swq;	// thread-local software queue for this flow group
+	unsigned int tid; 				// thread id
+	double load;					// tokens issued per us (EMA), read by the tenant balancer
+	bool pinned;					// never migrated, see NVME_FLOW_PINNED
+	int conn_ref_count;
+};
+
+/* flow groups by handle, registered ones are set in nvme_fgs_bitmap */
+extern struct nvme_flow_group nvme_fgs[MAX_NVME_FLOW_GROUPS];
+extern unsigned long nvme_fgs_bitmap[];
+
+/* per-thread scheduler state */
+struct nvme_tenant_mgmt {
+	struct list_head tenant_swq;
+	struct list_head be_active;	// BE tenants with queued requests, in DRR order
+	int tid;
+	int num_tenants;
+	int num_best_effort_tenants;
+	unsigned long be_weight;	// sum of the weights of BE tenants on this core
+	unsigned long be_active_weight;	// sum of the weights of the BE tenants in be_active
+	unsigned long be_active_weight_published;
+	unsigned long last_sched_time;	// in clock ticks
+	unsigned long local_extra_demand;
+	unsigned long local_leftover_tokens;
+	uint64_t be_token_rem;
+	unsigned int class_inflight_cmds[2];
+	unsigned long class_inflight_bytes[2];
+};
+
+/*
+ * Hooks, defined by the server the scheduler is linked into. They are
+ * called on the thread that owns @m.
+ */
+extern unsigned long nvme_sched_now(void);			// the clock, in ticks
+extern void nvme_sched_issue(struct nvme_tenant_mgmt *m, struct nvme_sched_req *req);
+extern bool nvme_sched_running(int tid);			// false if the thread doesn't schedule
+extern void nvme_sched_log(const char *fmt, ...);
+
+extern int nvme_sched_parse_devmodel(const char *devmodel_file);
+extern void nvme_sched_init(unsigned long ticks_per_us, int nr_threads);
+extern void nvme_sched_thread_init(struct nvme_tenant_mgmt *m, int tid);
+extern void nvme_sched_thread_idle(struct nvme_tenant_mgmt *m, bool idle);
+
+extern int nvme_compute_req_cost(int req_type, size_t req_len);
+extern unsigned long scaled_IOPS(unsigned long IOPS, int rw_ratio_100);
+extern uint64_t token_rate_fixed(unsigned long tokens_per_s);
+extern bool recalculate_weights_add(long new_flow_group_idx);
+extern void recalculate_weights_remove(long flow_group_idx);
+
+extern void nvme_sched_add_tenant(struct nvme_tenant_mgmt *m, struct nvme_sw_queue *swq,
+				  long fg_handle);
+extern void nvme_sched_remove_tenant(struct nvme_tenant_mgmt *m, struct nvme_sw_queue *swq);
+extern void drr_activate(struct nvme_tenant_mgmt *m, struct nvme_sw_queue *swq);
+extern void drr_deactivate(struct nvme_tenant_mgmt *m, struct nvme_sw_queue *swq);
+
+extern int nvme_sched_enqueue(struct nvme_tenant_mgmt *m, long fg_handle,
+			      struct nvme_sched_req *req, int cmd, size_t len);
+extern void nvme_inflight_put(struct nvme_tenant_mgmt *m, struct nvme_sched_req *req);
+extern void nvme_sched_round(struct nvme_tenant_mgmt *m);
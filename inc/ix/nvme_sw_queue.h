@@ -2,16 +2,30 @@
  * Data structure for Flash SW queue scheduling
  * Lock-free and works for single producer, single consumer 
  *
+ * Shared by the IX dataplane and reflex_linux, see ix/nvme_sched.h.
 */
 
-#include <ix/nvmedev.h>
+#pragma once
+
+#include <ix/stddef.h>
 #include <ix/list.h>
 
 #define NVME_SW_QUEUE_SIZE (256*8)  
 
+/*
+ * The scheduler's part of a request, embedded in the server's request
+ * (struct nvme_ctx in the dataplane).
+ */
+struct nvme_sched_req {
+	int req_cost;					//cost of request in tokens
+	unsigned long bytes;			//moved on the device, 0 for TRIM and FLUSH
+	struct nvme_sw_queue *swq;		//tenant charged for this command while in flight, or NULL
+	int sched_class;				//NVME_CLASS_[BE or LC] charged while in flight
+};
+
 struct nvme_sw_queue
 {
-    struct nvme_ctx* buf[NVME_SW_QUEUE_SIZE]; 
+    struct nvme_sched_req* buf[NVME_SW_QUEUE_SIZE]; 
 	int count;				  // number of elements current in queue
     unsigned int head;       // head index (insert here)
     unsigned int tail;       // tail index (remove from here)
@@ -19,16 +33,26 @@ struct nvme_sw_queue
 	unsigned long saved_tokens;
     long fg_handle;
 	long token_credit;
+	uint64_t token_rem;		// fraction of a token carried to the next round
+	unsigned int inflight_cmds;	// issued to the device and not completed yet
+	unsigned long inflight_bytes;
+	unsigned long issued_tokens;	// tokens issued since the last load update
+	bool draining;			// being migrated, issue nothing until in-flight drains
+	long drr_deficit;		// BE tokens this tenant may still spend in its DRR turns
+	bool drr_turn;			// got its quantum for the current turn
+	bool drr_active;		// linked in the thread's be_active list
+	struct list_node drr_list;
 	struct list_node list;
 };
 
 
 
 void nvme_sw_queue_init(struct nvme_sw_queue *q, long fg_handle);
-int nvme_sw_queue_push_back(struct nvme_sw_queue *q, struct nvme_ctx *ctx);
-int nvme_sw_queue_pop_front(struct nvme_sw_queue *q, struct nvme_ctx **ctx);
+int nvme_sw_queue_push_back(struct nvme_sw_queue *q, struct nvme_sched_req *req);
+int nvme_sw_queue_pop_front(struct nvme_sw_queue *q, struct nvme_sched_req **req);
 int nvme_sw_queue_isempty(struct nvme_sw_queue *q);
 int nvme_sw_queue_peak_head_cost(struct nvme_sw_queue *q);
+struct nvme_sched_req *nvme_sw_queue_peek_head(struct nvme_sw_queue *q);
 unsigned long nvme_sw_queue_save_tokens(struct nvme_sw_queue *q, unsigned long tokens);
 unsigned long nvme_sw_queue_take_saved_tokens(struct nvme_sw_queue *q);
 
@@ -0,0 +1,144 @@
+/*
+ * Copyright 2013-16 Board of Trustees of Stanford University
+ * Copyright 2013-16 Ecole Polytechnique Federale Lausanne (EPFL)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * reqtrace.h - request lifecycle tracing
+ *
+ * With ENABLE_REQTRACE, each dataplane core records timestamped events of
+ * sampled NVMe requests into a ring in the shared memory segment
+ * REQTRACE_SHM, keyed by the request's user-level cookie. The application
+ * records the events it sees (header parsed, response queued, response
+ * acknowledged) with ksys_reqtrace(), passing its own TSC reading; the
+ * dataplane records the software queue and device events itself. The ring
+ * is overwritten as it wraps, so tools/ix_reqtrace can snapshot it at any
+ * time and attribute each request's latency to its stages.
+ *
+ * This header is shared by the dataplane, libix and tools/ix_reqtrace.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#define REQTRACE_SHM		"/ix-reqtrace"
+#define REQTRACE_MAGIC		0x3145434152545152UL	/* "RQTRACE1" */
+#define REQTRACE_RING_SIZE	8192	/* events per core, a power of 2 */
+
+enum {
+	REQTRACE_RX = 0,	/* app: request header parsed */
+	REQTRACE_NVME_ENQUEUE,	/* queued in the tenant's software queue */
+	REQTRACE_NVME_DISPATCH,	/* submitted to the device by the scheduler */
+	REQTRACE_NVME_COMPLETE,	/* device completion processed */
+	REQTRACE_TX,		/* app: response queued for sending */
+	REQTRACE_ACK,		/* app: response acknowledged by the client */
+	REQTRACE_NR,
+};
+
+struct reqtrace_event {
+	uint64_t tsc;
+	uint64_t id;		/* the request's cookie */
+	uint32_t type;
+	uint32_t arg;		/* the NVMe flow group handle of the tenant */
+};
+
+struct reqtrace_ring {
+	volatile uint64_t head;	/* number of events ever recorded */
+	uint64_t pad[7];
+	struct reqtrace_event ev[REQTRACE_RING_SIZE];
+};
+
+struct reqtrace_shmem {
+	uint64_t magic;
+	uint32_t nr_cpus;
+	uint32_t ring_size;
+	uint64_t cycles_per_us;
+	uint64_t pad[5];
+	struct reqtrace_ring ring[];
+};
+
+#ifdef __KERNEL__
+
+#include <ix/stddef.h>
+#include <ix/cpu.h>
+
+#ifdef ENABLE_REQTRACE
+
+DECLARE_PERCPU(struct reqtrace_ring *, reqtrace_ring);
+DECLARE_PERCPU(unsigned long, reqtrace_pending);
+
+static inline void reqtrace_record(unsigned long id, int type, uint64_t tsc,
+				   uint32_t arg)
+{
+	struct reqtrace_ring *r = percpu_get(reqtrace_ring);
+	struct reqtrace_event *ev;
+	uint64_t head;
+
+	if (unlikely(!r))
+		return;
+
+	head = r->head;
+	ev = &r->ev[head & (REQTRACE_RING_SIZE - 1)];
+	ev->tsc = tsc;
+	ev->id = id;
+	ev->type = type;
+	ev->arg = arg;
+	/* x86 does not reorder stores, keep the compiler from doing so */
+	asm volatile("" ::: "memory");
+	r->head = head + 1;
+}
+
+/*
+ * The application records REQTRACE_RX for a sampled request right before
+ * the NVMe call that carries the same cookie, so the next command queued
+ * with that cookie is the one to trace.
+ */
+static inline bool reqtrace_claim(unsigned long cookie)
+{
+	if (likely(percpu_get(reqtrace_pending) != cookie))
+		return false;
+	percpu_get(reqtrace_pending) = 0;
+	return true;
+}
+
+#define REQTRACE_CTX(_ctx, _type) \
+	do { \
+		if (unlikely((_ctx)->traced)) \
+			reqtrace_record((_ctx)->cookie, _type, rdtsc(), (_ctx)->fg_handle); \
+	} while (0)
+
+extern long bsys_reqtrace(unsigned long id, int type, uint64_t tsc, uint32_t arg);
+extern int reqtrace_init(void);
+extern int reqtrace_init_cpu(void);
+
+#else /* ENABLE_REQTRACE */
+
+#define REQTRACE_CTX(_ctx, _type)
+
+static inline long bsys_reqtrace(unsigned long id, int type, uint64_t tsc, uint32_t arg)
+{
+	return 0;
+}
+
+#endif /* ENABLE_REQTRACE */
+
+#endif /* __KERNEL__ */
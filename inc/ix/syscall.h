@@ -98,24 +98,25 @@ enum {
  * Batched system calls
  */
 
-typedef long(*bsysfn_t)(uint64_t, uint64_t, uint64_t, uint64_t, uint64_t, uint64_t);
+typedef long(*bsysfn_t)(uint64_t, uint64_t, uint64_t, uint64_t, uint64_t, uint64_t,
+			 uint64_t);
 
 /*
  * batched system call descriptor format:
  * sysnr: - the system call number
- * arga-arge: parameters one through five
+ * arga-argg: parameters one through seven
  * argd: overwritten with the return code
  */
 struct bsys_desc {
 	uint64_t sysnr;
-	uint64_t arga, argb, argc, argd, arge, argf;
+	uint64_t arga, argb, argc, argd, arge, argf, argg;
 } __packed;
 
 struct bsys_ret {
 	uint64_t sysnr;
 	uint64_t cookie;
 	long ret;
-	uint64_t pad[4];
+	uint64_t pad[5];
 } __packed;
 
 #define BSYS_DESC_NOARG(desc, vsysnr) \
@@ -138,6 +139,9 @@ struct bsys_ret {
 #define BSYS_DESC_6ARG(desc, vsysnr, varga, vargb, vargc, vargd, varge, vargf) \
 	BSYS_DESC_5ARG(desc, vsysnr, varga, vargb, vargc, vargd, varge),	\
 	(desc)->argf = (uint64_t) (vargf)
+#define BSYS_DESC_7ARG(desc, vsysnr, varga, vargb, vargc, vargd, varge, vargf, vargg) \
+	BSYS_DESC_6ARG(desc, vsysnr, varga, vargb, vargc, vargd, varge, vargf), \
+	(desc)->argg = (uint64_t) (vargg)
 
 struct bsys_arr {
 	unsigned long len;
@@ -194,6 +198,10 @@ enum {
 	KSYS_NVME_CLOSE,
 	KSYS_NVME_REGISTER_FLOW,
 	KSYS_NVME_UNREGISTER_FLOW,
+	KSYS_NVME_TRIM,
+	KSYS_NVME_FLUSH,
+	KSYS_NVME_WRITE_ZEROES,
+	KSYS_REQTRACE,
 	KSYS_NR,
 };
 
@@ -425,6 +433,14 @@ ksys_nvme_readv(struct bsys_desc *d, hqu_t fg_handle, void **sgls, int num_sgls,
 }
 
 
+/*
+ * Flags of ksys_nvme_register_flow(). NVME_FLOW_PINNED keeps the tenant on
+ * the core it registered on: the tenant balancer, core parking and
+ * CP_CMD_MIGRATE_TENANT never move it, for applications that keep
+ * per-thread state for the tenant.
+ */
+#define NVME_FLOW_PINNED	(1U << 0)
+
 /**
  * ksys_nvme_register_flow - registers an nvme flow
  * @d: the syscal descriptor to program
@@ -433,14 +449,16 @@ ksys_nvme_readv(struct bsys_desc *d, hqu_t fg_handle, void **sgls, int num_sgls,
  * @latency_us_SLO: latency SLO (0 if not latency critical, ie if best-effort)
  * @IOPS_SLO: IOPS SLO (0 if not latency critical)
  * @rw_ratio_SLO: read write ratio corresponding to SLO above
+ * @be_weight: share of best-effort bandwidth (0 counts as 1, ignored if latency critical)
+ * @flags: NVME_FLOW_* flags
  */
 static inline void
 ksys_nvme_register_flow(struct bsys_desc *d, long flow_group_id, unsigned long cookie, 
 							 unsigned int latency_us_SLO, unsigned long IOPS_SLO, 
-							 int rw_ratio_SLO  )
+							 int rw_ratio_SLO, unsigned int be_weight, unsigned int flags)
 {
-	BSYS_DESC_5ARG(d, KSYS_NVME_REGISTER_FLOW, flow_group_id, cookie, 
-				   latency_us_SLO, IOPS_SLO, rw_ratio_SLO); 
+	BSYS_DESC_7ARG(d, KSYS_NVME_REGISTER_FLOW, flow_group_id, cookie, 
+				   latency_us_SLO, IOPS_SLO, rw_ratio_SLO, be_weight, flags); 
 }
 
 /* ksys_nvme_unregister_flow - unregisters an nvme flow
@@ -453,6 +471,71 @@ ksys_nvme_unregister_flow(struct bsys_desc *d, long fg_handle)
 	BSYS_DESC_1ARG(d, KSYS_NVME_UNREGISTER_FLOW, fg_handle);
 }
 
+/**
+ * ksys_nvme_trim - deallocates a range of an nvme namespace
+ * @d: the syscal descriptor to program
+ * @fg_handle: the flow group handle
+ * @lba: the first logical block to deallocate
+ * @lba_count: number of logical blocks
+ * @cookie: a user-level tag for the request
+ *
+ * Completes with usys_nvme_written().
+ */
+static inline void
+ksys_nvme_trim(struct bsys_desc *d, hqu_t fg_handle, unsigned long lba,
+	       unsigned int lba_count, unsigned long cookie)
+{
+	BSYS_DESC_4ARG(d, KSYS_NVME_TRIM, fg_handle, lba, lba_count, cookie);
+}
+
+/**
+ * ksys_nvme_flush - makes all completed nvme writes durable
+ * @d: the syscal descriptor to program
+ * @fg_handle: the flow group handle
+ * @cookie: a user-level tag for the request
+ *
+ * Completes with usys_nvme_written().
+ */
+static inline void
+ksys_nvme_flush(struct bsys_desc *d, hqu_t fg_handle, unsigned long cookie)
+{
+	BSYS_DESC_2ARG(d, KSYS_NVME_FLUSH, fg_handle, cookie);
+}
+
+/**
+ * ksys_nvme_write_zeroes - zeroes a range of an nvme namespace
+ * @d: the syscal descriptor to program
+ * @fg_handle: the flow group handle
+ * @lba: the first logical block to zero
+ * @lba_count: number of logical blocks
+ * @cookie: a user-level tag for the request
+ *
+ * Completes with usys_nvme_written().
+ */
+static inline void
+ksys_nvme_write_zeroes(struct bsys_desc *d, hqu_t fg_handle, unsigned long lba,
+		       unsigned int lba_count, unsigned long cookie)
+{
+	BSYS_DESC_4ARG(d, KSYS_NVME_WRITE_ZEROES, fg_handle, lba, lba_count, cookie);
+}
+
+/**
+ * ksys_reqtrace - records a request lifecycle event (see ix/reqtrace.h)
+ * @d: the syscal descriptor to program
+ * @cookie: the cookie of the request's NVMe command
+ * @type: REQTRACE_RX, REQTRACE_TX or REQTRACE_ACK
+ * @tsc: the TSC when the event happened
+ * @fg_handle: the flow group handle of the tenant
+ *
+ * Only has an effect if the dataplane is built with ENABLE_REQTRACE.
+ */
+static inline void
+ksys_reqtrace(struct bsys_desc *d, unsigned long cookie, int type,
+	      unsigned long tsc, hqu_t fg_handle)
+{
+	BSYS_DESC_4ARG(d, KSYS_REQTRACE, cookie, type, tsc, fg_handle);
+}
+
 
 /*
  * Commands that can be sent from the kernel to the user-level application.
@@ -721,7 +804,8 @@ extern long bsys_nvme_open(long dev_id, long ns_id);
 extern long bsys_nvme_close(long dev_id, long ns_id, hqu_t handle);
 extern long bsys_nvme_register_flow(long flow_group_id, unsigned long cookie, 
 				unsigned int latency_us_SLO, unsigned long IOPS_SLO, 
-				int rw_ratio_SLO);
+				int rw_ratio_SLO, unsigned int be_weight,
+				unsigned int flags);
 extern long bsys_nvme_unregister_flow(long flow_group_id); 
 extern long bsys_nvme_write(hqu_t priority, void *buf, unsigned long lba,
 			    unsigned int lba_count, unsigned long cookie);
@@ -732,6 +816,11 @@ extern long bsys_nvme_writev(hqu_t fg_handle, void **sgls, int num_sgls,
 
 extern long bsys_nvme_readv(hqu_t fg_handle, void **sgls, int num_sgls,
 			    unsigned long lba, unsigned int lba_count, unsigned long cookie);
+extern long bsys_nvme_trim(hqu_t fg_handle, unsigned long lba,
+			   unsigned int lba_count, unsigned long cookie);
+extern long bsys_nvme_flush(hqu_t fg_handle, unsigned long cookie);
+extern long bsys_nvme_write_zeroes(hqu_t fg_handle, unsigned long lba,
+				   unsigned int lba_count, unsigned long cookie);
   
 struct dune_tf;
 extern void do_syscall(struct dune_tf *tf, uint64_t sysnr);
@@ -107,12 +107,52 @@ static inline void timer_del(struct timer *t)
 extern void timer_run(void);
 extern uint64_t timer_deadline(uint64_t max_us);
 
+/*
+ * High-resolution timers, for delays under HRTIMER_MAX_DELAY_US that the
+ * wheels would round up to the next MIN_DELAY_US bucket. Deadlines are in
+ * TSC cycles, kept in a small per-core min-heap that hrtimer_run() checks
+ * on each polling pass.
+ */
+#define HRTIMER_MAX_DELAY_US	64
+
+struct hrtimer {
+	void (*handler)(struct hrtimer *t);
+	uint64_t deadline;	/* in cycles */
+	int heap_idx;		/* -1 if not pending */
+};
+
+/**
+ * hrtimer_init_entry - initializes a high-resolution timer
+ * @t: the timer
+ */
+static inline void
+hrtimer_init_entry(struct hrtimer *t, void (*handler)(struct hrtimer *t))
+{
+	t->handler = handler;
+	t->heap_idx = -1;
+}
+
+/**
+ * hrtimer_pending - determines if a high-resolution timer is pending
+ * @t: the timer
+ */
+static inline bool hrtimer_pending(struct hrtimer *t)
+{
+	return t->heap_idx >= 0;
+}
+
+extern int hrtimer_add(struct hrtimer *t, uint64_t nsecs);
+extern int hrtimer_add_abs(struct hrtimer *t, uint64_t deadline);
+extern void hrtimer_del(struct hrtimer *t);
+extern void hrtimer_run(void);
+
 extern int timer_collect_fgs(uint8_t *fg_vector, struct hlist_head *list, uint64_t *timer_pos);
 extern void timer_reinject_fgs(struct hlist_head *list, uint64_t timer_pos);
 
 
 extern void timer_init_fg(void);
 extern int timer_init_cpu(void);
+extern int hrtimer_init_cpu(void);
 extern int timer_init(void);
 
 extern int cycles_per_us;
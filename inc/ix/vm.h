@@ -39,12 +39,16 @@
 
 #include <ix/mem.h>
 #include <ix/lock.h>
+#include <ix/atomic.h>
 
 /* FIXME: this should be defined in inc/asm */
 #include <mmu-x86.h>
 
 DECLARE_SPINLOCK(vm_lock);
 
+/* bumped by vm_unmap(), so cached translations can tell they may be stale */
+extern atomic_t vm_unmap_gen;
+
 /* FIXME: a bunch of gross hacks until we can better integrate libdune */
 #define UINT64(x) ((uint64_t) x)
 #define CAST64(x) ((uint64_t) x)
@@ -187,6 +187,33 @@ static inline void ix_nvme_writev(hqu_t fg_handle, void **sgls,
 			 lba, lba_count, cookie);
 }
 
+static inline void ix_nvme_trim(hqu_t fg_handle, unsigned long lba,
+				unsigned int lba_count, unsigned long cookie)
+{
+	if (karr->len >= karr->max_len)
+		ix_flush();
+
+	ksys_nvme_trim(__bsys_arr_next(karr), fg_handle, lba, lba_count, cookie);
+}
+
+static inline void ix_nvme_flush(hqu_t fg_handle, unsigned long cookie)
+{
+	if (karr->len >= karr->max_len)
+		ix_flush();
+
+	ksys_nvme_flush(__bsys_arr_next(karr), fg_handle, cookie);
+}
+
+static inline void ix_nvme_write_zeroes(hqu_t fg_handle, unsigned long lba,
+					unsigned int lba_count, unsigned long cookie)
+{
+	if (karr->len >= karr->max_len)
+		ix_flush();
+
+	ksys_nvme_write_zeroes(__bsys_arr_next(karr), fg_handle, lba, lba_count,
+			       cookie);
+}
+
 
 extern void *ix_alloc_pages(int nrpages);
 extern void ix_free_pages(void *addr, int nrpages);
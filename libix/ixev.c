@@ -607,9 +607,63 @@ void ixev_nvme_writev(hqu_t fg_handle, void **sgls,
 			 lba, lba_count, cookie);
 }
 
+/*
+ * TRIM, FLUSH and WRITE_ZEROES complete like writes, with IXEV_NVME_WR
+ */
+void ixev_nvme_trim(hqu_t fg_handle, unsigned long lba,
+		    unsigned int lba_count, unsigned long cookie)
+{
+	if (unlikely(karr->len >= karr->max_len)) {
+		printf("ixev: ran out of command space 3\n");
+		exit(-1);
+	}
+
+	ksys_nvme_trim(__bsys_arr_next(karr), fg_handle, lba, lba_count, cookie);
+}
+
+void ixev_nvme_flush(hqu_t fg_handle, unsigned long cookie)
+{
+	if (unlikely(karr->len >= karr->max_len)) {
+		printf("ixev: ran out of command space 3\n");
+		exit(-1);
+	}
+
+	ksys_nvme_flush(__bsys_arr_next(karr), fg_handle, cookie);
+}
+
+void ixev_nvme_write_zeroes(hqu_t fg_handle, unsigned long lba,
+			    unsigned int lba_count, unsigned long cookie)
+{
+	if (unlikely(karr->len >= karr->max_len)) {
+		printf("ixev: ran out of command space 3\n");
+		exit(-1);
+	}
+
+	ksys_nvme_write_zeroes(__bsys_arr_next(karr), fg_handle, lba, lba_count,
+			       cookie);
+}
+
+/**
+ * ixev_reqtrace - records a request lifecycle event (see ix/reqtrace.h)
+ *
+ * A REQTRACE_RX event must come right before the NVMe call with the same
+ * cookie for the dataplane to trace that command.
+ */
+void ixev_reqtrace(unsigned long cookie, int type, unsigned long tsc,
+		   hqu_t fg_handle)
+{
+	if (unlikely(karr->len >= karr->max_len)) {
+		printf("ixev: ran out of command space 3\n");
+		exit(-1);
+	}
+
+	ksys_reqtrace(__bsys_arr_next(karr), cookie, type, tsc, fg_handle);
+}
+
 
 void ixev_nvme_register_flow(long flow_group_id, unsigned long cookie, unsigned int latency_us_SLO,
-							 unsigned long IOPS_SLO, int rw_ratio_SLO)
+							 unsigned long IOPS_SLO, int rw_ratio_SLO, unsigned int be_weight,
+							 unsigned int flags)
 {
 	if (unlikely(karr->len >= karr->max_len)) {
 		printf("ixev: ran out of command space 4\n");
@@ -617,7 +671,7 @@ void ixev_nvme_register_flow(long flow_group_id, unsigned long cookie, unsigned
 	}
 //	printf("IXEV: rw_ratio_SLO is %f\n", rw_ratio_SLO);
 	ksys_nvme_register_flow(__bsys_arr_next(karr), flow_group_id, cookie, 
-							latency_us_SLO, IOPS_SLO, rw_ratio_SLO);
+							latency_us_SLO, IOPS_SLO, rw_ratio_SLO, be_weight, flags);
 
 }
 
@@ -818,6 +872,9 @@ static void ixev_handle_one_ret(struct bsys_ret *r)
 		break;
 
 	case KSYS_NVME_WRITE:
+	case KSYS_NVME_TRIM:
+	case KSYS_NVME_FLUSH:
+	case KSYS_NVME_WRITE_ZEROES:
 		ixev_handle_nvme_write_ret(ctx, ret);
 		break;
 
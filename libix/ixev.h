@@ -169,9 +169,17 @@ extern void ixev_nvme_readv(hqu_t fg_handle, void **sgls,
 extern void ixev_nvme_writev(hqu_t fg_handle, void **sgls,
 			     int num_sgls, unsigned long lba, unsigned int lba_count,
 			     unsigned long cookie);
+extern void ixev_nvme_trim(hqu_t fg_handle, unsigned long lba,
+			   unsigned int lba_count, unsigned long cookie);
+extern void ixev_nvme_flush(hqu_t fg_handle, unsigned long cookie);
+extern void ixev_nvme_write_zeroes(hqu_t fg_handle, unsigned long lba,
+				   unsigned int lba_count, unsigned long cookie);
+extern void ixev_reqtrace(unsigned long cookie, int type, unsigned long tsc,
+			  hqu_t fg_handle);
 
 extern void ixev_nvme_register_flow(long flow_group_id, unsigned long cookie, unsigned int latency_us_SLO,
-							 unsigned long IOPS_SLO, int rw_ratio_SLO);
+							 unsigned long IOPS_SLO, int rw_ratio_SLO, unsigned int be_weight,
+							 unsigned int flags);
 extern void ixev_nvme_unregister_flow(long flow_group_id); 
 
 
@@ -58,7 +58,7 @@ void ix_handle_events(void)
 	int i;
 	for (i = 0; i < uarr->len; i++) {
 		struct bsys_desc d = uarr->descs[i];
-		usys_tbl[d.sysnr](d.arga, d.argb, d.argc, d.argd, d.arge, d.argf);
+		usys_tbl[d.sysnr](d.arga, d.argb, d.argc, d.argd, d.arge, d.argf, d.argg);
 	}
 }
 
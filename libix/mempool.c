@@ -182,7 +182,6 @@ int mempool_create_datastore(struct mempool_datastore *mds, int nr_elems, size_t
 		int elems_per_page = PGSIZE_2MB / elem_len;
 		nr_pages = div_up(nr_elems, elems_per_page);
 		mds->buf = ix_alloc_pages(nr_pages);
-		assert(mds->buf);
 	} else {
 		nr_pages = PGN_2MB(nr_elems * elem_len + PGMASK_2MB);
 		nr_elems = nr_pages * PGSIZE_2MB / elem_len;
@@ -200,8 +199,7 @@ int mempool_create_datastore(struct mempool_datastore *mds, int nr_elems, size_t
 	if (mds->buf == MAP_FAILED || mds->buf == 0) {
 		log_err("mempool alloc failed\n");
 		printf("Unable to create mempool datastore %s\n", name);
-
-		panic("unable to create mempool datstore for %s\n", name);
+		mds->magic = 0;
 		return -ENOMEM;
 	}
 
@@ -0,0 +1,598 @@
+/*
+ * Copyright 2013-16 Board of Trustees of Stanford University
+ * Copyright 2013-16 Ecole Polytechnique Federale Lausanne (EPFL)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * client.c - libreflex request handling, striping and batching
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "client.h"
+
+#define DEFAULT_QUEUE_DEPTH	128
+#define DEFAULT_BATCH		16
+
+static int rf_connect(const char *host, unsigned short port)
+{
+	struct addrinfo hints, *res;
+	char port_str[8];
+	int fd, one = 1, ret;
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_INET;
+	hints.ai_socktype = SOCK_STREAM;
+	snprintf(port_str, sizeof(port_str), "%hu", port);
+
+	ret = getaddrinfo(host, port_str, &hints, &res);
+	if (ret)
+		return -EHOSTUNREACH;
+
+	fd = socket(res->ai_family, res->ai_socktype, res->ai_protocol);
+	if (fd < 0) {
+		ret = -errno;
+		goto out;
+	}
+	if (connect(fd, res->ai_addr, res->ai_addrlen) ||
+	    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one)) ||
+	    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK)) {
+		ret = -errno;
+		close(fd);
+		goto out;
+	}
+	ret = fd;
+
+out:
+	freeaddrinfo(res);
+	return ret;
+}
+
+static int rf_buffer_index(struct reflex_client *c, const char *buf, size_t len)
+{
+	int i;
+
+	for (i = 0; i < c->nr_buffers; i++) {
+		const char *base = c->buffers[i].iov_base;
+
+		if (buf >= base && buf + len <= base + c->buffers[i].iov_len)
+			return i;
+	}
+	return -1;
+}
+
+static void rf_post_recv(struct reflex_client *c, unsigned int i, void *buf, size_t len,
+			 int buf_index)
+{
+	struct rf_conn *conn = &c->conns[i];
+
+	conn->recv_buf = buf;
+	conn->recv_len = len;
+	conn->recv_index = buf_index;
+	c->ops->post_recv(c, i);
+}
+
+static void rf_post_hdr_recv(struct reflex_client *c, unsigned int i)
+{
+	struct rf_conn *conn = &c->conns[i];
+
+	rf_post_recv(c, i, (char *) &conn->rx_hdr + conn->rx_got,
+		     sizeof(BINARY_HEADER) - conn->rx_got, -1);
+}
+
+static void rf_complete(struct reflex_client *c, struct rf_req *req)
+{
+	struct reflex_completion *cqe = &c->cq[c->cq_tail++ % c->opts.queue_depth];
+
+	cqe->cookie = req->cookie;
+	cqe->status = req->status;
+	req->next_free = c->free_req;
+	c->free_req = req - c->reqs;
+	c->nr_reqs--;
+}
+
+static void rf_sub_complete(struct reflex_client *c, struct rf_sub *sub, int status)
+{
+	struct rf_req *req = sub->req;
+
+	sub->in_use = false;
+	sub->next = c->free_sub;
+	c->free_sub = sub - c->subs;
+	c->nr_free_subs++;
+
+	if (status && !req->status)
+		req->status = status;
+	if (--req->pending == 0)
+		rf_complete(c, req);
+}
+
+/* fails every request on a broken connection; the socket is closed on destroy */
+static void rf_conn_fail(struct reflex_client *c, unsigned int i, int err)
+{
+	struct rf_conn *conn = &c->conns[i];
+	int j;
+
+	conn->dead = true;
+	shutdown(conn->fd, SHUT_RDWR);
+	for (j = 0; j < c->nr_subs; j++)
+		if (c->subs[j].in_use && c->subs[j].conn == i)
+			rf_sub_complete(c, &c->subs[j], err);
+	conn->tx_head = conn->tx_tail = -1;
+	conn->nr_queued = 0;
+	conn->rx_sub = NULL;
+}
+
+/* sends the queued wire requests of a connection as one sendmsg */
+static void rf_conn_kick(struct reflex_client *c, unsigned int i)
+{
+	struct rf_conn *conn = &c->conns[i];
+	struct rf_sub *sub;
+	int niov = 0;
+
+	if (conn->tx_busy || conn->dead || !conn->nr_queued)
+		return;
+
+	conn->tx_nr_subs = 0;
+	while (conn->tx_head >= 0 && conn->tx_nr_subs < RF_MAX_BATCH) {
+		sub = &c->subs[conn->tx_head];
+		conn->tx_head = sub->next;
+		conn->nr_queued--;
+
+		conn->tx_subs[conn->tx_nr_subs++] = sub - c->subs;
+		conn->tx_iov[niov].iov_base = &sub->hdr;
+		conn->tx_iov[niov++].iov_len = sizeof(BINARY_HEADER);
+		if (sub->hdr.opcode == CMD_SET) {
+			conn->tx_iov[niov].iov_base = sub->buf;
+			conn->tx_iov[niov++].iov_len = sub->hdr.lba_count * REFLEX_SECTOR_SIZE;
+		}
+	}
+	if (conn->tx_head < 0)
+		conn->tx_tail = -1;
+
+	memset(&conn->tx_msg, 0, sizeof(conn->tx_msg));
+	conn->tx_msg.msg_iov = conn->tx_iov;
+	conn->tx_msg.msg_iovlen = niov;
+	conn->tx_busy = true;
+	c->ops->post_send(c, i);
+}
+
+/**
+ * rf_send_done - called by the backend when a posted send finished
+ * @c: the client
+ * @i: the connection
+ * @res: the number of bytes sent, or a negative error code
+ */
+void rf_send_done(struct reflex_client *c, unsigned int i, ssize_t res)
+{
+	struct rf_conn *conn = &c->conns[i];
+	struct msghdr *msg = &conn->tx_msg;
+
+	if (conn->dead)
+		return;
+	if (res < 0) {
+		rf_conn_fail(c, i, res);
+		return;
+	}
+
+	while (res > 0 && msg->msg_iovlen) {
+		if (res >= msg->msg_iov->iov_len) {
+			res -= msg->msg_iov->iov_len;
+			msg->msg_iov++;
+			msg->msg_iovlen--;
+		} else {
+			msg->msg_iov->iov_base = (char *) msg->msg_iov->iov_base + res;
+			msg->msg_iov->iov_len -= res;
+			res = 0;
+		}
+	}
+
+	if (msg->msg_iovlen) {
+		c->ops->post_send(c, i);
+		return;
+	}
+
+	/* requests queued while this send was in flight form the next batch */
+	conn->tx_busy = false;
+	rf_conn_kick(c, i);
+}
+
+/**
+ * rf_recv_done - called by the backend when a posted receive finished
+ * @c: the client
+ * @i: the connection
+ * @res: the number of bytes received, 0 on EOF, or a negative error code
+ */
+void rf_recv_done(struct reflex_client *c, unsigned int i, ssize_t res)
+{
+	struct rf_conn *conn = &c->conns[i];
+	BINARY_HEADER *hdr = &conn->rx_hdr;
+	struct rf_sub *sub;
+	uintptr_t idx;
+
+	if (conn->dead)
+		return;
+	if (res <= 0) {
+		rf_conn_fail(c, i, res ? res : -ECONNRESET);
+		return;
+	}
+	conn->rx_got += res;
+
+	if (conn->rx_sub) {
+		sub = conn->rx_sub;
+		if (conn->rx_got < conn->rx_len) {
+			rf_post_recv(c, i, sub->buf + conn->rx_got, conn->rx_len - conn->rx_got,
+				     sub->buf_index);
+			return;
+		}
+		conn->rx_sub = NULL;
+		conn->rx_got = 0;
+		rf_sub_complete(c, sub, 0);
+		rf_post_hdr_recv(c, i);
+		return;
+	}
+
+	if (conn->rx_got < sizeof(BINARY_HEADER)) {
+		rf_post_hdr_recv(c, i);
+		return;
+	}
+
+	idx = (uintptr_t) hdr->req_handle;
+	if (hdr->magic != sizeof(BINARY_HEADER) || idx >= c->nr_subs ||
+	    !c->subs[idx].in_use || c->subs[idx].conn != i) {
+		rf_conn_fail(c, i, -EPROTO);
+		return;
+	}
+	sub = &c->subs[idx];
+	conn->rx_got = 0;
+
+	if (hdr->opcode == CMD_GET && hdr->lba_count == sub->hdr.lba_count) {
+		conn->rx_sub = sub;
+		conn->rx_len = hdr->lba_count * REFLEX_SECTOR_SIZE;
+		rf_post_recv(c, i, sub->buf, conn->rx_len, sub->buf_index);
+		return;
+	} else if (hdr->opcode == CMD_SET) {
+		rf_sub_complete(c, sub, 0);
+	} else {
+		/* includes CMD_GET_LZ4, compressed tenants are not supported */
+		rf_conn_fail(c, i, -EPROTO);
+		return;
+	}
+	rf_post_hdr_recv(c, i);
+}
+
+/* returns the number of sectors of the wire request starting at @lba */
+static unsigned int rf_piece(struct reflex_client *c, unsigned long lba, unsigned int lba_count)
+{
+	unsigned int stripe = c->opts.stripe_sectors;
+	unsigned int count = lba_count < REFLEX_MAX_SECTORS ? lba_count : REFLEX_MAX_SECTORS;
+
+	if (stripe && count > stripe - lba % stripe)
+		count = stripe - lba % stripe;
+	return count;
+}
+
+static int rf_submit(struct reflex_client *c, uint16_t opcode, char *buf, unsigned long lba,
+		     unsigned int lba_count, void *cookie)
+{
+	unsigned int nr = 0, count, conn_idx, left;
+	unsigned long pos;
+	struct rf_conn *conn;
+	struct rf_req *req;
+	struct rf_sub *sub;
+
+	if (!lba_count)
+		return -EINVAL;
+	for (pos = lba, left = lba_count; left; nr++) {
+		count = rf_piece(c, pos, left);
+		pos += count;
+		left -= count;
+	}
+	if (nr > c->nr_subs)
+		return -E2BIG;
+	if (c->free_req < 0 || nr > c->nr_free_subs)
+		return -EAGAIN;
+
+	req = &c->reqs[c->free_req];
+	c->free_req = req->next_free;
+	c->nr_reqs++;
+	req->cookie = cookie;
+	req->pending = nr;
+	req->status = 0;
+
+	conn_idx = c->next_conn++ % c->nr_conns;
+	while (lba_count) {
+		count = rf_piece(c, lba, lba_count);
+		if (c->opts.stripe_sectors)
+			conn_idx = (lba / c->opts.stripe_sectors) % c->nr_conns;
+		conn = &c->conns[conn_idx];
+
+		sub = &c->subs[c->free_sub];
+		c->free_sub = sub->next;
+		c->nr_free_subs--;
+		sub->in_use = true;
+		sub->req = req;
+		sub->buf = buf;
+		sub->buf_index = rf_buffer_index(c, buf, count * REFLEX_SECTOR_SIZE);
+		sub->conn = conn_idx;
+		sub->hdr.magic = sizeof(BINARY_HEADER);
+		sub->hdr.opcode = opcode;
+		sub->hdr.req_handle = (void *) (uintptr_t) (sub - c->subs);
+		sub->hdr.lba = lba;
+		sub->hdr.lba_count = count;
+
+		lba += count;
+		lba_count -= count;
+		buf += count * REFLEX_SECTOR_SIZE;
+
+		if (conn->dead) {
+			rf_sub_complete(c, sub, -ENOTCONN);
+			continue;
+		}
+
+		sub->next = -1;
+		if (conn->tx_tail >= 0)
+			c->subs[conn->tx_tail].next = sub - c->subs;
+		else
+			conn->tx_head = sub - c->subs;
+		conn->tx_tail = sub - c->subs;
+		if (++conn->nr_queued >= c->opts.batch)
+			rf_conn_kick(c, conn_idx);
+	}
+	return 0;
+}
+
+/**
+ * reflex_submit_read - queues a read
+ * @c: the client
+ * @buf: the buffer to read into, lba_count * REFLEX_SECTOR_SIZE bytes
+ * @lba: the first sector
+ * @lba_count: the number of sectors
+ * @cookie: returned in the completion
+ *
+ * Returns 0 if successful, -EAGAIN if queue_depth requests are outstanding
+ * or -E2BIG if the request needs more wire requests than the client has.
+ */
+int reflex_submit_read(struct reflex_client *c, void *buf, unsigned long lba,
+		       unsigned int lba_count, void *cookie)
+{
+	return rf_submit(c, CMD_GET, buf, lba, lba_count, cookie);
+}
+
+/**
+ * reflex_submit_write - queues a write
+ * @c: the client
+ * @buf: the data, which must not change until the request completes
+ * @lba: the first sector
+ * @lba_count: the number of sectors
+ * @cookie: returned in the completion
+ *
+ * Returns 0 if successful, otherwise see reflex_submit_read().
+ */
+int reflex_submit_write(struct reflex_client *c, const void *buf, unsigned long lba,
+			unsigned int lba_count, void *cookie)
+{
+	return rf_submit(c, CMD_SET, (char *) buf, lba, lba_count, cookie);
+}
+
+/**
+ * reflex_flush - starts sending all queued requests
+ * @c: the client
+ *
+ * Returns 0.
+ */
+int reflex_flush(struct reflex_client *c)
+{
+	unsigned int i;
+
+	for (i = 0; i < c->nr_conns; i++)
+		rf_conn_kick(c, i);
+	return 0;
+}
+
+static long rf_now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/**
+ * reflex_poll - flushes queued requests and reaps completions
+ * @c: the client
+ * @cqes: the completions to fill in
+ * @max: the capacity of @cqes
+ * @timeout_ms: 0 to not wait, -1 to wait until a request completes
+ *
+ * Returns the number of completions, or a negative error code. Returns 0
+ * right away if no request is outstanding.
+ */
+int reflex_poll(struct reflex_client *c, struct reflex_completion *cqes, int max,
+		int timeout_ms)
+{
+	long deadline = timeout_ms > 0 ? rf_now_ms() + timeout_ms : 0;
+	int n = 0, wait_ms, ret;
+
+	reflex_flush(c);
+
+	while (c->cq_head == c->cq_tail && c->nr_reqs) {
+		wait_ms = timeout_ms;
+		if (timeout_ms > 0) {
+			wait_ms = deadline - rf_now_ms();
+			if (wait_ms < 0)
+				wait_ms = 0;
+		}
+		ret = c->ops->wait(c, wait_ms);
+		if (ret < 0)
+			return ret;
+		if (wait_ms == 0)
+			break;
+	}
+
+	while (n < max && c->cq_head != c->cq_tail)
+		cqes[n++] = c->cq[c->cq_head++ % c->opts.queue_depth];
+	return n;
+}
+
+/**
+ * reflex_register_buffer - declares memory that requests will use
+ * @c: the client
+ * @addr: the start of the buffer
+ * @len: the length of the buffer
+ *
+ * Registration is optional: with the io_uring backend, reads into
+ * registered buffers use fixed-buffer receives, avoiding per-request page
+ * pinning. Returns 0 if successful, otherwise fail.
+ */
+int reflex_register_buffer(struct reflex_client *c, void *addr, size_t len)
+{
+	int ret = 0;
+
+	if (c->nr_buffers == RF_MAX_BUFFERS)
+		return -ENOSPC;
+
+	c->buffers[c->nr_buffers].iov_base = addr;
+	c->buffers[c->nr_buffers].iov_len = len;
+	c->nr_buffers++;
+	if (c->ops->register_buffers)
+		ret = c->ops->register_buffers(c);
+	if (ret)
+		c->nr_buffers--;
+	return ret;
+}
+
+/**
+ * reflex_client_backend - returns the name of the backend in use
+ */
+const char *reflex_client_backend(struct reflex_client *c)
+{
+	return c->ops->name;
+}
+
+/**
+ * reflex_client_create - connects to a ReFlex server
+ * @opts: the options, zero fields take their defaults
+ * @client: set to the new client
+ *
+ * Returns 0 if successful, otherwise fail.
+ */
+int reflex_client_create(const struct reflex_client_opts *opts, struct reflex_client **client)
+{
+	struct reflex_client *c;
+	unsigned int i;
+	int ret;
+
+	c = calloc(1, sizeof(*c));
+	if (!c)
+		return -ENOMEM;
+
+	c->opts = *opts;
+	if (!c->opts.nr_conns)
+		c->opts.nr_conns = 1;
+	if (!c->opts.queue_depth)
+		c->opts.queue_depth = DEFAULT_QUEUE_DEPTH;
+	if (!c->opts.batch)
+		c->opts.batch = DEFAULT_BATCH;
+	if (c->opts.batch > RF_MAX_BATCH)
+		c->opts.batch = RF_MAX_BATCH;
+	if (c->opts.nr_conns > REFLEX_MAX_CONNS) {
+		free(c);
+		return -EINVAL;
+	}
+
+	c->nr_subs = c->opts.queue_depth * RF_SUBS_PER_REQ;
+	c->reqs = calloc(c->opts.queue_depth, sizeof(*c->reqs));
+	c->subs = calloc(c->nr_subs, sizeof(*c->subs));
+	c->cq = calloc(c->opts.queue_depth, sizeof(*c->cq));
+	if (!c->reqs || !c->subs || !c->cq) {
+		ret = -ENOMEM;
+		goto fail;
+	}
+	for (i = 0; i < c->opts.queue_depth; i++)
+		c->reqs[i].next_free = i + 1 < c->opts.queue_depth ? i + 1 : -1;
+	for (i = 0; i < c->nr_subs; i++)
+		c->subs[i].next = i + 1 < c->nr_subs ? i + 1 : -1;
+	c->free_req = 0;
+	c->free_sub = 0;
+	c->nr_free_subs = c->nr_subs;
+
+	for (i = 0; i < c->opts.nr_conns; i++) {
+		ret = rf_connect(c->opts.host, c->opts.port);
+		if (ret < 0)
+			goto fail;
+		c->conns[i].fd = ret;
+		c->conns[i].tx_head = c->conns[i].tx_tail = -1;
+		c->nr_conns++;
+	}
+
+	ret = -EINVAL;
+	if (c->opts.backend != REFLEX_BACKEND_EPOLL) {
+		c->ops = &rf_uring_ops;
+		ret = c->ops->init(c);
+	}
+	if (ret && c->opts.backend != REFLEX_BACKEND_URING) {
+		c->ops = &rf_epoll_ops;
+		ret = c->ops->init(c);
+	}
+	if (ret) {
+		c->ops = NULL;
+		goto fail;
+	}
+
+	for (i = 0; i < c->nr_conns; i++)
+		rf_post_hdr_recv(c, i);
+
+	*client = c;
+	return 0;
+
+fail:
+	reflex_client_destroy(c);
+	return ret;
+}
+
+/**
+ * reflex_client_destroy - closes the connections and frees the client
+ * @c: the client
+ *
+ * Outstanding requests are abandoned.
+ */
+void reflex_client_destroy(struct reflex_client *c)
+{
+	unsigned int i;
+
+	if (c->ops)
+		c->ops->exit(c);
+	for (i = 0; i < c->nr_conns; i++)
+		close(c->conns[i].fd);
+	free(c->reqs);
+	free(c->subs);
+	free(c->cq);
+	free(c);
+}
@@ -0,0 +1,135 @@
+/*
+ * Copyright 2013-16 Board of Trustees of Stanford University
+ * Copyright 2013-16 Ecole Polytechnique Federale Lausanne (EPFL)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * client.h - libreflex internals shared by the core and the I/O backends
+ *
+ * The core keeps at most one receive and one send posted per connection;
+ * a backend performs them (epoll: when the socket is ready, io_uring: as
+ * ring operations) and reports the result with rf_recv_done() and
+ * rf_send_done().
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include "reflex.h"
+#include "libreflex.h"
+
+#define BINARY_HEADER binary_header_blk_t
+
+#define RF_MAX_BATCH	32		/* requests per sendmsg */
+#define RF_MAX_BUFFERS	64		/* registered buffers */
+#define RF_SUBS_PER_REQ	4		/* wire requests per caller request, on average */
+
+struct reflex_client;
+
+/* a caller request */
+struct rf_req {
+	void *cookie;
+	int pending;			/* wire requests not completed yet */
+	int status;
+	int next_free;
+};
+
+/* a request on the wire, a stripe-aligned piece of a caller request */
+struct rf_sub {
+	BINARY_HEADER hdr;
+	struct rf_req *req;
+	char *buf;
+	int buf_index;			/* registered buffer, or -1 */
+	unsigned int conn;
+	bool in_use;
+	int next;			/* tx queue link or free list */
+};
+
+struct rf_conn {
+	int fd;
+	bool dead;
+	unsigned int nr_queued;		/* wire requests waiting for a send */
+	int tx_head, tx_tail;		/* queued wire requests */
+
+	/* the send in progress */
+	bool tx_busy;
+	struct msghdr tx_msg;
+	struct iovec tx_iov[RF_MAX_BATCH * 2];
+	int tx_subs[RF_MAX_BATCH];
+	int tx_nr_subs;
+
+	/* the response being received */
+	BINARY_HEADER rx_hdr;
+	size_t rx_got;
+	struct rf_sub *rx_sub;		/* set while receiving a payload */
+	size_t rx_len;
+
+	/* backend state */
+	void *recv_buf;
+	size_t recv_len;
+	int recv_index;
+	bool recv_posted;
+	bool send_posted;
+};
+
+struct rf_backend_ops {
+	const char *name;
+	int (*init)(struct reflex_client *c);
+	void (*exit)(struct reflex_client *c);
+	int (*register_buffers)(struct reflex_client *c);
+	int (*post_recv)(struct reflex_client *c, unsigned int conn);
+	int (*post_send)(struct reflex_client *c, unsigned int conn);
+	int (*wait)(struct reflex_client *c, int timeout_ms);
+};
+
+struct reflex_client {
+	struct reflex_client_opts opts;
+	const struct rf_backend_ops *ops;
+	void *backend;
+
+	unsigned int nr_conns;
+	struct rf_conn conns[REFLEX_MAX_CONNS];
+	unsigned int next_conn;
+
+	struct rf_req *reqs;
+	int free_req;
+	unsigned int nr_reqs;		/* outstanding caller requests */
+	struct rf_sub *subs;
+	unsigned int nr_subs;
+	int free_sub;
+	unsigned int nr_free_subs;
+
+	struct reflex_completion *cq;	/* ring of queue_depth entries */
+	unsigned int cq_head, cq_tail;
+
+	struct iovec buffers[RF_MAX_BUFFERS];
+	unsigned int nr_buffers;
+};
+
+extern const struct rf_backend_ops rf_uring_ops;
+extern const struct rf_backend_ops rf_epoll_ops;
+
+extern void rf_recv_done(struct reflex_client *c, unsigned int conn, ssize_t res);
+extern void rf_send_done(struct reflex_client *c, unsigned int conn, ssize_t res);
@@ -0,0 +1,172 @@
+/*
+ * Copyright 2013-16 Board of Trustees of Stanford University
+ * Copyright 2013-16 Ecole Polytechnique Federale Lausanne (EPFL)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * epoll.c - libreflex backend using non-blocking sockets and epoll
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <sys/epoll.h>
+#include <unistd.h>
+
+#include "client.h"
+
+struct rf_epoll {
+	int epfd;
+	bool want_out[REFLEX_MAX_CONNS];	/* registered for EPOLLOUT */
+	struct epoll_event events[REFLEX_MAX_CONNS];
+};
+
+static void rf_epoll_want_out(struct reflex_client *c, unsigned int i, bool want)
+{
+	struct rf_epoll *ep = c->backend;
+	struct epoll_event ev;
+
+	if (ep->want_out[i] == want)
+		return;
+	ev.events = EPOLLIN | (want ? EPOLLOUT : 0);
+	ev.data.u32 = i;
+	epoll_ctl(ep->epfd, EPOLL_CTL_MOD, c->conns[i].fd, &ev);
+	ep->want_out[i] = want;
+}
+
+/* returns true if any send made progress */
+static bool rf_epoll_try_send(struct reflex_client *c, unsigned int i)
+{
+	struct rf_conn *conn = &c->conns[i];
+	bool progress = false;
+	ssize_t ret;
+
+	while (conn->send_posted) {
+		ret = sendmsg(conn->fd, &conn->tx_msg, MSG_NOSIGNAL);
+		if (ret < 0 && errno == EAGAIN) {
+			rf_epoll_want_out(c, i, true);
+			return progress;
+		}
+		conn->send_posted = false;
+		rf_send_done(c, i, ret < 0 ? -errno : ret);
+		progress = true;
+	}
+	rf_epoll_want_out(c, i, false);
+	return progress;
+}
+
+static void rf_epoll_try_recv(struct reflex_client *c, unsigned int i)
+{
+	struct rf_conn *conn = &c->conns[i];
+	ssize_t ret;
+
+	while (conn->recv_posted) {
+		ret = recv(conn->fd, conn->recv_buf, conn->recv_len, 0);
+		if (ret < 0 && errno == EAGAIN)
+			return;
+		conn->recv_posted = false;
+		rf_recv_done(c, i, ret < 0 ? -errno : ret);
+	}
+}
+
+static int rf_epoll_post_recv(struct reflex_client *c, unsigned int i)
+{
+	c->conns[i].recv_posted = true;
+	return 0;
+}
+
+static int rf_epoll_post_send(struct reflex_client *c, unsigned int i)
+{
+	c->conns[i].send_posted = true;
+	return 0;
+}
+
+static int rf_epoll_wait(struct reflex_client *c, int timeout_ms)
+{
+	struct rf_epoll *ep = c->backend;
+	bool progress = false;
+	unsigned int i;
+	int n, j;
+
+	/* sends are attempted right away, epoll only reports blocked ones */
+	for (i = 0; i < c->nr_conns; i++)
+		if (c->conns[i].send_posted && !ep->want_out[i])
+			progress |= rf_epoll_try_send(c, i);
+
+	n = epoll_wait(ep->epfd, ep->events, c->nr_conns, progress ? 0 : timeout_ms);
+	if (n < 0)
+		return errno == EINTR ? 0 : -errno;
+
+	for (j = 0; j < n; j++) {
+		i = ep->events[j].data.u32;
+		if (ep->events[j].events & EPOLLOUT)
+			rf_epoll_try_send(c, i);
+		if (ep->events[j].events & (EPOLLIN | EPOLLERR | EPOLLHUP))
+			rf_epoll_try_recv(c, i);
+	}
+	return 0;
+}
+
+static int rf_epoll_init(struct reflex_client *c)
+{
+	struct rf_epoll *ep;
+	struct epoll_event ev;
+	unsigned int i;
+
+	ep = calloc(1, sizeof(*ep));
+	if (!ep)
+		return -ENOMEM;
+
+	ep->epfd = epoll_create1(0);
+	if (ep->epfd < 0) {
+		free(ep);
+		return -errno;
+	}
+
+	for (i = 0; i < c->nr_conns; i++) {
+		ev.events = EPOLLIN;
+		ev.data.u32 = i;
+		if (epoll_ctl(ep->epfd, EPOLL_CTL_ADD, c->conns[i].fd, &ev)) {
+			close(ep->epfd);
+			free(ep);
+			return -errno;
+		}
+	}
+
+	c->backend = ep;
+	return 0;
+}
+
+static void rf_epoll_exit(struct reflex_client *c)
+{
+	struct rf_epoll *ep = c->backend;
+
+	close(ep->epfd);
+	free(ep);
+}
+
+const struct rf_backend_ops rf_epoll_ops = {
+	.name		= "epoll",
+	.init		= rf_epoll_init,
+	.exit		= rf_epoll_exit,
+	.post_recv	= rf_epoll_post_recv,
+	.post_send	= rf_epoll_post_send,
+	.wait		= rf_epoll_wait,
+};
@@ -0,0 +1,84 @@
+/*
+ * Copyright 2013-16 Board of Trustees of Stanford University
+ * Copyright 2013-16 Ecole Polytechnique Federale Lausanne (EPFL)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * libreflex.h - ReFlex client library for stock Linux
+ *
+ * Talks the ReFlex block protocol (see apps/reflex.h) to a block tenant
+ * over one or more TCP connections, without IX. A client is owned by a
+ * single thread: requests are queued with reflex_submit_read/write(),
+ * sent in batches by reflex_flush() or reflex_poll(), and their
+ * completions are returned by reflex_poll().
+ *
+ * Socket I/O uses io_uring when the kernel supports it and epoll otherwise.
+ * Read payloads are received directly into the caller's buffer; buffers
+ * registered with reflex_register_buffer() are additionally pinned once
+ * (io_uring fixed buffers) instead of on every receive.
+ */
+
+#pragma once
+
+#include <stddef.h>
+
+#define REFLEX_SECTOR_SIZE	512
+#define REFLEX_MAX_CONNS	64
+/* largest request the server accepts; larger requests are split */
+#define REFLEX_MAX_SECTORS	512
+
+enum reflex_backend {
+	REFLEX_BACKEND_AUTO = 0,
+	REFLEX_BACKEND_URING,
+	REFLEX_BACKEND_EPOLL,
+};
+
+struct reflex_client_opts {
+	const char *host;		/* server IPv4 address or host name */
+	unsigned short port;		/* tenant port */
+	unsigned int nr_conns;		/* connections to open, default 1 */
+	unsigned int queue_depth;	/* requests outstanding at most, default 128 */
+	unsigned int stripe_sectors;	/* stripe unit across connections, 0: none */
+	unsigned int batch;		/* queued requests that trigger a send, default 16 */
+	enum reflex_backend backend;
+};
+
+struct reflex_completion {
+	void *cookie;			/* as passed to reflex_submit_*() */
+	int status;			/* 0 or a negative error code */
+};
+
+struct reflex_client;
+
+extern int reflex_client_create(const struct reflex_client_opts *opts,
+				struct reflex_client **client);
+extern void reflex_client_destroy(struct reflex_client *c);
+extern const char *reflex_client_backend(struct reflex_client *c);
+
+extern int reflex_register_buffer(struct reflex_client *c, void *addr, size_t len);
+
+extern int reflex_submit_read(struct reflex_client *c, void *buf, unsigned long lba,
+			      unsigned int lba_count, void *cookie);
+extern int reflex_submit_write(struct reflex_client *c, const void *buf, unsigned long lba,
+			       unsigned int lba_count, void *cookie);
+extern int reflex_flush(struct reflex_client *c);
+extern int reflex_poll(struct reflex_client *c, struct reflex_completion *cqes, int max,
+		       int timeout_ms);
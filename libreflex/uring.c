@@ -0,0 +1,301 @@
+/*
+ * Copyright 2013-16 Board of Trustees of Stanford University
+ * Copyright 2013-16 Ecole Polytechnique Federale Lausanne (EPFL)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * uring.c - libreflex backend using io_uring
+ *
+ * Uses the raw system calls, so no liburing is needed at build time; init
+ * fails (and the client falls back to epoll) on kernels without io_uring.
+ */
+
+#include <errno.h>
+#include <linux/io_uring.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "client.h"
+
+#define RF_URING_SEND		(1ULL << 32)
+#define RF_URING_TIMEOUT	(1ULL << 33)
+
+struct rf_uring {
+	int fd;
+	unsigned int sq_entries;
+	unsigned int *sq_head, *sq_tail, *sq_mask, *sq_array;
+	unsigned int *cq_head, *cq_tail, *cq_mask;
+	struct io_uring_sqe *sqes;
+	struct io_uring_cqe *cqes;
+	void *sq_ring, *cq_ring;
+	size_t sq_ring_sz, cq_ring_sz, sqes_sz;
+	unsigned int to_submit;
+	bool fixed;			/* c->buffers are registered */
+	struct __kernel_timespec timeout;
+};
+
+static int rf_uring_enter(struct rf_uring *u, unsigned int to_submit, unsigned int min_complete,
+			  unsigned int flags)
+{
+	int ret = syscall(__NR_io_uring_enter, u->fd, to_submit, min_complete, flags, NULL, 0);
+
+	return ret < 0 ? -errno : ret;
+}
+
+static int rf_uring_submit(struct rf_uring *u, unsigned int min_complete)
+{
+	unsigned int flags = min_complete ? IORING_ENTER_GETEVENTS : 0;
+	int ret;
+
+	if (!u->to_submit && !min_complete)
+		return 0;
+	ret = rf_uring_enter(u, u->to_submit, min_complete, flags);
+	if (ret >= 0) {
+		u->to_submit -= ret < u->to_submit ? ret : u->to_submit;
+		return 0;
+	}
+	return ret == -EINTR || ret == -ETIME ? 0 : ret;
+}
+
+static struct io_uring_sqe *rf_uring_get_sqe(struct rf_uring *u)
+{
+	unsigned int tail = *u->sq_tail;
+	struct io_uring_sqe *sqe;
+
+	if (tail - __atomic_load_n(u->sq_head, __ATOMIC_ACQUIRE) == u->sq_entries) {
+		rf_uring_submit(u, 0);
+		if (tail - __atomic_load_n(u->sq_head, __ATOMIC_ACQUIRE) == u->sq_entries)
+			return NULL;
+	}
+
+	sqe = &u->sqes[tail & *u->sq_mask];
+	memset(sqe, 0, sizeof(*sqe));
+	u->sq_array[tail & *u->sq_mask] = tail & *u->sq_mask;
+	return sqe;
+}
+
+static void rf_uring_queue_sqe(struct rf_uring *u)
+{
+	__atomic_store_n(u->sq_tail, *u->sq_tail + 1, __ATOMIC_RELEASE);
+	u->to_submit++;
+}
+
+static int rf_uring_post_recv(struct reflex_client *c, unsigned int i)
+{
+	struct rf_uring *u = c->backend;
+	struct rf_conn *conn = &c->conns[i];
+	struct io_uring_sqe *sqe = rf_uring_get_sqe(u);
+
+	if (!sqe)
+		return -EBUSY;
+
+	sqe->fd = conn->fd;
+	sqe->addr = (unsigned long) conn->recv_buf;
+	sqe->len = conn->recv_len;
+	sqe->user_data = i;
+	if (u->fixed && conn->recv_index >= 0) {
+		sqe->opcode = IORING_OP_READ_FIXED;
+		sqe->buf_index = conn->recv_index;
+	} else {
+		sqe->opcode = IORING_OP_RECV;
+	}
+	rf_uring_queue_sqe(u);
+	return 0;
+}
+
+static int rf_uring_post_send(struct reflex_client *c, unsigned int i)
+{
+	struct rf_uring *u = c->backend;
+	struct rf_conn *conn = &c->conns[i];
+	struct io_uring_sqe *sqe = rf_uring_get_sqe(u);
+
+	if (!sqe)
+		return -EBUSY;
+
+	sqe->opcode = IORING_OP_SENDMSG;
+	sqe->fd = conn->fd;
+	sqe->addr = (unsigned long) &conn->tx_msg;
+	sqe->msg_flags = MSG_NOSIGNAL;
+	sqe->user_data = RF_URING_SEND | i;
+	rf_uring_queue_sqe(u);
+	return 0;
+}
+
+static int rf_uring_wait(struct reflex_client *c, int timeout_ms)
+{
+	struct rf_uring *u = c->backend;
+	struct io_uring_sqe *sqe;
+	struct io_uring_cqe *cqe;
+	unsigned int head, min_complete = timeout_ms ? 1 : 0;
+	int ret;
+
+	/* completes on expiry or as soon as any other request completes */
+	if (timeout_ms > 0 && (sqe = rf_uring_get_sqe(u))) {
+		u->timeout.tv_sec = timeout_ms / 1000;
+		u->timeout.tv_nsec = (timeout_ms % 1000) * 1000000L;
+		sqe->opcode = IORING_OP_TIMEOUT;
+		sqe->addr = (unsigned long) &u->timeout;
+		sqe->len = 1;
+		sqe->off = 1;
+		sqe->user_data = RF_URING_TIMEOUT;
+		rf_uring_queue_sqe(u);
+	}
+
+	/* skip waiting if completions are already there */
+	if (*u->cq_head != __atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE))
+		min_complete = 0;
+	ret = rf_uring_submit(u, min_complete);
+	if (ret)
+		return ret;
+
+	head = *u->cq_head;
+	while (head != __atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE)) {
+		cqe = &u->cqes[head & *u->cq_mask];
+		head++;
+		__atomic_store_n(u->cq_head, head, __ATOMIC_RELEASE);
+
+		if (cqe->user_data & RF_URING_TIMEOUT)
+			continue;
+		if (cqe->user_data & RF_URING_SEND)
+			rf_send_done(c, (uint32_t) cqe->user_data, cqe->res);
+		else
+			rf_recv_done(c, (uint32_t) cqe->user_data, cqe->res);
+	}
+
+	/* push out what the completions posted */
+	return rf_uring_submit(u, 0);
+}
+
+static int rf_uring_register_buffers(struct reflex_client *c)
+{
+	struct rf_uring *u = c->backend;
+	int ret;
+
+	if (u->fixed)
+		syscall(__NR_io_uring_register, u->fd, IORING_UNREGISTER_BUFFERS, NULL, 0);
+	u->fixed = false;
+
+	ret = syscall(__NR_io_uring_register, u->fd, IORING_REGISTER_BUFFERS,
+		      c->buffers, c->nr_buffers);
+	if (ret < 0) {
+		ret = -errno;
+		/* keep the buffers registered before this one */
+		if (c->nr_buffers > 1 &&
+		    !syscall(__NR_io_uring_register, u->fd, IORING_REGISTER_BUFFERS,
+			     c->buffers, c->nr_buffers - 1))
+			u->fixed = true;
+		return ret;
+	}
+	u->fixed = true;
+	return 0;
+}
+
+static void rf_uring_unmap(struct rf_uring *u)
+{
+	if (u->sqes && u->sqes != MAP_FAILED)
+		munmap(u->sqes, u->sqes_sz);
+	if (u->cq_ring && u->cq_ring != MAP_FAILED && u->cq_ring != u->sq_ring)
+		munmap(u->cq_ring, u->cq_ring_sz);
+	if (u->sq_ring && u->sq_ring != MAP_FAILED)
+		munmap(u->sq_ring, u->sq_ring_sz);
+}
+
+static int rf_uring_init(struct reflex_client *c)
+{
+	struct io_uring_params p;
+	struct rf_uring *u;
+	int ret;
+
+	u = calloc(1, sizeof(*u));
+	if (!u)
+		return -ENOMEM;
+
+	/* one receive and one send per connection, plus a timeout */
+	memset(&p, 0, sizeof(p));
+	u->fd = syscall(__NR_io_uring_setup, c->nr_conns * 2 + 2, &p);
+	if (u->fd < 0) {
+		ret = -errno;
+		free(u);
+		return ret;
+	}
+
+	u->sq_ring_sz = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+	u->cq_ring_sz = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		if (u->cq_ring_sz > u->sq_ring_sz)
+			u->sq_ring_sz = u->cq_ring_sz;
+		u->cq_ring_sz = u->sq_ring_sz;
+	}
+	u->sqes_sz = p.sq_entries * sizeof(struct io_uring_sqe);
+
+	u->sq_ring = mmap(NULL, u->sq_ring_sz, PROT_READ | PROT_WRITE,
+			  MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQ_RING);
+	if (p.features & IORING_FEAT_SINGLE_MMAP)
+		u->cq_ring = u->sq_ring;
+	else
+		u->cq_ring = mmap(NULL, u->cq_ring_sz, PROT_READ | PROT_WRITE,
+				  MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_CQ_RING);
+	u->sqes = mmap(NULL, u->sqes_sz, PROT_READ | PROT_WRITE,
+		       MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQES);
+	if (u->sq_ring == MAP_FAILED || u->cq_ring == MAP_FAILED || u->sqes == MAP_FAILED) {
+		rf_uring_unmap(u);
+		close(u->fd);
+		free(u);
+		return -ENOMEM;
+	}
+
+	u->sq_entries = p.sq_entries;
+	u->sq_head = (unsigned int *) ((char *) u->sq_ring + p.sq_off.head);
+	u->sq_tail = (unsigned int *) ((char *) u->sq_ring + p.sq_off.tail);
+	u->sq_mask = (unsigned int *) ((char *) u->sq_ring + p.sq_off.ring_mask);
+	u->sq_array = (unsigned int *) ((char *) u->sq_ring + p.sq_off.array);
+	u->cq_head = (unsigned int *) ((char *) u->cq_ring + p.cq_off.head);
+	u->cq_tail = (unsigned int *) ((char *) u->cq_ring + p.cq_off.tail);
+	u->cq_mask = (unsigned int *) ((char *) u->cq_ring + p.cq_off.ring_mask);
+	u->cqes = (struct io_uring_cqe *) ((char *) u->cq_ring + p.cq_off.cqes);
+
+	c->backend = u;
+	if (c->nr_buffers)
+		rf_uring_register_buffers(c);
+	return 0;
+}
+
+static void rf_uring_exit(struct reflex_client *c)
+{
+	struct rf_uring *u = c->backend;
+
+	rf_uring_unmap(u);
+	close(u->fd);
+	free(u);
+}
+
+const struct rf_backend_ops rf_uring_ops = {
+	.name			= "io_uring",
+	.init			= rf_uring_init,
+	.exit			= rf_uring_exit,
+	.register_buffers	= rf_uring_register_buffers,
+	.post_recv		= rf_uring_post_recv,
+	.post_send		= rf_uring_post_send,
+	.wait			= rf_uring_wait,
+};
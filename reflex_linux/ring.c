@@ -0,0 +1,159 @@
+/*
+ * Copyright 2013-16 Board of Trustees of Stanford University
+ * Copyright 2013-16 Ecole Polytechnique Federale Lausanne (EPFL)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * ring.c - a minimal io_uring wrapper on the raw system calls
+ *
+ * Same approach as libreflex/uring.c, so no liburing is needed to build.
+ */
+
+#include <errno.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "ring.h"
+
+/**
+ * ring_submit - submits queued entries
+ * @r: the ring
+ * @wait: block until at least one completion is available
+ *
+ * Returns 0 if successful, otherwise fail.
+ */
+int ring_submit(struct ring *r, bool wait)
+{
+	unsigned int flags = wait ? IORING_ENTER_GETEVENTS : 0;
+	int ret;
+
+	if (!r->to_submit && !wait)
+		return 0;
+
+	ret = syscall(__NR_io_uring_enter, r->fd, r->to_submit, wait ? 1 : 0, flags, NULL, 0);
+	if (ret < 0)
+		return errno == EINTR || errno == EBUSY || errno == EAGAIN ? 0 : -errno;
+	r->to_submit -= (unsigned int) ret < r->to_submit ? (unsigned int) ret : r->to_submit;
+	return 0;
+}
+
+/**
+ * ring_get_sqe - returns a cleared submission entry
+ * @r: the ring
+ *
+ * Submits queued entries first if the submission queue is full.
+ *
+ * Returns the entry, or NULL if the queue is still full.
+ */
+struct io_uring_sqe *ring_get_sqe(struct ring *r)
+{
+	unsigned int tail = *r->sq_tail;
+	struct io_uring_sqe *sqe;
+
+	if (tail - __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE) == r->sq_entries) {
+		ring_submit(r, false);
+		if (tail - __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE) == r->sq_entries)
+			return NULL;
+	}
+
+	sqe = &r->sqes[tail & *r->sq_mask];
+	memset(sqe, 0, sizeof(*sqe));
+	r->sq_array[tail & *r->sq_mask] = tail & *r->sq_mask;
+	return sqe;
+}
+
+static void ring_unmap(struct ring *r)
+{
+	if (r->sqes && r->sqes != MAP_FAILED)
+		munmap(r->sqes, r->sqes_sz);
+	if (r->cq_ring && r->cq_ring != MAP_FAILED && r->cq_ring != r->sq_ring)
+		munmap(r->cq_ring, r->cq_ring_sz);
+	if (r->sq_ring && r->sq_ring != MAP_FAILED)
+		munmap(r->sq_ring, r->sq_ring_sz);
+}
+
+/**
+ * ring_init - sets up an io_uring instance
+ * @r: the ring
+ * @entries: the submission queue size
+ *
+ * The completion queue is sized 4x @entries, since every connection keeps
+ * a receive posted on top of the storage and send requests.
+ *
+ * Returns 0 if successful, otherwise fail.
+ */
+int ring_init(struct ring *r, unsigned int entries)
+{
+	struct io_uring_params p;
+	int ret;
+
+	memset(r, 0, sizeof(*r));
+	memset(&p, 0, sizeof(p));
+	p.flags = IORING_SETUP_CQSIZE;
+	p.cq_entries = entries * 4;
+	r->fd = syscall(__NR_io_uring_setup, entries, &p);
+	if (r->fd < 0)
+		return -errno;
+
+	r->sq_ring_sz = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+	r->cq_ring_sz = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		if (r->cq_ring_sz > r->sq_ring_sz)
+			r->sq_ring_sz = r->cq_ring_sz;
+		r->cq_ring_sz = r->sq_ring_sz;
+	}
+	r->sqes_sz = p.sq_entries * sizeof(struct io_uring_sqe);
+
+	r->sq_ring = mmap(NULL, r->sq_ring_sz, PROT_READ | PROT_WRITE,
+			  MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQ_RING);
+	if (p.features & IORING_FEAT_SINGLE_MMAP)
+		r->cq_ring = r->sq_ring;
+	else
+		r->cq_ring = mmap(NULL, r->cq_ring_sz, PROT_READ | PROT_WRITE,
+				  MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_CQ_RING);
+	r->sqes = mmap(NULL, r->sqes_sz, PROT_READ | PROT_WRITE,
+		       MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQES);
+	if (r->sq_ring == MAP_FAILED || r->cq_ring == MAP_FAILED || r->sqes == MAP_FAILED) {
+		ret = -ENOMEM;
+		ring_unmap(r);
+		close(r->fd);
+		return ret;
+	}
+
+	r->sq_entries = p.sq_entries;
+	r->sq_head = (unsigned int *) ((char *) r->sq_ring + p.sq_off.head);
+	r->sq_tail = (unsigned int *) ((char *) r->sq_ring + p.sq_off.tail);
+	r->sq_mask = (unsigned int *) ((char *) r->sq_ring + p.sq_off.ring_mask);
+	r->sq_array = (unsigned int *) ((char *) r->sq_ring + p.sq_off.array);
+	r->cq_head = (unsigned int *) ((char *) r->cq_ring + p.cq_off.head);
+	r->cq_tail = (unsigned int *) ((char *) r->cq_ring + p.cq_off.tail);
+	r->cq_mask = (unsigned int *) ((char *) r->cq_ring + p.cq_off.ring_mask);
+	r->cqes = (struct io_uring_cqe *) ((char *) r->cq_ring + p.cq_off.cqes);
+	return 0;
+}
+
+void ring_exit(struct ring *r)
+{
+	ring_unmap(r);
+	close(r->fd);
+}
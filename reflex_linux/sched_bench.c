@@ -0,0 +1,149 @@
+/*
+ * Copyright 2013-16 Board of Trustees of Stanford University
+ * Copyright 2013-16 Ecole Polytechnique Federale Lausanne (EPFL)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * sched_bench.c - measures the cost of one token scheduler round
+ *
+ * Runs dp/core/nvme_sched.c, the scheduler the dataplane is built with.
+ * Registers LC and BE tenants on a single thread, keeps each tenant's
+ * software queue backlogged with 4KB reads, and times sched_round().
+ * Issued requests complete at once and are queued again after the round,
+ * so the rounds measured always have work to schedule.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <x86intrin.h>
+
+#include "token_sched.h"
+
+#define BENCH_QUEUE_DEPTH	32
+#define BENCH_LC_IOPS		100000
+#define BENCH_LC_LATENCY_US	500
+#define BENCH_PORT		1234
+
+struct bench_req {
+	struct nvme_sched_req ctx;
+	long fg_handle;
+};
+
+static struct bench_req **completed;
+static int nr_completed;
+
+static void bench_issue(struct sched_thread *t, struct nvme_sched_req *ctx)
+{
+	completed[nr_completed++] = (struct bench_req *) ctx;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "usage: %s [-l lc_tenants] [-b be_tenants] [-r rounds] [-m devmodel]\n", prog);
+	exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+	struct sched_thread t;
+	struct bench_req *reqs;
+	const char *model = "default";
+	int nr_lc = 4, nr_be = 4, nr_tenants;
+	long rounds = 1000000, r, issued = 0;
+	unsigned long start, cycles = 0, min_cycles = ~0UL;
+	int i, j, opt;
+
+	while ((opt = getopt(argc, argv, "l:b:r:m:")) != -1) {
+		switch (opt) {
+		case 'l':
+			nr_lc = atoi(optarg);
+			break;
+		case 'b':
+			nr_be = atoi(optarg);
+			break;
+		case 'r':
+			rounds = atol(optarg);
+			break;
+		case 'm':
+			model = optarg;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	nr_tenants = nr_lc + nr_be;
+	if (nr_lc < 0 || nr_be < 0 || !nr_tenants || rounds <= 0)
+		usage(argv[0]);
+
+	if (sched_init(model, 1))
+		return 1;
+	sched_thread_init(&t, 0, bench_issue);
+
+	reqs = calloc(nr_tenants * BENCH_QUEUE_DEPTH, sizeof(*reqs));
+	completed = calloc(nr_tenants * BENCH_QUEUE_DEPTH, sizeof(*completed));
+	if (!reqs || !completed)
+		return 1;
+
+	for (i = 0; i < nr_tenants; i++) {
+		long fg_handle;
+
+		if (i < nr_lc)
+			fg_handle = sched_register_flow(&t, BENCH_PORT + i, BENCH_LC_LATENCY_US,
+							BENCH_LC_IOPS, 100, 0);
+		else
+			fg_handle = sched_register_flow(&t, BENCH_PORT + i, 0, 0, 100, 1);
+		if (fg_handle < 0)
+			return 1;
+
+		for (j = 0; j < BENCH_QUEUE_DEPTH; j++) {
+			struct bench_req *req = &reqs[i * BENCH_QUEUE_DEPTH + j];
+
+			req->fg_handle = fg_handle;
+			sched_submit(&t, fg_handle, &req->ctx, NVME_CMD_READ, 4096);
+		}
+	}
+
+	for (r = 0; r < rounds; r++) {
+		unsigned long round_cycles;
+
+		start = __rdtsc();
+		sched_round(&t);
+		round_cycles = __rdtsc() - start;
+
+		cycles += round_cycles;
+		if (round_cycles < min_cycles)
+			min_cycles = round_cycles;
+
+		issued += nr_completed;
+		for (i = 0; i < nr_completed; i++) {
+			sched_complete(&t, &completed[i]->ctx);
+			sched_submit(&t, completed[i]->fg_handle, &completed[i]->ctx,
+				     NVME_CMD_READ, 4096);
+		}
+		nr_completed = 0;
+	}
+
+	printf("%d LC + %d BE tenants, %ld rounds: %.1f cycles/round (min %lu), %.2f requests/round\n",
+	       nr_lc, nr_be, rounds, (double) cycles / rounds, min_cycles,
+	       (double) issued / rounds);
+	return 0;
+}
@@ -0,0 +1,941 @@
+/*
+ * Copyright 2013-16 Board of Trustees of Stanford University
+ * Copyright 2013-16 Ecole Polytechnique Federale Lausanne (EPFL)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * server.c - ReFlex server for stock Linux
+ *
+ * Serves the ReFlex block protocol (apps/reflex.h) with the tenant SLOs of
+ * apps/reflex_tenants.h and the token scheduler of token_sched.c, without Dune or
+ * IX. Each thread runs one io_uring for both its sockets and its storage
+ * requests, and its own listening socket per port (SO_REUSEPORT lets the
+ * kernel spread connections over the threads, in place of fdir rules).
+ * Compressed and key-value tenants are not supported: the server does not
+ * listen on their ports.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/falloc.h>
+#include <linux/fs.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "reflex.h"
+#include "reflex_tenants.h"
+#include "ring.h"
+#include "token_sched.h"
+
+#define BINARY_HEADER binary_header_blk_t
+#define MAX_PAGES_PER_ACCESS 64
+#define PAGE_SIZE 4096
+#define SECTOR_SIZE 512
+#define MAX_REQ_BYTES (MAX_PAGES_PER_ACCESS * PAGE_SIZE)
+
+#define RING_ENTRIES	4096
+#define RX_BUF_SIZE	(64 * 1024)
+#define TX_BATCH	32		// responses per sendmsg
+#define MAX_PORTS	32
+#define MAX_THREADS	NVME_SCHED_MAX_THREADS
+#define DEFAULT_REQS	1024		// outstanding requests per thread
+
+/* completion types, kept in the low bits of user_data */
+#define TAG_ACCEPT	1
+#define TAG_RECV	2
+#define TAG_SEND	3
+#define TAG_IO		4
+#define TAG_MASK	7UL
+
+struct srv_conn;
+
+struct srv_req {
+	struct nvme_sched_req sc;
+	struct srv_conn *conn;
+	uint16_t opcode;
+	void *remote_req_handle;
+	unsigned long lba;
+	unsigned int lba_count;
+	unsigned int io_done;		// bytes read or written so far
+	unsigned int tx_sent;		// bytes of the response sent so far
+	BINARY_HEADER resp;
+	char *buf;
+	struct srv_req *next;
+} __attribute__ ((aligned (8)));
+
+struct srv_conn {
+	int fd;
+	unsigned short port;
+	long fg_handle;
+	struct srv_thread *thread;
+	int refs;			// posted SQEs, live requests and list entries
+	bool closing;
+	bool recv_posted;
+	bool recv_direct;		// receiving into cur->buf, not rx_buf
+	bool send_posted;
+	bool tx_listed;
+	bool stalled;			// out of requests, rx parsing paused
+	char *rx_buf;
+	unsigned int rx_off, rx_len;	// unparsed bytes are rx_buf[rx_off..rx_len)
+	struct srv_req *cur;		// write whose payload is being received
+	unsigned int cur_received;
+	struct srv_req *tx_head, *tx_tail;
+	struct srv_conn *next_tx, *next_stalled;
+	struct msghdr msg;
+	struct iovec iov[TX_BATCH * 2];
+} __attribute__ ((aligned (8)));
+
+struct srv_listener {
+	int fd;
+	unsigned short port;
+} __attribute__ ((aligned (8)));
+
+struct srv_thread {
+	int id;
+	struct ring ring;
+	struct sched_thread sched;
+	struct srv_listener listeners[MAX_PORTS];
+	struct srv_req *reqs;
+	char *bufs;
+	struct srv_req *free_reqs;
+	struct srv_req *io_backlog;	// issued while the SQ was full
+	struct srv_conn *tx_list;	// conns with responses to send
+	struct srv_conn *stalled_list;
+	unsigned long conn_opened;
+};
+
+static int dev_fd = -1;
+static unsigned long dev_size;
+static const char *listen_addr = "0.0.0.0";
+static unsigned short ports[MAX_PORTS];
+static int nr_ports;
+static int nr_reqs = DEFAULT_REQS;
+static bool busy_poll;
+
+static void conn_close(struct srv_conn *conn);
+static void post_recv(struct srv_conn *conn);
+
+static inline unsigned long tag(void *p, unsigned long t)
+{
+	return (unsigned long) p | t;
+}
+
+static void conn_put(struct srv_conn *conn)
+{
+	if (--conn->refs || !conn->closing)
+		return;
+
+	sched_unregister_flow(&conn->thread->sched, conn->fg_handle);
+	close(conn->fd);
+	conn->thread->conn_opened--;
+	free(conn->rx_buf);
+	free(conn);
+}
+
+static struct srv_req *req_alloc(struct srv_conn *conn)
+{
+	struct srv_thread *t = conn->thread;
+	struct srv_req *req = t->free_reqs;
+
+	if (!req)
+		return NULL;
+	t->free_reqs = req->next;
+	req->next = NULL;
+	req->conn = conn;
+	req->io_done = 0;
+	req->tx_sent = 0;
+	conn->refs++;
+	return req;
+}
+
+static void req_free(struct srv_req *req)
+{
+	struct srv_conn *conn = req->conn;
+	struct srv_thread *t = conn->thread;
+
+	req->next = t->free_reqs;
+	t->free_reqs = req;
+	conn_put(conn);
+}
+
+/* queue the response and have the main loop send it */
+static void req_complete(struct srv_req *req)
+{
+	struct srv_conn *conn = req->conn;
+	struct srv_thread *t = conn->thread;
+
+	sched_complete(&t->sched, &req->sc);
+	if (conn->closing) {
+		req_free(req);
+		return;
+	}
+
+	req->resp.magic = sizeof(BINARY_HEADER);
+	req->resp.opcode = req->opcode;
+	req->resp.req_handle = req->remote_req_handle;
+	req->resp.lba = req->lba;
+	req->resp.lba_count = req->opcode == CMD_GET ? req->lba_count : 0;
+
+	req->next = NULL;
+	if (conn->tx_tail)
+		conn->tx_tail->next = req;
+	else
+		conn->tx_head = req;
+	conn->tx_tail = req;
+
+	if (!conn->tx_listed && !conn->send_posted) {
+		conn->tx_listed = true;
+		conn->refs++;
+		conn->next_tx = t->tx_list;
+		t->tx_list = conn;
+	}
+}
+
+static bool post_io(struct srv_thread *t, struct srv_req *req)
+{
+	struct io_uring_sqe *sqe = ring_get_sqe(&t->ring);
+
+	if (!sqe)
+		return false;
+
+	sqe->fd = dev_fd;
+	sqe->user_data = tag(req, TAG_IO);
+	switch (req->opcode) {
+	case CMD_GET:
+	case CMD_SET:
+		sqe->opcode = req->opcode == CMD_SET ? IORING_OP_WRITE : IORING_OP_READ;
+		sqe->addr = (unsigned long) req->buf + req->io_done;
+		sqe->len = req->lba_count * SECTOR_SIZE - req->io_done;
+		sqe->off = req->lba * SECTOR_SIZE + req->io_done;
+		break;
+	case CMD_FLUSH:
+		sqe->opcode = IORING_OP_FSYNC;
+		sqe->fsync_flags = IORING_FSYNC_DATASYNC;
+		break;
+	default:
+		/*
+		 * fallocate takes the length in addr and the mode in len. On a
+		 * block device, punching a hole unmaps the range and zeroing a
+		 * range falls back to writing zeroes.
+		 */
+		sqe->opcode = IORING_OP_FALLOCATE;
+		sqe->off = req->lba * SECTOR_SIZE;
+		sqe->addr = (unsigned long) req->lba_count * SECTOR_SIZE;
+		sqe->len = FALLOC_FL_KEEP_SIZE | (req->opcode == CMD_TRIM ?
+				FALLOC_FL_PUNCH_HOLE : FALLOC_FL_ZERO_RANGE);
+		break;
+	}
+	ring_queue_sqe(&t->ring);
+	return true;
+}
+
+/* sched_issue_fn: the tenant has the tokens, send the request to the device */
+static void issue_req(struct sched_thread *st, struct nvme_sched_req *ctx)
+{
+	struct srv_thread *t = container_of(st, struct srv_thread, sched);
+	struct srv_req *req = container_of(ctx, struct srv_req, sc);
+
+	//don't schedule request on flash if FAKE_FLASH test
+	if (nvme_dev_model == FAKE_FLASH) {
+		req_complete(req);
+		return;
+	}
+
+	if (!post_io(t, req)) {
+		req->next = t->io_backlog;
+		t->io_backlog = req;
+	}
+}
+
+static void io_done(struct srv_req *req, int res)
+{
+	unsigned int len = req->lba_count * SECTOR_SIZE;
+
+	if (req->opcode != CMD_GET && req->opcode != CMD_SET) {
+		// TRIM is only a hint, ignore devices that can't unmap
+		if (res < 0 && !(req->opcode == CMD_TRIM && res == -EOPNOTSUPP))
+			printf("%s Failed: %s\n", req->opcode == CMD_FLUSH ? "Flush" :
+			       req->opcode == CMD_TRIM ? "Trim" : "Write zeroes", strerror(-res));
+		req_complete(req);
+		return;
+	}
+
+	if (res < 0) {
+		printf("%s Failed: %s\n", req->opcode == CMD_SET ? "Write" : "Read", strerror(-res));
+	} else if (res == 0 && req->opcode == CMD_GET) {
+		// read past the end of a file
+		memset(req->buf + req->io_done, 0, len - req->io_done);
+	} else if (req->io_done + res < len) {
+		req->io_done += res;
+		if (!post_io(req->conn->thread, req)) {
+			req->next = req->conn->thread->io_backlog;
+			req->conn->thread->io_backlog = req;
+		}
+		return;
+	}
+	req_complete(req);
+}
+
+static void dispatch_req(struct srv_conn *conn, struct srv_req *req)
+{
+	int cmd;
+
+	switch (req->opcode) {
+	case CMD_SET:
+		cmd = NVME_CMD_WRITE;
+		break;
+	case CMD_TRIM:
+		cmd = NVME_CMD_TRIM;
+		break;
+	case CMD_FLUSH:
+		cmd = NVME_CMD_FLUSH;
+		break;
+	case CMD_WRITE_ZEROES:
+		cmd = NVME_CMD_WRITE_ZEROES;
+		break;
+	default:
+		cmd = NVME_CMD_READ;
+	}
+
+	if (sched_submit(&conn->thread->sched, conn->fg_handle, &req->sc, cmd,
+			 (size_t) req->lba_count * SECTOR_SIZE)) {
+		// cannot happen while nr_reqs <= NVME_SW_QUEUE_SIZE
+		printf("sw queue full, issuing without tokens\n");
+		issue_req(&conn->thread->sched, &req->sc);
+	}
+}
+
+/* parses requests out of rx_buf, returns false if the connection was closed */
+static bool process_rx(struct srv_conn *conn)
+{
+	BINARY_HEADER *header;
+	struct srv_req *req;
+	unsigned int len;
+
+	while (1) {
+		if (conn->cur) {
+			req = conn->cur;
+			len = req->lba_count * SECTOR_SIZE - conn->cur_received;
+			if (len > conn->rx_len - conn->rx_off)
+				len = conn->rx_len - conn->rx_off;
+			memcpy(req->buf + conn->cur_received, conn->rx_buf + conn->rx_off, len);
+			conn->rx_off += len;
+			conn->cur_received += len;
+			if (conn->cur_received < req->lba_count * SECTOR_SIZE)
+				return true;
+			conn->cur = NULL;
+			dispatch_req(conn, req);
+		}
+
+		if (conn->rx_len - conn->rx_off < sizeof(BINARY_HEADER))
+			return true;
+
+		header = (BINARY_HEADER *) &conn->rx_buf[conn->rx_off];
+		len = header->lba_count * SECTOR_SIZE;
+		if (header->magic != sizeof(BINARY_HEADER) ||
+		    (header->opcode != CMD_GET && header->opcode != CMD_SET &&
+		     header->opcode != CMD_TRIM && header->opcode != CMD_FLUSH &&
+		     header->opcode != CMD_WRITE_ZEROES)) {
+			printf("Received unsupported command, closing connection\n");
+			conn_close(conn);
+			return false;
+		}
+		// FLUSH has no range, TRIM and WRITE_ZEROES have no payload to fit in a buffer
+		if (header->opcode != CMD_FLUSH &&
+		    (!header->lba_count ||
+		     ((header->opcode == CMD_GET || header->opcode == CMD_SET) &&
+		      header->lba_count > MAX_REQ_BYTES / SECTOR_SIZE) ||
+		     (dev_fd >= 0 && (header->lba + header->lba_count) * SECTOR_SIZE > dev_size))) {
+			printf("Received request out of range (lba %lu, count %u), closing connection\n",
+			       header->lba, header->lba_count);
+			conn_close(conn);
+			return false;
+		}
+
+		req = req_alloc(conn);
+		if (!req) {
+			// resumed by the main loop once a request is freed
+			conn->stalled = true;
+			conn->refs++;
+			conn->next_stalled = conn->thread->stalled_list;
+			conn->thread->stalled_list = conn;
+			return true;
+		}
+		req->opcode = header->opcode;
+		req->lba = header->lba;
+		req->lba_count = header->lba_count;
+		req->remote_req_handle = header->req_handle;
+		conn->rx_off += sizeof(BINARY_HEADER);
+
+		if (req->opcode == CMD_SET) {
+			conn->cur = req;
+			conn->cur_received = 0;
+		} else {
+			dispatch_req(conn, req);
+		}
+	}
+}
+
+static void post_recv(struct srv_conn *conn)
+{
+	struct io_uring_sqe *sqe;
+
+	if (conn->closing || conn->recv_posted || conn->stalled)
+		return;
+	sqe = ring_get_sqe(&conn->thread->ring);
+	if (!sqe) {
+		conn_close(conn);
+		return;
+	}
+
+	sqe->opcode = IORING_OP_RECV;
+	sqe->fd = conn->fd;
+	sqe->user_data = tag(conn, TAG_RECV);
+	// large write payloads go straight into the request buffer
+	conn->recv_direct = conn->cur && conn->rx_off == conn->rx_len;
+	if (conn->recv_direct) {
+		sqe->addr = (unsigned long) conn->cur->buf + conn->cur_received;
+		sqe->len = conn->cur->lba_count * SECTOR_SIZE - conn->cur_received;
+	} else {
+		if (conn->rx_off) {
+			memmove(conn->rx_buf, conn->rx_buf + conn->rx_off, conn->rx_len - conn->rx_off);
+			conn->rx_len -= conn->rx_off;
+			conn->rx_off = 0;
+		}
+		sqe->addr = (unsigned long) conn->rx_buf + conn->rx_len;
+		sqe->len = RX_BUF_SIZE - conn->rx_len;
+	}
+	ring_queue_sqe(&conn->thread->ring);
+	conn->recv_posted = true;
+	conn->refs++;
+}
+
+static void recv_done(struct srv_conn *conn, int res)
+{
+	conn->recv_posted = false;
+
+	if (res <= 0 || conn->closing) {
+		if (res != -EINTR && res != -EAGAIN)
+			conn_close(conn);
+		else
+			post_recv(conn);
+		conn_put(conn);
+		return;
+	}
+
+	if (conn->recv_direct) {
+		conn->cur_received += res;
+		if (conn->cur_received == conn->cur->lba_count * SECTOR_SIZE) {
+			struct srv_req *req = conn->cur;
+
+			conn->cur = NULL;
+			dispatch_req(conn, req);
+		}
+	} else {
+		conn->rx_len += res;
+	}
+
+	if (process_rx(conn))
+		post_recv(conn);
+	conn_put(conn);
+}
+
+static void post_send(struct srv_conn *conn)
+{
+	struct io_uring_sqe *sqe;
+	struct srv_req *req;
+	unsigned int hdr_len = sizeof(BINARY_HEADER);
+	unsigned int off, data_len;
+	int n = 0, i;
+
+	sqe = ring_get_sqe(&conn->thread->ring);
+	if (!sqe) {
+		conn_close(conn);
+		return;
+	}
+
+	for (req = conn->tx_head, i = 0; req && i < TX_BATCH; req = req->next, i++) {
+		off = req->tx_sent;
+		data_len = req->resp.lba_count * SECTOR_SIZE;
+		if (off < hdr_len) {
+			conn->iov[n].iov_base = (char *) &req->resp + off;
+			conn->iov[n++].iov_len = hdr_len - off;
+			off = hdr_len;
+		}
+		if (data_len) {
+			conn->iov[n].iov_base = req->buf + off - hdr_len;
+			conn->iov[n++].iov_len = data_len - (off - hdr_len);
+		}
+	}
+	memset(&conn->msg, 0, sizeof(conn->msg));
+	conn->msg.msg_iov = conn->iov;
+	conn->msg.msg_iovlen = n;
+
+	sqe->opcode = IORING_OP_SENDMSG;
+	sqe->fd = conn->fd;
+	sqe->addr = (unsigned long) &conn->msg;
+	sqe->msg_flags = MSG_NOSIGNAL;
+	sqe->user_data = tag(conn, TAG_SEND);
+	ring_queue_sqe(&conn->thread->ring);
+	conn->send_posted = true;
+	conn->refs++;
+}
+
+static void send_done(struct srv_conn *conn, int res)
+{
+	struct srv_req *req;
+	unsigned int left, len;
+
+	conn->send_posted = false;
+	if (res < 0 || conn->closing) {
+		conn_close(conn);
+		while ((req = conn->tx_head)) {
+			conn->tx_head = req->next;
+			req_free(req);
+		}
+		conn->tx_tail = NULL;
+		conn_put(conn);
+		return;
+	}
+
+	while ((req = conn->tx_head) && res > 0) {
+		len = sizeof(BINARY_HEADER) + req->resp.lba_count * SECTOR_SIZE;
+		left = len - req->tx_sent;
+		if ((unsigned int) res < left) {
+			req->tx_sent += res;
+			break;
+		}
+		res -= left;
+		conn->tx_head = req->next;
+		if (!conn->tx_head)
+			conn->tx_tail = NULL;
+		req_free(req);
+	}
+
+	if (conn->tx_head)
+		post_send(conn);
+	conn_put(conn);
+}
+
+static void conn_close(struct srv_conn *conn)
+{
+	struct srv_req *req;
+
+	if (conn->closing)
+		return;
+	conn->closing = true;
+	conn->refs++;
+
+	// completes the posted receive, if any
+	shutdown(conn->fd, SHUT_RDWR);
+
+	if (conn->cur) {
+		req = conn->cur;
+		conn->cur = NULL;
+		req_free(req);
+	}
+	if (!conn->send_posted) {
+		while ((req = conn->tx_head)) {
+			conn->tx_head = req->next;
+			req_free(req);
+		}
+		conn->tx_tail = NULL;
+	}
+	conn_put(conn);
+}
+
+static void post_accept(struct srv_thread *t, struct srv_listener *l)
+{
+	struct io_uring_sqe *sqe = ring_get_sqe(&t->ring);
+
+	if (!sqe) {
+		fprintf(stderr, "thread %d: cannot post accept on port %u\n", t->id, l->port);
+		return;
+	}
+	sqe->opcode = IORING_OP_ACCEPT;
+	sqe->fd = l->fd;
+	sqe->user_data = tag(l, TAG_ACCEPT);
+	ring_queue_sqe(&t->ring);
+}
+
+static void accept_done(struct srv_thread *t, struct srv_listener *l, int res)
+{
+	const struct reflex_slo_policy *slo;
+	unsigned int latency_us_SLO = 0;
+	unsigned long IOPS_SLO = 0;
+	int rd_wr_ratio_SLO = 50;
+	unsigned int be_weight = 1;
+	struct srv_conn *conn;
+	int one = 1;
+	long fg_handle;
+
+	post_accept(t, l);
+	if (res < 0) {
+		if (res != -EINTR && res != -EAGAIN && res != -ECONNABORTED)
+			fprintf(stderr, "accept on port %u failed: %s\n", l->port, strerror(-res));
+		return;
+	}
+	setsockopt(res, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+	slo = reflex_slo_lookup(l->port);
+	if (slo) {
+		latency_us_SLO = slo->latency_us_SLO;
+		IOPS_SLO = slo->IOPS_SLO;
+		rd_wr_ratio_SLO = slo->rd_wr_ratio_SLO;
+		be_weight = slo->be_weight;
+	} else {
+		printf("WARNING: unrecognized SLO policy, default is best-effort\n");
+	}
+	fg_handle = sched_register_flow(&t->sched, l->port, latency_us_SLO, IOPS_SLO, rd_wr_ratio_SLO,
+					be_weight);
+	if (fg_handle < 0) {
+		close(res);
+		return;
+	}
+
+	conn = calloc(1, sizeof(*conn));
+	if (conn)
+		conn->rx_buf = malloc(RX_BUF_SIZE);
+	if (!conn || !conn->rx_buf) {
+		printf("Cannot allocate connection\n");
+		free(conn);
+		sched_unregister_flow(&t->sched, fg_handle);
+		close(res);
+		return;
+	}
+	conn->fd = res;
+	conn->port = l->port;
+	conn->fg_handle = fg_handle;
+	conn->thread = t;
+	t->conn_opened++;
+	post_recv(conn);
+}
+
+static int open_listener(struct srv_listener *l, unsigned short port)
+{
+	struct sockaddr_in sin;
+	int one = 1;
+
+	memset(&sin, 0, sizeof(sin));
+	sin.sin_family = AF_INET;
+	sin.sin_port = htons(port);
+	if (inet_pton(AF_INET, listen_addr, &sin.sin_addr) != 1)
+		return -EINVAL;
+
+	l->port = port;
+	l->fd = socket(AF_INET, SOCK_STREAM, 0);
+	if (l->fd < 0)
+		return -errno;
+	setsockopt(l->fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+	setsockopt(l->fd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one));
+	if (bind(l->fd, (struct sockaddr *) &sin, sizeof(sin)) || listen(l->fd, 1024)) {
+		close(l->fd);
+		return -errno;
+	}
+	return 0;
+}
+
+static void thread_loop(struct srv_thread *t)
+{
+	struct io_uring_cqe *cqe;
+	struct srv_conn *conn;
+	struct srv_req *req;
+	unsigned long ud;
+	bool idle;
+	int res;
+
+	while (1) {
+		sched_round(&t->sched);
+
+		// resume connections that ran out of requests
+		while (t->free_reqs && (conn = t->stalled_list)) {
+			t->stalled_list = conn->next_stalled;
+			conn->stalled = false;
+			if (!conn->closing && process_rx(conn))
+				post_recv(conn);
+			conn_put(conn);
+		}
+
+		while ((req = t->io_backlog)) {
+			t->io_backlog = req->next;
+			if (!post_io(t, req)) {
+				t->io_backlog = req;
+				break;
+			}
+		}
+
+		while ((conn = t->tx_list)) {
+			t->tx_list = conn->next_tx;
+			conn->tx_listed = false;
+			if (!conn->closing && !conn->send_posted && conn->tx_head)
+				post_send(conn);
+			conn_put(conn);
+		}
+
+		// sleep only when there is nothing to schedule
+		idle = !busy_poll && !t->sched.queued && !t->io_backlog && !ring_peek_cqe(&t->ring);
+		if (idle)
+			sched_thread_idle(&t->sched, true);
+		res = ring_submit(&t->ring, idle);
+		if (idle)
+			sched_thread_idle(&t->sched, false);
+		if (res) {
+			fprintf(stderr, "thread %d: io_uring_enter failed: %s\n", t->id, strerror(-res));
+			return;
+		}
+
+		while ((cqe = ring_peek_cqe(&t->ring))) {
+			ud = cqe->user_data;
+			res = cqe->res;
+			ring_cqe_seen(&t->ring);
+
+			switch (ud & TAG_MASK) {
+			case TAG_ACCEPT:
+				accept_done(t, (struct srv_listener *) (ud & ~TAG_MASK), res);
+				break;
+			case TAG_RECV:
+				recv_done((struct srv_conn *) (ud & ~TAG_MASK), res);
+				break;
+			case TAG_SEND:
+				send_done((struct srv_conn *) (ud & ~TAG_MASK), res);
+				break;
+			case TAG_IO:
+				io_done((struct srv_req *) (ud & ~TAG_MASK), res);
+				break;
+			}
+		}
+	}
+}
+
+static void *srv_main(void *arg)
+{
+	struct srv_thread *t = arg;
+	int i, ret;
+
+	ret = ring_init(&t->ring, RING_ENTRIES);
+	if (ret) {
+		fprintf(stderr, "unable to set up io_uring: %s\n", strerror(-ret));
+		exit(-1);
+	}
+
+	t->reqs = calloc(nr_reqs, sizeof(struct srv_req));
+	t->bufs = mmap(NULL, (size_t) nr_reqs * MAX_REQ_BYTES, PROT_READ | PROT_WRITE,
+		       MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	if (!t->reqs || t->bufs == MAP_FAILED) {
+		fprintf(stderr, "unable to allocate request buffers\n");
+		exit(-1);
+	}
+	for (i = nr_reqs - 1; i >= 0; i--) {
+		t->reqs[i].buf = t->bufs + (size_t) i * MAX_REQ_BYTES;
+		t->reqs[i].next = t->free_reqs;
+		t->free_reqs = &t->reqs[i];
+	}
+
+	sched_thread_init(&t->sched, t->id, issue_req);
+
+	for (i = 0; i < nr_ports; i++) {
+		ret = open_listener(&t->listeners[i], ports[i]);
+		if (ret) {
+			fprintf(stderr, "unable to listen on %s:%u: %s\n", listen_addr, ports[i],
+				strerror(-ret));
+			exit(-1);
+		}
+		post_accept(t, &t->listeners[i]);
+	}
+
+	thread_loop(t);
+	exit(-1);
+	return NULL;
+}
+
+static int open_device(const char *path)
+{
+	struct stat st;
+	uint64_t size;
+
+	dev_fd = open(path, O_RDWR | O_DIRECT);
+	if (dev_fd < 0 && errno == EINVAL) {
+		// e.g. tmpfs
+		printf("WARNING: %s does not support O_DIRECT, using the page cache\n", path);
+		dev_fd = open(path, O_RDWR);
+	}
+	if (dev_fd < 0 || fstat(dev_fd, &st))
+		return -errno;
+
+	if (S_ISBLK(st.st_mode)) {
+		if (ioctl(dev_fd, BLKGETSIZE64, &size))
+			return -errno;
+		dev_size = size;
+	} else {
+		dev_size = st.st_size;
+	}
+	printf("Device %s: %lu bytes, sector size: %d\n", path, dev_size, SECTOR_SIZE);
+	return 0;
+}
+
+static int parse_ports(char *list)
+{
+	char *tok;
+
+	for (tok = strtok(list, ","); tok; tok = strtok(NULL, ",")) {
+		if (nr_ports == MAX_PORTS || atoi(tok) <= 0 || atoi(tok) > 65535)
+			return -EINVAL;
+		ports[nr_ports++] = atoi(tok);
+	}
+	return nr_ports ? 0 : -EINVAL;
+}
+
+/*
+ * Compressed and key-value clients would have their headers parsed as
+ * block requests, so their ports are left out rather than misserved
+ */
+static void drop_unsupported_ports(void)
+{
+	const struct reflex_slo_policy *slo;
+	int i, n = 0;
+
+	for (i = 0; i < nr_ports; i++) {
+		slo = reflex_slo_lookup(ports[i]);
+		if (slo && slo->proto != REFLEX_PROTO_BLOCK) {
+			printf("WARNING: port %u is a %s tenant, which this server does not support, not listening on it\n",
+			       ports[i], slo->proto == REFLEX_PROTO_LZ4 ? "compressed" : "key-value");
+			continue;
+		}
+		ports[n++] = ports[i];
+	}
+	nr_ports = n;
+}
+
+int main(int argc, char *argv[])
+{
+	static struct srv_thread threads[MAX_THREADS];
+	const char *dev_path = NULL;
+	const char *dev_model = "default";
+	pthread_t tid;
+	int nr_threads = 1;
+	unsigned int i;
+	int opt, ret;
+
+	while ((opt = getopt(argc, argv, "a:d:m:p:t:r:Bn")) != -1) {
+		switch (opt) {
+		case 'a':
+			listen_addr = optarg;
+			break;
+		case 'd':
+			dev_path = optarg;
+			break;
+		case 'm':
+			dev_model = optarg;
+			break;
+		case 'p':
+			if (parse_ports(optarg)) {
+				fprintf(stderr, "invalid port list '%s'\n", optarg);
+				return -1;
+			}
+			break;
+		case 't':
+			nr_threads = atoi(optarg);
+			if (nr_threads < 1 || nr_threads > MAX_THREADS) {
+				fprintf(stderr, "threads must be 1..%d\n", MAX_THREADS);
+				return -1;
+			}
+			break;
+		case 'r':
+			nr_reqs = atoi(optarg);
+			if (nr_reqs < 1 || nr_reqs > NVME_SW_QUEUE_SIZE) {
+				fprintf(stderr, "outstanding requests must be 1..%d\n", NVME_SW_QUEUE_SIZE);
+				return -1;
+			}
+			break;
+		case 'B':
+			busy_poll = true;
+			break;
+		case 'n':
+			nvme_sched_flag = false;
+			break;
+		default:
+			argc = 0;
+			break;
+		}
+	}
+
+	if (argc == 0 || optind != argc || (!dev_path && strcmp(dev_model, "fake"))) {
+		fprintf(stderr, "Usage: %s [-d DEV] [-m MODEL] [-a ADDR] [-p PORT[,PORT]...] [-t THREADS] [-r REQS] [-B] [-n]\n"
+			"  -d  file or block device to serve, opened with O_DIRECT (needed unless MODEL is fake)\n"
+			"  -m  device model: default (no token limit), fake (complete requests without I/O)\n"
+			"      or a devmodel file such as sample.devmodel (default: default)\n"
+			"  -a  address to listen on (default 0.0.0.0)\n"
+			"  -p  ports to listen on (default: the ports in apps/reflex_tenants.h)\n"
+			"  -t  number of threads (default 1)\n"
+			"  -r  outstanding requests per thread (default %d)\n"
+			"  -B  busy-poll instead of sleeping when idle, like the IX dataplane\n"
+			"  -n  disable the token scheduler\n",
+			argv[0], DEFAULT_REQS);
+		return -1;
+	}
+
+	if (!nr_ports) {
+		for (i = 0; i < NR_REFLEX_SLO_POLICIES; i++)
+			ports[nr_ports++] = reflex_slo_policies[i].port;
+	}
+	drop_unsupported_ports();
+	if (!nr_ports) {
+		fprintf(stderr, "no block tenant port to listen on\n");
+		return -1;
+	}
+
+	ret = sched_init(dev_model, nr_threads);
+	if (ret) {
+		fprintf(stderr, "invalid device model '%s'\n", dev_model);
+		return ret;
+	}
+
+	if (dev_path) {
+		ret = open_device(dev_path);
+		if (ret) {
+			fprintf(stderr, "unable to open '%s': %s\n", dev_path, strerror(-ret));
+			return ret;
+		}
+	}
+
+	for (i = 1; i < nr_threads; i++) {
+		threads[i].id = i;
+		if (pthread_create(&tid, NULL, srv_main, &threads[i])) {
+			fprintf(stderr, "failed to spawn thread %d\n", i);
+			exit(-1);
+		}
+	}
+	printf("Started ReFlex server with %i threads..\n", nr_threads);
+	srv_main(&threads[0]);
+	return 0;
+}
@@ -0,0 +1,305 @@
+/*
+ * Copyright 2013-16 Board of Trustees of Stanford University
+ * Copyright 2013-16 Ecole Polytechnique Federale Lausanne (EPFL)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+/*
+ * token_sched.c - ReFlex token scheduler for the Linux server
+ *
+ * Provides the hooks of dp/core/nvme_sched.c for the server's threads and
+ * the flow registration that bsys_nvme_register_flow() and
+ * bsys_nvme_unregister_flow() do in the dataplane.
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <ix/bitmap.h>
+
+#include "token_sched.h"
+
+static pthread_mutex_t nvme_bitmap_lock = PTHREAD_MUTEX_INITIALIZER;
+static bool idle_bit_vector[NVME_SCHED_MAX_THREADS];
+
+unsigned long nvme_sched_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000UL + ts.tv_nsec;
+}
+
+void nvme_sched_issue(struct nvme_tenant_mgmt *m, struct nvme_sched_req *req)
+{
+	struct sched_thread *t = container_of(m, struct sched_thread, mgmt);
+
+	t->queued--;
+	t->issue(t, req);
+}
+
+/*
+ * The IX dataplane spins, so every core completes a scheduling round each
+ * loop. A sleeping thread counts as having scheduled, so the global bucket
+ * keeps being reset.
+ */
+bool nvme_sched_running(int tid)
+{
+	return !idle_bit_vector[tid];
+}
+
+void nvme_sched_log(const char *fmt, ...)
+{
+	va_list ptr;
+
+	va_start(ptr, fmt);
+	vprintf(fmt, ptr);
+	va_end(ptr);
+}
+
+/**
+ * sched_init - sets up the scheduler
+ * @model: "default" (no token limit), "fake" (complete requests without
+ *         I/O) or a devmodel file
+ * @nr_threads: the number of threads that will call sched_round()
+ *
+ * Returns 0 if successful, otherwise fail.
+ */
+int sched_init(const char *model, int nr_threads)
+{
+	int ret;
+
+	if (nr_threads < 1 || nr_threads > NVME_SCHED_MAX_THREADS)
+		return -EINVAL;
+
+	if (!model || !strcmp(model, "default")) {
+		printf("Device model: DEFAULT_FLASH (no limit)\n");
+		nvme_dev_model = DEFAULT_FLASH;
+	} else if (!strcmp(model, "fake")) {
+		printf("Device model: FAKE_FLASH (fake I/O completion events)\n");
+		nvme_dev_model = FAKE_FLASH;
+	} else {
+		nvme_dev_model = FLASH_DEV_MODEL;
+		ret = nvme_sched_parse_devmodel(model);
+		if (ret)
+			return ret;
+	}
+
+	nvme_sched_init(1000, nr_threads);
+	return 0;
+}
+
+/**
+ * sched_thread_init - initializes the per-thread tenant manager
+ * @t: the thread state
+ * @tid: the thread index, below the count passed to sched_init()
+ * @issue: called for each request once the tenant has the tokens for it
+ */
+void sched_thread_init(struct sched_thread *t, int tid, sched_issue_fn issue)
+{
+	nvme_sched_thread_init(&t->mgmt, tid);
+	t->issue = issue;
+	t->queued = 0;
+}
+
+/**
+ * sched_thread_idle - marks a thread as sleeping or running again
+ * @t: the thread state
+ * @idle: true before the thread blocks, false once it wakes up
+ */
+void sched_thread_idle(struct sched_thread *t, bool idle)
+{
+	idle_bit_vector[t->mgmt.tid] = idle;
+	nvme_sched_thread_idle(&t->mgmt, idle);
+}
+
+/**
+ * sched_register_flow - registers a connection with its tenant
+ * @t: the thread the connection is served by
+ * @flow_group_id: the tenant, the port the connection came in on
+ * @latency_us_SLO: the latency SLO, 0 for a best-effort tenant
+ * @IOPS_SLO: the IOPS SLO of a latency-critical tenant
+ * @rw_ratio_SLO: the percentage of reads in the IOPS SLO
+ * @be_weight: the share of a best-effort tenant, 0 for 1
+ *
+ * A tenant is registered once per thread, its other connections on the
+ * thread share its software queue and keep the SLO it registered with.
+ *
+ * Returns the flow group handle, or -EBUSY if the device can't meet the
+ * SLO, or -ENOMEM.
+ */
+long sched_register_flow(struct sched_thread *t, long flow_group_id,
+			 unsigned int latency_us_SLO, unsigned long IOPS_SLO,
+			 int rw_ratio_SLO, unsigned int be_weight)
+{
+	struct nvme_flow_group *fg;
+	struct nvme_sw_queue *swq;
+	long fg_handle = -1;
+	long i;
+
+	pthread_mutex_lock(&nvme_bitmap_lock);
+	for (i = 1; i < MAX_NVME_FLOW_GROUPS; i++) {
+		if (bitmap_test(nvme_fgs_bitmap, i)) {
+			// if already registered this flow group, return its index
+			if (nvme_fgs[i].flow_group_id == flow_group_id && nvme_fgs[i].tid == t->mgmt.tid) {
+				if (nvme_fgs[i].scaled_IOPS_limit != scaled_IOPS(IOPS_SLO, rw_ratio_SLO))
+					printf("warning: tenant connection registered different SLO, "
+					       "keeping the tenant's first SLO. 1 SLO per tenant.\n");
+				nvme_fgs[i].conn_ref_count++;
+				pthread_mutex_unlock(&nvme_bitmap_lock);
+				return i;
+			}
+		} else if (fg_handle < 0) {
+			fg_handle = i;
+		}
+	}
+	if (fg_handle < 0) {
+		pthread_mutex_unlock(&nvme_bitmap_lock);
+		printf("error: exceeded max (%d) flow groups!\n", MAX_NVME_FLOW_GROUPS);
+		return -ENOMEM;
+	}
+
+	swq = calloc(1, sizeof(*swq));
+	if (!swq) {
+		pthread_mutex_unlock(&nvme_bitmap_lock);
+		return -ENOMEM;
+	}
+
+	fg = &nvme_fgs[fg_handle];
+	memset(fg, 0, sizeof(*fg));
+	fg->flow_group_id = flow_group_id;
+	fg->latency_us_SLO = latency_us_SLO;
+	fg->IOPS_SLO = IOPS_SLO;
+	fg->rw_ratio_SLO = rw_ratio_SLO;
+	fg->scaled_IOPS_limit = scaled_IOPS(IOPS_SLO, rw_ratio_SLO);
+	fg->token_rate = token_rate_fixed(fg->scaled_IOPS_limit);
+	fg->latency_critical_flag = latency_us_SLO != 0;
+	if (!fg->latency_critical_flag)
+		fg->be_weight = be_weight ? be_weight : 1;
+	fg->tid = t->mgmt.tid;
+
+	// set first, as in the dataplane, so the LC boost is applied to it too
+	bitmap_set(nvme_fgs_bitmap, fg_handle);
+	if (!recalculate_weights_add(fg_handle)) {
+		bitmap_clear(nvme_fgs_bitmap, fg_handle);
+		pthread_mutex_unlock(&nvme_bitmap_lock);
+		free(swq);
+		printf("warning: cannot satisfy SLO\n");
+		return -EBUSY;
+	}
+	fg->conn_ref_count = 1;
+	pthread_mutex_unlock(&nvme_bitmap_lock);
+
+	nvme_sched_add_tenant(&t->mgmt, swq, fg_handle);
+	if (!latency_us_SLO) {
+		printf("Register tenant %ld (port id: %ld). Managed by thread %d. Best-effort tenant, weight %u.\n",
+		       fg_handle, flow_group_id, t->mgmt.tid, fg->be_weight);
+	} else {
+		printf("Register tenant %ld (port id: %ld). Managed by thread %d. IOPS_SLO: %lu, r/w %d, "
+		       "scaled_IOPS: %lu tokens/s, latency SLO: %u us.\n",
+		       fg_handle, flow_group_id, t->mgmt.tid, IOPS_SLO, rw_ratio_SLO,
+		       fg->scaled_IOPS_limit, latency_us_SLO);
+	}
+	return fg_handle;
+}
+
+/**
+ * sched_unregister_flow - drops a connection's reference on its tenant
+ * @t: the thread the connection is served by
+ * @fg_handle: the handle returned by sched_register_flow()
+ *
+ * The caller must have completed the connection's requests.
+ */
+void sched_unregister_flow(struct sched_thread *t, long fg_handle)
+{
+	struct nvme_flow_group *fg = &nvme_fgs[fg_handle];
+	struct nvme_sw_queue *swq = fg->nvme_swq;
+
+	if (--fg->conn_ref_count)
+		return;
+
+	nvme_sched_remove_tenant(&t->mgmt, swq);
+	t->queued -= swq->count;
+	free(swq);
+
+	pthread_mutex_lock(&nvme_bitmap_lock);
+	recalculate_weights_remove(fg_handle);
+	bitmap_clear(nvme_fgs_bitmap, fg_handle);
+	pthread_mutex_unlock(&nvme_bitmap_lock);
+}
+
+/**
+ * sched_submit - queues a request until its tenant has the tokens
+ * @t: the thread state
+ * @fg_handle: the tenant, registered on this thread
+ * @req: the scheduler's part of the request
+ * @cmd: the NVME_CMD_* command
+ * @len: the request length in bytes
+ *
+ * The request is passed to the issue callback right away if scheduling is
+ * off, otherwise by a later sched_round().
+ *
+ * Returns 0 if successful, or -EAGAIN if the tenant's queue is full.
+ */
+int sched_submit(struct sched_thread *t, long fg_handle, struct nvme_sched_req *req,
+		 int cmd, size_t len)
+{
+	int ret;
+
+	if (!nvme_sched_flag) {
+		req->swq = NULL;
+		t->issue(t, req);
+		return 0;
+	}
+
+	ret = nvme_sched_enqueue(&t->mgmt, fg_handle, req, cmd, len);
+	if (!ret)
+		t->queued++;
+	return ret ? -EAGAIN : 0;
+}
+
+/**
+ * sched_complete - releases a completed request from the in-flight caps
+ * @t: the thread that issued the request
+ * @req: the scheduler's part of the request
+ */
+void sched_complete(struct sched_thread *t, struct nvme_sched_req *req)
+{
+	nvme_inflight_put(&t->mgmt, req);
+}
+
+/**
+ * sched_round - runs one scheduling round for the calling thread
+ * @t: the thread state
+ *
+ * Call once per event loop iteration, like nvme_sched() in the dataplane.
+ */
+int sched_round(struct sched_thread *t)
+{
+	if (nvme_sched_flag)
+		nvme_sched_round(&t->mgmt);
+	return 0;
+}
@@ -0,0 +1,60 @@
+/*
+ * Copyright 2013-16 Board of Trustees of Stanford University
+ * Copyright 2013-16 Ecole Polytechnique Federale Lausanne (EPFL)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+/*
+ * token_sched.h - ReFlex token scheduler for the Linux server
+ *
+ * The scheduler itself is dp/core/nvme_sched.c, the same source the IX
+ * dataplane is built with. This wraps it for the server's threads: flow
+ * registration under a mutex, software queues from the heap, and the
+ * scheduler hooks on CLOCK_MONOTONIC, so token rates are in tokens per
+ * 2^TOKEN_RATE_SHIFT ns instead of cycles.
+ */
+
+#pragma once
+
+#include <ix/nvme_sched.h>
+
+struct sched_thread;
+
+typedef void (*sched_issue_fn)(struct sched_thread *t, struct nvme_sched_req *req);
+
+/* per-thread scheduler state, the percpu nvme_tenant_manager of nvmedev.c */
+struct sched_thread {
+	struct nvme_tenant_mgmt mgmt;
+	sched_issue_fn issue;		// submits a request to the device
+	unsigned long queued;		// requests waiting in the sw queues
+};
+
+extern int sched_init(const char *dev_model, int nr_threads);
+extern void sched_thread_init(struct sched_thread *t, int tid, sched_issue_fn issue);
+extern void sched_thread_idle(struct sched_thread *t, bool idle);
+extern long sched_register_flow(struct sched_thread *t, long flow_group_id,
+				unsigned int latency_us_SLO, unsigned long IOPS_SLO,
+				int rw_ratio_SLO, unsigned int be_weight);
+extern void sched_unregister_flow(struct sched_thread *t, long fg_handle);
+extern int sched_submit(struct sched_thread *t, long fg_handle, struct nvme_sched_req *req,
+			int cmd, size_t len);
+extern void sched_complete(struct sched_thread *t, struct nvme_sched_req *req);
+extern int sched_round(struct sched_thread *t);
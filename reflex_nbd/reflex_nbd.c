@@ -12,9 +12,10 @@
 #include <linux/blkdev.h>
 #include <linux/blk-mq.h>
 #include <linux/errno.h>
-#include <linux/mutex.h>
+#include <linux/highmem.h>
+#include <net/busy_poll.h>
 #include <net/sock.h>
-#include <linux/kthread.h>
+#include <net/tcp.h>
 
 #include "reflex_nbd.h"
 
@@ -46,6 +47,8 @@ static char *dest_addr = "10.79.6.130";
 static int hw_queue_depth = 4096;
 static int submit_queues;
 static int home_node = NUMA_NO_NODE;
+static int nr_conns = 1;
+static struct workqueue_struct *reflex_wq;
 //FIXME: max cores/hw queues
 
 #ifndef NDEBUG
@@ -104,6 +107,7 @@ static int sock_xmit(struct socket *sock, int send, void *buf, int size,
 {
 	//struct socket *sock = nbd->sock;
 	int result;
+	int done = 0;
 	struct msghdr msg;
 	struct kvec iov;
 	//sigset_t blocked, oldset;
@@ -136,44 +140,64 @@ static int sock_xmit(struct socket *sock, int send, void *buf, int size,
 		} else {
 			result = kernel_recvmsg(sock, &msg, &iov, 1, size,
 						msg.msg_flags);
-			if (kthread_should_stop()) {
-				return -EIO;
-			}
 		}
 
-		if (result > 0) {
-			size -= result;
-			buf += result;
-		}
-		  
+		if (result <= 0)
+			break;
+		size -= result;
+		buf += result;
+		done += result;
 	} while (size > 0);
 	
 	tsk_restore_flags(current, pflags, PF_MEMALLOC);
 	//sigprocmask(SIG_SETMASK, &oldset, NULL);
 	
-	
-	return result;
+	/* a failed send or receive is fatal, report the error */
+	return result <= 0 ? result : done;
 }
 
-static inline int sock_send_bvec(struct socket *sock, struct bio_vec *bvec,
-				 int flags, struct reflex_queue *fq)
+/*
+ * Sends a payload segment by reference with kernel_sendpage(), so TCP
+ * takes a page reference instead of copying the data. Slab pages can't
+ * be referenced that way and are copied with sock_xmit().
+ */
+static int sock_send_bvec(struct socket *sock, struct bio_vec *bvec,
+			  int flags)
 {
-	int result;
-	unsigned long irq_flags;
+	struct page *page = bvec->bv_page;
+	int offset = bvec->bv_offset;
+	int size = bvec->bv_len;
+	int result, done = 0;
+	void *kaddr;
+
+	if (unlikely(PageSlab(page) || page_count(page) < 1)) {
+		kaddr = kmap(page);
+		result = sock_xmit(sock, 1, kaddr + offset, size, flags);
+		kunmap(page);
+		return result;
+	}
 
-	void *kaddr = kmap(bvec->bv_page);
-	
-	result = sock_xmit(sock, 1, kaddr + bvec->bv_offset,
-			   bvec->bv_len, flags);
-	kunmap(kaddr);
-	
-	return result;
+	sock->sk->sk_allocation = GFP_NOIO | __GFP_MEMALLOC;
+	do {
+		result = kernel_sendpage(sock, page, offset, size,
+					 flags | MSG_NOSIGNAL);
+		if (result <= 0)
+			return result;
+		offset += result;
+		size -= result;
+		done += result;
+	} while (size > 0);
+
+	return done;
 }
 
-/* always call with the tx_lock held */
-static int reflex_send_req(struct reflex_queue *fq, struct request *req)
+/*
+ * only called from the socket's tx_work, @more is set if more requests
+ * follow in the batch
+ */
+static int reflex_send_req(struct reflex_sock *rs, struct request *req, bool more)
 {
-	struct socket *sock = fq->sock;
+	struct socket *sock = rs->sock;
 	int result, flags;
 	binary_header_blk_t header;
 	struct req_iterator iter;
@@ -184,21 +208,33 @@ static int reflex_send_req(struct reflex_queue *fq, struct request *req)
 	struct bio *bio;
 	int num_bio = 0;
 	
-	if(unlikely((req->cmd_type != REFLEX_CMD_WRITE) && (req->cmd_type != REFLEX_CMD_READ))) {
-		printk("Unsupported command received %s\n", nbdcmd_to_ascii(req->cmd_type));
-		goto error_out;
-	}
-	
 	header.lba = blk_rq_pos(req);
 	//FIXME: Shift value must correspond with reflex server sector size
 	header.lba_count = blk_rq_bytes(req) >> 9; 
 	header.magic = sizeof(binary_header_blk_t);
-	header.opcode = (req->cmd_type == REFLEX_CMD_WRITE) ? CMD_SET : CMD_GET;
-	BUG_ON((req->cmd_type != REFLEX_CMD_WRITE) && (req->cmd_type != REFLEX_CMD_READ));
+	switch (cmd_type) {
+	case REFLEX_CMD_READ:
+		header.opcode = CMD_GET;
+		break;
+	case REFLEX_CMD_WRITE:
+		header.opcode = CMD_SET;
+		break;
+	case REFLEX_CMD_TRIM:
+		header.opcode = CMD_TRIM;
+		break;
+	case REFLEX_CMD_FLUSH:
+		header.opcode = CMD_FLUSH;
+		header.lba = 0;
+		header.lba_count = 0;
+		break;
+	default:
+		printk("Unsupported command received %s\n", nbdcmd_to_ascii(cmd_type));
+		goto error_out;
+	}
 	header.req_handle = req;
 
 	result = sock_xmit(sock, 1, &header, sizeof(binary_header_blk_t),
-			   (cmd_type == REFLEX_CMD_WRITE) ? MSG_MORE : 0); 
+			   (cmd_type == REFLEX_CMD_WRITE || more) ? MSG_MORE : 0);
 	BUG_ON(result != sizeof(binary_header_blk_t));
 	bio = req->bio;
 	while (bio) {
@@ -209,9 +245,9 @@ static int reflex_send_req(struct reflex_queue *fq, struct request *req)
 		if (cmd_type == REFLEX_CMD_WRITE) {
 			bio_for_each_segment(bvec, bio, iter) {
 				bool is_last = !next && bio_iter_last(bvec, iter);
-				int flags = is_last ? 0 : MSG_MORE;
+				int flags = (is_last && !more) ? 0 : MSG_MORE;
 
-				result = sock_send_bvec(sock, &bvec, flags, fq);
+				result = sock_send_bvec(sock, &bvec, flags);
 				if (result <= 0) {
 					printk(KERN_EMERG "FATAL cound not send\n");
 					BUG();
@@ -234,82 +270,159 @@ error_out:
 	return -EIO;
 }
 
-static inline int sock_recv_bvec(struct socket *sock, struct bio_vec *bvec)
+static void reflex_tx_work(struct work_struct *work)
 {
-	int result;
-	void *kaddr = kmap(bvec->bv_page);
+	struct reflex_sock *rs = container_of(work, struct reflex_sock, tx_work);
+	struct llist_node *list;
+	struct reflex_cmd *cmd, *next;
+
+	while ((list = llist_del_all(&rs->send_list))) {
+		/* llist_add() pushes at the head, send in submission order */
+		list = llist_reverse_order(list);
+		llist_for_each_entry_safe(cmd, next, list, send_node) {
+			reflex_send_req(rs, blk_mq_rq_from_pdu(cmd),
+					next || !llist_empty(&rs->send_list));
+		}
+	}
+}
+
+/*
+ * Consumes response bytes from an skb: the header, then for reads the
+ * payload straight into the request's pages. Runs in softirq context, or
+ * from process context with the socket locked (reflex_poll(), or
+ * release_sock() if the socket was owned by tx_work).
+ */
+static int reflex_recv_actor(read_descriptor_t *desc, struct sk_buff *skb,
+			     unsigned int offset, size_t len)
+{
+	struct reflex_sock *rs = desc->arg.data;
+	struct request *req;
+	struct bio_vec bvec;
+	size_t consumed = 0;
+	unsigned int n;
+	void *kaddr;
+
+	while (consumed < len) {
+		if (!rs->rx_req) {
+			n = min_t(size_t, len - consumed,
+				  sizeof(binary_header_blk_t) - rs->rx_hdr_off);
+			skb_copy_bits(skb, offset + consumed,
+				      (char *)&rs->rx_hdr + rs->rx_hdr_off, n);
+			consumed += n;
+			rs->rx_hdr_off += n;
+			if (rs->rx_hdr_off < sizeof(binary_header_blk_t))
+				break;
+			rs->rx_hdr_off = 0;
+
+			BUG_ON(rs->rx_hdr.magic != sizeof(binary_header_blk_t));
+			req = rs->rx_hdr.req_handle;
+			if (req->cmd_type == REFLEX_CMD_READ && req->bio) {
+				rs->rx_req = req;
+				rs->rx_bio = req->bio;
+				rs->rx_iter = req->bio->bi_iter;
+				rs->rx_left = blk_rq_bytes(req);
+			} else {
+				reflex_end_request(rs->fq, req);
+				rs->rx_done++;
+			}
+			continue;
+		}
 
-	result = sock_xmit(sock, 0, kaddr + bvec->bv_offset, bvec->bv_len,
-			   MSG_WAITALL);
+		bvec = bio_iter_iovec(rs->rx_bio, rs->rx_iter);
+		n = min_t(size_t, len - consumed, bvec.bv_len);
+		kaddr = kmap_atomic(bvec.bv_page);
+		skb_copy_bits(skb, offset + consumed, kaddr + bvec.bv_offset, n);
+		kunmap_atomic(kaddr);
+		consumed += n;
+		rs->rx_left -= n;
+
+		bio_advance_iter(rs->rx_bio, &rs->rx_iter, n);
+		if (!rs->rx_iter.bi_size && rs->rx_bio->bi_next) {
+			rs->rx_bio = rs->rx_bio->bi_next;
+			rs->rx_iter = rs->rx_bio->bi_iter;
+		}
+		if (!rs->rx_left) {
+			req = rs->rx_req;
+			rs->rx_req = NULL;
+			reflex_end_request(rs->fq, req);
+			rs->rx_done++;
+		}
+	}
 
-	kunmap(bvec->bv_page);
+	return consumed;
+}
 
-	return result;
+static void reflex_data_ready(struct sock *sk)
+{
+	struct reflex_sock *rs;
+	read_descriptor_t rd_desc;
+
+	read_lock_bh(&sk->sk_callback_lock);
+	rs = sk->sk_user_data;
+	if (likely(rs)) {
+		rd_desc.arg.data = rs;
+		rd_desc.count = 1;
+		tcp_read_sock(sk, &rd_desc, reflex_recv_actor);
+	}
+	read_unlock_bh(&sk->sk_callback_lock);
 }
 
-static int reflex_read_stat(struct reflex_queue *fq)
+/*
+ * blk-mq poll hook for polled direct I/O (io_poll set on the queue): spins
+ * on the socket carrying @tag instead of waiting for the softirq and the
+ * wakeup. If busy polling is enabled on the socket (net.core.busy_read),
+ * the NIC queue is polled directly as well.
+ *
+ * Returns the number of requests completed on the socket.
+ */
+static int reflex_poll(struct blk_mq_hw_ctx *hctx, unsigned int tag)
 {
-	int result = 0;
-	struct request *req;
-	int i;
-	binary_header_blk_t header;
-	void* handle;
-	int recv_bytes = 0;
-	int recv_reqs = 0;
+	struct reflex_queue *fq = hctx->driver_data;
+	struct reflex_sock *rs;
+	struct sock *sk;
+	read_descriptor_t rd_desc;
 
-	while (1) {
-		result = sock_xmit(fq->sock, 0, &header, sizeof(binary_header_blk_t), MSG_WAITALL);
+	if (unlikely(!fq->nr_socks))
+		return 0;
 
-		if (result == -EIO) {
-			BUG();
-			return result;
-		}
+	rs = &fq->socks[tag % fq->nr_socks];
+	sk = rs->sock->sk;
 
-		BUG_ON(result < 0);
-		BUG_ON(header.magic != sizeof(binary_header_blk_t));
+	if (sk_can_busy_loop(sk))
+		sk_busy_loop(sk, 1);
 
-		req = header.req_handle;
-	
-		if (req->cmd_type == REFLEX_CMD_READ) {
-			struct bio_vec bvec;
-			struct req_iterator iter;
-			struct request *req = header.req_handle;
-			
-			rq_for_each_segment(bvec, req, iter) {
-				result = sock_recv_bvec(fq->sock, &bvec);
-				if (result <= 0) {
-					printk(KERN_EMERG "FATAL cound not receive\n");
-					BUG();
-				}
-			}
-		}
-		reflex_end_request(fq, req);
-	}
+	/* with the socket owned, softirq input goes to the backlog instead */
+	lock_sock(sk);
+	rs->rx_done = 0;
+	rd_desc.arg.data = rs;
+	rd_desc.count = 1;
+	tcp_read_sock(sk, &rd_desc, reflex_recv_actor);
+	release_sock(sk);
 
-	return recv_reqs;
+	return rs->rx_done;
 }
 
-static int reflex_thread_recv(void *arg)
+/*
+ * Kicks tx_work on every socket of the queue with requests waiting, once
+ * blk-mq has handed over the last request of a dispatch batch.
+ */
+static void reflex_kick_socks(struct reflex_queue *fq)
 {
-	struct request *req;
-	int ret;
-	struct reflex_queue *fq = (struct reflex_queue *)arg;
-	
-	BUG_ON(fq->reflex_dev->magic != REFLEX_MAGIC);
+	int i;
 
-	while (!kthread_should_stop()) {
-		reflex_read_stat(fq);
-	}
+	for (i = 0; i < fq->nr_socks; i++) {
+		struct reflex_sock *rs = &fq->socks[i];
 
-	return 0;
+		if (!llist_empty(&rs->send_list))
+			queue_work(reflex_wq, &rs->tx_work);
+	}
 }
 
-static void reflex_handle_cmd(struct reflex_queue *fq, struct reflex_cmd *cmd)
+static void reflex_handle_cmd(struct reflex_queue *fq, struct reflex_cmd *cmd,
+			      bool last)
 {
 	struct request *req = blk_mq_rq_from_pdu(cmd);
-	int num_reflex_reqs;
-	ktime_t ktime;
-	int ret;
+	struct reflex_sock *rs;
 	
 	if (req->cmd_type != REQ_TYPE_FS) {
 		printk(KERN_WARNING "---starnge cm type %i\n", req->cmd_type);
@@ -317,9 +430,6 @@ static void reflex_handle_cmd(struct reflex_queue *fq, struct reflex_cmd *cmd)
 
 	}
 
-	BUG_ON(req->cmd_flags & REQ_FLUSH);
-	BUG_ON(req->cmd_flags & REQ_FLUSH_SEQ);
-	BUG_ON(req->cmd_flags & REQ_DISCARD);
 	BUG_ON(req->cmd_flags & REQ_SOFTBARRIER);
 	BUG_ON(req->cmd_flags & REQ_STARTED);
 	
@@ -338,14 +448,21 @@ static void reflex_handle_cmd(struct reflex_queue *fq, struct reflex_cmd *cmd)
 
 	req->errors = 0;
 
-	if (unlikely(!fq->sock)) {
+	if (unlikely(!fq->nr_socks)) {
 		goto error_out;
 	}
 
-	mutex_lock(&fq->tx_lock);
-	num_reflex_reqs = reflex_send_req(fq, req);
-	mutex_unlock(&fq->tx_lock);
-	
+	/*
+	 * Spread requests over the queue's sockets by tag. queue_rq may run
+	 * with preemption disabled, so leave the (sleeping) send to tx_work,
+	 * which picks up everything queued on the socket meanwhile. The work
+	 * is only kicked at the end of a dispatch batch (bd->last), so a
+	 * plugged batch goes out back to back with MSG_MORE.
+	 */
+	rs = &fq->socks[req->tag % fq->nr_socks];
+	llist_add(&cmd->send_node, &rs->send_list);
+	if (last)
+		reflex_kick_socks(fq);
 	return;
 
 error_out:
@@ -367,73 +484,107 @@ static int reflex_queue_rq(struct blk_mq_hw_ctx *hctx,
 	struct reflex_queue *fq = hctx->driver_data;
 		
 	blk_mq_start_request(bd->rq);
-	reflex_handle_cmd(fq, cmd);
+	reflex_handle_cmd(fq, cmd, bd->last);
 	  
 	return BLK_MQ_RQ_QUEUE_OK;	
 }
 
-static int reflex_init_hctx(struct blk_mq_hw_ctx *hctx, void *data,
-			     unsigned int index)
+static void reflex_close_sock(struct reflex_sock *rs)
+{
+	struct sock *sk = rs->sock->sk;
+
+	write_lock_bh(&sk->sk_callback_lock);
+	sk->sk_user_data = NULL;
+	sk->sk_data_ready = rs->saved_data_ready;
+	write_unlock_bh(&sk->sk_callback_lock);
+
+	cancel_work_sync(&rs->tx_work);
+	kernel_sock_shutdown(rs->sock, SHUT_RDWR);
+	sock_release(rs->sock);
+	rs->sock = NULL;
+}
+
+static int reflex_open_sock(struct reflex_queue *fq, struct reflex_sock *rs)
 {
-	struct reflex_device *reflex_dev = data;
-	struct reflex_queue *fq = &reflex_dev->queues[index];
-	int sock_flags = 0;
 	struct sockaddr_in sockaddr;
-	int ret = 0;
-	int US_POLL_DELAY = 1;
-	int len = sizeof(int);
-	struct timeval tv;
-	
-	BUG_ON(!reflex_dev);
-	BUG_ON(!fq);
+	struct sock *sk;
+	int one = 1;
+	int ret;
 
-	fq->index = index;
-	fq->reflex_dev = reflex_dev;
-	
-	mutex_init(&fq->tx_lock);
-	hctx->driver_data = fq;
-	fq->reflex_reqs = kzalloc(sizeof(long) * hw_queue_depth, GFP_KERNEL);
+	rs->fq = fq;
+	init_llist_head(&rs->send_list);
+	INIT_WORK(&rs->tx_work, reflex_tx_work);
 
 	/* Connect to reflex server */
-	ret = sock_create(PF_INET, SOCK_STREAM, IPPROTO_TCP, &fq->sock);
+	ret = sock_create(PF_INET, SOCK_STREAM, IPPROTO_TCP, &rs->sock);
 	if(ret) {
 		printk(KERN_WARNING "Could not create socket\n");
-		goto out;
+		return ret;
 	}
 
-	tv.tv_sec = 0;  /* 100 ms Timeout */
-	tv.tv_usec = 100000;  
-	kernel_setsockopt(fq->sock, SOL_SOCKET, SO_RCVTIMEO, (char *)&tv,
-			  sizeof(struct timeval));
-	
 	memset(&sockaddr, 0, sizeof(sockaddr));
 	sockaddr.sin_family = AF_INET;
 	sockaddr.sin_addr.s_addr = inet_addr(dest_addr);
 	sockaddr.sin_port = htons(1234);
 
-	printk(KERN_EMERG "Connecting to IP: %s\n", dest_addr);
-	
-	ret = kernel_connect(fq->sock, (struct sockaddr *)&sockaddr,
-			     sizeof(struct sockaddr_in), sock_flags); 
+	ret = kernel_connect(rs->sock, (struct sockaddr *)&sockaddr,
+			     sizeof(struct sockaddr_in), 0);
 	if(ret) {
 		printk(KERN_WARNING "Could not connect socket. Server not running?\n");
-		goto out_sock;
+		sock_release(rs->sock);
+		rs->sock = NULL;
+		return ret;
 	}
 
-	fq->recvthread = kthread_create(reflex_thread_recv, fq, "Recv %s %i",
-					reflex_dev->disk->disk_name, index);
-	if (IS_ERR(fq->recvthread)) {
-		printk(KERN_WARNING "error creating recv thread\n");
-		goto out_sock;
+	/* batches are delimited with MSG_MORE, don't let Nagle hold the last one */
+	kernel_setsockopt(rs->sock, SOL_TCP, TCP_NODELAY, (char *)&one, sizeof(one));
+
+	sk = rs->sock->sk;
+	write_lock_bh(&sk->sk_callback_lock);
+	sk->sk_user_data = rs;
+	rs->saved_data_ready = sk->sk_data_ready;
+	sk->sk_data_ready = reflex_data_ready;
+	write_unlock_bh(&sk->sk_callback_lock);
+
+	return 0;
+}
+
+static int reflex_init_hctx(struct blk_mq_hw_ctx *hctx, void *data,
+			     unsigned int index)
+{
+	struct reflex_device *reflex_dev = data;
+	struct reflex_queue *fq = &reflex_dev->queues[index];
+	int i;
+
+	BUG_ON(!reflex_dev);
+	BUG_ON(!fq);
+
+	fq->index = index;
+	fq->reflex_dev = reflex_dev;
+	
+	hctx->driver_data = fq;
+	fq->reflex_reqs = kzalloc(sizeof(long) * hw_queue_depth, GFP_KERNEL);
+	fq->socks = kcalloc(nr_conns, sizeof(struct reflex_sock), GFP_KERNEL);
+	if (!fq->reflex_reqs || !fq->socks)
+		goto out;
+
+	printk(KERN_EMERG "Connecting to IP: %s\n", dest_addr);
+
+	for (i = 0; i < nr_conns; i++) {
+		fq->socks[i].index = i;
+		if (reflex_open_sock(fq, &fq->socks[i]))
+			goto out_sock;
 	}
-	//kthread_bind(fq->recvthread, index + 6);//smp_processor_id());
-	wake_up_process(fq->recvthread);
+	fq->nr_socks = nr_conns;
 	
 	return 0;
 	
 out_sock:
-	sock_release(fq->sock);
+	while (i--)
+		reflex_close_sock(&fq->socks[i]);
 out:
+	kfree(fq->socks);
+	fq->socks = NULL;
 	kfree(fq->reflex_reqs);
 	return -1;
 }
@@ -443,6 +594,7 @@ static struct blk_mq_ops reflex_mq_ops = {
 	.queue_rq       = reflex_queue_rq,
 	.map_queue      = blk_mq_map_queue,
 	.init_hctx	= reflex_init_hctx,
+	.poll		= reflex_poll,
 //	.complete	= reflex_softirq_done_fn,
 };
 
@@ -475,6 +627,11 @@ static int __init reflex_init(void)
 	
 	submit_queues = 24;//nr_online_nodes;
 	
+	if (nr_conns < 1) {
+		printk(KERN_ERR "reflex: nr_conns must be >= 1\n");
+		return -EINVAL;
+	}
+
 	if (max_part < 0) {
 		printk(KERN_ERR "reflex: max_part must be >= 0\n");
 		return -EINVAL;
@@ -501,9 +658,15 @@ static int __init reflex_init(void)
 	if (reflex_devs_max > 1UL << (MINORBITS - part_shift))
 		return -EINVAL;
 
+	reflex_wq = alloc_workqueue("reflex_tx", WQ_HIGHPRI | WQ_MEM_RECLAIM, 0);
+	if (!reflex_wq)
+		return -ENOMEM;
+
 	reflex_dev = kcalloc(reflex_devs_max, sizeof(*reflex_dev), GFP_KERNEL);
-	if (!reflex_dev)
+	if (!reflex_dev) {
+		destroy_workqueue(reflex_wq);
 		return -ENOMEM;
+	}
 
 	setup_queues(reflex_dev);
 	
@@ -542,6 +705,11 @@ static int __init reflex_init(void)
 	blk_queue_max_segments(reflex_dev->q, 8);
 	blk_queue_max_integrity_segments(reflex_dev->q, 1);
 	blk_queue_max_discard_sectors(reflex_dev->q, 0xffffffff);
+	/* discards become ReFlex TRIMs, cache flushes ReFlex FLUSHes */
+	reflex_dev->q->limits.discard_granularity = 512;
+	reflex_dev->q->limits.discard_zeroes_data = 0;
+	queue_flag_set_unlocked(QUEUE_FLAG_DISCARD, reflex_dev->q);
+	blk_queue_flush(reflex_dev->q, REQ_FLUSH);
 		
 	disk = reflex_dev->disk = alloc_disk_node(1, home_node);
 	if (!disk) {
@@ -586,6 +754,7 @@ out:
 		put_disk(reflex_dev->disk);
 	}
 	kfree(reflex_dev);
+	destroy_workqueue(reflex_wq);
 	return err;
 
 	//FIXME: handle errors
@@ -597,11 +766,16 @@ out_cleanup_tags:
 
 static void __exit reflex_cleanup(void)
 {
-	int i;
+	int i, j;
 	
 	for (i = 0; i < submit_queues; i++) {
-		kthread_stop((&reflex_dev->queues[i])->recvthread);
-		kernel_sock_shutdown((&reflex_dev->queues[i])->sock, SHUT_RDWR);
+		struct reflex_queue *fq = &reflex_dev->queues[i];
+
+		for (j = 0; j < fq->nr_socks; j++)
+			reflex_close_sock(&fq->socks[j]);
+		fq->nr_socks = 0;
+		kfree(fq->socks);
+		kfree(fq->reflex_reqs);
 	}
 	for (i = 0; i < reflex_devs_max; i++) {
 		struct gendisk *disk = reflex_dev->disk;
@@ -614,6 +788,7 @@ static void __exit reflex_cleanup(void)
 	}
 	unregister_blkdev(REFLEX_MAJOR, "reflex");
 	kfree(reflex_dev);
+	destroy_workqueue(reflex_wq);
 	printk(KERN_WARNING "ReFlex: unregistered device at major %d\n", REFLEX_MAJOR);
 }
 
@@ -632,6 +807,9 @@ MODULE_PARM_DESC(home_node, "Home node for the device");
 module_param(dest_addr, charp, S_IRUGO);
 MODULE_PARM_DESC(dest_addr, "Reflex Server IP");
 
+module_param(nr_conns, int, S_IRUGO);
+MODULE_PARM_DESC(nr_conns, "TCP connections per hardware queue. Default: 1");
+
 MODULE_DESCRIPTION("Reflex Network Block Device");
 MODULE_LICENSE("GPL");
 
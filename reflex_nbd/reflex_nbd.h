@@ -14,7 +14,8 @@
 #ifndef LINUX_REFLEX_H
 #define LINUX_REFLEX_H
 
-#include <linux/mutex.h>
+#include <linux/llist.h>
+#include <linux/workqueue.h>
 
 #include "../apps/reflex.h"
 
@@ -29,16 +30,40 @@ struct request;
 
 struct reflex_cmd {
 	struct request *rq;
+	struct llist_node send_node;	/* on reflex_sock.send_list */
 //	struct reflex_queue *fq;
 };
 
+/*
+ * One TCP connection to the server. A hardware queue spreads its requests
+ * over nr_conns of these. Requests are queued on send_list without locks
+ * and sent in batches by tx_work; responses are parsed in sk_data_ready,
+ * or by reflex_poll() for polled I/O.
+ */
+struct reflex_sock {
+	struct reflex_queue *fq;
+	int index;
+	struct socket *sock;
+	struct llist_head send_list;
+	struct work_struct tx_work;
+	void (*saved_data_ready)(struct sock *sk);
+
+	/* receive state, only touched with the socket locked */
+	binary_header_blk_t rx_hdr;
+	int rx_hdr_off;
+	struct request *rx_req;		/* read whose payload is being received */
+	struct bio *rx_bio;
+	struct bvec_iter rx_iter;
+	unsigned int rx_left;
+	unsigned int rx_done;		/* requests completed, for reflex_poll() */
+};
+
 struct reflex_queue {
 	int index;
 	long *reflex_reqs;
-	struct mutex tx_lock;
 	struct reflex_device *reflex_dev;
-	struct socket *sock;
-	struct task_struct *recvthread;
+	struct reflex_sock *socks;
+	unsigned int nr_socks;
 };
 
 struct reflex_device {
@@ -0,0 +1,188 @@
+/*
+ * Copyright 2013-16 Board of Trustees of Stanford University
+ * Copyright 2013-16 Ecole Polytechnique Federale Lausanne (EPFL)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * ix_logdecode.c - formats a binary log written by the dataplane
+ *
+ * The dataplane writes logk_fast() records to CFG.log_file as call site
+ * ids and raw arguments (see inc/ix/binlog.h). This tool reads such a file
+ * and prints the records in the format of the text log.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <ix/binlog.h>
+
+#define MAX_SITES	4096
+
+struct site {
+	char *fmt;
+	char *file;
+	uint32_t line;
+	uint8_t level;
+};
+
+static struct site sites[MAX_SITES];
+
+static const char *level_names[] = {
+	"emerg", "crit", "err", "warn", "info", "debug",
+};
+
+static int read_site(FILE *f, bool verbose)
+{
+	struct binlog_site_ent ent;
+	struct site *s;
+
+	if (fread((char *) &ent + sizeof(uint32_t), sizeof(ent) - sizeof(uint32_t), 1, f) != 1)
+		return -1;
+	if (ent.id >= MAX_SITES)
+		return -1;
+
+	s = &sites[ent.id];
+	free(s->fmt);
+	free(s->file);
+	s->fmt = calloc(1, ent.fmt_len + 1);
+	s->file = calloc(1, ent.file_len + 1);
+	if (!s->fmt || !s->file)
+		return -1;
+	if (ent.fmt_len && fread(s->fmt, ent.fmt_len, 1, f) != 1)
+		return -1;
+	if (ent.file_len && fread(s->file, ent.file_len, 1, f) != 1)
+		return -1;
+	s->line = ent.line;
+	s->level = ent.level;
+
+	if (verbose)
+		printf("site %u: %s:%u\n", ent.id, s->file, s->line);
+	return 0;
+}
+
+static int read_record(FILE *f, const struct binlog_file_hdr *hdr, bool verbose)
+{
+	struct binlog_record_ent ent;
+	struct binlog_record *rec = &ent.rec;
+	struct site *s;
+	char msg[1024];
+	char timestr[32];
+	uint64_t us;
+	time_t t;
+
+	if (fread((char *) &ent + sizeof(uint32_t), sizeof(ent) - sizeof(uint32_t), 1, f) != 1)
+		return -1;
+	if (rec->site >= MAX_SITES || !sites[rec->site].fmt)
+		return -1;
+	s = &sites[rec->site];
+
+	us = (rec->tsc - hdr->start_tsc) / hdr->cycles_per_us;
+	t = hdr->start_time + us / 1000000;
+	strftime(timestr, sizeof(timestr), "%H:%M:%S", localtime(&t));
+
+	if (rec->suppressed)
+		printf("CPU %02d| %s.%06lu <%s>: (%u similar messages suppressed)\n",
+		       rec->cpu, timestr, us % 1000000,
+		       s->level < 6 ? level_names[s->level] : "?", rec->suppressed);
+
+	binlog_format(msg, sizeof(msg), s->fmt, rec->args,
+		      rec->nargs < BINLOG_MAX_ARGS ? rec->nargs : BINLOG_MAX_ARGS);
+	printf("CPU %02d| %s.%06lu <%s>: ", rec->cpu, timestr, us % 1000000,
+	       s->level < 6 ? level_names[s->level] : "?");
+	if (verbose)
+		printf("[%s:%u] ", s->file, s->line);
+	fputs(msg, stdout);
+	return 0;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "usage: %s [-v] logfile\n", prog);
+	exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+	struct binlog_file_hdr hdr;
+	struct binlog_dropped_ent dropped;
+	bool verbose = false;
+	uint32_t type;
+	FILE *f;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "v")) != -1) {
+		switch (opt) {
+		case 'v':
+			verbose = true;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (optind != argc - 1)
+		usage(argv[0]);
+
+	f = fopen(argv[optind], "rb");
+	if (!f) {
+		perror(argv[optind]);
+		return 1;
+	}
+
+	if (fread(&hdr, sizeof(hdr), 1, f) != 1 ||
+	    memcmp(hdr.magic, BINLOG_MAGIC, sizeof(hdr.magic)) ||
+	    !hdr.cycles_per_us) {
+		fprintf(stderr, "%s: not a binary log\n", argv[optind]);
+		return 1;
+	}
+
+	while (fread(&type, sizeof(type), 1, f) == 1) {
+		int ret;
+
+		switch (type) {
+		case BINLOG_ENT_SITE:
+			ret = read_site(f, verbose);
+			break;
+		case BINLOG_ENT_RECORD:
+			ret = read_record(f, &hdr, verbose);
+			break;
+		case BINLOG_ENT_DROPPED:
+			ret = fread((char *) &dropped + sizeof(uint32_t),
+				    sizeof(dropped) - sizeof(uint32_t), 1, f) == 1 ? 0 : -1;
+			if (!ret)
+				printf("CPU %02d| <warn>: %lu log records dropped, ring full\n",
+				       dropped.cpu, dropped.count);
+			break;
+		default:
+			ret = -1;
+		}
+
+		if (ret) {
+			fprintf(stderr, "%s: corrupt entry at offset %ld\n",
+				argv[optind], ftell(f));
+			return 1;
+		}
+	}
+
+	fclose(f);
+	return 0;
+}
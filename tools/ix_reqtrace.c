@@ -0,0 +1,416 @@
+/*
+ * Copyright 2013-16 Board of Trustees of Stanford University
+ * Copyright 2013-16 Ecole Polytechnique Federale Lausanne (EPFL)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * ix_reqtrace.c - snapshots and analyzes request lifecycle traces
+ *
+ * Copies the per-core trace rings out of the dataplane's shared memory
+ * segment (see inc/ix/reqtrace.h), or reads a snapshot saved earlier with
+ * -w, then rebuilds the timeline of each traced request and reports how
+ * long requests spent in each stage:
+ *
+ *   submit   header parsed -> queued in the software queue (payload
+ *            receive for writes, application, syscall batching)
+ *   swqueue  queued -> submitted to the device by the scheduler
+ *   device   submitted -> completion processed
+ *   respond  completion -> response queued (completion delivery, application)
+ *   server   header parsed -> response queued, the sum of the above
+ *   ack      response queued -> acknowledged by the client (reads only)
+ */
+
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <ix/reqtrace.h>
+
+struct snap_hdr {
+	uint64_t magic;
+	uint64_t cycles_per_us;
+	uint64_t nr_events;
+};
+
+enum {
+	STAGE_SUBMIT = 0,
+	STAGE_SWQUEUE,
+	STAGE_DEVICE,
+	STAGE_RESPOND,
+	STAGE_SERVER,
+	STAGE_ACK,
+	STAGE_NR,
+};
+
+static const struct {
+	const char *name;
+	int from;
+	int to;
+} stages[STAGE_NR] = {
+	{ "submit",  REQTRACE_RX,            REQTRACE_NVME_ENQUEUE },
+	{ "swqueue", REQTRACE_NVME_ENQUEUE,  REQTRACE_NVME_DISPATCH },
+	{ "device",  REQTRACE_NVME_DISPATCH, REQTRACE_NVME_COMPLETE },
+	{ "respond", REQTRACE_NVME_COMPLETE, REQTRACE_TX },
+	{ "server",  REQTRACE_RX,            REQTRACE_TX },
+	{ "ack",     REQTRACE_TX,            REQTRACE_ACK },
+};
+
+struct timeline {
+	uint64_t id;
+	uint32_t fg;
+	unsigned int seen;	/* bitmap of REQTRACE_* events */
+	uint64_t tsc[REQTRACE_NR];
+};
+
+static struct reqtrace_event *events;
+static uint64_t nr_events;
+static uint64_t cycles_per_us;
+
+static struct timeline *timelines;
+static uint64_t nr_timelines;
+
+static uint64_t *stage_cycles[STAGE_NR];
+static uint64_t nr_stage[STAGE_NR];
+
+/* copies the events of one ring that were not overwritten while copying */
+static void snapshot_ring(volatile struct reqtrace_ring *r, uint32_t ring_size)
+{
+	uint64_t head, tail, now, lost = 0, i;
+
+	head = r->head;
+	__sync_synchronize();
+	tail = head > ring_size ? head - ring_size : 0;
+	for (i = tail; i < head; i++)
+		events[nr_events + i - tail] = r->ev[i & (ring_size - 1)];
+	__sync_synchronize();
+
+	/*
+	 * Meanwhile the dataplane may have overwritten events older than
+	 * now - ring_size, and be writing the slot of event now.
+	 */
+	now = r->head;
+	if (now + 1 > tail + ring_size) {
+		lost = now + 1 - ring_size - tail;
+		if (lost > head - tail)
+			lost = head - tail;
+		memmove(&events[nr_events], &events[nr_events + lost],
+			(head - tail - lost) * sizeof(*events));
+	}
+	nr_events += head - tail - lost;
+}
+
+static int snapshot_shm(void)
+{
+	struct reqtrace_shmem *shm;
+	struct stat st;
+	uint32_t cpu;
+	int fd;
+
+	fd = shm_open(REQTRACE_SHM, O_RDONLY, 0);
+	if (fd == -1 || fstat(fd, &st)) {
+		perror("/dev/shm" REQTRACE_SHM);
+		return -1;
+	}
+	shm = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (shm == MAP_FAILED) {
+		perror("mmap");
+		return -1;
+	}
+
+	if (shm->magic != REQTRACE_MAGIC || shm->ring_size != REQTRACE_RING_SIZE ||
+	    sizeof(*shm) + shm->nr_cpus * sizeof(struct reqtrace_ring) > (size_t) st.st_size) {
+		fprintf(stderr, "/dev/shm%s: not a request trace\n", REQTRACE_SHM);
+		return -1;
+	}
+
+	cycles_per_us = shm->cycles_per_us;
+	events = malloc(shm->nr_cpus * shm->ring_size * sizeof(*events));
+	if (!events)
+		return -1;
+	for (cpu = 0; cpu < shm->nr_cpus; cpu++)
+		snapshot_ring(&shm->ring[cpu], shm->ring_size);
+
+	munmap(shm, st.st_size);
+	return 0;
+}
+
+static int read_snapshot(const char *path)
+{
+	struct snap_hdr hdr;
+	FILE *f;
+
+	f = fopen(path, "rb");
+	if (!f) {
+		perror(path);
+		return -1;
+	}
+	if (fread(&hdr, sizeof(hdr), 1, f) != 1 || hdr.magic != REQTRACE_MAGIC ||
+	    !hdr.cycles_per_us) {
+		fprintf(stderr, "%s: not a request trace snapshot\n", path);
+		return -1;
+	}
+
+	cycles_per_us = hdr.cycles_per_us;
+	nr_events = hdr.nr_events;
+	events = malloc(nr_events * sizeof(*events));
+	if (!events || fread(events, sizeof(*events), nr_events, f) != nr_events) {
+		fprintf(stderr, "%s: truncated snapshot\n", path);
+		return -1;
+	}
+
+	fclose(f);
+	return 0;
+}
+
+static int write_snapshot(const char *path)
+{
+	struct snap_hdr hdr = {
+		.magic = REQTRACE_MAGIC,
+		.cycles_per_us = cycles_per_us,
+		.nr_events = nr_events,
+	};
+	FILE *f;
+
+	f = fopen(path, "wb");
+	if (!f) {
+		perror(path);
+		return -1;
+	}
+	fwrite(&hdr, sizeof(hdr), 1, f);
+	fwrite(events, sizeof(*events), nr_events, f);
+	if (fclose(f)) {
+		perror(path);
+		return -1;
+	}
+	return 0;
+}
+
+static int event_cmp(const void *a, const void *b)
+{
+	const struct reqtrace_event *x = a, *y = b;
+
+	if (x->id != y->id)
+		return x->id < y->id ? -1 : 1;
+	if (x->tsc != y->tsc)
+		return x->tsc < y->tsc ? -1 : 1;
+	return (int) x->type - (int) y->type;
+}
+
+static int u64_cmp(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *) a, y = *(const uint64_t *) b;
+
+	return x < y ? -1 : x > y;
+}
+
+static int timeline_cmp(const void *a, const void *b)
+{
+	const struct timeline *x = a, *y = b;
+	uint64_t dx = x->tsc[REQTRACE_TX] - x->tsc[REQTRACE_RX];
+	uint64_t dy = y->tsc[REQTRACE_TX] - y->tsc[REQTRACE_RX];
+
+	return dx < dy ? 1 : dx > dy ? -1 : 0;
+}
+
+/*
+ * Cookies are reused once a request is freed, so the events of one id
+ * sorted by time are split into timelines, each starting at REQTRACE_RX.
+ * Only timelines from REQTRACE_RX to REQTRACE_TX are kept.
+ */
+static uint64_t build_timelines(void)
+{
+	struct timeline *t = NULL;
+	uint64_t i, incomplete = 0;
+
+	qsort(events, nr_events, sizeof(*events), event_cmp);
+	timelines = calloc(nr_events, sizeof(*timelines));
+	if (!timelines)
+		exit(1);
+
+	for (i = 0; i < nr_events; i++) {
+		struct reqtrace_event *ev = &events[i];
+
+		if (ev->type >= REQTRACE_NR)
+			continue;
+		if (ev->type == REQTRACE_RX || !t || t->id != ev->id ||
+		    (t->seen & (1 << ev->type))) {
+			if (t && !(t->seen & (1 << REQTRACE_TX)))
+				incomplete++;
+			else if (t)
+				nr_timelines++;
+			t = NULL;
+			if (ev->type != REQTRACE_RX)
+				continue;
+			t = &timelines[nr_timelines];
+			memset(t, 0, sizeof(*t));
+			t->id = ev->id;
+		}
+		t->seen |= 1 << ev->type;
+		t->tsc[ev->type] = ev->tsc;
+		t->fg = ev->arg;
+	}
+	if (t && !(t->seen & (1 << REQTRACE_TX)))
+		incomplete++;
+	else if (t)
+		nr_timelines++;
+
+	return incomplete;
+}
+
+static void print_timeline(struct timeline *t)
+{
+	int s;
+
+	printf("%16lx fg %4u", t->id, t->fg);
+	for (s = 0; s < STAGE_NR; s++) {
+		unsigned int mask = (1 << stages[s].from) | (1 << stages[s].to);
+
+		if ((t->seen & mask) == mask)
+			printf("  %s %8.1f", stages[s].name,
+			       (double) (t->tsc[stages[s].to] - t->tsc[stages[s].from]) / cycles_per_us);
+		else
+			printf("  %s %8s", stages[s].name, "-");
+	}
+	printf("\n");
+}
+
+static double percentile(uint64_t *v, uint64_t n, double p)
+{
+	uint64_t idx = (uint64_t) (p * (n - 1) / 100);
+
+	return (double) v[idx] / cycles_per_us;
+}
+
+static void report(int slowest, bool verbose, long fg)
+{
+	uint64_t i, sum;
+	int s;
+
+	for (s = 0; s < STAGE_NR; s++) {
+		stage_cycles[s] = malloc((nr_timelines + 1) * sizeof(uint64_t));
+		if (!stage_cycles[s])
+			exit(1);
+	}
+
+	for (i = 0; i < nr_timelines; i++) {
+		struct timeline *t = &timelines[i];
+
+		if (fg >= 0 && t->fg != fg)
+			continue;
+		if (verbose)
+			print_timeline(t);
+		for (s = 0; s < STAGE_NR; s++) {
+			unsigned int mask = (1 << stages[s].from) | (1 << stages[s].to);
+
+			if ((t->seen & mask) == mask)
+				stage_cycles[s][nr_stage[s]++] =
+					t->tsc[stages[s].to] - t->tsc[stages[s].from];
+		}
+	}
+
+	printf("%-8s %8s %10s %10s %10s %10s %10s  (us)\n",
+	       "stage", "count", "avg", "p50", "p99", "p99.9", "max");
+	for (s = 0; s < STAGE_NR; s++) {
+		uint64_t n = nr_stage[s];
+
+		if (!n) {
+			printf("%-8s %8d\n", stages[s].name, 0);
+			continue;
+		}
+		qsort(stage_cycles[s], n, sizeof(uint64_t), u64_cmp);
+		for (sum = 0, i = 0; i < n; i++)
+			sum += stage_cycles[s][i];
+		printf("%-8s %8lu %10.1f %10.1f %10.1f %10.1f %10.1f\n",
+		       stages[s].name, n, (double) sum / n / cycles_per_us,
+		       percentile(stage_cycles[s], n, 50),
+		       percentile(stage_cycles[s], n, 99),
+		       percentile(stage_cycles[s], n, 99.9),
+		       (double) stage_cycles[s][n - 1] / cycles_per_us);
+	}
+
+	if (slowest > 0) {
+		qsort(timelines, nr_timelines, sizeof(*timelines), timeline_cmp);
+		printf("\nslowest requests by server time (us):\n");
+		for (i = 0; i < nr_timelines && slowest > 0; i++) {
+			if (fg >= 0 && timelines[i].fg != fg)
+				continue;
+			print_timeline(&timelines[i]);
+			slowest--;
+		}
+	}
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "usage: %s [-r snapshot] [-w snapshot] [-f fg_handle] [-s nr_slowest] [-v]\n"
+		"  with no -r, snapshots the running dataplane's trace rings\n", prog);
+	exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+	const char *in = NULL, *out = NULL;
+	bool verbose = false;
+	int slowest = 10, opt;
+	long fg = -1;
+	uint64_t incomplete;
+
+	while ((opt = getopt(argc, argv, "r:w:f:s:v")) != -1) {
+		switch (opt) {
+		case 'r':
+			in = optarg;
+			break;
+		case 'w':
+			out = optarg;
+			break;
+		case 'f':
+			fg = atol(optarg);
+			break;
+		case 's':
+			slowest = atoi(optarg);
+			break;
+		case 'v':
+			verbose = true;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (optind != argc)
+		usage(argv[0]);
+
+	if (in ? read_snapshot(in) : snapshot_shm())
+		return 1;
+	if (out && write_snapshot(out))
+		return 1;
+
+	incomplete = build_timelines();
+	printf("%lu events, %lu requests, %lu incomplete (ring wrapped or still in flight)\n\n",
+	       nr_events, nr_timelines, incomplete);
+	report(slowest, verbose, fg);
+	return 0;
+}